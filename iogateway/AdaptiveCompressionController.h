@@ -0,0 +1,249 @@
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
+
+#ifndef MuscleAdaptiveCompressionController_h
+#define MuscleAdaptiveCompressionController_h
+
+#include "support/MuscleSupport.h"
+
+namespace muscle {
+
+#ifndef MUSCLE_ADAPTIVE_COMPRESSION_DEFAULT_WINDOW_MICROS
+/** Default length of the measurement window that AdaptiveCompressionController evaluates its statistics over, in microseconds. */
+# define MUSCLE_ADAPTIVE_COMPRESSION_DEFAULT_WINDOW_MICROS (1000000)
+#endif
+
+/** This class decides which zlib compression level (if any) a stream of outgoing data should be compressed at,
+  * so as to deliver as many uncompressed bytes per second as possible.  It is fed measurements of how long each
+  * compression operation took and how much it shrank the data, and of how quickly the output buffer drains.
+  * At the end of each measurement window it looks at those measurements and votes on whether the level should change:
+  *   - If the link wasn't saturated (i.e. the output buffer never stayed full), compression isn't buying any throughput,
+  *     so it votes to lower the level (or to turn compression off).
+  *   - If the link was saturated but compressing used more than the allowed fraction of the window's time, the CPU is
+  *     becoming the bottleneck, so it votes to lower the level.
+  *   - If the link was saturated and compressing used less than half the allowed fraction of the time, there is CPU
+  *     to spare for a better compression ratio, so it votes to raise the level (or to turn compression on).
+  *   - If the data didn't compress usefully at all, it votes to turn compression off, and afterwards waits ten times as
+  *     long as usual before trying compression again.
+  * The level only changes once the same vote has been cast for several windows in a row, so that it doesn't flip-flop.
+  * This class does no I/O or compression itself; MessageIOGateway::SetAdaptiveCompressionEnabled() uses it.
+  */
+class AdaptiveCompressionController
+{
+public:
+   /** Default constructor.  Compression starts out disabled (level 0). */
+   AdaptiveCompressionController() : _windowMicros(MUSCLE_ADAPTIVE_COMPRESSION_DEFAULT_WINDOW_MICROS), _hysteresisWindows(3), _maxCPUFraction(0.5f), _minUsefulRatio(1.1f), _maxLevel(9)
+   {
+      Reset(0, 0);
+   }
+
+   /** Sets the tuning parameters.
+     * @param windowMicros How long each measurement window lasts, in microseconds.  Defaults to MUSCLE_ADAPTIVE_COMPRESSION_DEFAULT_WINDOW_MICROS (one second).
+     * @param hysteresisWindows How many consecutive windows must vote for the same change before the change is made.  Defaults to 3.
+     * @param maxCPUFraction The largest fraction of wall-clock time that compression may use before we consider the CPU
+     *                       to be the bottleneck.  Defaults to 0.5.
+     * @param maxLevel The highest zlib level we will go up to (1-9).  Defaults to 9.
+     */
+   void SetParameters(uint64 windowMicros, uint32 hysteresisWindows, float maxCPUFraction, int maxLevel)
+   {
+      _windowMicros      = muscleMax(windowMicros, (uint64)1);
+      _hysteresisWindows = muscleMax(hysteresisWindows, (uint32)1);
+      _votesNeeded       = _hysteresisWindows;
+      _maxCPUFraction    = maxCPUFraction;
+      _maxLevel          = muscleClamp(maxLevel, 1, 9);
+      _level             = muscleMin(_level, _maxLevel);
+   }
+
+   /** Returns the measurement window length, in microseconds, as set by SetParameters(). */
+   uint64 GetWindowMicros() const {return _windowMicros;}
+
+   /** Returns the number of consecutive votes needed to change the level, as set by SetParameters(). */
+   uint32 GetHysteresisWindows() const {return _hysteresisWindows;}
+
+   /** Returns the maximum fraction of time to spend compressing, as set by SetParameters(). */
+   float GetMaxCPUFraction() const {return _maxCPUFraction;}
+
+   /** Returns the highest level we will choose, as set by SetParameters(). */
+   int GetMaxLevel() const {return _maxLevel;}
+
+   /** Clears all statistics and starts over at the specified level.
+     * @param level The zlib level to start at (1-9), or 0 to start with compression disabled.
+     * @param now The current time, as returned by GetRunTime64().
+     */
+   void Reset(int level, uint64 now)
+   {
+      _level = muscleClamp(level, 0, _maxLevel);
+      _windowStartTime = now;
+      ClearWindow();
+      _pendingVote = 0;
+      _numPendingVotes = 0;
+      _votesNeeded = _hysteresisWindows;
+      _numLevelChanges = 0;
+      _lastDrainRate = 0.0f;
+      _lastRatio = 0.0f;
+      _lastCPUFraction = 0.0f;
+      _lastSaturated = false;
+      _totalRawBytes = _totalCompressedBytes = _totalCompressionMicros = _totalWireBytes = 0;
+   }
+
+   /** Should be called after each compression operation.
+     * @param numRawBytes How many bytes of data were compressed.
+     * @param numCompressedBytes How many bytes they were compressed down to.
+     * @param micros How many microseconds the compression took.  (On platforms where GetRunTime64() has a coarse
+     *               resolution, many of these measurements will be zero and a few will be too large; that's okay,
+     *               since only their sum over the measurement window is used)
+     */
+   void CompressionPerformed(uint32 numRawBytes, uint32 numCompressedBytes, uint64 micros)
+   {
+      _windowRawBytes          += numRawBytes;
+      _windowCompressedBytes   += numCompressedBytes;
+      _windowCompressionMicros += micros;
+   }
+
+   /** Should be called after each batch of writes to the link.
+     * @param numBytesWritten How many bytes were written.
+     * @param blocked True iff the batch was cut short because the link's output buffer was full.
+     */
+   void OutputPerformed(uint32 numBytesWritten, bool blocked)
+   {
+      _windowWireBytes += numBytesWritten;
+      _windowOutputCalls++;
+      if (blocked) _windowBlockedCalls++;
+   }
+
+   /** Should be called periodically (e.g. after each batch of output).  If the current measurement window
+     * has ended, evaluates it, and possibly changes the compression level.
+     * @param now The current time, as returned by GetRunTime64().
+     * @returns true iff the compression level was changed by this call.
+     */
+   bool Update(uint64 now)
+   {
+      if (now < _windowStartTime+_windowMicros) return false;
+
+      const int oldLevel = _level;
+      if ((_windowOutputCalls > 0)||(_windowRawBytes > 0)) EvaluateWindow(now-_windowStartTime);
+      _windowStartTime = now;
+      ClearWindow();
+      return (_level != oldLevel);
+   }
+
+   /** Returns the zlib level (1-9) that data should currently be compressed at, or 0 if it shouldn't be compressed. */
+   int GetCompressionLevel() const {return _level;}
+
+   /** Returns the number of times the level has changed since the last call to Reset(). */
+   uint32 GetNumLevelChanges() const {return _numLevelChanges;}
+
+   /** Returns the rate at which data was written to the link during the last evaluated window, in bytes per second. */
+   float GetLastDrainRate() const {return _lastDrainRate;}
+
+   /** Returns the compression ratio (raw bytes divided by compressed bytes) achieved during the last evaluated window, or 0.0 if nothing was compressed. */
+   float GetLastCompressionRatio() const {return _lastRatio;}
+
+   /** Returns the fraction of the last evaluated window's wall-clock time that was spent compressing. */
+   float GetLastCPUFraction() const {return _lastCPUFraction;}
+
+   /** Returns true iff the link's output buffer was full for a significant part of the last evaluated window. */
+   bool WasLastWindowSaturated() const {return _lastSaturated;}
+
+   /** Returns the average number of microseconds spent compressing each raw byte, since the last call to Reset(), or 0.0 if nothing was compressed. */
+   float GetCompressionMicrosPerByte() const {return (_totalRawBytes > 0) ? ((float)_totalCompressionMicros/_totalRawBytes) : 0.0f;}
+
+   /** Returns the total number of raw bytes compressed since the last call to Reset() (not counting the current window). */
+   uint64 GetTotalRawBytes() const {return _totalRawBytes;}
+
+   /** Returns the total number of compressed bytes produced since the last call to Reset() (not counting the current window). */
+   uint64 GetTotalCompressedBytes() const {return _totalCompressedBytes;}
+
+   /** Returns the total number of microseconds spent compressing since the last call to Reset() (not counting the current window). */
+   uint64 GetTotalCompressionMicros() const {return _totalCompressionMicros;}
+
+   /** Returns the total number of bytes written to the link since the last call to Reset() (not counting the current window). */
+   uint64 GetTotalWireBytes() const {return _totalWireBytes;}
+
+private:
+   enum {
+      VOTE_OFF = -2,
+      VOTE_DOWN,
+      VOTE_STAY,
+      VOTE_UP
+   };
+
+   void ClearWindow()
+   {
+      _windowRawBytes = _windowCompressedBytes = _windowCompressionMicros = _windowWireBytes = 0;
+      _windowOutputCalls = _windowBlockedCalls = 0;
+   }
+
+   void EvaluateWindow(uint64 elapsedMicros)
+   {
+      _totalRawBytes          += _windowRawBytes;
+      _totalCompressedBytes   += _windowCompressedBytes;
+      _totalCompressionMicros += _windowCompressionMicros;
+      _totalWireBytes         += _windowWireBytes;
+
+      _lastDrainRate   = (float) ((_windowWireBytes*1000000.0)/elapsedMicros);
+      _lastCPUFraction = (float) (((double)_windowCompressionMicros)/elapsedMicros);
+      _lastRatio       = (_windowCompressedBytes > 0) ? (float) (((double)_windowRawBytes)/_windowCompressedBytes) : 0.0f;
+      _lastSaturated   = ((_windowBlockedCalls > 0)&&((_windowBlockedCalls*4) >= _windowOutputCalls));  // full for at least a quarter of our writes
+
+      int vote = VOTE_STAY;
+      if (_level == 0)
+      {
+         if (_lastSaturated) vote = VOTE_UP;
+      }
+      else if ((_windowRawBytes >= 4096)&&(_lastRatio < _minUsefulRatio)) vote = VOTE_OFF;  // the data isn't compressible, so don't bother
+      else if ((_lastSaturated == false)||(_lastCPUFraction > _maxCPUFraction)) vote = VOTE_DOWN;
+      else if ((_level < _maxLevel)&&((_lastCPUFraction*2.0f) < _maxCPUFraction)) vote = VOTE_UP;
+
+      if ((vote == VOTE_STAY)||(vote != _pendingVote))
+      {
+         _pendingVote     = vote;
+         _numPendingVotes = 0;
+      }
+      if ((vote != VOTE_STAY)&&(++_numPendingVotes >= _votesNeeded))
+      {
+         switch(vote)
+         {
+            case VOTE_OFF:  _level = 0;                              break;
+            case VOTE_DOWN: _level--;                                break;
+            case VOTE_UP:   _level = muscleMin(_level+1, _maxLevel); break;
+         }
+         _numLevelChanges++;
+         _votesNeeded     = (vote == VOTE_OFF) ? (10*_hysteresisWindows) : _hysteresisWindows;  // incompressible data probably stays that way for a while
+         _pendingVote     = VOTE_STAY;
+         _numPendingVotes = 0;
+      }
+   }
+
+   uint64 _windowMicros;
+   uint32 _hysteresisWindows;
+   float _maxCPUFraction;
+   float _minUsefulRatio;
+   int _maxLevel;
+
+   int _level;
+   uint64 _windowStartTime;
+   uint64 _windowRawBytes;
+   uint64 _windowCompressedBytes;
+   uint64 _windowCompressionMicros;
+   uint64 _windowWireBytes;
+   uint32 _windowOutputCalls;
+   uint32 _windowBlockedCalls;
+
+   int _pendingVote;
+   uint32 _numPendingVotes;
+   uint32 _votesNeeded;
+
+   uint32 _numLevelChanges;
+   float _lastDrainRate;
+   float _lastRatio;
+   float _lastCPUFraction;
+   bool _lastSaturated;
+   uint64 _totalRawBytes;
+   uint64 _totalCompressedBytes;
+   uint64 _totalCompressionMicros;
+   uint64 _totalWireBytes;
+};
+
+} // end namespace muscle
+
+#endif
@@ -4,9 +4,43 @@
 #include "reflector/StorageReflectConstants.h"  // for PR_COMMAND_PING, PR_RESULT_PONG
 #include "dataio/TCPSocketDataIO.h"
 
+#ifndef WIN32
+# include <stdlib.h>    // for mkstemp()
+# include <sys/mman.h>  // for mmap()
+#endif
+
+#ifndef MUSCLE_MESSAGE_IO_GATEWAY_INITIAL_FLATTEN_BUFFER_SIZE
+# define MUSCLE_MESSAGE_IO_GATEWAY_INITIAL_FLATTEN_BUFFER_SIZE 256  // enough for most Messages; larger ones will grow the buffer as they are flattened
+#endif
+
 namespace muscle {
 
+#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+// Runs the jobs one after another, in the calling thread
+class InlineJobRunner : public IParallelJobRunner
+{
+public:
+   InlineJobRunner() {/* empty */}
+
+   virtual status_t RunJobs(uint32 numJobs, ParallelJobFunc func, void * userData)
+   {
+      for (uint32 i=0; i<numJobs; i++) func(i, userData);
+      return B_NO_ERROR;
+   }
+};
+#endif
+
+// Bits in the flags byte that starts each MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY Message body
+enum {
+   DICTIONARY_FLAG_RESET = (1<<0)  // the receiver should clear its field-name dictionary before decoding this Message
+};
+
 MessageIOGateway :: MessageIOGateway(int32 encoding) :
+   _pipelineRunner(NULL), _pipelineJobQueue(NULL), _maxPipelineDepth(MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_PIPELINE_DEPTH), _pipelineNumFlattened(0),
+   _inPipelineJob(false), _pipelineJobEncoding(encoding),
+   _outgoingStreamingThreshold(MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_STREAMING_THRESHOLD),
+   _incomingSpoolThreshold(MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD),
+   _spoolFD(-1), _spoolBodySize(0), _spoolBytesReceived(0),
    _maxIncomingMessageSize(MUSCLE_NO_LIMIT),
    _outgoingEncoding(encoding), 
    _aboutToFlattenCallback(NULL), _aboutToFlattenCallbackData(NULL),
@@ -14,6 +48,8 @@ MessageIOGateway :: MessageIOGateway(int32 encoding) :
    _unflattenedCallback(NULL), _unflattenedCallbackData(NULL)
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
    , _sendCodec(NULL), _recvCodec(NULL)
+   , _zlibParallelRunner(NULL), _zlibParallelMinSize(MUSCLE_NO_LIMIT)
+   , _adaptiveCompressionEnabled(false)
 #endif
    , _syncPingCounter(0), _pendingSyncPingCounter(-1)
 {
@@ -22,6 +58,8 @@ MessageIOGateway :: MessageIOGateway(int32 encoding) :
 
 MessageIOGateway :: ~MessageIOGateway() 
 {
+   (void) SetOutgoingMessagePipeline(NULL);  // must be done before we start tearing down our state
+   CloseSpoolFile();
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
    delete _sendCodec;
    delete _recvCodec;
@@ -35,6 +73,146 @@ PopNextOutgoingMessage(MessageRef & retMsg)
    return GetOutgoingMessageQueue().RemoveHead(retMsg);
 }
 
+status_t
+MessageIOGateway ::
+AddOutgoingMessage(const MessageRef & messageRef)
+{
+   if (AbstractMessageIOGateway::AddOutgoingMessage(messageRef) != B_NO_ERROR) return B_ERROR;
+   if (_pipelineJobQueue) FeedPipeline();  // start flattening it right away
+   return B_NO_ERROR;
+}
+
+status_t
+MessageIOGateway ::
+SetOutgoingMessagePipeline(IParallelJobRunner * runner, uint32 maxDepth)
+{
+   ISerialJobQueue * newQueue = NULL;
+   if (runner)
+   {
+      newQueue = runner->CreateSerialJobQueue();
+      if (newQueue == NULL) return B_ERROR;
+   }
+
+   delete _pipelineJobQueue;  // blocks until all the Messages already in the pipeline have been flattened
+   _pipelineJobQueue = newQueue;
+   _pipelineRunner   = runner;
+   _maxPipelineDepth = muscleMax(maxDepth, (uint32)1);
+   if (_pipelineJobQueue) FeedPipeline();
+   return B_NO_ERROR;
+}
+
+// Moves Messages from the outgoing-Message queue into the pipeline, until the pipeline is full
+void
+MessageIOGateway ::
+FeedPipeline()
+{
+   while(_pipelineJobQueue)
+   {
+      {
+         DECLARE_MUTEXGUARD(_pipelineMutex);
+         if (_pipeline.GetNumItems() >= _maxPipelineDepth) return;
+      }
+
+      MessageRef nextRef;
+      if (PopNextOutgoingMessage(nextRef) != B_NO_ERROR) return;
+      if (nextRef() == NULL) continue;
+
+      if (_aboutToFlattenCallback) _aboutToFlattenCallback(nextRef, _aboutToFlattenCallbackData);
+
+      const PipelinedMessage pm(nextRef, GetEffectiveOutgoingEncoding());
+      status_t ret;
+      {
+         DECLARE_MUTEXGUARD(_pipelineMutex);
+         ret = _pipeline.AddTail(pm);
+      }
+      if (ret != B_NO_ERROR)
+      {
+         (void) GetOutgoingMessageQueue().AddHead(nextRef);  // out of memory?  We'll try again later
+         return;
+      }
+      MessageEnteredOutgoingPipeline(nextRef);
+
+      if (_pipelineJobQueue->QueueJob(FlattenPipelinedMessageJob, this) != B_NO_ERROR)
+      {
+         // Couldn't hand it off, so we'll flatten it ourself, once the pipeline has caught up (so that the Messages stay in order)
+         _pipelineJobQueue->WaitForJobsToComplete();
+         FlattenNextPipelinedMessage();
+      }
+   }
+}
+
+// Called (usually from inside a worker thread) to flatten the first Message in the pipeline that hasn't been flattened yet
+void
+MessageIOGateway ::
+FlattenNextPipelinedMessage()
+{
+   MessageRef msgRef;
+   {
+      DECLARE_MUTEXGUARD(_pipelineMutex);
+      if (_pipelineNumFlattened >= _pipeline.GetNumItems()) return;  // paranoia
+      const PipelinedMessage & pm = _pipeline[_pipelineNumFlattened];
+      msgRef = pm._msg;
+      _pipelineJobEncoding = pm._encoding;
+   }
+
+   _inPipelineJob = true;  // so that FlattenHeaderAndMessage() will use (_pipelineJobEncoding), and won't wait on another runner
+   bool stream;
+   ByteBufferRef buf = FlattenOutgoingMessage(msgRef, stream);  // a streamed Message gets flattened later on, by DoOutputImplementation()
+   _inPipelineJob = false;
+
+   DECLARE_MUTEXGUARD(_pipelineMutex);
+   PipelinedMessage & pm = _pipeline[_pipelineNumFlattened++];
+   pm._buffer = buf;
+   pm._stream = stream;
+}
+
+// Retrieves the next flattened Message from the head of the pipeline.  Returns B_ERROR if there isn't one ready.
+status_t
+MessageIOGateway ::
+PopNextPipelinedMessage(MessageRef & retMsg, ByteBufferRef & retBuf, bool & retStream, bool mayWait)
+{
+   FeedPipeline();  // in case Messages were placed into the outgoing-Message queue directly
+
+   while(true)
+   {
+      PipelinedMessage pm;
+      {
+         DECLARE_MUTEXGUARD(_pipelineMutex);
+         if (_pipelineNumFlattened == 0)
+         {
+            if ((mayWait == false)||(_pipeline.IsEmpty())) return B_ERROR;
+         }
+         else if (_pipeline.RemoveHead(pm) == B_NO_ERROR) _pipelineNumFlattened--;
+      }
+
+      if (pm._msg())
+      {
+         retMsg    = pm._msg;
+         retBuf    = pm._buffer;
+         retStream = pm._stream;
+         MessageLeftOutgoingPipeline(retMsg);
+         FeedPipeline();  // since we've just made room for one more
+         return B_NO_ERROR;
+      }
+      WaitForPipeline();
+   }
+}
+
+bool
+MessageIOGateway ::
+HasPipelinedMessages() const
+{
+   DECLARE_MUTEXGUARD(_pipelineMutex);  // since the pipeline's job may be updating (_pipeline) right now
+   return _pipeline.HasItems();
+}
+
+void
+MessageIOGateway ::
+WaitForPipeline()
+{
+   if (_pipelineJobQueue) _pipelineJobQueue->WaitForJobsToComplete();
+}
+
 // For this method, B_NO_ERROR means "keep sending", and B_ERROR means "stop sending for now", and isn't fatal to the stream
 // If there is a fatal error in the stream it will call SetHosed() to indicate that.
 status_t 
@@ -63,6 +241,7 @@ DoOutputImplementation(uint32 maxBytes)
    TCHECKPOINT;
 
    int32 sentBytes = 0;
+   bool blocked = false;  // set true if we stop because the DataIO can't accept any more data right now
    while((maxBytes > 0)&&(IsHosed() == false))
    {
       // First, make sure our outgoing byte-buffer has data.  If it doesn't, fill it with the next outgoing message.
@@ -71,19 +250,29 @@ DoOutputImplementation(uint32 maxBytes)
          while(true)
          {
             MessageRef nextRef;
-            if (PopNextOutgoingMessage(nextRef) != B_NO_ERROR) 
+            ByteBufferRef flattenedBuf;
+            bool streamIt = false;
+            const bool usePipeline = ((_pipelineJobQueue)||(HasPipelinedMessages()));
+            if (usePipeline ? (PopNextPipelinedMessage(nextRef, flattenedBuf, streamIt, (sentBytes == 0)) != B_NO_ERROR) : (PopNextOutgoingMessage(nextRef) != B_NO_ERROR))
             {
                if ((GetFlushOnEmpty())&&(sentBytes > 0)) GetDataIO()()->FlushOutput();
+               AdaptiveCompressionOutputPerformed(sentBytes, false);
                return sentBytes;  // nothing more to send, so we're done!
             }
 
             const Message * nextSendMsg = nextRef();
             if (nextSendMsg)
             {
-               if (_aboutToFlattenCallback) _aboutToFlattenCallback(nextRef, _aboutToFlattenCallbackData);
+               if (usePipeline == false)
+               {
+                  if (_aboutToFlattenCallback) _aboutToFlattenCallback(nextRef, _aboutToFlattenCallbackData);
+
+                  flattenedBuf = FlattenOutgoingMessage(nextRef, streamIt);
+               }
 
                _sendBuffer._offset = 0;
-               _sendBuffer._buffer = FlattenHeaderAndMessage(nextRef);
+               _sendBuffer._buffer = flattenedBuf;
+               if (streamIt) (void) BeginStreamingOutgoingMessage(nextRef);
                if (_sendBuffer._buffer() == NULL) {SetHosed(); return -1;}
 
                if (_flattenedCallback) _flattenedCallback(nextRef, _flattenedCallbackData);
@@ -116,17 +305,96 @@ DoOutputImplementation(uint32 maxBytes)
             _sendBuffer.Reset();
          }
          else if (numSent < 0) SetHosed();
-         else break;
+         else {blocked = true; break;}
       }
       else
       {
-         if (SendMoreData(sentBytes, maxBytes) != B_NO_ERROR) break;  // output buffer is temporarily full
-         if (_sendBuffer._offset == _sendBuffer._buffer()->GetNumBytes()) _sendBuffer.Reset();
+         if (SendMoreData(sentBytes, maxBytes) != B_NO_ERROR) {blocked = true; break;}  // output buffer is temporarily full
+         if (_sendBuffer._offset == _sendBuffer._buffer()->GetNumBytes())
+         {
+            if (_sendFlattener.HasBytesRemaining()) 
+            {
+               if (ContinueStreamingOutgoingMessage() != B_NO_ERROR) {SetHosed(); break;}
+            }
+            else
+            {
+               _sendBuffer.Reset();
+               if (_sendFlattener.GetFlattenedSize() > 0) _sendFlattener.Reset();  // done streaming; release the Message
+            }
+         }
       }
    }
+   AdaptiveCompressionOutputPerformed(sentBytes, blocked);
    return IsHosed() ? -1 : sentBytes;
 }
 
+void
+MessageIOGateway ::
+AdaptiveCompressionOutputPerformed(int32 sentBytes, bool blocked)
+{
+#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+   if (_adaptiveCompressionEnabled)
+   {
+      DECLARE_MUTEXGUARD(_pipelineMutex);  // since the pipeline's thread may be compressing at the same time
+      _adaptiveController.OutputPerformed(muscleMax(sentBytes, (int32)0), blocked);
+      if (_adaptiveController.Update(GetRunTime64()))
+      {
+         const AdaptiveCompressionController & c = _adaptiveController;
+         LogTime(MUSCLE_LOG_DEBUG, "MessageIOGateway %p:  Adaptive compression level is now %i (drain rate=%.0f bytes/sec, ratio=%.2f, CPU=%.1f%%, %s)\n", this, c.GetCompressionLevel(), c.GetLastDrainRate(), c.GetLastCompressionRatio(), c.GetLastCPUFraction()*100.0f, c.WasLastWindowSaturated()?"saturated":"not saturated");
+      }
+   }
+#else
+   (void) sentBytes;
+   (void) blocked;
+#endif
+}
+
+int32
+MessageIOGateway ::
+GetEffectiveOutgoingEncoding() const
+{
+#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+   if (_adaptiveCompressionEnabled)
+   {
+      DECLARE_MUTEXGUARD(_pipelineMutex);
+      const int level = _adaptiveController.GetCompressionLevel();
+      return (level > 0) ? (MUSCLE_MESSAGE_ENCODING_ZLIB_1+level-1) : MUSCLE_MESSAGE_ENCODING_DEFAULT;
+   }
+#endif
+   return _outgoingEncoding;
+}
+
+// Sets up (_sendBuffer) to hold the header and the first chunk of a Message that is too large to flatten all at once
+status_t 
+MessageIOGateway :: BeginStreamingOutgoingMessage(const MessageRef & msgRef)
+{
+   const uint32 hs = GetHeaderSize();
+   ByteBufferRef buf = GetByteBufferFromPool(hs+MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE);
+   if ((buf() == NULL)||(_sendFlattener.SetMessage(msgRef) != B_NO_ERROR)) return B_ERROR;
+
+   uint32 * lhb = (uint32 *) buf()->GetBuffer();
+   muscleCopyOut(&lhb[0], B_HOST_TO_LENDIAN_INT32(_sendFlattener.GetFlattenedSize()));
+   muscleCopyOut(&lhb[1], B_HOST_TO_LENDIAN_INT32(MUSCLE_MESSAGE_ENCODING_DEFAULT));
+   (void) buf()->SetNumBytes(hs+_sendFlattener.GetNextBytes(buf()->GetBuffer()+hs, buf()->GetNumBytes()-hs), true);
+
+   _sendBuffer._buffer = buf;
+   _sendBuffer._offset = 0;
+   return B_NO_ERROR;
+}
+
+// Refills (_sendBuffer) with the next chunk of the Message we are currently streaming out
+status_t
+MessageIOGateway :: ContinueStreamingOutgoingMessage()
+{
+   ByteBuffer * bb = _sendBuffer._buffer();
+   if (bb->SetNumBytes(MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE, true) != B_NO_ERROR) return B_ERROR;  // won't reallocate, since the buffer was allocated bigger than this
+
+   const uint32 numBytes = _sendFlattener.GetNextBytes(bb->GetBuffer(), bb->GetNumBytes());
+   (void) bb->SetNumBytes(numBytes, true);
+   _sendBuffer._offset = 0;
+   return (numBytes > 0) ? B_NO_ERROR : B_ERROR;  // zero bytes here would mean the Message was modified while we were streaming it
+}
+
 ByteBufferRef
 MessageIOGateway ::
 GetScratchReceiveBuffer()
@@ -225,7 +493,7 @@ DoInputImplementation(AbstractGatewayMessageReceiver & receiver, uint32 maxBytes
                {
                   int32 availableBodyBytes = bb->GetNumBytes()-hs;
                   if (bodySize <= availableBodyBytes) (void) bb->SetNumBytes(hs+bodySize, true);  // trim off any extra space we don't need
-                  else
+                  else if ((((uint32)bodySize) <= _incomingSpoolThreshold)||(BeginSpoolingIncomingMessage(bodySize) != B_NO_ERROR))  // very large bodies go to a spool file instead
                   {
                      // Oops, the Message body is greater than our buffer has bytes to store!  We're going to need a bigger buffer!
                      ByteBufferRef bigBuf = GetByteBufferFromPool(hs+bodySize);
@@ -246,11 +514,17 @@ DoInputImplementation(AbstractGatewayMessageReceiver & receiver, uint32 maxBytes
 
          if (_recvBuffer._offset >= hs)  // if we got here, we're ready to read the body of the incoming Message
          {
-            if ((_recvBuffer._offset < bb->GetNumBytes())&&(ReceiveMoreData(readBytes, maxBytes, bb->GetNumBytes()) != B_NO_ERROR)) break;
-            if (_recvBuffer._offset == bb->GetNumBytes())
+            const bool spooling = (_spoolFD >= 0);
+            if (spooling)
+            {
+               if ((_spoolBytesReceived < _spoolBodySize)&&(ReceiveMoreSpoolData(readBytes, maxBytes) != B_NO_ERROR)) break;
+            }
+            else if ((_recvBuffer._offset < bb->GetNumBytes())&&(ReceiveMoreData(readBytes, maxBytes, bb->GetNumBytes()) != B_NO_ERROR)) break;
+
+            if (spooling ? (_spoolBytesReceived == _spoolBodySize) : (_recvBuffer._offset == bb->GetNumBytes()))
             {
                // Finished receiving message bytes... now reconstruct that bad boy!
-               MessageRef msg = UnflattenHeaderAndMessage(_recvBuffer._buffer);
+               MessageRef msg = spooling ? UnflattenSpooledMessage() : UnflattenHeaderAndMessage(_recvBuffer._buffer);
                _recvBuffer.Reset();  // reset our state for the next one!
                ForgetScratchReceiveBufferIfSubclassIsStillUsingIt();
 
@@ -284,6 +558,135 @@ MessageIOGateway :: ReceiveMoreData(int32 & readBytes, uint32 & maxBytes, uint32
    return (numRead < attemptSize) ? B_ERROR : B_NO_ERROR;
 }
 
+status_t
+MessageIOGateway :: BeginSpoolingIncomingMessage(uint32 bodySize)
+{
+#ifdef WIN32
+   (void) bodySize;
+   return B_ERROR;  // spooling isn't supported under Windows, so we'll just receive the Message into memory as usual
+#else
+   if (GetMaximumPacketSize() > 0) return B_ERROR;  // paranoia; spooling only makes sense for stream I/O
+
+   if (_spoolChunk() == NULL) _spoolChunk = GetByteBufferFromPool(MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE);
+   if (_spoolChunk() == NULL) return B_ERROR;  // out of memory?
+
+   String dir = _incomingSpoolDirectory;
+   if (dir.IsEmpty())
+   {
+      const char * tmpDir = getenv("TMPDIR");
+      dir = ((tmpDir)&&(*tmpDir)) ? tmpDir : "/tmp";
+   }
+   const String pathTemplate = dir + "/muscle_spool_XXXXXX";
+   ByteBufferRef pathBuf = GetByteBufferFromPool(pathTemplate.Length()+1, (const uint8 *) pathTemplate());  // mkstemp() needs a writable array
+   if (pathBuf() == NULL) {_spoolChunk.Reset(); return B_ERROR;}
+
+   char * path = (char *) pathBuf()->GetBuffer();
+   int fd = mkstemp(path);
+   if (fd < 0) 
+   {
+      LogTime(MUSCLE_LOG_ERROR, "MessageIOGateway %p:  Unable to create spool file [%s] for a " UINT32_FORMAT_SPEC "-byte incoming Message!\n", this, path, bodySize);
+      _spoolChunk.Reset();
+      return B_ERROR;
+   }
+   (void) unlink(path);  // the file's storage will be reclaimed as soon as nothing refers to it any more
+
+   _spoolFD            = fd;
+   _spoolBodySize      = bodySize;
+   _spoolBytesReceived = 0;
+   return B_NO_ERROR;
+#endif
+}
+
+// Same return-value semantics as ReceiveMoreData(), except the received bytes are appended to our spool file
+status_t
+MessageIOGateway :: ReceiveMoreSpoolData(int32 & readBytes, uint32 & maxBytes)
+{
+   TCHECKPOINT;
+
+   ByteBuffer * chunk = _spoolChunk();
+   int32 attemptSize = muscleMin(maxBytes, muscleMin(chunk->GetNumBytes(), _spoolBodySize-_spoolBytesReceived));
+   int32 numRead     = GetDataIO()()->Read(chunk->GetBuffer(), attemptSize);
+   if (numRead >= 0)
+   {
+      maxBytes  -= numRead;
+      readBytes += numRead;
+
+#ifndef WIN32
+      for (int32 numWritten=0; numWritten<numRead;)
+      {
+         long wret = write_ignore_eintr(_spoolFD, chunk->GetBuffer()+numWritten, numRead-numWritten);
+         if (wret <= 0)
+         {
+            LogTime(MUSCLE_LOG_ERROR, "MessageIOGateway %p:  Error writing to spool file! (disk full?)\n", this);
+            SetHosed();
+            return B_ERROR;
+         }
+         numWritten += wret;
+      }
+#endif
+      _spoolBytesReceived += numRead;
+   }
+   else SetHosed();
+
+   return (numRead < attemptSize) ? B_ERROR : B_NO_ERROR;
+}
+
+MessageRef
+MessageIOGateway :: UnflattenSpooledMessage()
+{
+   TCHECKPOINT;
+
+   MessageRef ret;
+#ifndef WIN32
+   const uint32 hs       = GetHeaderSize();
+   const uint32 * lhb    = (const uint32 *) _recvBuffer._buffer()->GetBuffer();
+   const int32  encoding = B_LENDIAN_TO_HOST_INT32(muscleCopyIn<int32>(&lhb[1]));
+   if (encoding == MUSCLE_MESSAGE_ENCODING_DEFAULT)
+   {
+      // Map the whole body just long enough to parse it; the large items will get their own mappings of the file
+      void * map = mmap(NULL, _spoolBodySize, PROT_READ, MAP_PRIVATE, _spoolFD, 0);
+      if (map != MAP_FAILED)
+      {
+         ret = GetMessageFromPool();
+         if ((ret())&&(ret()->UnflattenFromMappedFile((const uint8 *) map, _spoolBodySize, _spoolFD, 0, MUSCLE_MESSAGE_IO_GATEWAY_SPOOL_MIN_MAPPED_ITEM_SIZE) != B_NO_ERROR)) ret.Reset();
+         (void) munmap(map, _spoolBodySize);
+      }
+      else LogTime(MUSCLE_LOG_ERROR, "MessageIOGateway %p:  Unable to map " UINT32_FORMAT_SPEC "-byte spool file!\n", this, _spoolBodySize);
+   }
+   else
+   {
+      // A compressed body has to be inflated in memory anyway, so just read it back in and handle it the usual way
+      ByteBufferRef bufRef = GetByteBufferFromPool(hs+_spoolBodySize);
+      if (bufRef())
+      {
+         memcpy(bufRef()->GetBuffer(), lhb, hs);
+         uint32 numRead = 0;
+         while(numRead < _spoolBodySize)
+         {
+            long pret = pread(_spoolFD, bufRef()->GetBuffer()+hs+numRead, _spoolBodySize-numRead, numRead);
+            if (pret > 0) numRead += pret;
+            else if ((pret < 0)&&(PreviousOperationWasInterrupted())) continue;
+            else break;
+         }
+         if (numRead == _spoolBodySize) ret = UnflattenHeaderAndMessage(bufRef);
+      }
+   }
+#endif
+   CloseSpoolFile();
+   return ret;
+}
+
+void
+MessageIOGateway :: CloseSpoolFile()
+{
+#ifndef WIN32
+   if (_spoolFD >= 0) (void) close(_spoolFD);
+#endif
+   _spoolFD = -1;
+   _spoolBodySize = _spoolBytesReceived = 0;
+   _spoolChunk.Reset();
+}
+
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
 ZLibCodec * 
 MessageIOGateway ::
@@ -299,16 +702,81 @@ GetCodec(int32 newEncoding, ZLibCodec * & setCodec) const
          delete setCodec;  // oops, encoding change!  Throw out the old codec, if any
          setCodec = newnothrow ZLibCodec(newLevel);
          if (setCodec == NULL) WARN_OUT_OF_MEMORY;
+         else if ((_zlibPresetDictionary())&&(setCodec->SetPresetDictionary(_zlibPresetDictionary) != B_NO_ERROR))
+         {
+            delete setCodec;
+            setCodec = NULL;
+         }
       }
       return setCodec;
    }
    return NULL;
 }
+
+void
+MessageIOGateway ::
+SetAdaptiveCompressionEnabled(bool enable)
+{
+   DECLARE_MUTEXGUARD(_pipelineMutex);
+   _adaptiveCompressionEnabled = enable;
+   if (enable) _adaptiveController.Reset(muscleInRange(_outgoingEncoding, (int32)MUSCLE_MESSAGE_ENCODING_ZLIB_1, (int32)MUSCLE_MESSAGE_ENCODING_ZLIB_9) ? (_outgoingEncoding-MUSCLE_MESSAGE_ENCODING_ZLIB_1+1) : 0, GetRunTime64());
+}
+
+void
+MessageIOGateway ::
+SetZLibParallelDeflate(IParallelJobRunner * runner, uint32 minMessageSize)
+{
+   WaitForPipeline();  // so that a pipeline job won't see the settings change halfway through a Message
+   _zlibParallelRunner  = runner;
+   _zlibParallelMinSize = minMessageSize;
+}
+
+void
+MessageIOGateway ::
+SetZLibPresetDictionary(const ConstByteBufferRef & dict)
+{
+   WaitForPipeline();  // so that we won't delete a ZLibCodec that the pipeline is using
+   _zlibPresetDictionary = dict;
+
+   // GetCodec() will create new codecs, with the new dictionary, as necessary
+   delete _sendCodec; _sendCodec = NULL;
+   delete _recvCodec; _recvCodec = NULL;
+}
 #endif
 
+bool
+MessageIOGateway ::
+MayStreamMessage(const MessageRef & msgRef) const
+{
+   // The other encodings need the whole Message in memory anyway, and a packet-based DataIO needs the whole Message in one packet
+   return ((msgRef())&&(_outgoingStreamingThreshold != MUSCLE_NO_LIMIT)&&(GetMaximumPacketSize() == 0)&&(GetFlattenEncoding() == MUSCLE_MESSAGE_ENCODING_DEFAULT));
+}
+
+// Flattens (msgRef) for sending, unless it may be streamed and turns out to be larger than our streaming
+// threshold, in which case (retStream) is set to true and a NULL reference is returned.
+ByteBufferRef
+MessageIOGateway ::
+FlattenOutgoingMessage(const MessageRef & msgRef, bool & retStream) const
+{
+   retStream = false;
+   if (MayStreamMessage(msgRef) == false) return FlattenHeaderAndMessage(msgRef);
+
+   // The flatten gives up as soon as it exceeds the threshold, so we never have to call FlattenedSize() up front
+   ByteBufferRef ret = FlattenHeaderAndMessageAux(msgRef, _outgoingStreamingThreshold);
+   if (ret() == NULL) retStream = true;  // too big (or out of memory), so stream it out instead
+   return ret;
+}
+
 ByteBufferRef 
 MessageIOGateway ::
 FlattenHeaderAndMessage(const MessageRef & msgRef) const
+{
+   return FlattenHeaderAndMessageAux(msgRef, MUSCLE_NO_LIMIT);
+}
+
+ByteBufferRef 
+MessageIOGateway ::
+FlattenHeaderAndMessageAux(const MessageRef & msgRef, uint32 maxBodyBytes) const
 {
    TCHECKPOINT;
 
@@ -316,32 +784,87 @@ FlattenHeaderAndMessage(const MessageRef & msgRef) const
    if (msgRef())
    {
       uint32 hs = GetHeaderSize();
-      ret = GetByteBufferFromPool(hs+msgRef()->FlattenedSize());
+      const int32 outgoingEncoding = GetFlattenEncoding();
+
+      int32 encoding = MUSCLE_MESSAGE_ENCODING_DEFAULT;
+      ret = GetByteBufferFromPool(hs+MUSCLE_MESSAGE_IO_GATEWAY_INITIAL_FLATTEN_BUFFER_SIZE);
+      if ((ret())&&(ret()->SetNumBytes(hs, true) != B_NO_ERROR)) ret.Reset();
       if (ret())
       {
-         msgRef()->Flatten(ret()->GetBuffer()+hs);
-
-         int32 encoding = MUSCLE_MESSAGE_ENCODING_DEFAULT;
+         if (outgoingEncoding == MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY)
+         {
+            // If the receiver might not see every Message we send, in order, then each Message has to be decodable on its own
+            if ((GetMaximumPacketSize() > 0)||(AreOutgoingMessagesIndependent())||(_sendDictionary.GetNumNames() >= MessageFieldNameDictionary::MAX_NAMES)) _sendDictionary.Clear();
 
+            const uint8 flags = _sendDictionary.IsEmpty() ? DICTIONARY_FLAG_RESET : 0;  // so the receiver will start over with an empty dictionary too
+            if ((ret()->AppendByte(flags) == B_NO_ERROR)&&(msgRef()->AppendDictionaryEncodedToByteBuffer(*ret(), _sendDictionary) == B_NO_ERROR)) encoding = MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY;
+            else
+            {
+               ret.Reset();
+               _sendDictionary.Clear();  // since it may now hold names that the receiver will never see
+            }
+         }
+         else if (msgRef()->AppendFlattenedToByteBuffer(*ret(), maxBodyBytes) != B_NO_ERROR) ret.Reset();  // single-pass:  no FlattenedSize() call needed
+      }
+      if (ret())
+      {
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
          if (ret()->GetNumBytes() >= 32)  // below 32 bytes, the compression headers usually offset the benefits
          {
-            ZLibCodec * enc = GetCodec(_outgoingEncoding, _sendCodec);
+            ZLibCodec * enc = GetCodec(outgoingEncoding, _sendCodec);
             if (enc)
             {
-               ByteBufferRef compressedRef = enc->Deflate(ret()->GetBuffer()+hs, ret()->GetNumBytes()-hs, AreOutgoingMessagesIndependent(), hs);
+               const uint32 numRaw = ret()->GetNumBytes()-hs;
+               const bool parallel = ((_zlibParallelRunner)&&(numRaw >= _zlibParallelMinSize));
+               const bool independent = ((parallel)||(AreOutgoingMessagesIndependent()));  // DeflateParallel()'s output is always independent
+               const uint64 startTime = _adaptiveCompressionEnabled ? GetRunTime64() : 0;
+
+               // Inside a pipeline job we mustn't block waiting on (_zlibParallelRunner), since it might need the very thread we're running in
+               InlineJobRunner inlineRunner;
+               IParallelJobRunner * chunkRunner = _inPipelineJob ? static_cast<IParallelJobRunner *>(&inlineRunner) : _zlibParallelRunner;
+               ByteBufferRef compressedRef = parallel ? enc->DeflateParallel(ret()->GetBuffer()+hs, numRaw, *chunkRunner, MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE, hs) : enc->Deflate(ret()->GetBuffer()+hs, numRaw, independent, hs);
                if (compressedRef())
                {
-                  encoding = MUSCLE_MESSAGE_ENCODING_ZLIB_1+enc->GetCompressionLevel()-1;
-                  ret = compressedRef;
+                  if (_adaptiveCompressionEnabled)
+                  {
+                     DECLARE_MUTEXGUARD(_pipelineMutex);
+                     _adaptiveController.CompressionPerformed(numRaw, compressedRef()->GetNumBytes()-hs, GetRunTime64()-startTime);
+                  }
+
+                  // An independent Message that didn't shrink can go out uncompressed, since the receiver's inflater
+                  // doesn't need to see it.  (A dependent Message can't, since our deflater's state now includes it)
+                  if ((independent == false)||(enc->GetPresetDictionary()() == NULL)||(compressedRef()->GetNumBytes() < ret()->GetNumBytes()))
+                  {
+                     encoding = MUSCLE_MESSAGE_ENCODING_ZLIB_1+enc->GetCompressionLevel()-1;
+                     ret = compressedRef;
+                  }
                }
                else ret.Reset();  // uh oh, the compressor failed
             }
          }
 #endif
 
+         if ((outgoingEncoding == MUSCLE_MESSAGE_ENCODING_LZ4)&&(ret())&&(ret()->GetNumBytes() >= 32))
+         {
+            ByteBufferRef compressedRef = LZ4CompressByteBuffer(ret()->GetBuffer()+hs, ret()->GetNumBytes()-hs, hs);
+            if (compressedRef())
+            {
+               if (compressedRef()->GetNumBytes() < ret()->GetNumBytes())  // otherwise we might as well send the Message uncompressed
+               {
+                  encoding = MUSCLE_MESSAGE_ENCODING_LZ4;
+                  ret = compressedRef;
+               }
+            }
+            else ret.Reset();  // out of memory?
+         }
+
          if (ret())
          {
+            // The single-pass flatten grows the buffer geometrically, so a large Message can leave up to half of it unused.
+            // Since the buffer may sit in our outgoing queue for a while, we give that memory back now.
+            ByteBuffer & buf = *ret();
+            if ((buf.GetNumAllocatedBytes()-buf.GetNumBytes()) > muscleMax((uint32)MUSCLE_MESSAGE_IO_GATEWAY_INITIAL_FLATTEN_BUFFER_SIZE, buf.GetNumBytes()/8)) (void) buf.FreeExtraBytes();
+
             uint32 * lhb = (uint32 *) ret()->GetBuffer();
             muscleCopyOut(&lhb[0], B_HOST_TO_LENDIAN_INT32(ret()->GetNumBytes()-hs));
             muscleCopyOut(&lhb[1], B_HOST_TO_LENDIAN_INT32(encoding));
@@ -375,28 +898,59 @@ UnflattenHeaderAndMessage(const ConstByteBufferRef & bufRef) const
 
          int32 encoding = B_LENDIAN_TO_HOST_INT32(muscleCopyIn<int32>(&lhb[1]));
 
-         const ByteBuffer * bb = bufRef();  // default; may be changed below
+         if (encoding == MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY)
+         {
+            const uint8 * body = bufRef()->GetBuffer()+offset;
+            if ((lhbSize > 0)&&((body[0] & ~DICTIONARY_FLAG_RESET) == 0))
+            {
+               if (body[0] & DICTIONARY_FLAG_RESET) _recvDictionary.Clear();
+               if (ret()->UnflattenDictionaryEncoded(body+1, lhbSize-1, _recvDictionary) == B_NO_ERROR) return ret;
+            }
+            LogTime(MUSCLE_LOG_DEBUG, "MessageIOGateway %p:  Error decoding dictionary-encoded Message!\n", this);
+            return MessageRef();
+         }
 
-#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+         const ByteBuffer * bb = bufRef();  // default; may be changed below
          ByteBufferRef expRef;  // must be declared outside the brackets below!
-         ZLibCodec * enc = GetCodec(encoding, _recvCodec);
-         if (enc) 
+
+         if (encoding == MUSCLE_MESSAGE_ENCODING_LZ4)
          {
-            expRef = enc->Inflate(bb->GetBuffer()+offset, bb->GetNumBytes()-offset);
-            if (expRef()) 
+            expRef = LZ4DecompressByteBuffer(bb->GetBuffer()+offset, bb->GetNumBytes()-offset);
+            if (expRef())
             {
                bb = expRef();
                offset = 0;
             }
             else
             {
-               LogTime(MUSCLE_LOG_DEBUG, "MessageIOGateway %p:  Error inflating compressed byte buffer!\n", this);
+               LogTime(MUSCLE_LOG_DEBUG, "MessageIOGateway %p:  Error decompressing LZ4 byte buffer!\n", this);
                bb = NULL;
             }
          }
+         else
+         {
+#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+            ZLibCodec * enc = GetCodec(encoding, _recvCodec);
+            if (enc) 
+            {
+               expRef = enc->Inflate(bb->GetBuffer()+offset, bb->GetNumBytes()-offset);
+               if (expRef()) 
+               {
+                  bb = expRef();
+                  offset = 0;
+               }
+               else
+               {
+                  const uint32 wantedDictID = enc->GetMismatchedPresetDictionaryID();
+                  if (wantedDictID != 0) LogTime(MUSCLE_LOG_ERROR, "MessageIOGateway %p:  Incoming Message was compressed with preset dictionary ID " UINT32_FORMAT_SPEC ", but our preset dictionary's ID is " UINT32_FORMAT_SPEC "!  Both peers must call SetZLibPresetDictionary() with the same dictionary.\n", this, wantedDictID, enc->GetPresetDictionaryID());
+                                    else LogTime(MUSCLE_LOG_DEBUG, "MessageIOGateway %p:  Error inflating compressed byte buffer!\n", this);
+                  bb = NULL;
+               }
+            }
 #else
-         if (encoding != MUSCLE_MESSAGE_ENCODING_DEFAULT) bb = NULL;
+            if (encoding != MUSCLE_MESSAGE_ENCODING_DEFAULT) bb = NULL;
 #endif
+         }
 
          if ((bb == NULL)||(ret()->Unflatten(bb->GetBuffer()+offset, bb->GetNumBytes()-offset) != B_NO_ERROR)) ret.Reset();
       }
@@ -425,7 +979,7 @@ bool
 MessageIOGateway ::
 HasBytesToOutput() const
 {
-   return ((IsHosed() == false)&&((_sendBuffer._buffer())||(GetOutgoingMessageQueue().HasItems())));
+   return ((IsHosed() == false)&&((_sendBuffer._buffer())||(GetOutgoingMessageQueue().HasItems())||(HasPipelinedMessages())));
 }
 
 void
@@ -436,13 +990,25 @@ Reset()
 
    AbstractMessageIOGateway::Reset();
 
+   WaitForPipeline();
+   {
+      DECLARE_MUTEXGUARD(_pipelineMutex);
+      _pipeline.Clear();
+      _pipelineNumFlattened = 0;
+   }
+
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
    delete _sendCodec; _sendCodec = NULL;
    delete _recvCodec; _recvCodec = NULL;
+   if (_adaptiveCompressionEnabled) SetAdaptiveCompressionEnabled(true);  // start measuring the new stream from scratch
 #endif
 
    _sendBuffer.Reset();
    _recvBuffer.Reset();
+   _sendFlattener.Reset();
+   CloseSpoolFile();
+   _sendDictionary.Clear();
+   _recvDictionary.Clear();
 }
 
 MessageRef MessageIOGateway :: CreateSynchronousPingMessage(uint32 syncPingCounter) const
@@ -535,24 +1101,35 @@ status_t MessageIOGateway :: ExecuteSynchronousMessageSend(const Message & reque
 CountedMessageIOGateway :: CountedMessageIOGateway(int32 outgoingEncoding)
    : MessageIOGateway(outgoingEncoding)
    , _outgoingByteCount(0)
+   , _lastPoppedByteCount(0)
+   , _pipelinedByteCount(0)
 {
    // empty
 }
 
 status_t CountedMessageIOGateway :: AddOutgoingMessage(const MessageRef & messageRef)
 {
-   if (MessageIOGateway::AddOutgoingMessage(messageRef) != B_NO_ERROR) return B_ERROR;
-
+   // The count is updated first, since MessageIOGateway::AddOutgoingMessage() may pop the Message right back out into its pipeline
+   const uint32 oldByteCount = _outgoingByteCount;
    uint32 msgSize = messageRef()?messageRef()->FlattenedSize():0;
-   if (GetOutgoingMessageQueue().GetNumItems() > 1) _outgoingByteCount += msgSize;
-                                               else _outgoingByteCount  = msgSize;  // semi-paranoia about meddling via GetOutgoingMessageQueue() access
+   if (GetOutgoingMessageQueue().HasItems()) _outgoingByteCount += msgSize;
+                                        else _outgoingByteCount  = msgSize;  // semi-paranoia about meddling via GetOutgoingMessageQueue() access
+
+   if (MessageIOGateway::AddOutgoingMessage(messageRef) != B_NO_ERROR)
+   {
+      _outgoingByteCount = oldByteCount;
+      return B_ERROR;
+   }
    return B_NO_ERROR;
 }
 
 void CountedMessageIOGateway :: Reset()
 {
    MessageIOGateway::Reset();
-   _outgoingByteCount = 0;
+   _outgoingByteCount   = 0;
+   _lastPoppedByteCount = 0;
+   _pipelinedByteCount  = 0;
+   _pipelinedByteCounts.Clear();
 }
 
 status_t CountedMessageIOGateway :: PopNextOutgoingMessage(MessageRef & ret)
@@ -562,11 +1139,30 @@ status_t CountedMessageIOGateway :: PopNextOutgoingMessage(MessageRef & ret)
    if (GetOutgoingMessageQueue().HasItems())
    {
       uint32 retSize = ret()?ret()->FlattenedSize():0;
+      _lastPoppedByteCount = muscleMin(retSize, _outgoingByteCount);
       _outgoingByteCount = (retSize<_outgoingByteCount) ? (_outgoingByteCount-retSize) : 0;  // paranoia to avoid underflow
    }
-   else _outgoingByteCount = 0;  // semi-paranoia about meddling via GetOutgoingMessageQueue() access
+   else
+   {
+      _lastPoppedByteCount = _outgoingByteCount;  // whatever was left must have been (ret)'s
+      _outgoingByteCount = 0;  // semi-paranoia about meddling via GetOutgoingMessageQueue() access
+   }
 
    return B_NO_ERROR;
 }
 
+void CountedMessageIOGateway :: MessageEnteredOutgoingPipeline(const MessageRef & /*msgRef*/)
+{
+   // (msgRef) was just popped, so (_lastPoppedByteCount) is its size.  The pipeline is FIFO, so we can remember
+   // the sizes in order, rather than calling FlattenedSize() on each Message again when it comes out.
+   if (_pipelinedByteCounts.AddTail(_lastPoppedByteCount) == B_NO_ERROR) _pipelinedByteCount += _lastPoppedByteCount;
+}
+
+void CountedMessageIOGateway :: MessageLeftOutgoingPipeline(const MessageRef & /*msgRef*/)
+{
+   uint32 msgSize = 0;
+   (void) _pipelinedByteCounts.RemoveHead(msgSize);
+   _pipelinedByteCount = (msgSize<_pipelinedByteCount) ? (_pipelinedByteCount-msgSize) : 0;  // paranoia to avoid underflow
+}
+
 } // end namespace muscle
@@ -4,17 +4,46 @@
 #define MuscleMessageIOGateway_h
 
 #include "iogateway/AbstractMessageIOGateway.h"
+#include "system/IParallelJobRunner.h"
+#include "system/Mutex.h"
 #include "util/ByteBuffer.h"
 #include "util/NestCount.h"
 
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
 # include "zlib/ZLibCodec.h"
+# include "iogateway/AdaptiveCompressionController.h"
 #endif
 
 namespace muscle {
 
+#ifndef MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_STREAMING_THRESHOLD
+/** Outgoing Messages that flatten to more than this many bytes are streamed out incrementally rather than being flattened into one big buffer.  See MessageIOGateway::SetOutgoingMessageStreamingThreshold(). */
+# define MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_STREAMING_THRESHOLD (1024*1024)
+#endif
+
+#ifndef MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE
+/** Size of the buffer, in bytes, that MessageIOGateway uses when streaming out a large Message, or when spooling in a large Message. */
+# define MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE (64*1024)
+#endif
+
+#ifndef MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD
+/** Incoming Message bodies larger than this many bytes are spooled to a temporary file rather than being received into memory.  Defaults to MUSCLE_NO_LIMIT (i.e. never).  See MessageIOGateway::SetIncomingMessageSpoolThreshold(). */
+# define MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD MUSCLE_NO_LIMIT
+#endif
+
+#ifndef MUSCLE_MESSAGE_IO_GATEWAY_SPOOL_MIN_MAPPED_ITEM_SIZE
+/** Raw-data items of at least this many bytes in a spooled incoming Message are memory-mapped from the spool file rather than copied into the heap. */
+# define MUSCLE_MESSAGE_IO_GATEWAY_SPOOL_MIN_MAPPED_ITEM_SIZE (64*1024)
+#endif
+
+#ifndef MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_PIPELINE_DEPTH
+/** Default maximum number of outgoing Messages that MessageIOGateway will have flattened ahead of time in its outgoing-Message pipeline.  See MessageIOGateway::SetOutgoingMessagePipeline(). */
+# define MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_PIPELINE_DEPTH 16
+#endif
+
 /**
- * Encoding IDs identify how a Message object will be converted to and from a flattened byte-buffer.  We currently support the vanilla MUSCLE_MESSAGE_ENCODING_DEFAULT plus 9 levels of zlib compression.
+ * Encoding IDs identify how a Message object will be converted to and from a flattened byte-buffer.  We currently support the vanilla MUSCLE_MESSAGE_ENCODING_DEFAULT,
+ * 9 levels of zlib compression, the field-name-dictionary encoding, and LZ4 compression.
  */
 enum {
    MUSCLE_MESSAGE_ENCODING_DEFAULT = 1164862256, /**< 'Enc0' -- just standard flattened-Message format, with no special encoding */
@@ -29,7 +58,9 @@ enum {
    MUSCLE_MESSAGE_ENCODING_ZLIB_8,
    MUSCLE_MESSAGE_ENCODING_ZLIB_9,               /**< highest level of zlib compression (uses the least number of bytes) */
 #endif
-   MUSCLE_MESSAGE_ENCODING_END_MARKER = MUSCLE_MESSAGE_ENCODING_DEFAULT+10  /**< guard value */
+   MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY = MUSCLE_MESSAGE_ENCODING_DEFAULT+10, /**< 'Enc:' -- compact format where each field name is sent in full only once per connection; see Message::AppendDictionaryEncodedToByteBuffer() */
+   MUSCLE_MESSAGE_ENCODING_LZ4 = MUSCLE_MESSAGE_ENCODING_DEFAULT+11, /**< 'Enc;' -- standard flattened-Message format, compressed with our built-in LZ4 codec; see LZ4CompressByteBuffer() */
+   MUSCLE_MESSAGE_ENCODING_END_MARKER = MUSCLE_MESSAGE_ENCODING_DEFAULT+12  /**< guard value */
 };
 
 /** Callback function type for flatten/unflatten notification callbacks */
@@ -69,6 +100,12 @@ public:
     */
    virtual ~MessageIOGateway();
 
+   /** Overridden to also start the Message flattening in our outgoing-Message pipeline, if there is one.
+     * @param messageRef The Message to send.
+     * @returns B_NO_ERROR on success, or B_ERROR on failure.
+     */
+   virtual status_t AddOutgoingMessage(const MessageRef & messageRef);
+
    virtual bool HasBytesToOutput() const;
    virtual void Reset();
 
@@ -115,13 +152,163 @@ public:
    /** Call this to change the encoding this gateway applies to outgoing Messages.
      * Note that the encoding change will take place starting with the next Message
      * that is actually sent, so if any Messages are currently Queued up to be sent,
-     * they will be sent using the new encoding.
+     * they will be sent using the new encoding.  (The exception is Messages that have already
+     * been handed to the outgoing-Message pipeline; see SetOutgoingMessagePipeline())
      * Note that to use any of the MUSCLE_MESSAGE_ENCODING_ZLIB_* encodings, 
      * you MUST have defined the compiler symbol -DMUSCLE_ENABLE_ZLIB_ENCODING.
+     * MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY sends each distinct field name in full only
+     * once per connection, and is a good choice for streams of small structured Messages.
+     * MUSCLE_MESSAGE_ENCODING_LZ4 compresses less than the zlib encodings do, but uses much less CPU,
+     * and is always available.
+     * Only choose an encoding that the receiving peer is known to understand.
      * @param ec Encoding type to use.  Should be one of the MUSCLE_MESSAGE_ENCODING_* constants.
      */
    void SetOutgoingEncoding(int32 ec) {_outgoingEncoding = ec;}
 
+   /** Call this to change the size above which outgoing Messages are streamed out incrementally.
+     * A streamed Message is never flattened into a single ByteBuffer; instead, its flattened bytes are
+     * generated (via an IncrementalMessageFlattener) a chunk at a time, as the DataIO is able to accept them,
+     * so that sending a very large Message needs only MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE bytes
+     * of send buffer.  The bytes sent on the wire are the same either way.
+     * Streaming is only done when no compression encoding is in use and the DataIO isn't packet-based;
+     * otherwise large Messages are sent the usual way.  (See MayStreamMessage() for details)
+     * A Message's size is discovered as it is flattened:  flattening gives up as soon as the Message turns out to
+     * be larger than this threshold, and the Message is then streamed instead.
+     * Note that a Message must not be modified while it is being streamed out.
+     * @param numBytes The new threshold, in bytes, or MUSCLE_NO_LIMIT to disable streaming.
+     *                 Defaults to MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_STREAMING_THRESHOLD (one megabyte).
+     */
+   void SetOutgoingMessageStreamingThreshold(uint32 numBytes) {_outgoingStreamingThreshold = numBytes;}
+
+   /** Returns the outgoing-Message streaming threshold, as was set by SetOutgoingMessageStreamingThreshold(). */
+   uint32 GetOutgoingMessageStreamingThreshold() const {return _outgoingStreamingThreshold;}
+
+   /** Call this to change the size above which incoming Message bodies are spooled to a temporary file as they are received,
+     * instead of being accumulated in a heap buffer.  The temporary file is deleted as soon as it is created, so it never
+     * outlives the process.  Once the entire body has arrived, the file is memory-mapped and unflattened via
+     * Message::UnflattenFromMappedFile(), so that any raw-data items of at least MUSCLE_MESSAGE_IO_GATEWAY_SPOOL_MIN_MAPPED_ITEM_SIZE
+     * bytes are exposed as file-backed ByteBuffers rather than being copied into the heap.  That way a server that is
+     * receiving many large uploads at once needs only MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE bytes of heap per upload
+     * while they are in progress, and the bulk data afterwards lives in pages the OS can evict at will.
+     * Spooling is only done for stream (non-packet-based) DataIOs, and only on OS's that support mmap().  Compressed Messages
+     * are spooled also, but must then be read back into memory to be inflated.  Subclasses that override UnflattenHeaderAndMessage()
+     * should leave spooling disabled, since spooled Messages without compression are unflattened without calling it.
+     * StorageReflectSessionFactory::SetIncomingMessageSpoolThreshold() passes this setting on to the gateways of the sessions
+     * it creates; muscled sets that from its "spoolthreshold" argument.
+     * @param numBytes The new threshold, in bytes, or MUSCLE_NO_LIMIT to disable spooling.
+     *                 Defaults to MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD (MUSCLE_NO_LIMIT).
+     */
+   void SetIncomingMessageSpoolThreshold(uint32 numBytes) {_incomingSpoolThreshold = numBytes;}
+
+   /** Returns the incoming-Message spooling threshold, as was set by SetIncomingMessageSpoolThreshold(). */
+   uint32 GetIncomingMessageSpoolThreshold() const {return _incomingSpoolThreshold;}
+
+   /** Sets the directory that spool files for large incoming Messages are created in.
+     * @param dir The directory's path, or an empty String to use the directory named by the TMPDIR
+     *            environment variable (or /tmp, if TMPDIR isn't set).  Defaults to an empty String.
+     */
+   void SetIncomingMessageSpoolDirectory(const String & dir) {_incomingSpoolDirectory = dir;}
+
+   /** Returns the spool directory, as was set by SetIncomingMessageSpoolDirectory(). */
+   const String & GetIncomingMessageSpoolDirectory() const {return _incomingSpoolDirectory;}
+
+   /** Enables (or disables) the outgoing-Message pipeline.  When it is enabled, each outgoing Message is handed
+     * off as soon as it is added (via AddOutgoingMessage()) to a job queue created via (runner)'s CreateSerialJobQueue()
+     * method (e.g. a ThreadPoolJobRunner's), where FlattenHeaderAndMessage() is called on it -- so the flattening
+     * and compressing of outgoing Messages is done in another thread, and the thread that calls DoOutput() only has to
+     * write out the buffers that are ready.  The Messages are flattened one at a time and in order, so the bytes sent
+     * are the same as they would be without the pipeline.  If DoOutput() finds that the next Message's buffer isn't
+     * ready yet and it hasn't written anything yet, it waits for the pipeline to catch up.
+     * Some caveats:  Messages must not be modified after they are added to this gateway, FlattenHeaderAndMessage()
+     * (and AreOutgoingMessagesIndependent(), etc) must be safe to call from another thread, the about-to-flatten
+     * callback is called when the Message is handed to the pipeline, and any Messages that are inserted directly
+     * into the outgoing-Message queue will be sent after the Messages that are already in the pipeline.
+     * A Message's encoding is decided when it is handed to the pipeline, so a later call to SetOutgoingEncoding()
+     * (or a change made by adaptive compression) only affects the Messages that are handed off after it.
+     * Messages in the pipeline (up to (maxDepth) of them) are no longer in GetOutgoingMessageQueue(), so code that
+     * examines that queue (e.g. StorageReflectSession's JettisonOutgoing*() methods, or ReflectServer's low-memory
+     * check) won't see them; CountedMessageIOGateway::GetNumOutgoingDataBytes() does include them.
+     * If parallel compression is enabled too (see SetZLibParallelDeflate()), Messages that are flattened by the
+     * pipeline have their chunks compressed one after another, within the pipeline's job, rather than via the
+     * parallel-compression runner -- since waiting for that runner from inside the pipeline's job would deadlock
+     * if both were using the same ThreadPool.
+     * @param runner The object to create the job queue with, or NULL to disable the pipeline (the default).
+     *               Disabling the pipeline blocks until any Messages in it have been flattened; they will still
+     *               be sent.  The object must remain valid for as long as it is set here.
+     * @param maxDepth The maximum number of Messages to have in the pipeline at once.
+     *                 Defaults to MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_PIPELINE_DEPTH.
+     * @returns B_NO_ERROR on success, or B_ERROR if (runner) couldn't create a job queue.
+     */
+   status_t SetOutgoingMessagePipeline(IParallelJobRunner * runner, uint32 maxDepth = MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_PIPELINE_DEPTH);
+
+   /** Returns the IParallelJobRunner that was passed to SetOutgoingMessagePipeline(), or NULL if the pipeline is disabled. */
+   IParallelJobRunner * GetOutgoingMessagePipelineRunner() const {return _pipelineRunner;}
+
+#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+   /** Sets a preset dictionary for the MUSCLE_MESSAGE_ENCODING_ZLIB_* encodings to use, in both directions.
+     * A dictionary built from typical traffic (see ZLibCodec::BuildPresetDictionary()) lets small Messages
+     * compress well even when each one must be compressed independently, and helps the first Messages sent on
+     * every connection.  The dictionary is not negotiated:  the peer MUST be set up with the same dictionary, and
+     * this has to be arranged out-of-band (e.g. both sides load it from the same file).  ZLibCodec::GetPresetDictionaryID()
+     * can be used to check that they match.  The ID of the dictionary is embedded in each zlib stream, so an incoming
+     * Message that was compressed with a different dictionary (or when we have none) is detected before it is inflated:
+     * an error naming both dictionary IDs is logged, and the Message is treated as undecodable (which, on a stream-based
+     * DataIO, closes the connection).
+     * When a dictionary is in use and outgoing Messages are independent, any Message that doesn't get any
+     * smaller when compressed is sent uncompressed instead.
+     * This call restarts the zlib streams, so it should be made before any Messages are sent or received.
+     * @param dict The dictionary bytes, or a NULL reference to use no dictionary (which is the default).
+     */
+   void SetZLibPresetDictionary(const ConstByteBufferRef & dict);
+
+   /** Returns the preset dictionary that was set by SetZLibPresetDictionary(), or a NULL reference if there isn't one. */
+   const ConstByteBufferRef & GetZLibPresetDictionary() const {return _zlibPresetDictionary;}
+
+   /** Enables parallel compression of large outgoing Messages, for the MUSCLE_MESSAGE_ENCODING_ZLIB_* encodings.
+     * Each outgoing Message whose flattened size is at least (minMessageSize) bytes will be compressed via
+     * ZLibCodec::DeflateParallel() rather than ZLibCodec::Deflate(), so that it is compressed in several chunks at once.
+     * The peer doesn't need to do anything differently to receive these Messages.
+     * Note that while the outgoing-Message pipeline is enabled (see SetOutgoingMessagePipeline()), the Messages it
+     * flattens have their chunks compressed one at a time, inside the pipeline's job, rather than via (runner);
+     * that way the two may safely share a ThreadPool.  The compressed bytes are the same either way.
+     * @param runner The object to compress the chunks with (e.g. a ThreadPoolJobRunner), or NULL to compress
+     *               every Message in the calling thread (which is the default).  The object must remain valid
+     *               for as long as it is set here.
+     * @param minMessageSize The smallest flattened Message size that will be compressed in parallel.
+     *                       Defaults to 4 times MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE.
+     */
+   void SetZLibParallelDeflate(IParallelJobRunner * runner, uint32 minMessageSize = 4*MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE);
+
+   /** Returns the IParallelJobRunner that was passed to SetZLibParallelDeflate(), or NULL if there isn't one. */
+   IParallelJobRunner * GetZLibParallelDeflateRunner() const {return _zlibParallelRunner;}
+
+   /** Enables or disables adaptive compression of outgoing Messages.  When enabled, this gateway measures how quickly
+     * its outgoing data drains out through the DataIO, and how much CPU time compressing it costs, and uses an
+     * AdaptiveCompressionController to pick the zlib level (or no compression at all) that gets the most data
+     * delivered per second.  For example, on a fast LAN link compression will tend to be switched off, whereas on a
+     * slow WAN link the level will be raised for as long as there is CPU time to spare.  Level changes are logged
+     * at MUSCLE_LOG_DEBUG, and the controller's statistics can be examined via GetAdaptiveCompressionController().
+     * While enabled, this overrides the encoding that was set via SetOutgoingEncoding(), so the receiving peer
+     * must understand the MUSCLE_MESSAGE_ENCODING_ZLIB_* encodings.
+     * @param enable True to enable adaptive compression, or false to go back to using the encoding set by
+     *               SetOutgoingEncoding() (which is the default).  If the current outgoing encoding is one of the
+     *               MUSCLE_MESSAGE_ENCODING_ZLIB_* encodings, adaptive compression starts at that level; otherwise
+     *               it starts out with compression disabled.
+     */
+   void SetAdaptiveCompressionEnabled(bool enable);
+
+   /** Returns true iff adaptive compression was enabled via SetAdaptiveCompressionEnabled(). */
+   bool IsAdaptiveCompressionEnabled() const {return _adaptiveCompressionEnabled;}
+
+   /** Returns a read/write reference to the controller that adaptive compression uses, so that its
+     * parameters can be tuned (via AdaptiveCompressionController::SetParameters()) and its statistics monitored.
+     */
+   AdaptiveCompressionController & GetAdaptiveCompressionController() {return _adaptiveController;}
+
+   /** Returns a read-only reference to the controller that adaptive compression uses. */
+   const AdaptiveCompressionController & GetAdaptiveCompressionController() const {return _adaptiveController;}
+#endif
+
    /** Overwritten to augment AbstractMessageIOGateway::ExecuteSynchronousMessaging()
      * with some additional logic that prepends a PR_COMMAND_PING to the outgoing Message queue
      * and then makes sure that ExecuteSynchronousMessaging() doesn't return until the
@@ -174,6 +361,20 @@ protected:
     */
    virtual ByteBufferRef FlattenHeaderAndMessage(const MessageRef & msgRef) const;
 
+   /**
+    * Called before each outgoing Message is flattened, to decide whether it may be streamed out incrementally
+    * (see SetOutgoingMessageStreamingThreshold()) if it turns out to be too large.  If this method returns true,
+    * the Message is flattened by the default code with a size limit of the streaming threshold, and is streamed
+    * if it exceeds that limit; if it returns false, the Message is passed to FlattenHeaderAndMessage() as usual.
+    * @param msgRef Reference to the Message that is about to be sent.
+    * @return true iff (msgRef) may be streamed.  The default implementation returns true iff (msgRef) isn't NULL,
+    *         a streaming threshold is set, the outgoing encoding is MUSCLE_MESSAGE_ENCODING_DEFAULT, and the
+    *         DataIO isn't packet-based.  It never needs to compute the Message's size.
+    * @note A streamed Message is sent in the default flattened format, so if you override FlattenHeaderAndMessage()
+    *       to send Messages some other way, you should override this method to return false also.
+    */
+   virtual bool MayStreamMessage(const MessageRef & msgRef) const;
+
    /**
     * Unflattens a specified ByteBuffer object back into a MessageRef object.
     * @param bufRef Reference to a ByteBuffer object that contains the appropriate header
@@ -232,6 +433,18 @@ protected:
      */
    virtual status_t PopNextOutgoingMessage(MessageRef & retMsg);
 
+   /** Called after a Message that was popped via PopNextOutgoingMessage() has been handed to the outgoing-Message
+     * pipeline (see SetOutgoingMessagePipeline()).  Default implementation is a no-op.
+     * @param msgRef The Message that is now in the pipeline.
+     */
+   virtual void MessageEnteredOutgoingPipeline(const MessageRef & msgRef) {(void) msgRef;}
+
+   /** Called when a Message comes out of the outgoing-Message pipeline, just before it is sent.
+     * Default implementation is a no-op.
+     * @param msgRef The Message that is no longer in the pipeline.
+     */
+   virtual void MessageLeftOutgoingPipeline(const MessageRef & msgRef) {(void) msgRef;}
+
    /** 
      * Should return true iff we need to make sure that any outgoing Messages that we've deflated
      * are inflatable independently of each other.  The default method always returns false, since it
@@ -247,6 +460,18 @@ private:
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
    ZLibCodec * GetCodec(int32 newEncoding, ZLibCodec * & setCodec) const;
 #endif
+   int32 GetEffectiveOutgoingEncoding() const;
+   void AdaptiveCompressionOutputPerformed(int32 sentBytes, bool blocked);
+
+   void FeedPipeline();
+   status_t PopNextPipelinedMessage(MessageRef & retMsg, ByteBufferRef & retBuf, bool & retStream, bool mayWait);
+   void FlattenNextPipelinedMessage();
+   void WaitForPipeline();
+   bool HasPipelinedMessages() const;
+   int32 GetFlattenEncoding() const {return _inPipelineJob ? _pipelineJobEncoding : GetEffectiveOutgoingEncoding();}
+   ByteBufferRef FlattenHeaderAndMessageAux(const MessageRef & msgRef, uint32 maxBodyBytes) const;
+   ByteBufferRef FlattenOutgoingMessage(const MessageRef & msgRef, bool & retStream) const;
+   static void FlattenPipelinedMessageJob(uint32 jobIndex, void * userData) {(void) jobIndex; static_cast<MessageIOGateway *>(userData)->FlattenNextPipelinedMessage();}
 
 #ifndef DOXYGEN_SHOULD_IGNORE_THIS  // this is here so doxygen-coverage won't complain that I haven't documented this class -- but it's a private class so I don't need to
    class TransferBuffer
@@ -266,18 +491,59 @@ private:
 #endif
 
    status_t SendMoreData(int32 & sentBytes, uint32 & maxBytes);
+   status_t BeginStreamingOutgoingMessage(const MessageRef & msgRef);
+   status_t ContinueStreamingOutgoingMessage();
    status_t ReceiveMoreData(int32 & readBytes, uint32 & maxBytes, uint32 maxArraySize);
+   status_t BeginSpoolingIncomingMessage(uint32 bodySize);
+   status_t ReceiveMoreSpoolData(int32 & readBytes, uint32 & maxBytes);
+   MessageRef UnflattenSpooledMessage();
+   void CloseSpoolFile();
 
    ByteBufferRef GetScratchReceiveBuffer();
    void ForgetScratchReceiveBufferIfSubclassIsStillUsingIt();
 
+#ifndef DOXYGEN_SHOULD_IGNORE_THIS
+   class PipelinedMessage
+   {
+   public:
+      PipelinedMessage() : _encoding(MUSCLE_MESSAGE_ENCODING_DEFAULT), _stream(false) {/* empty */}
+      PipelinedMessage(const MessageRef & msg, int32 encoding) : _msg(msg), _encoding(encoding), _stream(false) {/* empty */}
+
+      MessageRef _msg;
+      ByteBufferRef _buffer;  // set by FlattenNextPipelinedMessage()
+      int32 _encoding;        // the effective outgoing encoding at the time the Message was handed to the pipeline
+      bool _stream;           // set by FlattenNextPipelinedMessage() if the Message is to be streamed out instead
+   };
+#endif
+
    TransferBuffer _sendBuffer;
    TransferBuffer _recvBuffer;
 
+   IParallelJobRunner * _pipelineRunner;
+   ISerialJobQueue * _pipelineJobQueue;
+   uint32 _maxPipelineDepth;
+   Queue<PipelinedMessage> _pipeline;  // Messages that have been handed to (_pipelineJobQueue), in order
+   uint32 _pipelineNumFlattened;       // how many of the Messages at the head of (_pipeline) have been flattened
+   mutable Mutex _pipelineMutex;       // serializes access to the above two, and to the adaptive-compression controller
+   bool _inPipelineJob;                // true while FlattenNextPipelinedMessage() is flattening a Message.  Since those
+   int32 _pipelineJobEncoding;         // flattens never overlap, only the flattening thread touches these two.
+
+   uint32 _outgoingStreamingThreshold;
+   IncrementalMessageFlattener _sendFlattener;  // used only while a large Message is being streamed out
+
    ByteBufferRef _scratchRecvBuffer;   // used to efficiently receive small Messages in the normal case
 
+   uint32 _incomingSpoolThreshold;
+   String _incomingSpoolDirectory;
+   int _spoolFD;                       // non-negative only while a large incoming Message's body is being spooled to disk
+   uint32 _spoolBodySize;
+   uint32 _spoolBytesReceived;
+   ByteBufferRef _spoolChunk;          // receive buffer used while spooling
+
    uint32 _maxIncomingMessageSize;
    int32 _outgoingEncoding;
+   mutable MessageFieldNameDictionary _sendDictionary;  // field names we've sent, for MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY
+   mutable MessageFieldNameDictionary _recvDictionary;  // field names we've received, ditto
   
    MessageFlattenedCallback _aboutToFlattenCallback;
    void * _aboutToFlattenCallbackData;
@@ -291,6 +557,11 @@ private:
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
    mutable ZLibCodec * _sendCodec;
    mutable ZLibCodec * _recvCodec;
+   ConstByteBufferRef _zlibPresetDictionary;
+   IParallelJobRunner * _zlibParallelRunner;
+   uint32 _zlibParallelMinSize;
+   bool _adaptiveCompressionEnabled;
+   mutable AdaptiveCompressionController _adaptiveController;
 #endif
 
    NestCount _noRPCReply;
@@ -317,17 +588,22 @@ public:
 
    virtual void Reset();
 
-   /** Returns the number of bytes of data currently in our outgoing-messages-queue
-     * Calculated by calling FlattenedSize() on the Messages as they are added to
-     * or removed from the queue)
+   /** Returns the number of bytes of data currently in our outgoing-messages-queue, plus those
+     * in our outgoing-Message pipeline, if it is enabled.  (Calculated by calling FlattenedSize()
+     * on the Messages as they are added to or removed from the queue and the pipeline)
      */
-   uint32 GetNumOutgoingDataBytes() const {return _outgoingByteCount;}
+   uint32 GetNumOutgoingDataBytes() const {return _outgoingByteCount+_pipelinedByteCount;}
 
 protected:
    virtual status_t PopNextOutgoingMessage(MessageRef & ret);
+   virtual void MessageEnteredOutgoingPipeline(const MessageRef & msgRef);
+   virtual void MessageLeftOutgoingPipeline(const MessageRef & msgRef);
 
 private:
    uint32 _outgoingByteCount;
+   uint32 _lastPoppedByteCount;         // the size of the Message most recently returned by PopNextOutgoingMessage()
+   uint32 _pipelinedByteCount;
+   Queue<uint32> _pipelinedByteCounts;  // the sizes of the Messages in our outgoing-Message pipeline, oldest first
 };
 DECLARE_REFTYPES(CountedMessageIOGateway);
 
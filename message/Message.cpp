@@ -4,6 +4,11 @@
 #include "util/Queue.h"
 #include "message/Message.h"
 
+#if !defined(MUSCLE_AVOID_SIMD_NUMERIC_CODECS) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+# define MUSCLE_COLUMNAR_USE_SSE2
+# include <emmintrin.h>
+#endif
+
 namespace muscle {
 
 using namespace muscle_message_imp;
@@ -784,7 +789,9 @@ public:
 
    virtual uint32 TypeCode() const {return _typeCode;}
 
-   virtual status_t Unflatten(const uint8 * buffer, uint32 numBytes)
+   virtual status_t Unflatten(const uint8 * buffer, uint32 numBytes) {return UnflattenAux(buffer, numBytes, NULL);}
+
+   status_t UnflattenAux(const uint8 * buffer, uint32 numBytes, const MappedFileUnflattenInfo * optMapInfo)
    {
       Clear(false);
 
@@ -813,7 +820,7 @@ public:
             LogTime(MUSCLE_LOG_DEBUG, "ByteBufferDataArray %p:  Item size too large (i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC ", readOffset=" UINT32_FORMAT_SPEC ", numBytes=" UINT32_FORMAT_SPEC ", readFs=" UINT32_FORMAT_SPEC ")\n", this, i, numItems, readOffset, numBytes, readFs);
             return B_ERROR;  // message size too large for our buffer... corruption?
          }
-         FlatCountableRef fcRef(GetByteBufferFromPool(readFs, &buffer[readOffset]).GetRefCountableRef(), true);
+         FlatCountableRef fcRef((optMapInfo ? optMapInfo->GetByteBuffer(&buffer[readOffset], readFs) : GetByteBufferFromPool(readFs, &buffer[readOffset])).GetRefCountableRef(), true);
          if ((fcRef())&&(AddDataItem(&fcRef, sizeof(fcRef)) == B_NO_ERROR)) readOffset += readFs;
                                                                        else return B_ERROR;
       }
@@ -915,7 +922,9 @@ public:
    /** For backwards compatibility with older muscle streams */
    virtual bool ShouldWriteNumItems() const {return false;}
 
-   virtual status_t Unflatten(const uint8 * buffer, uint32 numBytes)
+   virtual status_t Unflatten(const uint8 * buffer, uint32 numBytes) {return UnflattenAux(buffer, numBytes, NULL);}
+
+   status_t UnflattenAux(const uint8 * buffer, uint32 numBytes, const MappedFileUnflattenInfo * optMapInfo)
    {
       Clear(false);
 
@@ -938,7 +947,7 @@ public:
          MessageRef nextMsg = GetMessageFromPool();
          if (nextMsg())
          {
-            if (nextMsg()->Unflatten(&buffer[readOffset], readFs) != B_NO_ERROR) 
+            if ((optMapInfo ? optMapInfo->UnflattenMessage(*nextMsg(), &buffer[readOffset], readFs) : nextMsg()->Unflatten(&buffer[readOffset], readFs)) != B_NO_ERROR) 
             {
                LogTime(MUSCLE_LOG_DEBUG, "MessageDataArray %p:  Sub-message unflatten failed (readOffset=" UINT32_FORMAT_SPEC ", numBytes=" UINT32_FORMAT_SPEC ", readFs=" UINT32_FORMAT_SPEC ")\n", this, readOffset, numBytes, readFs);
                return B_ERROR;
@@ -1240,6 +1249,13 @@ MessageField * Message :: GetOrCreateMessageField(const String & fieldName, uint
    return _entries.PutIfNotAlreadyPresent(fieldName, MessageField(tc));
 }
 
+MessageField * Message :: GetOrCreateMessageField(const FieldKey & key, uint32 tc)
+{
+   MessageField * mf = _entries.GetWithPrecomputedHash(key.GetFieldName(), key.HashCode());
+   if (mf) return (mf->TypeCode() == tc) ? mf : NULL;  // can't create a same-named field of a different type
+   return _entries.PutIfNotAlreadyPresentWithPrecomputedHash(key.GetFieldName(), key.HashCode(), MessageField(tc));
+}
+
 status_t Message :: Rename(const String & oldFieldName, const String & newFieldName) 
 {
    if (oldFieldName == newFieldName) return B_NO_ERROR;  // nothing needs to be done in this case
@@ -1346,7 +1362,980 @@ void Message :: Flatten(uint8 * buffer) const
    memcpy(entryCountPtr, &networkByteOrder, sizeof(uint32));
 }
 
+// Makes sure (buf) holds at least (numBytesNeeded) bytes, growing it geometrically so that many small appends stay cheap
+static status_t EnsureFlattenSpace(ByteBuffer & buf, uint32 numBytesNeeded, uint32 maxNumBytes)
+{
+   if (numBytesNeeded <= buf.GetNumBytes()) return B_NO_ERROR;
+   if (numBytesNeeded > maxNumBytes) return B_ERROR;
+   return buf.SetNumBytes(muscleMin(muscleMax(numBytesNeeded, buf.GetNumBytes()*2), maxNumBytes), true);
+}
+
+status_t Message :: AppendFlattenedToByteBuffer(ByteBuffer & outBuf, uint32 maxBytesToAppend) const
+{
+   TCHECKPOINT;
+
+   const uint32 origNumBytes = outBuf.GetNumBytes();
+   uint32 writeOffset = origNumBytes;
+   const uint32 maxWriteOffset = (maxBytesToAppend < (MUSCLE_NO_LIMIT-origNumBytes)) ? (origNumBytes+maxBytesToAppend) : MUSCLE_NO_LIMIT;
+   if (AppendFlattenedToByteBufferAux(outBuf, writeOffset, maxWriteOffset) == B_NO_ERROR) return outBuf.SetNumBytes(writeOffset, true);  // truncating never reallocates
+
+   (void) outBuf.SetNumBytes(origNumBytes, true);
+   return B_ERROR;
+}
+
+status_t Message :: AppendFlattenedToByteBufferAux(ByteBuffer & outBuf, uint32 & writeOffset, uint32 maxWriteOffset) const
+{
+   // Same format as Flatten(), except that the entry-data-length fields are filled in after
+   // each entry's data has been written, so that we never need to call FlattenedSize().
+   if (EnsureFlattenSpace(outBuf, writeOffset+(3*sizeof(uint32)), maxWriteOffset) != B_NO_ERROR) return B_ERROR;
+
+   uint32 networkByteOrder = B_HOST_TO_LENDIAN_INT32(CURRENT_PROTOCOL_VERSION);
+   WriteData(outBuf.GetBuffer(), &writeOffset, &networkByteOrder, sizeof(networkByteOrder));
+
+   networkByteOrder = B_HOST_TO_LENDIAN_INT32(what);
+   WriteData(outBuf.GetBuffer(), &writeOffset, &networkByteOrder, sizeof(networkByteOrder));
+
+   // Note that we store offsets rather than pointers, since (outBuf) may get reallocated as we go
+   const uint32 entryCountOffset = writeOffset;
+   writeOffset += sizeof(uint32);
+
+   uint32 numFlattenedEntries = 0;
+   for (HashtableIterator<String, MessageField> it(_entries, HTIT_FLAG_NOREGISTER); it.HasData(); it++)
+   {
+      const MessageField & mf = it.GetValue();
+      if (mf.IsFlattenable())
+      {
+         numFlattenedEntries++;
+
+         const String & fieldName = it.GetKey();
+         const uint32 keyNameSize = fieldName.FlattenedSize();
+         if (EnsureFlattenSpace(outBuf, writeOffset+keyNameSize+(3*sizeof(uint32)), maxWriteOffset) != B_NO_ERROR) return B_ERROR;
+
+         networkByteOrder = B_HOST_TO_LENDIAN_INT32(keyNameSize);
+         WriteData(outBuf.GetBuffer(), &writeOffset, &networkByteOrder, sizeof(networkByteOrder));
+
+         fieldName.Flatten(outBuf.GetBuffer()+writeOffset);
+         writeOffset += keyNameSize;
+
+         networkByteOrder = B_HOST_TO_LENDIAN_INT32(mf.TypeCode());
+         WriteData(outBuf.GetBuffer(), &writeOffset, &networkByteOrder, sizeof(networkByteOrder));
+
+         const uint32 dataSizeOffset = writeOffset;
+         writeOffset += sizeof(uint32);
+
+         if (mf.AppendFlattenedToByteBuffer(outBuf, writeOffset, maxWriteOffset) != B_NO_ERROR) return B_ERROR;
+         muscleCopyOut(outBuf.GetBuffer()+dataSizeOffset, B_HOST_TO_LENDIAN_INT32(writeOffset-(dataSizeOffset+sizeof(uint32))));
+      }
+   }
+
+   muscleCopyOut(outBuf.GetBuffer()+entryCountOffset, B_HOST_TO_LENDIAN_INT32(numFlattenedEntries));
+   return B_NO_ERROR;
+}
+
+enum {
+   FLATTEN_FRAME_STATE_HEADER = 0,
+   FLATTEN_FRAME_STATE_NEXT_FIELD,
+   FLATTEN_FRAME_STATE_MESSAGE_ITEMS,
+   FLATTEN_FRAME_STATE_FLATCOUNTABLE_ITEMS
+};
+
+static const uint32 _incrementalFlattenScratchSize = 16*1024;  // we'll generate up to about this many bytes at a time
+
+// Returns true iff (mf)'s items are separately-flattened variable-sized objects (e.g. ByteBuffers) that we can generate one at a time
+static bool IsFieldFlattenedPerItem(const MessageField & mf)
+{
+   const uint32 tc = mf.TypeCode();
+   return ((tc != B_MESSAGE_TYPE)&&(tc != B_STRING_TYPE)&&(mf.ElementsAreFixedSize() == false));
+}
+
+void IncrementalMessageFlattener :: Reset()
+{
+   _frames.Clear();  // must be done before we release the Message, since the frames' iterators point into it
+   _msgRef.Reset();
+   _sizes.Clear();
+   _nextSizeIdx = 0;
+   _flattenedSize = _numBytesRemaining = 0;
+   _scratch.Clear(_scratch.GetNumAllocatedBytes() > (2*_incrementalFlattenScratchSize));  // don't hold on to an unusually large buffer
+   _scratchReadOffset = 0;
+   _blobRef.Reset();
+   _blobBytes = NULL;
+   _numBlobBytes = 0;
+}
+
+status_t IncrementalMessageFlattener :: SetMessage(const ConstMessageRef & msgRef)
+{
+   Reset();
+   if (msgRef() == NULL) return B_ERROR;
+
+   _msgRef = msgRef;
+   if ((ComputeSizes(*msgRef(), _flattenedSize) != B_NO_ERROR)||(PushFrame(*msgRef()) != B_NO_ERROR)) 
+   {
+      Reset();
+      return B_ERROR;
+   }
+   _nextSizeIdx       = 1;  // the root Message's own size isn't part of its flattened data, so we skip over it
+   _numBytesRemaining = _flattenedSize;
+   return B_NO_ERROR;
+}
+
+status_t IncrementalMessageFlattener :: ComputeSizes(const Message & msg, uint32 & retSize)
+{
+   // Record the placeholders for this Message's size and field-count; we'll fill them in at the end
+   const uint32 msgIdx = _sizes.GetNumItems();
+   if ((_sizes.AddTail(0) != B_NO_ERROR)||(_sizes.AddTail(0) != B_NO_ERROR)) return B_ERROR;
+
+   uint32 msgSize = 3*sizeof(uint32);  // protocol version, what-code, number-of-entries
+   uint32 numFields = 0;
+   for (HashtableIterator<String, MessageField> it(msg._entries, HTIT_FLAG_NOREGISTER); it.HasData(); it++)
+   {
+      const MessageField & mf = it.GetValue();
+      if (mf.IsFlattenable())
+      {
+         numFields++;
+
+         const uint32 fieldIdx = _sizes.GetNumItems();
+         if (_sizes.AddTail(0) != B_NO_ERROR) return B_ERROR;
+
+         uint32 dataSize = 0;
+         if (mf.TypeCode() == B_MESSAGE_TYPE)
+         {
+            const uint32 numItems = mf.GetNumItems();
+            for (uint32 i=0; i<numItems; i++)
+            {
+               const Message * subMsg = dynamic_cast<const Message *>(mf.GetItemAtAsRefCountableRef(i)());
+               if (subMsg)
+               {
+                  uint32 subMsgSize;
+                  if (ComputeSizes(*subMsg, subMsgSize) != B_NO_ERROR) return B_ERROR;
+                  dataSize += sizeof(uint32)+subMsgSize;
+               }
+            }
+         }
+         else dataSize = mf.FlattenedSize();
+
+         _sizes[fieldIdx] = dataSize;
+         msgSize += sizeof(uint32) + it.GetKey().FlattenedSize() + sizeof(uint32) + sizeof(uint32) + dataSize;
+      }
+   }
+
+   _sizes[msgIdx]   = msgSize;
+   _sizes[msgIdx+1] = numFields;
+   retSize = msgSize;
+   return B_NO_ERROR;
+}
+
+status_t IncrementalMessageFlattener :: PushFrame(const Message & msg)
+{
+   FlattenFrame * frame = _frames.AddTailAndGet();
+   if (frame == NULL) return B_ERROR;
+
+   frame->_msg = &msg;
+   frame->_iter = HashtableIterator<String, MessageField>(msg._entries);
+   return B_NO_ERROR;
+}
+
+uint32 IncrementalMessageFlattener :: GetNextBytes(uint8 * outBuf, uint32 maxBytes)
+{
+   uint32 numWritten = 0;
+   while(numWritten < maxBytes)
+   {
+      if (_scratchReadOffset < _scratch.GetNumBytes())
+      {
+         const uint32 numToCopy = muscleMin(maxBytes-numWritten, _scratch.GetNumBytes()-_scratchReadOffset);
+         memcpy(outBuf+numWritten, _scratch.GetBuffer()+_scratchReadOffset, numToCopy);
+         _scratchReadOffset += numToCopy;
+         numWritten         += numToCopy;
+      }
+      else if (_numBlobBytes > 0)
+      {
+         const uint32 numToCopy = muscleMin(maxBytes-numWritten, _numBlobBytes);
+         memcpy(outBuf+numWritten, _blobBytes, numToCopy);
+         _blobBytes    += numToCopy;
+         _numBlobBytes -= numToCopy;
+         numWritten    += numToCopy;
+         if (_numBlobBytes == 0) {_blobRef.Reset(); _blobBytes = NULL;}
+      }
+      else if (GenerateMoreBytes() != B_NO_ERROR) break;  // no more bytes to generate
+   }
+
+   _numBytesRemaining -= muscleMin(numWritten, _numBytesRemaining);
+   return numWritten;
+}
+
+status_t IncrementalMessageFlattener :: GenerateMoreBytes()
+{
+   (void) _scratch.SetNumBytes(0, true);
+   _scratchReadOffset = 0;
+
+   // Batch up small items until we have a reasonable amount of data, or until we get a ByteBuffer item to return directly
+   while((_frames.HasItems())&&(_scratch.GetNumBytes() < _incrementalFlattenScratchSize)&&(_numBlobBytes == 0)) if (GenerateNextUnit() != B_NO_ERROR) return B_ERROR;
+   return ((_scratch.GetNumBytes() > 0)||(_numBlobBytes > 0)) ? B_NO_ERROR : B_ERROR;
+}
+
+status_t IncrementalMessageFlattener :: AppendScratchInt32(uint32 val)
+{
+   const uint32 leVal = B_HOST_TO_LENDIAN_INT32(val);
+   return _scratch.AppendBytes((const uint8 *) &leVal, sizeof(leVal));
+}
+
+status_t IncrementalMessageFlattener :: GenerateNextUnit()
+{
+   FlattenFrame & frame = _frames.Tail();
+   switch(frame._state)
+   {
+      case FLATTEN_FRAME_STATE_HEADER:
+         if ((AppendScratchInt32(CURRENT_PROTOCOL_VERSION) != B_NO_ERROR)||(AppendScratchInt32(frame._msg->what) != B_NO_ERROR)||(AppendScratchInt32(GetNextRecordedSize()) != B_NO_ERROR)) return B_ERROR;
+         frame._state = FLATTEN_FRAME_STATE_NEXT_FIELD;
+      break;
+
+      case FLATTEN_FRAME_STATE_NEXT_FIELD:
+      {
+         while((frame._iter.HasData())&&(frame._iter.GetValue().IsFlattenable() == false)) frame._iter++;
+         if (frame._iter.HasData() == false) return _frames.RemoveTail();  // done with this Message
+
+         const String & fieldName = frame._iter.GetKey();
+         const MessageField & mf  = frame._iter.GetValue();
+         if ((AppendScratchInt32(fieldName.FlattenedSize()) != B_NO_ERROR)||(_scratch.AppendBytes((const uint8 *) fieldName(), fieldName.FlattenedSize()) != B_NO_ERROR)||(AppendScratchInt32(mf.TypeCode()) != B_NO_ERROR)||(AppendScratchInt32(GetNextRecordedSize()) != B_NO_ERROR)) return B_ERROR;
+
+         frame._field   = &mf;
+         frame._itemIdx = 0;
+         if (mf.TypeCode() == B_MESSAGE_TYPE) frame._state = FLATTEN_FRAME_STATE_MESSAGE_ITEMS;
+         else if (IsFieldFlattenedPerItem(mf))
+         {
+            if (AppendScratchInt32(mf.GetNumItems()) != B_NO_ERROR) return B_ERROR;
+            frame._state = FLATTEN_FRAME_STATE_FLATCOUNTABLE_ITEMS;
+         }
+         else
+         {
+            // Fixed-size items and Strings:  just flatten the whole field at once
+            const uint32 oldNumBytes = _scratch.GetNumBytes();
+            const uint32 dataSize    = mf.FlattenedSize();
+            if (_scratch.SetNumBytes(oldNumBytes+dataSize, true) != B_NO_ERROR) return B_ERROR;
+            mf.Flatten(_scratch.GetBuffer()+oldNumBytes);
+            frame._iter++;
+         }
+      }
+      break;
+
+      case FLATTEN_FRAME_STATE_MESSAGE_ITEMS:
+         if (frame._itemIdx < frame._field->GetNumItems())
+         {
+            const Message * subMsg = dynamic_cast<const Message *>(frame._field->GetItemAtAsRefCountableRef(frame._itemIdx++)());
+            if (subMsg) return ((AppendScratchInt32(GetNextRecordedSize()) == B_NO_ERROR)&&(PushFrame(*subMsg) == B_NO_ERROR)) ? B_NO_ERROR : B_ERROR;  // note:  (frame) is invalid after PushFrame()
+         }
+         else
+         {
+            frame._iter++;
+            frame._state = FLATTEN_FRAME_STATE_NEXT_FIELD;
+         }
+      break;
+
+      case FLATTEN_FRAME_STATE_FLATCOUNTABLE_ITEMS:
+         if (frame._itemIdx < frame._field->GetNumItems())
+         {
+            RefCountableRef itemRef = frame._field->GetItemAtAsRefCountableRef(frame._itemIdx++);
+            const FlatCountable * fc = dynamic_cast<const FlatCountable *>(itemRef());
+            const uint32 itemSize = fc ? fc->FlattenedSize() : 0;
+            if (AppendScratchInt32(itemSize) != B_NO_ERROR) return B_ERROR;
+
+            const ByteBuffer * bb = dynamic_cast<const ByteBuffer *>(fc);
+            if (bb)
+            {
+               // ByteBuffers flatten to their own bytes, so we can return those directly, without copying them to (_scratch) first
+               _blobRef      = itemRef;
+               _blobBytes    = bb->GetBuffer();
+               _numBlobBytes = itemSize;
+            }
+            else if (fc)
+            {
+               const uint32 oldNumBytes = _scratch.GetNumBytes();
+               if (_scratch.SetNumBytes(oldNumBytes+itemSize, true) != B_NO_ERROR) return B_ERROR;
+               fc->Flatten(_scratch.GetBuffer()+oldNumBytes);
+            }
+         }
+         else
+         {
+            frame._iter++;
+            frame._state = FLATTEN_FRAME_STATE_NEXT_FIELD;
+         }
+      break;
+   }
+   return B_NO_ERROR;
+}
+
+// Dictionary-encoded field names are written as a varint whose low bit(s) say what follows:
+//    (id<<1)        -- the name is the (id)'th entry in the dictionary
+//    (length<<2)|1  -- (length) bytes of name follow, and the name should be added to the dictionary
+//    (length<<2)|3  -- (length) bytes of name follow, and the name should NOT be added to the dictionary
+enum {
+   DICTIONARY_NAME_LITERAL_BIT = (1<<0),
+   DICTIONARY_NAME_NO_ADD_BIT  = (1<<1)
+};
+
+// Dictionary-encoded field data is preceded by a varint of (length<<1), or of (length<<1)|1 if the data is in columnar format (see below)
+enum {
+   DICTIONARY_DATA_COLUMNAR_BIT = (1<<0)
+};
+
+// Writes (val) as a little-endian base-128 varint, which takes between 1 and 5 bytes
+static inline void WriteVarUInt32(uint8 * buffer, uint32 * writeOffset, uint32 val)
+{
+   while(val >= 0x80) {buffer[(*writeOffset)++] = (uint8)(val|0x80); val >>= 7;}
+   buffer[(*writeOffset)++] = (uint8) val;
+}
+
+static inline uint32 GetVarUInt32Size(uint32 val)
+{
+   uint32 ret = 1;
+   while(val >= 0x80) {val >>= 7; ret++;}
+   return ret;
+}
+
+static status_t ReadVarUInt32(const uint8 * buffer, uint32 numBytes, uint32 * readOffset, uint32 * retVal)
+{
+   uint32 val = 0;
+   for (uint32 shift=0; shift<35; shift+=7)
+   {
+      if (*readOffset >= numBytes) return B_ERROR;
+      const uint8 b = buffer[(*readOffset)++];
+      val |= ((uint32)(b & 0x7F)) << shift;
+      if ((b & 0x80) == 0) {*retVal = val; return B_NO_ERROR;}
+   }
+   return B_ERROR;  // too many continuation bytes; corrupt data?
+}
+
+// Fills in the varint length-prefix for the bytes between (prefixOffset) and (writeOffset).  Only one
+// byte was reserved for the prefix, so if more are needed, the data bytes get shifted over to make room.
+// If (numFlagBits) is non-zero, the length is shifted left by that many bits and (flags) is OR'd in below it.
+static status_t WriteVarUInt32LengthPrefix(ByteBuffer & outBuf, uint32 prefixOffset, uint32 & writeOffset, uint32 numFlagBits = 0, uint32 flags = 0)
+{
+   const uint32 dataOffset = prefixOffset+1;
+   const uint32 dataLength = writeOffset-dataOffset;
+   if ((numFlagBits > 0)&&((dataLength>>(32-numFlagBits)) != 0)) return B_ERROR;  // too long to encode
+
+   const uint32 prefix     = (dataLength<<numFlagBits)|flags;
+   const uint32 extraBytes = GetVarUInt32Size(prefix)-1;
+   if (extraBytes > 0)
+   {
+      if (EnsureFlattenSpace(outBuf, writeOffset+extraBytes, MUSCLE_NO_LIMIT) != B_NO_ERROR) return B_ERROR;
+      memmove(outBuf.GetBuffer()+dataOffset+extraBytes, outBuf.GetBuffer()+dataOffset, dataLength);
+      writeOffset += extraBytes;
+   }
+   WriteVarUInt32(outBuf.GetBuffer(), &prefixOffset, prefix);
+   return B_NO_ERROR;
+}
+
+// Numeric arrays in dictionary-encoded Messages may be sent in a columnar format that suits slowly-changing
+// sample data much better than raw bytes do.  Integers are delta-encoded, zigzag-encoded, and then bit-packed
+// in blocks of COLUMNAR_BLOCK_SIZE values, each block using just as many bits per value as its largest value
+// needs.  Floating point values are XOR'd with their predecessor and the non-zero bits of the result are
+// written out as in Facebook's Gorilla time-series database.
+enum {
+   COLUMNAR_BLOCK_SIZE = 128,
+   COLUMNAR_MIN_ITEMS  = 8     // below this many items, the columnar format rarely saves enough to bother
+};
+
+static inline bool IsColumnarTypeCode(uint32 tc) {return ((tc == B_INT32_TYPE)||(tc == B_INT64_TYPE)||(tc == B_FLOAT_TYPE)||(tc == B_DOUBLE_TYPE));}
+static inline uint32 GetColumnarItemSize(uint32 tc) {return ((tc == B_INT64_TYPE)||(tc == B_DOUBLE_TYPE)) ? sizeof(uint64) : sizeof(uint32);}
+
+static inline void LoadLittleEndian(const uint8 * p, uint32 & v) {v = B_LENDIAN_TO_HOST_INT32(muscleCopyIn<uint32>(p));}
+static inline void LoadLittleEndian(const uint8 * p, uint64 & v) {v = B_LENDIAN_TO_HOST_INT64(muscleCopyIn<uint64>(p));}
+static inline void StoreLittleEndian(uint8 * p, uint32 v) {muscleCopyOut(p, B_HOST_TO_LENDIAN_INT32(v));}
+static inline void StoreLittleEndian(uint8 * p, uint64 v) {muscleCopyOut(p, B_HOST_TO_LENDIAN_INT64(v));}
+
+static inline uint32 GetLowBitsMask(uint32 numBits) {return (numBits >= 32) ? ((uint32)-1) : ((((uint32)1)<<numBits)-1);}
+
+static inline uint32 GetNumSignificantBits(uint64 v)
+{
+   if (v == 0) return 0;
+#if defined(__GNUC__)
+   return 64-__builtin_clzll(v);
+#else
+   uint32 ret = 0;
+   while(v) {ret++; v >>= 1;}
+   return ret;
+#endif
+}
+
+static inline uint32 GetNumTrailingZeroBits(uint64 v)  // (v) must be non-zero
+{
+#if defined(__GNUC__)
+   return __builtin_ctzll(v);
+#else
+   uint32 ret = 0;
+   while((v & 0x01) == 0) {ret++; v >>= 1;}
+   return ret;
+#endif
+}
+
+// Writes bit-fields into a byte array, least-significant bit first
+class ColumnarBitWriter
+{
+public:
+   ColumnarBitWriter(uint8 * out) : _out(out), _numBytes(0), _acc(0), _numAccBits(0) {/* empty */}
+
+   void WriteBits(uint64 val, uint32 numBits)
+   {
+      if (numBits > 32) {WriteBitsAux((uint32)val, 32); WriteBitsAux((uint32)(val>>32), numBits-32);}
+                   else WriteBitsAux((uint32)val, numBits);
+   }
+
+   // Flushes any partial byte, and returns the number of bytes written
+   uint32 Finish()
+   {
+      if (_numAccBits > 0) {_out[_numBytes++] = (uint8)_acc; _acc = 0; _numAccBits = 0;}
+      return _numBytes;
+   }
+
+private:
+   void WriteBitsAux(uint32 val, uint32 numBits)
+   {
+      _acc |= ((uint64)(val & GetLowBitsMask(numBits))) << _numAccBits;
+      _numAccBits += numBits;
+      while(_numAccBits >= 8) {_out[_numBytes++] = (uint8)_acc; _acc >>= 8; _numAccBits -= 8;}
+   }
+
+   uint8 * _out;
+   uint32 _numBytes;
+   uint64 _acc;
+   uint32 _numAccBits;
+};
+
+// Reads bit-fields that were written by a ColumnarBitWriter, with bounds-checking
+class ColumnarBitReader
+{
+public:
+   ColumnarBitReader(const uint8 * in, uint32 numBytes) : _in(in), _numBytes(numBytes), _numBytesRead(0), _acc(0), _numAccBits(0) {/* empty */}
+
+   status_t ReadBits(uint32 numBits, uint64 & retVal)
+   {
+      uint32 lo, hi = 0;
+      if (numBits > 32) 
+      {
+         if ((ReadBitsAux(32, lo) != B_NO_ERROR)||(ReadBitsAux(numBits-32, hi) != B_NO_ERROR)) return B_ERROR;
+      }
+      else if (ReadBitsAux(numBits, lo) != B_NO_ERROR) return B_ERROR;
+
+      retVal = (((uint64)hi)<<32)|lo;
+      return B_NO_ERROR;
+   }
+
+   // Returns the number of bytes consumed so far, counting any partially-consumed byte as consumed
+   uint32 GetNumBytesRead() const {return _numBytesRead;}
+
+private:
+   status_t ReadBitsAux(uint32 numBits, uint32 & retVal)
+   {
+      while(_numAccBits < numBits)
+      {
+         if (_numBytesRead >= _numBytes) return B_ERROR;  // ran off the end of the data
+         _acc |= ((uint64)_in[_numBytesRead++]) << _numAccBits;
+         _numAccBits += 8;
+      }
+      retVal = ((uint32)_acc) & GetLowBitsMask(numBits);
+      _acc >>= numBits;
+      _numAccBits -= numBits;
+      return B_NO_ERROR;
+   }
+
+   const uint8 * _in;
+   uint32 _numBytes;
+   uint32 _numBytesRead;
+   uint64 _acc;
+   uint32 _numAccBits;
+};
+
+// Computes the zigzag-encoded deltas of (n) little-endian values into (zz), and returns the bitwise-OR of them all
+static uint32 DeltaZigZagEncode(const uint8 * rawLE, uint32 n, uint32 & prev, uint32 * zz)
+{
+   uint32 orBits = 0;
+   uint32 i      = 0;
+#ifdef MUSCLE_COLUMNAR_USE_SSE2
+   __m128i orAcc = _mm_setzero_si128();
+   for (; i+4<=n; i+=4)
+   {
+      const __m128i cur = _mm_loadu_si128((const __m128i *)(rawLE+(i*sizeof(uint32))));
+      const __m128i prv = _mm_or_si128(_mm_slli_si128(cur, 4), _mm_cvtsi32_si128((int)prev));  // (prev, cur0, cur1, cur2)
+      const __m128i d   = _mm_sub_epi32(cur, prv);
+      const __m128i z   = _mm_xor_si128(_mm_slli_epi32(d, 1), _mm_srai_epi32(d, 31));
+      _mm_storeu_si128((__m128i *)(zz+i), z);
+      orAcc = _mm_or_si128(orAcc, z);
+      prev  = (uint32) _mm_cvtsi128_si32(_mm_srli_si128(cur, 12));
+   }
+   orAcc  = _mm_or_si128(orAcc, _mm_srli_si128(orAcc, 8));
+   orAcc  = _mm_or_si128(orAcc, _mm_srli_si128(orAcc, 4));
+   orBits = (uint32) _mm_cvtsi128_si32(orAcc);
+#endif
+   for (; i<n; i++)
+   {
+      uint32 v; LoadLittleEndian(rawLE+(i*sizeof(uint32)), v);
+      const uint32 d = v-prev;
+      zz[i]   = (d<<1)^(0-(d>>31));
+      orBits |= zz[i];
+      prev    = v;
+   }
+   return orBits;
+}
+
+static uint64 DeltaZigZagEncode(const uint8 * rawLE, uint32 n, uint64 & prev, uint64 * zz)
+{
+   uint64 orBits = 0;
+   uint32 i      = 0;
+#ifdef MUSCLE_COLUMNAR_USE_SSE2
+   __m128i orAcc = _mm_setzero_si128();
+   for (; i+2<=n; i+=2)
+   {
+      const __m128i cur  = _mm_loadu_si128((const __m128i *)(rawLE+(i*sizeof(uint64))));
+      const __m128i prv  = _mm_or_si128(_mm_slli_si128(cur, 8), _mm_loadl_epi64((const __m128i *)&prev));  // (prev, cur0)
+      const __m128i d    = _mm_sub_epi64(cur, prv);
+      const __m128i sign = _mm_shuffle_epi32(_mm_srai_epi32(d, 31), _MM_SHUFFLE(3,3,1,1));  // SSE2 has no 64-bit arithmetic shift
+      const __m128i z    = _mm_xor_si128(_mm_slli_epi64(d, 1), sign);
+      _mm_storeu_si128((__m128i *)(zz+i), z);
+      orAcc = _mm_or_si128(orAcc, z);
+      _mm_storel_epi64((__m128i *)&prev, _mm_srli_si128(cur, 8));
+   }
+   uint64 orLanes[2];
+   _mm_storeu_si128((__m128i *)orLanes, orAcc);
+   orBits = orLanes[0] | orLanes[1];
+#endif
+   for (; i<n; i++)
+   {
+      uint64 v; LoadLittleEndian(rawLE+(i*sizeof(uint64)), v);
+      const uint64 d = v-prev;
+      zz[i]   = (d<<1)^(0-(d>>63));
+      orBits |= zz[i];
+      prev    = v;
+   }
+   return orBits;
+}
+
+// Inverse of DeltaZigZagEncode():  writes (n) little-endian values into (rawLE)
+static void DeltaZigZagDecode(const uint32 * zz, uint32 n, uint32 & prev, uint8 * rawLE)
+{
+   uint32 i = 0;
+#ifdef MUSCLE_COLUMNAR_USE_SSE2
+   const __m128i one = _mm_set1_epi32(1);
+   for (; i+4<=n; i+=4)
+   {
+      const __m128i z = _mm_loadu_si128((const __m128i *)(zz+i));
+      __m128i d = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(z, one)));
+      d = _mm_add_epi32(d, _mm_slli_si128(d, 4));  // prefix sum...
+      d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+      d = _mm_add_epi32(d, _mm_set1_epi32((int)prev));  // ... plus the running total
+      _mm_storeu_si128((__m128i *)(rawLE+(i*sizeof(uint32))), d);
+      prev = (uint32) _mm_cvtsi128_si32(_mm_srli_si128(d, 12));
+   }
+#endif
+   for (; i<n; i++)
+   {
+      prev += (zz[i]>>1)^(0-(zz[i]&0x01));
+      StoreLittleEndian(rawLE+(i*sizeof(uint32)), prev);
+   }
+}
+
+static void DeltaZigZagDecode(const uint64 * zz, uint32 n, uint64 & prev, uint8 * rawLE)
+{
+   uint32 i = 0;
+#ifdef MUSCLE_COLUMNAR_USE_SSE2
+   const __m128i one = _mm_set_epi32(0, 1, 0, 1);
+   for (; i+2<=n; i+=2)
+   {
+      const __m128i z = _mm_loadu_si128((const __m128i *)(zz+i));
+      __m128i d = _mm_xor_si128(_mm_srli_epi64(z, 1), _mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(z, one)));
+      d = _mm_add_epi64(d, _mm_slli_si128(d, 8));  // prefix sum...
+      const __m128i p = _mm_loadl_epi64((const __m128i *)&prev);
+      d = _mm_add_epi64(d, _mm_unpacklo_epi64(p, p));  // ... plus the running total
+      _mm_storeu_si128((__m128i *)(rawLE+(i*sizeof(uint64))), d);
+      _mm_storel_epi64((__m128i *)&prev, _mm_srli_si128(d, 8));
+   }
+#endif
+   for (; i<n; i++)
+   {
+      prev += (zz[i]>>1)^(0-(zz[i]&0x01));
+      StoreLittleEndian(rawLE+(i*sizeof(uint64)), prev);
+   }
+}
+
+template<typename UT> static uint32 ColumnarEncodeIntegers(const uint8 * rawLE, uint32 numItems, uint8 * out)
+{
+   UT zz[COLUMNAR_BLOCK_SIZE];
+   UT prev = 0;
+   uint32 numBytes = 0;
+   for (uint32 blockStart=0; blockStart<numItems; blockStart+=COLUMNAR_BLOCK_SIZE)
+   {
+      const uint32 n = muscleMin(numItems-blockStart, (uint32)COLUMNAR_BLOCK_SIZE);
+      const uint32 bitWidth = GetNumSignificantBits(DeltaZigZagEncode(rawLE+(blockStart*sizeof(UT)), n, prev, zz));
+      out[numBytes++] = (uint8) bitWidth;
+
+      ColumnarBitWriter bw(out+numBytes);
+      if (bitWidth > 0) for (uint32 i=0; i<n; i++) bw.WriteBits(zz[i], bitWidth);
+      numBytes += bw.Finish();
+   }
+   return numBytes;
+}
+
+template<typename UT> static status_t ColumnarDecodeIntegers(const uint8 * in, uint32 numBytes, uint32 numItems, uint8 * rawLE)
+{
+   UT zz[COLUMNAR_BLOCK_SIZE];
+   UT prev = 0;
+   uint32 readOffset = 0;
+   for (uint32 blockStart=0; blockStart<numItems; blockStart+=COLUMNAR_BLOCK_SIZE)
+   {
+      if (readOffset >= numBytes) return B_ERROR;
+      const uint32 bitWidth = in[readOffset++];
+      if (bitWidth > sizeof(UT)*8) return B_ERROR;
+
+      const uint32 n = muscleMin(numItems-blockStart, (uint32)COLUMNAR_BLOCK_SIZE);
+      ColumnarBitReader br(in+readOffset, numBytes-readOffset);
+      for (uint32 i=0; i<n; i++)
+      {
+         uint64 v = 0;
+         if ((bitWidth > 0)&&(br.ReadBits(bitWidth, v) != B_NO_ERROR)) return B_ERROR;
+         zz[i] = (UT) v;
+      }
+      readOffset += br.GetNumBytesRead();
+      DeltaZigZagDecode(zz, n, prev, rawLE+(blockStart*sizeof(UT)));
+   }
+   return (readOffset == numBytes) ? B_NO_ERROR : B_ERROR;
+}
+
+// Each value is XOR'd with its predecessor.  A zero result is written as a single 0 bit.  Otherwise we write a 1 bit, then
+// either a 0 bit and the result's non-zero bits within the previous value's window, or (if they don't fit inside that
+// window) a 1 bit, the number of leading zero bits, the number of bits in the new window minus one, and the window's bits.
+template<typename UT> static uint32 ColumnarEncodeFloats(const uint8 * rawLE, uint32 numItems, uint8 * out)
+{
+   const uint32 bitWidth   = sizeof(UT)*8;
+   const uint32 countBits  = (bitWidth == 64) ? 6 : 5;
+   uint32 windowLeading    = bitWidth;  // i.e. no window yet
+   uint32 windowTrailing   = 0;
+
+   ColumnarBitWriter bw(out);
+   UT prev = 0;
+   for (uint32 i=0; i<numItems; i++)
+   {
+      UT v; LoadLittleEndian(rawLE+(i*sizeof(UT)), v);
+      const UT x = v^prev;
+      prev = v;
+
+      if (x == 0) bw.WriteBits(0, 1);
+      else
+      {
+         const uint32 leading  = bitWidth-GetNumSignificantBits(x);
+         const uint32 trailing = GetNumTrailingZeroBits(x);
+         if ((windowLeading < bitWidth)&&(leading >= windowLeading)&&(trailing >= windowTrailing))
+         {
+            bw.WriteBits(0x01, 2);  // 1 bit, then 0 bit
+            bw.WriteBits(x>>windowTrailing, bitWidth-windowLeading-windowTrailing);
+         }
+         else
+         {
+            const uint32 numWindowBits = bitWidth-leading-trailing;
+            bw.WriteBits(0x03, 2);  // 1 bit, then 1 bit
+            bw.WriteBits(leading,         countBits);
+            bw.WriteBits(numWindowBits-1, countBits);
+            bw.WriteBits(x>>trailing,     numWindowBits);
+            windowLeading  = leading;
+            windowTrailing = trailing;
+         }
+      }
+   }
+   return bw.Finish();
+}
+
+template<typename UT> static status_t ColumnarDecodeFloats(const uint8 * in, uint32 numBytes, uint32 numItems, uint8 * rawLE)
+{
+   const uint32 bitWidth   = sizeof(UT)*8;
+   const uint32 countBits  = (bitWidth == 64) ? 6 : 5;
+   uint32 windowLeading    = bitWidth;  // i.e. no window yet
+   uint32 windowTrailing   = 0;
+
+   ColumnarBitReader br(in, numBytes);
+   UT prev = 0;
+   for (uint32 i=0; i<numItems; i++)
+   {
+      uint64 bit;
+      if (br.ReadBits(1, bit) != B_NO_ERROR) return B_ERROR;
+      if (bit)
+      {
+         if (br.ReadBits(1, bit) != B_NO_ERROR) return B_ERROR;
+         if (bit)
+         {
+            uint64 leading, numWindowBitsMinusOne;
+            if ((br.ReadBits(countBits, leading) != B_NO_ERROR)||(br.ReadBits(countBits, numWindowBitsMinusOne) != B_NO_ERROR)||(leading+numWindowBitsMinusOne+1 > bitWidth)) return B_ERROR;
+            windowLeading  = (uint32) leading;
+            windowTrailing = (uint32) (bitWidth-leading-(numWindowBitsMinusOne+1));
+         }
+         else if (windowLeading >= bitWidth) return B_ERROR;  // can't re-use a window that was never specified!
+
+         uint64 windowBits;
+         if (br.ReadBits(bitWidth-windowLeading-windowTrailing, windowBits) != B_NO_ERROR) return B_ERROR;
+         prev ^= (UT) (windowBits<<windowTrailing);
+      }
+      StoreLittleEndian(rawLE+(i*sizeof(UT)), prev);
+   }
+   return (br.GetNumBytesRead() == numBytes) ? B_NO_ERROR : B_ERROR;
+}
+
+// Returns an upper bound on the number of bytes ColumnarEncodeNumericArray() might write
+static uint32 GetMaxColumnarEncodedSize(uint32 tc, uint32 numItems)
+{
+   const uint32 bitWidth = GetColumnarItemSize(tc)*8;
+   return 5 + 1 + (uint32) (((((uint64)numItems)*(bitWidth+14))+7)/8) + (numItems/COLUMNAR_BLOCK_SIZE);
+}
+
+// Writes the columnar encoding of (numItems) little-endian values of type (tc) to (out), and returns the number of bytes written
+static uint32 ColumnarEncodeNumericArray(uint32 tc, const uint8 * rawLE, uint32 numItems, uint8 * out)
+{
+   uint32 numBytes = 0;
+   WriteVarUInt32(out, &numBytes, numItems);
+   switch(tc)
+   {
+      case B_INT32_TYPE:  numBytes += ColumnarEncodeIntegers<uint32>(rawLE, numItems, out+numBytes); break;
+      case B_INT64_TYPE:  numBytes += ColumnarEncodeIntegers<uint64>(rawLE, numItems, out+numBytes); break;
+      case B_FLOAT_TYPE:  numBytes += ColumnarEncodeFloats<uint32>(  rawLE, numItems, out+numBytes); break;
+      case B_DOUBLE_TYPE: numBytes += ColumnarEncodeFloats<uint64>(  rawLE, numItems, out+numBytes); break;
+   }
+   return numBytes;
+}
+
+// Decodes the output of ColumnarEncodeNumericArray() back into the standard flattened (i.e. little-endian array) format
+static status_t ColumnarDecodeNumericArray(uint32 tc, const uint8 * in, uint32 numBytes, ByteBuffer & retRawLE)
+{
+   uint32 readOffset = 0, numItems;
+   if (ReadVarUInt32(in, numBytes, &readOffset, &numItems) != B_NO_ERROR) return B_ERROR;
+
+   // Each block of integers takes at least one byte, and each floating point value takes at least one bit, so anything more is bogus
+   const uint64 maxNumItems = ((uint64)(numBytes-readOffset))*(((tc == B_INT32_TYPE)||(tc == B_INT64_TYPE)) ? COLUMNAR_BLOCK_SIZE : 8);
+   const uint64 rawSize     = ((uint64)numItems)*GetColumnarItemSize(tc);
+   if ((numItems > maxNumItems)||(rawSize > MUSCLE_NO_LIMIT)||(retRawLE.SetNumBytes((uint32)rawSize, false) != B_NO_ERROR)) return B_ERROR;
+
+   in += readOffset; numBytes -= readOffset;
+   switch(tc)
+   {
+      case B_INT32_TYPE:  return ColumnarDecodeIntegers<uint32>(in, numBytes, numItems, retRawLE.GetBuffer());
+      case B_INT64_TYPE:  return ColumnarDecodeIntegers<uint64>(in, numBytes, numItems, retRawLE.GetBuffer());
+      case B_FLOAT_TYPE:  return ColumnarDecodeFloats<uint32>(  in, numBytes, numItems, retRawLE.GetBuffer());
+      case B_DOUBLE_TYPE: return ColumnarDecodeFloats<uint64>(  in, numBytes, numItems, retRawLE.GetBuffer());
+      default:            return B_ERROR;
+   }
+}
+
+status_t Message :: AppendDictionaryEncodedToByteBuffer(ByteBuffer & outBuf, MessageFieldNameDictionary & dict) const
+{
+   TCHECKPOINT;
+
+   const uint32 origNumBytes = outBuf.GetNumBytes();
+   uint32 writeOffset = origNumBytes;
+   if (AppendDictionaryEncodedToByteBufferAux(outBuf, writeOffset, dict) == B_NO_ERROR) return outBuf.SetNumBytes(writeOffset, true);  // truncating never reallocates
+
+   (void) outBuf.SetNumBytes(origNumBytes, true);
+   return B_ERROR;
+}
+
+status_t Message :: AppendDictionaryEncodedToByteBufferAux(ByteBuffer & outBuf, uint32 & writeOffset, MessageFieldNameDictionary & dict) const
+{
+   uint32 numFlattenedEntries = 0;
+   for (HashtableIterator<String, MessageField> it(_entries, HTIT_FLAG_NOREGISTER); it.HasData(); it++) if (it.GetValue().IsFlattenable()) numFlattenedEntries++;
+
+   if (EnsureFlattenSpace(outBuf, writeOffset+sizeof(uint32)+5, MUSCLE_NO_LIMIT) != B_NO_ERROR) return B_ERROR;
+
+   const uint32 networkByteOrder = B_HOST_TO_LENDIAN_INT32(what);
+   WriteData(outBuf.GetBuffer(), &writeOffset, &networkByteOrder, sizeof(networkByteOrder));
+   WriteVarUInt32(outBuf.GetBuffer(), &writeOffset, numFlattenedEntries);
+
+   for (HashtableIterator<String, MessageField> it(_entries, HTIT_FLAG_NOREGISTER); it.HasData(); it++)
+   {
+      const MessageField & mf = it.GetValue();
+      if (mf.IsFlattenable())
+      {
+         const String & fieldName = it.GetKey();
+         const uint32 * nameID    = dict._nameToID.Get(fieldName);
+         const uint32 nameLength  = nameID ? 0 : fieldName.Length();
+         if (EnsureFlattenSpace(outBuf, writeOffset+5+nameLength+sizeof(uint32)+1, MUSCLE_NO_LIMIT) != B_NO_ERROR) return B_ERROR;
+
+         if (nameID) WriteVarUInt32(outBuf.GetBuffer(), &writeOffset, (*nameID)<<1);
+         else
+         {
+            bool addToDictionary = ((nameLength <= MessageFieldNameDictionary::MAX_NAME_LENGTH)&&(dict._nameToID.GetNumItems() < MessageFieldNameDictionary::MAX_NAMES));
+            if ((addToDictionary)&&(dict._nameToID.Put(fieldName, dict._nameToID.GetNumItems()) != B_NO_ERROR)) return B_ERROR;
+
+            WriteVarUInt32(outBuf.GetBuffer(), &writeOffset, (nameLength<<2)|DICTIONARY_NAME_LITERAL_BIT|(addToDictionary?0:DICTIONARY_NAME_NO_ADD_BIT));
+            memcpy(outBuf.GetBuffer()+writeOffset, fieldName(), nameLength);
+            writeOffset += nameLength;
+         }
+
+         const uint32 tc = B_HOST_TO_LENDIAN_INT32(mf.TypeCode());
+         WriteData(outBuf.GetBuffer(), &writeOffset, &tc, sizeof(tc));
+
+         const uint32 dataSizeOffset = writeOffset++;  // one byte reserved for now; WriteVarUInt32LengthPrefix() will add more if necessary
+         uint32 dataFlags = 0;
+         if (mf.TypeCode() == B_MESSAGE_TYPE)
+         {
+            // Sub-Messages get dictionary-encoded too, each with its own varint size-prefix
+            const uint32 numItems = mf.GetNumItems();
+            for (uint32 i=0; i<numItems; i++)
+            {
+               const Message * msg = dynamic_cast<const Message *>(mf.GetItemAtAsRefCountableRef(i)());
+               if (msg)
+               {
+                  if (EnsureFlattenSpace(outBuf, writeOffset+1, MUSCLE_NO_LIMIT) != B_NO_ERROR) return B_ERROR;
+                  const uint32 msgSizeOffset = writeOffset++;
+                  if ((msg->AppendDictionaryEncodedToByteBufferAux(outBuf, writeOffset, dict) != B_NO_ERROR)||(WriteVarUInt32LengthPrefix(outBuf, msgSizeOffset, writeOffset) != B_NO_ERROR)) return B_ERROR;
+               }
+            }
+         }
+         else
+         {
+            const uint32 rawOffset = writeOffset;
+            if (mf.AppendFlattenedToByteBuffer(outBuf, writeOffset, MUSCLE_NO_LIMIT) != B_NO_ERROR) return B_ERROR;
+
+            const uint32 tc = mf.TypeCode();
+            if ((IsColumnarTypeCode(tc))&&(mf.GetNumItems() >= COLUMNAR_MIN_ITEMS))
+            {
+               // Encode into the space after the raw data, and keep the result only if it came out smaller
+               const uint32 rawSize  = writeOffset-rawOffset;
+               const uint32 numItems = rawSize/GetColumnarItemSize(tc);
+               if (EnsureFlattenSpace(outBuf, writeOffset+GetMaxColumnarEncodedSize(tc, numItems), MUSCLE_NO_LIMIT) != B_NO_ERROR) return B_ERROR;
+
+               uint8 * b = outBuf.GetBuffer();
+               const uint32 encodedSize = ColumnarEncodeNumericArray(tc, b+rawOffset, numItems, b+writeOffset);
+               if (encodedSize < rawSize)
+               {
+                  memmove(b+rawOffset, b+writeOffset, encodedSize);
+                  writeOffset = rawOffset+encodedSize;
+                  dataFlags   = DICTIONARY_DATA_COLUMNAR_BIT;
+               }
+            }
+         }
+
+         if (WriteVarUInt32LengthPrefix(outBuf, dataSizeOffset, writeOffset, 1, dataFlags) != B_NO_ERROR) return B_ERROR;
+      }
+   }
+   return B_NO_ERROR;
+}
+
+status_t Message :: UnflattenDictionaryEncoded(const uint8 * buffer, uint32 inputBufferBytes, MessageFieldNameDictionary & dict)
+{
+   TCHECKPOINT;
+
+   Clear(true);
+
+   uint32 readOffset = 0;
+   uint32 networkByteOrder;
+   if (ReadData(buffer, inputBufferBytes, &readOffset, &networkByteOrder, sizeof(networkByteOrder)) != B_NO_ERROR) 
+   {
+      LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Couldn't read dictionary-encoded what-code! (inputBufferBytes=" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes);
+      return B_ERROR;
+   }
+   what = B_LENDIAN_TO_HOST_INT32(networkByteOrder);
+
+   uint32 numEntries;
+   if ((ReadVarUInt32(buffer, inputBufferBytes, &readOffset, &numEntries) != B_NO_ERROR)||(numEntries > inputBufferBytes-readOffset))  // every entry takes at least one byte
+   {
+      LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Bad dictionary-encoded number-of-entries! (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes, what);
+      return B_ERROR;
+   }
+   if (_entries.EnsureSize(numEntries, true) != B_NO_ERROR) return B_ERROR;
+
+   for (uint32 i=0; i<numEntries; i++)
+   {
+      uint32 nameCode;
+      if (ReadVarUInt32(buffer, inputBufferBytes, &readOffset, &nameCode) != B_NO_ERROR) 
+      {
+         LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Error reading dictionary-encoded entry name! (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes, what, i, numEntries);
+         return B_ERROR;
+      }
+
+      String entryName;
+      if (nameCode & DICTIONARY_NAME_LITERAL_BIT)
+      {
+         const uint32 nameLength = nameCode>>2;
+         const bool addToDictionary = ((nameCode & DICTIONARY_NAME_NO_ADD_BIT) == 0);
+         if ((nameLength > inputBufferBytes-readOffset)||((addToDictionary)&&((nameLength > MessageFieldNameDictionary::MAX_NAME_LENGTH)||(dict._idToName.GetNumItems() >= MessageFieldNameDictionary::MAX_NAMES))))
+         {
+            LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Bad dictionary-encoded entry name! (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " nameLength=" UINT32_FORMAT_SPEC " dictSize=" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes, what, i, numEntries, nameLength, dict._idToName.GetNumItems());
+            return B_ERROR;
+         }
+         if ((entryName.SetInterned((const char *) &buffer[readOffset], nameLength) != B_NO_ERROR)||((addToDictionary)&&(dict._idToName.AddTail(entryName) != B_NO_ERROR))) return B_ERROR;
+         readOffset += nameLength;
+      }
+      else
+      {
+         const uint32 nameID = nameCode>>1;
+         if (nameID >= dict._idToName.GetNumItems())
+         {
+            LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Unknown field-name ID " UINT32_FORMAT_SPEC "! (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " dictSize=" UINT32_FORMAT_SPEC ")\n", this, nameID, inputBufferBytes, what, i, numEntries, dict._idToName.GetNumItems());
+            return B_ERROR;
+         }
+         entryName = dict._idToName[nameID];
+      }
+
+      uint32 tc;
+      if (ReadData(buffer, inputBufferBytes, &readOffset, &tc, sizeof(tc)) != B_NO_ERROR) return B_ERROR;
+      tc = B_LENDIAN_TO_HOST_INT32(tc);
+
+      uint32 eLengthCode;
+      if (ReadVarUInt32(buffer, inputBufferBytes, &readOffset, &eLengthCode) != B_NO_ERROR) return B_ERROR;
+
+      const uint32 eLength   = eLengthCode>>1;
+      const bool isColumnar  = ((eLengthCode & DICTIONARY_DATA_COLUMNAR_BIT) != 0);
+      if ((eLength > inputBufferBytes-readOffset)||((isColumnar)&&(IsColumnarTypeCode(tc) == false)))
+      {
+         LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Bad dictionary-encoded data length! (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " tc=" UINT32_FORMAT_SPEC " entryName=[%s])\n", this, inputBufferBytes, what, i, numEntries, tc, entryName());
+         return B_ERROR;
+      }
+
+      MessageField * nextEntry = GetOrCreateMessageField(entryName, tc);
+      if (nextEntry == NULL) return B_ERROR;
+
+      if (tc == B_MESSAGE_TYPE)
+      {
+         const uint32 endOffset = readOffset+eLength;
+         while(readOffset < endOffset)
+         {
+            uint32 msgSize;
+            if ((ReadVarUInt32(buffer, endOffset, &readOffset, &msgSize) != B_NO_ERROR)||(msgSize > endOffset-readOffset)) return B_ERROR;
+
+            MessageRef subMsg = GetMessageFromPool();
+            if ((subMsg() == NULL)||(subMsg()->UnflattenDictionaryEncoded(&buffer[readOffset], msgSize, dict) != B_NO_ERROR)||(nextEntry->AddDataItem(&subMsg, sizeof(subMsg)) != B_NO_ERROR)) return B_ERROR;
+            readOffset += msgSize;
+         }
+         if (nextEntry->IsEmpty()) return B_ERROR;  // a Message field with no Messages in it?  That's not valid
+      }
+      else
+      {
+         ByteBuffer rawBuf;  // only used for columnar data, which must be expanded back to the standard format first
+         if ((isColumnar)&&(ColumnarDecodeNumericArray(tc, &buffer[readOffset], eLength, rawBuf) != B_NO_ERROR))
+         {
+            LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Unable to decode columnar data field!  (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " tc=" UINT32_FORMAT_SPEC " entryName=[%s] eLength=" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes, what, i, numEntries, tc, entryName(), eLength);
+            Clear();
+            return B_ERROR;
+         }
+
+         if ((isColumnar ? nextEntry->Unflatten(rawBuf.GetBuffer(), rawBuf.GetNumBytes()) : nextEntry->Unflatten(&buffer[readOffset], eLength)) != B_NO_ERROR) 
+         {
+            LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Unable to unflatten dictionary-encoded data field!  (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " tc=" UINT32_FORMAT_SPEC " entryName=[%s] eLength=" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes, what, i, numEntries, tc, entryName(), eLength);
+            Clear();
+            return B_ERROR;
+         }
+         readOffset += eLength;
+      }
+   }
+   return B_NO_ERROR;
+}
+
 status_t Message :: Unflatten(const uint8 * buffer, uint32 inputBufferBytes) 
+{
+   return UnflattenAux(buffer, inputBufferBytes, NULL);
+}
+
+status_t Message :: UnflattenFromMappedFile(const uint8 * buffer, uint32 inputBufferBytes, int fd, uint64 bufFileOffset, uint32 minMappedItemSize)
+{
+   const MappedFileUnflattenInfo mapInfo(fd, buffer, bufFileOffset, minMappedItemSize);
+   return UnflattenAux(buffer, inputBufferBytes, &mapInfo);
+}
+
+status_t Message :: UnflattenAux(const uint8 * buffer, uint32 inputBufferBytes, const MappedFileUnflattenInfo * optMapInfo)
 {
    TCHECKPOINT;
 
@@ -1405,7 +2394,7 @@ status_t Message :: Unflatten(const uint8 * buffer, uint32 inputBufferBytes)
 
       // Read entry name
       String entryName;
-      if (entryName.Unflatten(&buffer[readOffset], nameLength) != B_NO_ERROR) 
+      if (entryName.UnflattenInterned(&buffer[readOffset], nameLength) != B_NO_ERROR) 
       {
          LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Unable to unflatten entry name! (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " nameLength=" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes, what, i, numEntries, nameLength);
          return B_ERROR;
@@ -1440,7 +2429,7 @@ status_t Message :: Unflatten(const uint8 * buffer, uint32 inputBufferBytes)
          return B_ERROR;
       }
 
-      if (nextEntry->Unflatten(&buffer[readOffset], eLength) != B_NO_ERROR) 
+      if (nextEntry->Unflatten(&buffer[readOffset], eLength, optMapInfo) != B_NO_ERROR) 
       {
          LogTime(MUSCLE_LOG_DEBUG, "Message %p:  Unable to unflatten data field object!  (inputBufferBytes=" UINT32_FORMAT_SPEC ", what=" UINT32_FORMAT_SPEC " i=" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " tc=" UINT32_FORMAT_SPEC " entryName=[%s] eLength=" UINT32_FORMAT_SPEC ")\n", this, inputBufferBytes, what, i, numEntries, tc, entryName(), eLength);
          Clear();  // fix for occasional crash bug; we were deleting nextEntry here, *and* in the destructor!
@@ -1966,6 +2955,36 @@ status_t Message :: ReplaceMessage(bool okayToAdd, const String & fieldName, uin
    return B_ERROR;
 }
 
+status_t Message :: FindMessage(const FieldKey & key, uint32 index, MessageRef & ref) const
+{
+   const MessageField * field = GetMessageField(key, B_MESSAGE_TYPE);
+   if ((field == NULL)||(index >= field->GetNumItems())) return B_ERROR;
+
+   RefCountableRef rcRef = field->GetItemAtAsRefCountableRef(index);
+   if (rcRef())
+   {
+      ref.SetFromRefCountableRef(rcRef);
+      return ref() ? B_NO_ERROR : B_ERROR;
+   }
+   else return B_ERROR;
+}
+
+status_t Message :: AddMessage(const FieldKey & key, const MessageRef & ref)
+{
+   if (ref() == NULL) return B_ERROR;
+   MessageField * mf = GetOrCreateMessageField(key, B_MESSAGE_TYPE);
+   return (mf) ? mf->AddDataItem(&ref, sizeof(ref)) : B_ERROR;
+}
+
+status_t Message :: ReplaceMessage(bool okayToAdd, const FieldKey & key, uint32 index, const MessageRef & msgRef)
+{
+   if (msgRef() == NULL) return B_ERROR;
+   MessageField * field = GetMessageField(key, B_MESSAGE_TYPE);
+   if ((okayToAdd)&&((field == NULL)||(index >= field->GetNumItems()))) return AddMessage(key, msgRef);
+   if (field) return field->ReplaceDataItem(index, &msgRef, sizeof(msgRef));
+   return B_ERROR;
+}
+
 status_t Message :: ReplaceFlat(bool okayToAdd, const String & fieldName, uint32 index, const FlatCountableRef & ref) 
 {
    const FlatCountable * fc = ref();
@@ -2315,8 +3334,40 @@ void MessageField :: SingleFlatten(uint8 *buffer) const
    }
 }
 
+status_t MessageField :: AppendFlattenedToByteBuffer(ByteBuffer & outBuf, uint32 & writeOffset, uint32 maxWriteOffset) const
+{
+   if (_typeCode == B_MESSAGE_TYPE)
+   {
+      // Sub-Messages are appended recursively, with each one's size-prefix filled in afterwards, so that
+      // we don't have to call FlattenedSize() on them.  Note:  No number-of-items field is written, for historical reasons
+      const uint32 numItems = GetNumItems();
+      for (uint32 i=0; i<numItems; i++)
+      {
+         const Message * msg = dynamic_cast<const Message *>(GetItemAtAsRefCountableRef(i)());
+         if (msg)
+         {
+            if (EnsureFlattenSpace(outBuf, writeOffset+sizeof(uint32), maxWriteOffset) != B_NO_ERROR) return B_ERROR;
+            const uint32 msgSizeOffset = writeOffset;
+            writeOffset += sizeof(uint32);
+
+            if (msg->AppendFlattenedToByteBufferAux(outBuf, writeOffset, maxWriteOffset) != B_NO_ERROR) return B_ERROR;
+            muscleCopyOut(outBuf.GetBuffer()+msgSizeOffset, B_HOST_TO_LENDIAN_INT32(writeOffset-(msgSizeOffset+sizeof(uint32))));
+         }
+      }
+   }
+   else
+   {
+      // For all other types, computing the flattened size is cheap, so we just reserve the space and Flatten() into it
+      const uint32 numBytes = FlattenedSize();
+      if (EnsureFlattenSpace(outBuf, writeOffset+numBytes, maxWriteOffset) != B_NO_ERROR) return B_ERROR;
+      Flatten(outBuf.GetBuffer()+writeOffset);
+      writeOffset += numBytes;
+   }
+   return B_NO_ERROR;
+}
+
 // Note:  we assume here that we have enough bytes, at least for the fixed-size types, because we checked for that in MessageField::Unflatten() 
-status_t MessageField :: SingleUnflatten(const uint8 * buffer, uint32 numBytes)
+status_t MessageField :: SingleUnflatten(const uint8 * buffer, uint32 numBytes, const MappedFileUnflattenInfo * optMapInfo)
 {
    switch(_typeCode)
    {
@@ -2337,8 +3388,8 @@ status_t MessageField :: SingleUnflatten(const uint8 * buffer, uint32 numBytes)
          buffer += sizeof(uint32); numBytes -= sizeof(uint32);  // this line must be exactly here!
          if (msgSize != numBytes) return B_ERROR;
 
-         MessageRef msgRef = GetMessageFromPool(buffer, numBytes);
-         if (msgRef() == NULL) return B_ERROR;
+         MessageRef msgRef = optMapInfo ? GetMessageFromPool() : GetMessageFromPool(buffer, numBytes);
+         if ((msgRef() == NULL)||((optMapInfo)&&(optMapInfo->UnflattenMessage(*msgRef(), buffer, numBytes) != B_NO_ERROR))) return B_ERROR;
          SetInlineItemAsRefCountableRef(msgRef.GetRefCountableRef());
       }
       break;
@@ -2381,7 +3432,7 @@ status_t MessageField :: SingleUnflatten(const uint8 * buffer, uint32 numBytes)
          buffer += sizeof(uint32); numBytes -= sizeof(uint32);  // yes, this line MUST be exactly here!
          if (itemSize != numBytes) return B_ERROR;  // our one item should take up the entire buffer, or something is wrong
 
-         ByteBufferRef bbRef = GetByteBufferFromPool(numBytes, buffer);
+         ByteBufferRef bbRef = optMapInfo ? optMapInfo->GetByteBuffer(buffer, numBytes) : GetByteBufferFromPool(numBytes, buffer);
          if (bbRef() == NULL) return B_ERROR;
 
          SetInlineItemAsRefCountableRef(bbRef.GetRefCountableRef());
@@ -2897,17 +3948,46 @@ uint32 MessageField :: GetNumItemsInFlattenedBuffer(const uint8 * bytes, uint32
    }
 }
 
-status_t MessageField :: Unflatten(const uint8 * bytes, uint32 numBytes)
+// Only the arrays that hold ByteBuffers or sub-Messages care whether they are being unflattened out of a mapped file
+static status_t UnflattenDataArray(AbstractDataArray & ada, const uint8 * bytes, uint32 numBytes, const MappedFileUnflattenInfo * optMapInfo)
+{
+   if (optMapInfo)
+   {
+      ByteBufferDataArray * bbda = dynamic_cast<ByteBufferDataArray *>(&ada);
+      if (bbda) return bbda->UnflattenAux(bytes, numBytes, optMapInfo);
+
+      MessageDataArray * mda = dynamic_cast<MessageDataArray *>(&ada);
+      if (mda) return mda->UnflattenAux(bytes, numBytes, optMapInfo);
+   }
+   return ada.Unflatten(bytes, numBytes);
+}
+
+ByteBufferRef MappedFileUnflattenInfo :: GetByteBuffer(const uint8 * bytes, uint32 numBytes) const
+{
+   if (numBytes >= _minMappedItemSize)
+   {
+      ByteBufferRef ret = GetMemoryMappedByteBuffer(_fd, _mapFileOffset+(bytes-_mapStart), numBytes);
+      if (ret()) return ret;
+   }
+   return GetByteBufferFromPool(numBytes, bytes);
+}
+
+status_t MappedFileUnflattenInfo :: UnflattenMessage(Message & msg, const uint8 * bytes, uint32 numBytes) const
+{
+   return msg.UnflattenFromMappedFile(bytes, numBytes, _fd, _mapFileOffset+(bytes-_mapStart), _minMappedItemSize);
+}
+
+status_t MessageField :: Unflatten(const uint8 * bytes, uint32 numBytes, const MappedFileUnflattenInfo * optMapInfo)
 {
    _state = FIELD_STATE_EMPTY;  // semi-paranoia
    SetInlineItemToNull();       // ditto
 
    uint32 numItemsInBuffer = GetNumItemsInFlattenedBuffer(bytes, numBytes);
-   if (numItemsInBuffer == 1) return SingleUnflatten(bytes, numBytes);
+   if (numItemsInBuffer == 1) return SingleUnflatten(bytes, numBytes, optMapInfo);
    else
    {
       AbstractDataArrayRef adaRef = CreateDataArray(_typeCode);
-      if ((adaRef())&&(adaRef()->Unflatten(bytes, numBytes) == B_NO_ERROR))  // add our existing single-item to the array
+      if ((adaRef())&&(UnflattenDataArray(*adaRef(), bytes, numBytes, optMapInfo) == B_NO_ERROR))  // add our existing single-item to the array
       {
          _state = FIELD_STATE_ARRAY;
          SetInlineItemAsRefCountableRef(adaRef.GetRefCountableRef());
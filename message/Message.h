@@ -18,10 +18,13 @@
 #define MuscleMessage_h
 
 #include "message/MessageImpl.h"  // this is the only place that MessageImpl.h should ever be #included!
+#include "support/NotCopyable.h"
+#include "util/Queue.h"
 
 namespace muscle {
 
 class Message;
+class MessageFieldNameDictionary;
 DECLARE_REFTYPES(Message);
 
 /** Returns a reference to an empty/default Message object.
@@ -95,6 +98,42 @@ MessageRef GetLightweightCopyOfMessageFromPool(const Message & copyMe);
  */
 MessageRef GetLightweightCopyOfMessageFromPool(ObjectPool<Message> & pool, const Message & copyMe);
 
+/** A FieldKey holds a Message field name along with that name's pre-computed hash code.
+  * Passing a FieldKey (rather than a String or a C string) to the Message methods that accept one
+  * lets the Message look up the field without constructing a temporary String or re-hashing the
+  * field name on every call.  FieldKeys are meant to be constructed once and then re-used, e.g.
+  *    static const FieldKey _countKey("count");
+  *    int32 count = msg.GetInt32(_countKey);
+  * A FieldKey's name is interned (see String::SetInterned()), so it shares its chars with the field
+  * names of Messages that were received over the network.
+  */
+class FieldKey MUSCLE_FINAL_CLASS
+{
+public:
+   /** Constructor.
+     * @param fieldName the field name this key represents.
+     */
+   explicit FieldKey(const char * fieldName) {(void) _fieldName.SetInterned(fieldName); _hashCode = _fieldName.HashCode();}
+
+   /** Constructor.
+     * @param fieldName the field name this key represents.
+     */
+   explicit FieldKey(const String & fieldName) {(void) _fieldName.SetInterned(fieldName); _hashCode = _fieldName.HashCode();}
+
+   /** Returns the field name this key represents. */
+   const String & GetFieldName() const {return _fieldName;}
+
+   /** Returns the pre-computed hash code of our field name (the same value GetFieldName().HashCode() would return) */
+   uint32 HashCode() const {return _hashCode;}
+
+   /** Lets a FieldKey be passed to any Message method that takes a (const String &) field name. */
+   operator const String & () const {return _fieldName;}
+
+private:
+   String _fieldName;
+   uint32 _hashCode;
+};
+
 /** This is an iterator that allows you to efficiently iterate over the field names in a Message. */
 class MessageFieldNameIterator MUSCLE_FINAL_CLASS
 {
@@ -333,6 +372,50 @@ public:
     */
    virtual void Flatten(uint8 *buffer) const;
 
+   /**
+    *  Appends the flattened representation of this Message to the end of (outBuf), growing (outBuf) as necessary.
+    *  The appended bytes are identical to what Flatten() would write, but each field and each sub-Message
+    *  is visited only once, whereas calling FlattenedSize() and then Flatten() has to walk the Message tree
+    *  at least twice (and re-walks each sub-Message once per level of nesting above it).
+    *  @param outBuf The ByteBuffer to append our flattened bytes to.
+    *  @param maxBytesToAppend If specified, this method will give up and return B_ERROR as soon as it
+    *                          becomes apparent that more than this many bytes would need to be appended.
+    *                          Defaults to MUSCLE_NO_LIMIT.
+    *  @returns B_NO_ERROR on success, or B_ERROR on failure (out of memory, or (maxBytesToAppend) was exceeded).
+    *           On failure, (outBuf) is restored to its original length, although its allocated size may have grown.
+    *  @note (outBuf) is grown geometrically, so on return it may have up to twice as many bytes allocated as it holds.
+    *        If you are going to keep it around for a while, you may want to call FreeExtraBytes() on it.
+    */
+   status_t AppendFlattenedToByteBuffer(ByteBuffer & outBuf, uint32 maxBytesToAppend = MUSCLE_NO_LIMIT) const;
+
+   /**
+    *  Appends this Message to the end of (outBuf) in the compact field-name-dictionary format.  This format is
+    *  not compatible with Flatten()'s:  the first time a given field name is written, it is written in full and
+    *  remembered in (dict); after that it is written as a variable-length integer ID instead.  Field counts and
+    *  field lengths are written as variable-length integers also.  The field data itself is written as in Flatten(),
+    *  except that sub-Messages are written in the field-name-dictionary format as well, and arrays of eight or more
+    *  int32, int64, float or double values are written in a columnar format (delta/zigzag/bit-packed for integers,
+    *  Gorilla-style XOR for floating point values) whenever that turns out smaller than the raw values.
+    *  The bytes appended can be turned back into a Message only via UnflattenDictionaryEncoded(), with a
+    *  MessageFieldNameDictionary that has seen the same sequence of Messages as (dict).
+    *  @param outBuf The ByteBuffer to append our encoded bytes to.
+    *  @param dict The dictionary of field names that have already been written.  New field names will be added to it.
+    *  @returns B_NO_ERROR on success, or B_ERROR on failure (out of memory).
+    *           On failure, (outBuf) is restored to its original length, but (dict) may have been modified, and so should be cleared.
+    */
+   status_t AppendDictionaryEncodedToByteBuffer(ByteBuffer & outBuf, MessageFieldNameDictionary & dict) const;
+
+   /**
+    *  Restores this Message from bytes that were generated by AppendDictionaryEncodedToByteBuffer().
+    *  Any previous contents of this Message will be erased.
+    *  @param buf Pointer to the encoded bytes.
+    *  @param size The number of encoded bytes.
+    *  @param dict The dictionary of field names that have already been read.  New field names will be added to it.
+    *  @return B_NO_ERROR if the buffer was successfully decoded, or B_ERROR if there was an error (usually meaning
+    *          the buffer was corrupt, the dictionary was out of sync with the sender's, or out-of-memory)
+    */
+   status_t UnflattenDictionaryEncoded(const uint8 * buf, uint32 size, MessageFieldNameDictionary & dict);
+
    /**
     *  Convert the given byte buffer back into a Message.  Any previous contents of
     *  this Message will be erased, and replaced with the data specified in the byte buffer.
@@ -343,6 +426,22 @@ public:
     */
    virtual status_t Unflatten(const uint8 *buf, uint32 size);
 
+   /**
+    *  Same as Unflatten(), except that (buf) is assumed to point into a memory-mapped view of the file
+    *  referenced by (fd).  Any B_RAW_TYPE (or other variable-sized, non-String) items of at least
+    *  (minMappedItemSize) bytes are then exposed as ByteBuffers that map their bytes directly from the file
+    *  (see GetMemoryMappedByteBuffer()), rather than being copied into the heap.  The mappings remain valid
+    *  after (fd) is closed, and even after the file is deleted.
+    *  @param buf Pointer to a memory-mapped byte buffer containing a flattened Message to restore.
+    *  @param size The number of bytes in the flattened byte buffer.
+    *  @param fd File descriptor of the file that (buf) is a view of.
+    *  @param bufFileOffset The offset within the file of the byte that (buf) points to.
+    *  @param minMappedItemSize Items smaller than this many bytes will be copied into the heap as usual.
+    *  @return B_NO_ERROR if the buffer was successfully Unflattened, or B_ERROR if there
+    *          was an error (usually meaning the buffer was corrupt, or out-of-memory)
+    */
+   status_t UnflattenFromMappedFile(const uint8 *buf, uint32 size, int fd, uint64 bufFileOffset, uint32 minMappedItemSize);
+
    /** Adds a new string to the Message.
     *  @param fieldName Name of the field to add (or add to)
     *  @param val The string to add
@@ -1457,6 +1556,83 @@ public:
      */
    inline const String * GetStringPointer(const String & fn, const String * defVal=NULL, uint32 idx = 0) const {const String * r; return (FindString(fn, idx, &r) == B_NO_ERROR) ? r : defVal;}
 
+   /** Same as HasName(const String &, uint32), except the field is specified via a FieldKey, so its name doesn't need to be re-hashed.
+    *  @param key the key of the field to look for.
+    *  @param type the type to look for, or B_ANY_TYPE if type isn't important to you.
+    *  @return true if such a field exists, else false.
+    */
+   bool HasName(const FieldKey & key, uint32 type = B_ANY_TYPE) const {return (GetMessageField(key, type) != NULL);}
+
+   /** Same as GetNumValuesInName(const String &, uint32), except the field is specified via a FieldKey.
+    *  @param key the key of the field to look for.
+    *  @param type the type to look for, or B_ANY_TYPE if type isn't important to you.
+    *  @return The number of values stored under (key) if a field of the right type exists, or zero otherwise.
+    */
+   uint32 GetNumValuesInName(const FieldKey & key, uint32 type = B_ANY_TYPE) const {const muscle_message_imp::MessageField * mf = GetMessageField(key, type); return mf ? mf->GetNumItems() : 0;}
+
+   /** Same as FindString(const String &, uint32, const String **), except the field is specified via a FieldKey.
+    *  @param key the key of the field to look for.
+    *  @param index the index of the String item in its field entry.
+    *  @param writeValueHere On success, this will be set to point to the String in this Message.
+    *  @return B_NO_ERROR if the String value was found, or B_ERROR if it wasn't.
+    */
+   status_t FindString(const FieldKey & key, uint32 index, const String ** writeValueHere) const {return FindFieldKeyItemAux(key, index, B_STRING_TYPE, writeValueHere);}
+
+   /** Convenience method:  Same as FindString(key, 0, writeValueHere).
+    *  @param key the key of the field to look for.
+    *  @param writeValueHere On success, this will be set to point to the String in this Message.
+    *  @return B_NO_ERROR if the String value was found, or B_ERROR if it wasn't.
+    */
+   status_t FindString(const FieldKey & key, const String ** writeValueHere) const {return FindString(key, 0, writeValueHere);}
+
+   /** Looks up a data item of any type, via a FieldKey.  Unlike FindData(), this method doesn't convert the item
+    *  in any way:  on success, (writeValueHere) points at the item as it is stored in this Message (e.g. at a
+    *  String object for a B_STRING_TYPE field, or at a MessageRef for a B_MESSAGE_TYPE field).
+    *  @param key the key of the field to look for.
+    *  @param type the type of field to look for, or B_ANY_TYPE if type isn't important to you.
+    *  @param index the index of the item in its field entry.
+    *  @param writeValueHere On success, this will be set to point to the item in this Message.
+    *  @return B_NO_ERROR if the item was found, or B_ERROR if it wasn't.
+    */
+   status_t FindDataItem(const FieldKey & key, uint32 type, uint32 index, const void ** writeValueHere) const {return FindFieldKeyItemAux(key, index, type, writeValueHere);}
+
+   /** Same as FindMessage(const String &, uint32, MessageRef &), except the field is specified via a FieldKey.
+    *  @param key the key of the field to look for.
+    *  @param index the index of the Message item in its field entry.
+    *  @param writeValueHere On success, this object will be set to reference the found Message.
+    *  @return B_NO_ERROR if the Message was found, or B_ERROR if it wasn't.
+    */
+   status_t FindMessage(const FieldKey & key, uint32 index, MessageRef & writeValueHere) const;
+
+   /** Convenience method:  Same as FindMessage(key, 0, writeValueHere).
+    *  @param key the key of the field to look for.
+    *  @param writeValueHere On success, this object will be set to reference the found Message.
+    *  @return B_NO_ERROR if the Message was found, or B_ERROR if it wasn't.
+    */
+   status_t FindMessage(const FieldKey & key, MessageRef & writeValueHere) const {return FindMessage(key, 0, writeValueHere);}
+
+   /** Same as AddMessage(const String &, const MessageRef &), except the field is specified via a FieldKey.
+    *  @param key the key of the field to add the Message to.
+    *  @param msgRef The Message to add.  Must not be a NULL reference.
+    *  @return B_NO_ERROR on success, or B_ERROR on failure (out of memory, or a field of another type already uses this name)
+    */
+   status_t AddMessage(const FieldKey & key, const MessageRef & msgRef);
+
+   /** Same as ReplaceMessage(bool, const String &, uint32, const MessageRef &), except the field is specified via a FieldKey.
+    *  @param okayToAdd If set true, attempting to replace an item that doesn't exist will cause the new item to be added to the end of the field array, instead.
+    *  @param key the key of the field to replace a Message in.
+    *  @param index The index of the entry within the field name to modify
+    *  @param msgRef The replacement Message.
+    *  @return B_NO_ERROR on success, or B_ERROR if the field wasn't found, or if (index) wasn't a valid index, or out of memory.
+    */
+   status_t ReplaceMessage(bool okayToAdd, const FieldKey & key, uint32 index, const MessageRef & msgRef);
+
+   /** Same as RemoveName(const String &), except the field is specified via a FieldKey.
+    *  @param key the key of the field to remove.
+    *  @return B_NO_ERROR if the field was found and removed, or B_ERROR if it wasn't found.
+    */
+   status_t RemoveName(const FieldKey & key) {return _entries.Remove(key.GetFieldName());}
+
 #ifndef DOXYGEN_SHOULD_IGNORE_THIS
 # define DECLARE_MUSCLE_UNSIGNED_INTEGER_FIND_METHODS(bw)                                                                                               \
    inline status_t FindInt##bw (const String & fieldName, uint32 index, uint##bw & val) const {return FindInt##bw (fieldName, index, (int##bw &)val);} \
@@ -1501,6 +1677,29 @@ public:
    DECLARE_MUSCLE_CONVENIENCE_METHODS(Message, MessageRef);      ///< This macro defines Get(), CAdd(), and CPrepend() methods for convience in common use cases.
    DECLARE_MUSCLE_CONVENIENCE_METHODS(Flat,    ByteBufferRef);   ///< This macro defines Get(), CAdd(), and CPrepend() methods for convience in common use cases.
    DECLARE_MUSCLE_CONVENIENCE_METHODS(Tag,     RefCountableRef); ///< This macro defines Get(), CAdd(), and CPrepend() methods for convience in common use cases.
+
+# define DECLARE_MUSCLE_FIELD_KEY_METHODS(name, type, tc)                                                                                                               \
+   inline status_t Add##name(const FieldKey & key, const type & val) {muscle_message_imp::MessageField * mf = GetOrCreateMessageField(key, tc); return mf ? mf->AddDataItem(&val, sizeof(val)) : B_ERROR;} \
+   inline status_t Find##name(const FieldKey & key, uint32 index, type & val) const {const type * p; if (FindFieldKeyItemAux(key, index, tc, &p) != B_NO_ERROR) return B_ERROR; val = *p; return B_NO_ERROR;} \
+   inline status_t Find##name(const FieldKey & key, type & val) const {return Find##name(key, 0, val);}                                                           \
+   inline type Get##name(const FieldKey & key, const type & defVal = type(), uint32 idx = 0) const {const type * p; return (FindFieldKeyItemAux(key, idx, tc, &p) == B_NO_ERROR) ? *p : defVal;} \
+   inline status_t Replace##name(bool okayToAdd, const FieldKey & key, uint32 index, const type & val)                                                            \
+   {                                                                                                                                                                \
+      muscle_message_imp::MessageField * mf = GetMessageField(key, tc);                                                                                            \
+      if ((okayToAdd)&&((mf == NULL)||(index >= mf->GetNumItems()))) return Add##name(key, val);                                                                  \
+      return mf ? mf->ReplaceDataItem(index, &val, sizeof(val)) : B_ERROR;                                                                                        \
+   }                                                                                                                                                                \
+   inline status_t Replace##name(bool okayToAdd, const FieldKey & key, const type & val) {return Replace##name(okayToAdd, key, 0, val);}
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Bool,   bool,   B_BOOL_TYPE);   ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Double, double, B_DOUBLE_TYPE); ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Float,  float,  B_FLOAT_TYPE);  ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Int8,   int8,   B_INT8_TYPE);   ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Int16,  int16,  B_INT16_TYPE);  ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Int32,  int32,  B_INT32_TYPE);  ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Int64,  int64,  B_INT64_TYPE);  ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Point,  Point,  B_POINT_TYPE);  ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(Rect,   Rect,   B_RECT_TYPE);   ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
+   DECLARE_MUSCLE_FIELD_KEY_METHODS(String, String, B_STRING_TYPE); ///< This macro defines Add(), Find(), Get() and Replace() methods that take a FieldKey instead of a String.
    DECLARE_STANDARD_CLONE_METHOD(Message);  ///< implements the standard Clone() method to copy a Message object.
 #endif
 
@@ -1524,6 +1723,27 @@ private:
    muscle_message_imp::MessageField * GetOrCreateMessageField(const String & fieldName, uint32 tc);
    const muscle_message_imp::MessageField * GetMessageFieldAndTypeCode(const String & fieldName, uint32 index, uint32 * retTypeCode) const;
 
+   // FieldKey-based lookups, which use the key's pre-computed hash code instead of re-hashing the field name
+   muscle_message_imp::MessageField * GetMessageField(const FieldKey & key, uint32 tc)
+   {
+      muscle_message_imp::MessageField * mf = _entries.GetWithPrecomputedHash(key.GetFieldName(), key.HashCode());
+      return ((mf)&&((tc == B_ANY_TYPE)||(tc == mf->TypeCode()))) ? mf : NULL;
+   }
+   const muscle_message_imp::MessageField * GetMessageField(const FieldKey & key, uint32 tc) const
+   {
+      const muscle_message_imp::MessageField * mf = _entries.GetWithPrecomputedHash(key.GetFieldName(), key.HashCode());
+      return ((mf)&&((tc == B_ANY_TYPE)||(tc == mf->TypeCode()))) ? mf : NULL;
+   }
+   muscle_message_imp::MessageField * GetOrCreateMessageField(const FieldKey & key, uint32 tc);
+   template <class T> status_t FindFieldKeyItemAux(const FieldKey & key, uint32 index, uint32 tc, const T ** retItem) const
+   {
+      const muscle_message_imp::MessageField * mf = GetMessageField(key, tc);
+      const void * addr;
+      if ((mf == NULL)||(mf->FindDataItem(index, &addr) != B_NO_ERROR)) return B_ERROR;
+      *retItem = static_cast<const T *>(addr);
+      return B_NO_ERROR;
+   }
+
    status_t AddFlatAux(const String & fieldName, const FlatCountableRef & flat, uint32 etc, bool prepend);
    status_t AddFlatAux(const String & fieldName, const ByteBufferRef & bufRef, uint32 etc, bool prepend)
    {
@@ -1547,11 +1767,96 @@ private:
       return iter.HasData() ? &iter.GetFieldName() : NULL;
    }
 
+   status_t AppendFlattenedToByteBufferAux(ByteBuffer & outBuf, uint32 & writeOffset, uint32 maxWriteOffset) const;
+   status_t AppendDictionaryEncodedToByteBufferAux(ByteBuffer & outBuf, uint32 & writeOffset, MessageFieldNameDictionary & dict) const;
+   status_t UnflattenAux(const uint8 * buf, uint32 size, const muscle_message_imp::MappedFileUnflattenInfo * optMapInfo);
+
    friend class muscle_message_imp::MessageField;
    friend class MessageFieldNameIterator;
+   friend class IncrementalMessageFlattener;
    Hashtable<String, muscle_message_imp::MessageField> _entries;   
 };
 
+/** This class generates a Message's flattened bytes incrementally, a chunk at a time, so that a very large
+  * Message can be sent (or saved) without first flattening the whole thing into one big contiguous buffer.
+  * The generated bytes are identical to the bytes that Message::Flatten() would produce.
+  *
+  * SetMessage() walks the Message tree once, to record the sizes that the flattened format needs to declare
+  * up-front (a few bytes per field), and after that GetNextBytes() can be called repeatedly to retrieve the
+  * flattened bytes in order.  Sub-Messages, and the items of B_RAW_TYPE (and other FlatCountable) fields,
+  * are generated one item at a time, and the contents of ByteBuffer items are copied out directly, so
+  * memory usage is bounded by the size of the largest non-ByteBuffer item rather than by the size of the Message.
+  *
+  * Note that the Message must not be modified while it is being incrementally flattened.
+  */
+class IncrementalMessageFlattener MUSCLE_FINAL_CLASS : private NotCopyable
+{
+public:
+   /** Default constructor.  Call SetMessage() before calling GetNextBytes(). */
+   IncrementalMessageFlattener() : _flattenedSize(0), _numBytesRemaining(0), _nextSizeIdx(0), _scratchReadOffset(0), _blobBytes(NULL), _numBlobBytes(0) {/* empty */}
+
+   /** Prepares to flatten (msgRef), and computes its flattened size.
+     * @param msgRef The Message to flatten.  We will retain this reference until Reset() is called.
+     * @returns B_NO_ERROR on success, or B_ERROR on failure (NULL reference, or out of memory)
+     */
+   status_t SetMessage(const ConstMessageRef & msgRef);
+
+   /** Writes up to (maxBytes) more flattened bytes into (outBuf).
+     * @param outBuf The buffer to write the bytes into.  It must have room for at least (maxBytes) bytes.
+     * @param maxBytes The maximum number of bytes to write.
+     * @returns the number of bytes written, which will be less than (maxBytes) only when the end of the flattened Message is reached.
+     */
+   uint32 GetNextBytes(uint8 * outBuf, uint32 maxBytes);
+
+   /** Returns the total number of bytes the Message flattens into, as computed by SetMessage(). */
+   uint32 GetFlattenedSize() const {return _flattenedSize;}
+
+   /** Returns the number of flattened bytes that have yet to be returned by GetNextBytes(). */
+   uint32 GetNumBytesRemaining() const {return _numBytesRemaining;}
+
+   /** Returns true iff there are more bytes to be returned by GetNextBytes(). */
+   bool HasBytesRemaining() const {return (_numBytesRemaining > 0);}
+
+   /** Releases our Message reference and resets our state. */
+   void Reset();
+
+private:
+   class FlattenFrame
+   {
+   public:
+      FlattenFrame() : _msg(NULL), _field(NULL), _itemIdx(0), _state(0) {/* empty */}
+
+      const Message * _msg;
+      HashtableIterator<String, muscle_message_imp::MessageField> _iter;
+      const muscle_message_imp::MessageField * _field;
+      uint32 _itemIdx;
+      uint32 _state;
+   };
+
+   status_t ComputeSizes(const Message & msg, uint32 & retSize);
+   status_t PushFrame(const Message & msg);
+   status_t GenerateMoreBytes();
+   status_t GenerateNextUnit();
+   status_t AppendScratchInt32(uint32 val);
+   uint32 GetNextRecordedSize() {return (_nextSizeIdx < _sizes.GetNumItems()) ? _sizes[_nextSizeIdx++] : 0;}
+
+   ConstMessageRef _msgRef;
+   uint32 _flattenedSize;
+   uint32 _numBytesRemaining;
+
+   Queue<uint32> _sizes;  // per-Message sizes and field-counts, and per-field data sizes, in the order they get written
+   uint32 _nextSizeIdx;
+
+   Queue<FlattenFrame> _frames;  // one per Message currently being flattened (i.e. the current path from the root Message)
+
+   ByteBuffer _scratch;          // small flattened items are accumulated here before being returned
+   uint32 _scratchReadOffset;
+
+   RefCountableRef _blobRef;     // keeps the ByteBuffer we're currently returning bytes from valid
+   const uint8 * _blobBytes;
+   uint32 _numBlobBytes;
+};
+
 /** A macro to declare the necessary Template specializations so that the *Flat() methods do the right thing when called with a String/Point/Rect/Message object as their argument */
 #define DECLARE_MUSCLE_FLAT_SPECIALIZERS(tp)                                                                                                                    \
 template <> inline status_t Message::FindFlat<tp>(   const String & fieldName, uint32 index, tp & obj)  const  {return Find##tp(   fieldName, index, obj);}     \
@@ -1631,6 +1936,41 @@ template<class T> inline Ref<T> CreateObjectFromArchiveMessage(const MessageRef
    return msgRef() ? CreateObjectFromArchiveMessage<T>(*msgRef()) : Ref<T>();
 }
 
+/** This class holds the field names that have been sent (or received) so far over one direction of a connection
+  * that uses Message::AppendDictionaryEncodedToByteBuffer() and Message::UnflattenDictionaryEncoded().  Each
+  * distinct field name goes over the wire in full only once; after that it is referred to by its index in the dictionary.
+  * The sender's dictionary and the receiver's dictionary stay in sync only as long as they both see the same
+  * sequence of Messages in the same order, so both should be cleared whenever that can't be guaranteed.
+  * To bound the memory a peer can make us use, a dictionary holds at most MAX_NAMES names, and no name longer
+  * than MAX_NAME_LENGTH bytes; any other field names are always sent in full.
+  */
+class MessageFieldNameDictionary MUSCLE_FINAL_CLASS : private NotCopyable
+{
+public:
+   enum {
+      MAX_NAMES       = 4096, /**< Maximum number of field names a dictionary will hold */
+      MAX_NAME_LENGTH = 255   /**< Maximum length (in bytes) of a field name that a dictionary will hold */
+   };
+
+   /** Default constructor.  Creates an empty dictionary. */
+   MessageFieldNameDictionary() {/* empty */}
+
+   /** Removes all field names from this dictionary. */
+   void Clear() {_nameToID.Clear(); _idToName.Clear();}
+
+   /** Returns the number of field names currently held in this dictionary. */
+   uint32 GetNumNames() const {return muscleMax(_nameToID.GetNumItems(), _idToName.GetNumItems());}
+
+   /** Returns true iff this dictionary doesn't hold any field names. */
+   bool IsEmpty() const {return (GetNumNames() == 0);}
+
+private:
+   friend class Message;
+
+   Hashtable<String, uint32> _nameToID;  // used when encoding
+   Queue<String> _idToName;              // used when decoding
+};
+
 inline MessageFieldNameIterator :: MessageFieldNameIterator(const Message & msg, uint32 type, uint32 flags) : _typeCode(type), _iter(msg._entries.GetIterator(flags)) {if (_typeCode != B_ANY_TYPE) SkipNonMatchingFieldNames();}
 
 // declared down here to make clang++ happy
@@ -19,6 +19,8 @@
 
 namespace muscle {
 
+class Message;
+
 namespace muscle_message_imp {
 
 /** This class is a private part of the Message class's implementation.  User code should not access this class directly.
@@ -99,6 +101,35 @@ protected:
 };
 DECLARE_REFTYPES(AbstractDataArray);
 
+/** This class is a private part of the Message class's implementation.  User code should not access this class directly.
+  * It describes the memory-mapped file that a Message is being unflattened from; see Message::UnflattenFromMappedFile().
+  */
+class MappedFileUnflattenInfo
+{
+public:
+   /** Constructor
+     * @param fd the file descriptor of the mapped file
+     * @param mapStart pointer to the first byte of the mapped region
+     * @param mapFileOffset offset in the file of the byte that (mapStart) points to
+     * @param minMappedItemSize raw-data items at least this large will be mapped directly from the file rather than copied
+     */
+   MappedFileUnflattenInfo(int fd, const uint8 * mapStart, uint64 mapFileOffset, uint32 minMappedItemSize) : _fd(fd), _mapStart(mapStart), _mapFileOffset(mapFileOffset), _minMappedItemSize(minMappedItemSize) {/* empty */}
+
+   /** Returns a ByteBuffer holding a copy of the (numBytes) bytes at (bytes), which must point into our mapped region.
+     * Items of at least (minMappedItemSize) bytes are mapped directly from the file; smaller items (or items we fail to map) are copied into a pooled ByteBuffer.
+     */
+   ByteBufferRef GetByteBuffer(const uint8 * bytes, uint32 numBytes) const;
+
+   /** Unflattens the sub-Message at (bytes), which must point into our mapped region, so that its large items get mapped also. */
+   status_t UnflattenMessage(Message & msg, const uint8 * bytes, uint32 numBytes) const;
+
+private:
+   int _fd;
+   const uint8 * _mapStart;
+   uint64 _mapFileOffset;
+   uint32 _minMappedItemSize;
+};
+
 /** This class is a private part of the Message class's implementation.  User code should not access this class directly.
   * This class represents the value-data of one field in a Message object.
   */
@@ -128,7 +159,8 @@ public:
    bool AllowsTypeCode(uint32 tc) const {return tc == TypeCode();}
    uint32 FlattenedSize() const {return HasArray() ? GetArray()->FlattenedSize() : SingleFlattenedSize();}
    void Flatten(uint8 *buffer) const {if (HasArray()) GetArray()->Flatten(buffer); else SingleFlatten(buffer);}
-   status_t Unflatten(const uint8 * buf, uint32 numBytes);
+   status_t AppendFlattenedToByteBuffer(ByteBuffer & outBuf, uint32 & writeOffset, uint32 maxWriteOffset) const;
+   status_t Unflatten(const uint8 * buf, uint32 numBytes, const MappedFileUnflattenInfo * optMapInfo = NULL);
 
    // Pseudo-AbstractDataArray interface
    status_t AddDataItem(const void * data, uint32 numBytes) {return HasArray() ? GetArray()->AddDataItem(data, numBytes) : SingleAddDataItem(data, numBytes);}
@@ -167,7 +199,7 @@ private:
    // single-item implementation of the AbstractDataArray methods
    uint32 SingleFlattenedSize() const;
    void SingleFlatten(uint8 * buffer) const;
-   status_t SingleUnflatten(const uint8 * buffer, uint32 numBytes);
+   status_t SingleUnflatten(const uint8 * buffer, uint32 numBytes, const MappedFileUnflattenInfo * optMapInfo);
    status_t SingleAddDataItem(const void * data, uint32 numBytes);
    status_t SingleRemoveDataItem(uint32 index);
    status_t SinglePrependDataItem(const void * data, uint32 numBytes);
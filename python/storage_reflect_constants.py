@@ -71,8 +71,8 @@ PR_COMMAND_GETDATATREES      = 558916419
 # Removes matching RESULT_DATATREES Messages from the outgoing queuen
 PR_COMMAND_JETTISONDATATREES = 558916420 
 
-# Reserved for future expansion
-PR_COMMAND_RESERVED14        = 558916421 
+# Returns a count/sum/min/max/average computed over the matching nodes
+PR_COMMAND_GETAGGREGATE      = 558916421 
 
 # Reserved for future expansion
 PR_COMMAND_RESERVED15        = 558916422 
@@ -134,8 +134,8 @@ PR_RESULT_ERRORACCESSDENIED  = 558920246
 # Reply to a PR_COMMAND_GETDATATREES message
 PR_RESULT_DATATREES          = 558920247 
 
-# Reserved for future expansion
-PR_RESULT_RESERVED5          = 558920248 
+# Reply to a PR_COMMAND_GETAGGREGATE message
+PR_RESULT_AGGREGATE          = 558920248 
 
 # Reserved for future expansion
 PR_RESULT_RESERVED6          = 558920249 
@@ -309,6 +309,33 @@ PR_NAME_REPLY_ENCODING            = "!Enc"
 # If present as an int32 in PR_COMMAND_GETDATATREES, returned trees will be clipped to this maximum depth. (0==roots only)
 PR_NAME_MAXDEPTH                  = "!MDep"
 
+# String in PR_COMMAND_GETAGGREGATE:  "count", "sum", "min", "max" or "avg"
+PR_NAME_AGGREGATE_OP              = "!AgOp"
+
+# String in PR_COMMAND_GETAGGREGATE:  name of the numeric node-Message field to aggregate (not needed for "count")
+PR_NAME_AGGREGATE_FIELD           = "!AgFd"
+
+# String in PR_COMMAND_GETAGGREGATE:  if present, results are computed separately for each value of this node-Message field
+PR_NAME_AGGREGATE_GROUP_BY        = "!AgGb"
+
+# int64 in PR_RESULT_AGGREGATE:  number of nodes that were aggregated
+PR_NAME_AGGREGATE_COUNT           = "!AgCt"
+
+# int64 or double in PR_RESULT_AGGREGATE:  the computed sum/min/max/average (absent for "count", or if there were no values).  int64 if all the values were integers (except for "avg")
+PR_NAME_AGGREGATE_RESULT          = "!AgRs"
+
+# Message in PR_RESULT_AGGREGATE:  holds one sub-Message (with count, result and group-value fields) per group-by value
+PR_NAME_AGGREGATE_GROUPS          = "!AgGr"
+
+# String, int64 or double in each PR_NAME_AGGREGATE_GROUPS sub-Message:  the group-by value that the sub-Message's results are for
+PR_NAME_AGGREGATE_GROUP_VALUE     = "!AgGv"
+
+# String:  one or more field names (or wildcard patterns); if present in PR_COMMAND_GETDATA or alongside SUBSCRIBE: parameters, only matching fields of the node Messages are returned
+PR_NAME_PROJECTION                = "!Proj"
+
+# int64:  if present alongside SUBSCRIBE: parameters, the minimum number of microseconds between subscription updates for any one node
+PR_NAME_MIN_UPDATE_INTERVAL       = "!MnUI"
+
 # this field name's submessage is the payload of the current node
 # in the message created by StorageReflectSession::SaveNodeTreeToMessage() 
 PR_NAME_NODEDATA                  = "data"  
@@ -5,9 +5,150 @@
 
 namespace muscle {
 
+// A secondary index on one field of a DataNode's children's Messages:  the children, sorted by that field's first value
+class DataNode :: FieldIndex
+{
+public:
+   // The sort key for one child.  Values of different types are kept apart by sorting on the type code first.
+   class Key
+   {
+   public:
+      Key() : _typeCode(0), _bound(0), _number(0.0) {/* empty */}
+      Key(uint32 typeCode, int bound) : _typeCode(typeCode), _bound(bound), _number(0.0) {/* empty */}
+
+      uint32 _typeCode;
+      int _bound;      // -1 sorts before every value of (_typeCode), 1 sorts after every value of (_typeCode), 0 means a real value
+      double _number;  // used for the numeric types
+      String _string;  // used for B_STRING_TYPE
+   };
+
+   class Item
+   {
+   public:
+      Item() {/* empty */}
+      Item(const Key & key, const DataNodeRef & node) : _key(key), _node(node) {/* empty */}
+
+      Key _key;
+      DataNodeRef _node;
+   };
+
+   class ItemCompareFunctor
+   {
+   public:
+      int Compare(const Item & item, const Key & key, void *) const {return CompareKeys(item._key, key);}
+   };
+
+   FieldIndex(const String & fieldName) : _fieldName(fieldName) {/* empty */}
+
+   // Returns false if (msg) doesn't have an indexable value in our field
+   bool GetKey(const Message * msg, Key & retKey) const
+   {
+      uint32 tc;
+      if ((msg == NULL)||(msg->GetInfo(_fieldName, &tc) != B_NO_ERROR)) return false;
+
+      retKey._typeCode = tc;
+      retKey._bound    = 0;
+      if (tc == B_STRING_TYPE)
+      {
+         const String * s;
+         if (msg->FindString(_fieldName, 0, &s) != B_NO_ERROR) return false;
+         retKey._string = *s;
+         return true;
+      }
+
+      const void * p;
+      if (msg->FindData(_fieldName, tc, 0, &p, NULL) != B_NO_ERROR) return false;
+      switch(tc)
+      {
+         case B_INT8_TYPE:   retKey._number = *((const int8   *)p); break;
+         case B_INT16_TYPE:  retKey._number = *((const int16  *)p); break;
+         case B_INT32_TYPE:  retKey._number = *((const int32  *)p); break;
+         case B_INT64_TYPE:  retKey._number = (double) *((const int64 *)p); break;
+         case B_FLOAT_TYPE:  retKey._number = *((const float  *)p); break;
+         case B_DOUBLE_TYPE: retKey._number = *((const double *)p); break;
+         default:            return false;
+      }
+      return (retKey._number == retKey._number);  // NaNs can't be sorted, and never satisfy a range or equality test anyway
+   }
+
+   // (Re)indexes (child) under the current value of our field in its Message
+   void Update(const DataNodeRef & child)
+   {
+      Remove(child());
+
+      Key key;
+      if (GetKey(child()->GetData()(), key))
+      {
+         OrderStatisticTree<Item>::Entry * e;
+         if (_items.InsertItemAt(_items.GetUpperBound(key, ItemCompareFunctor()), Item(key, child), &e) == B_NO_ERROR)
+         {
+            if (_entries.Put(child(), e) != B_NO_ERROR) (void) _items.RemoveEntry(e);
+         }
+      }
+   }
+
+   void Remove(const DataNode * child)
+   {
+      OrderStatisticTree<Item>::Entry * e;
+      if (_entries.Remove(child, e) == B_NO_ERROR) (void) _items.RemoveEntry(e);
+   }
+
+   // Appends to (retNodes) every child whose key is in the range [lo, hi]
+   void GetRange(const Key & lo, const Key & hi, Queue<DataNodeRef> & retNodes) const
+   {
+      const uint32 startIdx = _items.GetLowerBound(lo, ItemCompareFunctor());
+      const uint32 endIdx   = _items.GetUpperBound(hi, ItemCompareFunctor());
+      if ((endIdx > startIdx)&&(retNodes.EnsureSize(retNodes.GetNumItems()+(endIdx-startIdx)) == B_NO_ERROR))
+      {
+         const OrderStatisticTree<Item>::Entry * e = _items.GetEntryAt(startIdx);
+         for (uint32 i=startIdx; i<endIdx; i++,e=_items.GetNextEntry(e)) (void) retNodes.AddTail(e->GetItem()._node);
+      }
+   }
+
+   // Sets (retLo) and (retHi) to the range of keys that could satisfy the comparison (op) against (value).
+   // The range is inclusive at both ends, so that it can be used for '<' and '>' too; the caller re-tests each candidate anyway.
+   static bool GetRangeForOperator(uint8 op, const Key & value, Key & retLo, Key & retHi)
+   {
+      switch(op)
+      {
+         case StringQueryFilter::OP_EQUAL_TO:                 retLo = retHi = value;                                  return true;
+         case StringQueryFilter::OP_LESS_THAN:                
+         case StringQueryFilter::OP_LESS_THAN_OR_EQUAL_TO:    retLo = Key(value._typeCode, -1); retHi = value;        return true;
+         case StringQueryFilter::OP_GREATER_THAN:             
+         case StringQueryFilter::OP_GREATER_THAN_OR_EQUAL_TO: retLo = value; retHi = Key(value._typeCode, 1);         return true;
+         default:                                             return false;
+      }
+   }
+
+   template<class NumericQueryFilterType> static bool GetNumericFilterRange(const QueryFilter & filter, uint32 dataTypeCode, Key & retLo, Key & retHi)
+   {
+      const NumericQueryFilterType & nqf = static_cast<const NumericQueryFilterType &>(filter);
+      if ((nqf.GetIndex() != 0)||(nqf.IsAssumedDefault())||(nqf.GetMaskOp() != NQF_MASK_OP_NONE)) return false;
+
+      Key value(dataTypeCode, 0);
+      value._number = (double) nqf.GetValue();
+      return ((value._number == value._number)&&(GetRangeForOperator(nqf.GetOperator(), value, retLo, retHi)));  // the NumericQueryFilter OP_* values are the same as the first few StringQueryFilter ones
+   }
+
+   static int CompareKeys(const Key & a, const Key & b)
+   {
+      if (a._typeCode != b._typeCode) return muscleCompare(a._typeCode, b._typeCode);
+      if ((a._bound != 0)||(b._bound != 0)) return muscleCompare(a._bound, b._bound);
+      if (a._number != b._number) return muscleCompare(a._number, b._number);
+      return a._string.CompareTo(b._string);
+   }
+
+private:
+   const String _fieldName;
+   OrderStatisticTree<Item> _items;
+   Hashtable<const DataNode *, OrderStatisticTree<Item>::Entry *> _entries;
+};
+
 DataNode :: DataNode()
    : _children(NULL)
    , _orderedIndex(NULL)
+   , _indexEntry(NULL)
+   , _fieldIndexes(NULL)
    , _orderedCounter(0L)
    , _subscribers(NULL)  // _parent and _cachedDataChecksum will be set in Init()/Reset(), not here
 {
@@ -16,19 +157,23 @@ DataNode :: DataNode()
 
 DataNode :: ~DataNode() 
 {
+   DeleteIndex();
+   DeleteFieldIndexes();
    delete _children;
-   delete _orderedIndex;
    delete _subscribers;
 }
 
 void DataNode :: Init(const String & name, const MessageRef & initData)
 {
-   _nodeName           = name;
+   if (_nodeName.SetInterned(name) != B_NO_ERROR) _nodeName = name;  // node names tend to recur across many sessions' subtrees
    _parent             = NULL;
+   _indexEntry         = NULL;
    _depth              = 0;
    _maxChildIDHint     = 0;
    _data               = initData;
    _cachedDataChecksum = 0;
+   _treeStructureChangeCount = 0;
+   _treeDataChangeCount      = 0;
 }
 
 void DataNode :: Reset()
@@ -39,15 +184,19 @@ void DataNode :: Reset()
    // just clearing them.  That will save memory, and also makes a 
    // newly-reset DataNode behavior more like a just-created one
    // (See FogBugz #9845 for details)
+   DeleteIndex();
+   DeleteFieldIndexes();
    delete _children;     _children     = NULL;
-   delete _orderedIndex; _orderedIndex = NULL;
    delete _subscribers;  _subscribers  = NULL;
 
    _parent             = NULL;
+   _indexEntry         = NULL;
    _depth              = 0;
    _maxChildIDHint     = 0;
    _data.Reset();
    _cachedDataChecksum = 0;
+   _treeStructureChangeCount = 0;
+   _treeDataChangeCount      = 0;
 }
 
 void DataNode :: IncrementSubscriptionRefCount(const String & sessionID, long delta)
@@ -79,13 +228,47 @@ void DataNode :: IncrementSubscriptionRefCount(const String & sessionID, long de
    }
 }
 
+void DataNode :: DeleteIndex()
+{
+   if (_orderedIndex)
+   {
+      // Our children mustn't keep pointers into the index after it's gone
+      for (DataNodeIndex::Entry * e = _orderedIndex->GetFirstEntry(); e; e = _orderedIndex->GetNextEntry(e)) e->GetItem()()->_indexEntry = NULL;
+      delete _orderedIndex;
+      _orderedIndex = NULL;
+   }
+}
+
+int32 DataNode :: GetIndexOfChild(const String & childName) const
+{
+   const DataNodeRef * childRef = _children ? _children->Get(&childName) : NULL;
+   const DataNodeIndex::Entry * e = childRef ? childRef->GetItemPointer()->_indexEntry : NULL;
+   return e ? (int32) _orderedIndex->GetIndexOf(e) : -1;
+}
+
+uint32 DataNode :: GetIndexInsertionPoint(const String * optInsertBefore) const
+{
+   const int32 idx = optInsertBefore ? GetIndexOfChild(*optInsertBefore) : -1;
+   return (idx >= 0) ? (uint32)idx : _orderedIndex->GetNumItems();  // default to end of index
+}
+
+status_t DataNode :: InsertIndexEntryAux(uint32 insertIndex, const DataNodeRef & child)
+{
+   if (_orderedIndex == NULL)
+   {
+      _orderedIndex = newnothrow DataNodeIndex;
+      if (_orderedIndex == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+   }
+   return _orderedIndex->InsertItemAt(insertIndex, child, &child()->_indexEntry);
+}
+
 status_t DataNode :: InsertOrderedChild(const MessageRef & data, const String * optInsertBefore, const String * optNodeName, StorageReflectSession * notifyWithOnSetParent, StorageReflectSession * optNotifyChangedData, Hashtable<String, DataNodeRef> * optRetAdded)
 {
    TCHECKPOINT;
 
    if (_orderedIndex == NULL)
    {
-      _orderedIndex = newnothrow Queue<DataNodeRef>;
+      _orderedIndex = newnothrow DataNodeIndex;
       if (_orderedIndex == NULL)
       {
          WARN_OUT_OF_MEMORY; 
@@ -113,23 +296,13 @@ status_t DataNode :: InsertOrderedChild(const MessageRef & data, const String *
       return B_ERROR;
    }
 
-   uint32 insertIndex = _orderedIndex->GetNumItems();  // default to end of index
-   if ((optInsertBefore)&&(optInsertBefore->Cstr()[0] == 'I'))  // only 'I''s could be in our index!
-   {
-      for (int i=_orderedIndex->GetNumItems()-1; i>=0; i--) 
-      {
-         if ((*_orderedIndex)[i]()->GetNodeName() == *optInsertBefore)
-         {
-            insertIndex = i;
-            break;
-         }
-      }
-   }
+   (void) RemoveIndexEntry(*optNodeName, notifyWithOnSetParent);  // in case we're replacing an existing indexed child
+   const uint32 insertIndex = GetIndexInsertionPoint(optInsertBefore);
  
    // Update the index
    if (PutChild(dref, notifyWithOnSetParent, optNotifyChangedData) == B_NO_ERROR)
    {
-      if (_orderedIndex->InsertItemAt(insertIndex, dref) == B_NO_ERROR)
+      if ((dref()->_indexEntry == NULL)&&(InsertIndexEntryAux(insertIndex, dref) == B_NO_ERROR))
       {
          String np;
          if ((optRetAdded)&&(dref()->GetNodePath(np) == B_NO_ERROR)) (void) optRetAdded->Put(np, dref);
@@ -149,7 +322,9 @@ status_t DataNode :: RemoveIndexEntryAt(uint32 removeIndex, StorageReflectSessio
 
    if ((_orderedIndex)&&(removeIndex < _orderedIndex->GetNumItems()))
    {
-      DataNodeRef holdKey = _orderedIndex->RemoveItemAtWithDefault(removeIndex);  // gotta make a temp copy here, or it's dangling pointer time
+      DataNodeRef holdKey;  // gotta make a temp copy here, or it's dangling pointer time
+      (void) _orderedIndex->RemoveItemAt(removeIndex, &holdKey);
+      if (holdKey()) holdKey()->_indexEntry = NULL;
       if ((holdKey())&&(optNotifyWith)) optNotifyWith->NotifySubscribersThatNodeIndexChanged(*this, INDEX_OP_ENTRYREMOVED, removeIndex, holdKey()->GetNodeName());
       return B_NO_ERROR;
    }
@@ -163,14 +338,9 @@ status_t DataNode :: InsertIndexEntryAt(uint32 insertIndex, StorageReflectSessio
    if (_children)
    {
       DataNodeRef childNode;
-      if (_children->Get(&key, childNode) == B_NO_ERROR)
+      if ((_children->Get(&key, childNode) == B_NO_ERROR)&&(childNode()->_indexEntry == NULL))  // a child can only be in the index once
       {
-         if (_orderedIndex == NULL)
-         {
-            _orderedIndex = newnothrow Queue<DataNodeRef>;
-            if (_orderedIndex == NULL) WARN_OUT_OF_MEMORY; 
-         }
-         if ((_orderedIndex)&&(_orderedIndex->InsertItemAt(insertIndex, childNode) == B_NO_ERROR))
+         if (InsertIndexEntryAux(insertIndex, childNode) == B_NO_ERROR)
          {
             // Notify anyone monitoring this node that the ordered-index has been updated
             notifyWithOnSetParent->NotifySubscribersThatNodeIndexChanged(*this, INDEX_OP_ENTRYINSERTED, insertIndex, childNode()->GetNodeName());
@@ -186,24 +356,13 @@ status_t DataNode :: ReorderChild(const DataNodeRef & child, const String * move
    TCHECKPOINT;
 
    // Only do anything if we have an index, and the node isn't going to be moved to before itself (silly) and (child) can be removed from the index
-   if ((_orderedIndex)&&(child())&&((moveToBeforeThis == NULL)||(*moveToBeforeThis != child()->GetNodeName()))&&(RemoveIndexEntry(child()->GetNodeName(), optNotifyWith) == B_NO_ERROR))
+   if ((_orderedIndex)&&(child())&&(child()->_parent == this)&&((moveToBeforeThis == NULL)||(*moveToBeforeThis != child()->GetNodeName()))&&(RemoveIndexEntry(child()->GetNodeName(), optNotifyWith) == B_NO_ERROR))
    {
       // Then re-add him to the index at the appropriate point
-      uint32 targetIndex = _orderedIndex->GetNumItems();  // default to end of index
-      if ((moveToBeforeThis)&&(HasChild(*moveToBeforeThis)))
-      {
-         for (int i=_orderedIndex->GetNumItems()-1; i>=0; i--) 
-         { 
-            if (*moveToBeforeThis == (*_orderedIndex)[i]()->GetNodeName())
-            {
-               targetIndex = i;
-               break; 
-            }
-         }
-      }
+      const uint32 targetIndex = GetIndexInsertionPoint(moveToBeforeThis);
 
       // Now add the child back into the index at his new position
-      if (_orderedIndex->InsertItemAt(targetIndex, child) == B_NO_ERROR)
+      if (InsertIndexEntryAux(targetIndex, child) == B_NO_ERROR)
       {
          // Notify anyone monitoring this node that the ordered-index has been updated
          if (optNotifyWith) optNotifyWith->NotifySubscribersThatNodeIndexChanged(*this, INDEX_OP_ENTRYINSERTED, targetIndex, child()->GetNodeName());
@@ -229,6 +388,19 @@ status_t DataNode :: PutChild(const DataNodeRef & node, StorageReflectSession *
       child->SetParent(this, optNotifyWithOnSetParent);
       DataNodeRef oldNode;
       ret = _children->Put(&child->_nodeName, node, oldNode);
+      if ((ret == B_NO_ERROR)&&(oldNode())&&(oldNode() != child)&&(oldNode()->_indexEntry)&&(child->_indexEntry == NULL))
+      {
+         // The new child takes over the replaced child's slot in our index, so the index never refers to a node that isn't our child
+         child->_indexEntry = oldNode()->_indexEntry;
+         child->_indexEntry->GetItem() = node;
+         oldNode()->_indexEntry = NULL;
+      }
+      if (ret == B_NO_ERROR)
+      {
+         if ((oldNode())&&(oldNode() != child)) RemoveFromFieldIndexes(oldNode());
+         UpdateFieldIndexes(child);
+         GetRootNode()->_treeStructureChangeCount++;
+      }
       if ((ret == B_NO_ERROR)&&(optNotifyChangedData))
       {
          MessageRef oldData; if (oldNode()) oldData = oldNode()->GetData();
@@ -356,7 +528,9 @@ status_t DataNode :: RemoveChild(const String & key, StorageReflectSession * opt
       }
       if (optCurrentNodeCount) (*optCurrentNodeCount)--;
 
+      RemoveFromFieldIndexes(child);
       (void) _children->Remove(&key, childRef);
+      GetRootNode()->_treeStructureChangeCount++;
       return B_NO_ERROR;
    }
    return B_ERROR;
@@ -367,17 +541,16 @@ status_t DataNode :: RemoveIndexEntry(const String & key, StorageReflectSession
    TCHECKPOINT;
 
    // Update our ordered-node index & notify everyone about the change
-   if ((_orderedIndex)&&(key()[0] == 'I'))  // if it doesn't start with I, we know it's not part of our ordered-index!
+   const DataNodeRef * childRef = _children ? _children->Get(&key) : NULL;
+   DataNode * child = childRef ? childRef->GetItemPointer() : NULL;
+   if ((child)&&(child->_indexEntry))
    {
-      for (int i=_orderedIndex->GetNumItems()-1; i>=0; i--)
-      {
-         if (key == (*_orderedIndex)[i]()->GetNodeName())
-         {
-            (void) _orderedIndex->RemoveItemAt(i);
-            if (optNotifyWith) optNotifyWith->NotifySubscribersThatNodeIndexChanged(*this, INDEX_OP_ENTRYREMOVED, i, key);
-            return B_NO_ERROR;
-         }
-      }
+      const uint32 removeIndex = _orderedIndex->GetIndexOf(child->_indexEntry);
+      DataNodeRef holdKey;  // keeps (key) valid until we're done with it, in case it's the child's own name
+      (void) _orderedIndex->RemoveEntry(child->_indexEntry, &holdKey);
+      child->_indexEntry = NULL;
+      if (optNotifyWith) optNotifyWith->NotifySubscribersThatNodeIndexChanged(*this, INDEX_OP_ENTRYREMOVED, removeIndex, key);
+      return B_NO_ERROR;
    }
    return B_ERROR;
 }
@@ -388,9 +561,116 @@ void DataNode :: SetData(const MessageRef & data, StorageReflectSession * optNot
    if (isBeingCreated == false) oldData = _data;
    _data = data;
    _cachedDataChecksum = 0;
+   GetRootNode()->_treeDataChangeCount++;
+   if (_parent) _parent->UpdateFieldIndexes(this);
    if (optNotifyWith) optNotifyWith->NotifySubscribersThatNodeChanged(*this, oldData, false);
 }
 
+status_t DataNode :: AddFieldIndex(const String & fieldName)
+{
+   if (HasFieldIndex(fieldName)) return B_NO_ERROR;
+
+   if (_fieldIndexes == NULL)
+   {
+      _fieldIndexes = newnothrow Hashtable<String, FieldIndex *>;
+      if (_fieldIndexes == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+   }
+
+   FieldIndex * fi = newnothrow FieldIndex(fieldName);
+   if (fi == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+   if (_fieldIndexes->Put(fieldName, fi) != B_NO_ERROR)
+   {
+      delete fi;
+      return B_ERROR;
+   }
+
+   for (DataNodeRefIterator iter = GetChildIterator(); iter.HasData(); iter++) fi->Update(iter.GetValue());
+   return B_NO_ERROR;
+}
+
+status_t DataNode :: RemoveFieldIndex(const String & fieldName)
+{
+   FieldIndex * fi;
+   if ((_fieldIndexes == NULL)||(_fieldIndexes->Remove(fieldName, fi) != B_NO_ERROR)) return B_ERROR;
+   delete fi;
+   return B_NO_ERROR;
+}
+
+void DataNode :: DeleteFieldIndexes()
+{
+   if (_fieldIndexes)
+   {
+      for (HashtableIterator<String, FieldIndex *> iter(*_fieldIndexes); iter.HasData(); iter++) delete iter.GetValue();
+      delete _fieldIndexes;
+      _fieldIndexes = NULL;
+   }
+}
+
+void DataNode :: UpdateFieldIndexes(DataNode * child)
+{
+   if (HasFieldIndexes())
+   {
+      const DataNodeRef * childRef = _children ? _children->Get(&child->_nodeName) : NULL;
+      if ((childRef)&&(childRef->GetItemPointer() == child)) for (HashtableIterator<String, FieldIndex *> iter(*_fieldIndexes); iter.HasData(); iter++) iter.GetValue()->Update(*childRef);
+   }
+}
+
+void DataNode :: RemoveFromFieldIndexes(const DataNode * child)
+{
+   if (_fieldIndexes) for (HashtableIterator<String, FieldIndex *> iter(*_fieldIndexes); iter.HasData(); iter++) iter.GetValue()->Remove(child);
+}
+
+status_t DataNode :: GetFieldIndexCandidates(const QueryFilter & filter, Queue<DataNodeRef> & retCandidates) const
+{
+   if (HasFieldIndexes() == false) return B_ERROR;
+
+   FieldIndex::Key lo, hi;
+   bool gotRange = false;
+   switch(filter.TypeCode())
+   {
+      case QUERY_FILTER_TYPE_INT8:   gotRange = FieldIndex::GetNumericFilterRange<Int8QueryFilter>  (filter, B_INT8_TYPE,   lo, hi); break;
+      case QUERY_FILTER_TYPE_INT16:  gotRange = FieldIndex::GetNumericFilterRange<Int16QueryFilter> (filter, B_INT16_TYPE,  lo, hi); break;
+      case QUERY_FILTER_TYPE_INT32:  gotRange = FieldIndex::GetNumericFilterRange<Int32QueryFilter> (filter, B_INT32_TYPE,  lo, hi); break;
+      case QUERY_FILTER_TYPE_INT64:  gotRange = FieldIndex::GetNumericFilterRange<Int64QueryFilter> (filter, B_INT64_TYPE,  lo, hi); break;
+      case QUERY_FILTER_TYPE_FLOAT:  gotRange = FieldIndex::GetNumericFilterRange<FloatQueryFilter> (filter, B_FLOAT_TYPE,  lo, hi); break;
+      case QUERY_FILTER_TYPE_DOUBLE: gotRange = FieldIndex::GetNumericFilterRange<DoubleQueryFilter>(filter, B_DOUBLE_TYPE, lo, hi); break;
+
+      case QUERY_FILTER_TYPE_STRING:
+      {
+         const StringQueryFilter & sqf = static_cast<const StringQueryFilter &>(filter);
+         if ((sqf.GetIndex() == 0)&&(sqf.IsAssumedDefault() == false))
+         {
+            FieldIndex::Key value(B_STRING_TYPE, 0);
+            value._string = sqf.GetValue();
+            gotRange = FieldIndex::GetRangeForOperator(sqf.GetOperator(), value, lo, hi);
+         }
+      }
+      break;
+
+      case QUERY_FILTER_TYPE_ANDOR:
+      {
+         // In "and" mode, every child must match, so the candidates for any one indexable child will do
+         const AndOrQueryFilter & aqf = static_cast<const AndOrQueryFilter &>(filter);
+         const Queue<ConstQueryFilterRef> & kids = aqf.GetChildren();
+         if ((kids.HasItems())&&(aqf.GetMinMatchCount() >= kids.GetNumItems()))
+         {
+            for (uint32 i=0; i<kids.GetNumItems(); i++) if ((kids[i]())&&(GetFieldIndexCandidates(*kids[i](), retCandidates) == B_NO_ERROR)) return B_NO_ERROR;
+         }
+      }
+      return B_ERROR;
+
+      default:
+         return B_ERROR;
+   }
+   if (gotRange == false) return B_ERROR;
+
+   FieldIndex * const * fi = _fieldIndexes->Get(static_cast<const ValueQueryFilter &>(filter).GetFieldName());
+   if (fi == NULL) return B_ERROR;
+
+   (*fi)->GetRange(lo, hi, retCandidates);
+   return B_NO_ERROR;
+}
+
 uint32 DataNode :: CalculateChecksum(uint32 maxRecursionDepth) const
 {
    // demand-calculate the local checksum and cache the result, since it can be expensive if the Message is big
@@ -399,7 +679,7 @@ uint32 DataNode :: CalculateChecksum(uint32 maxRecursionDepth) const
    else
    {
       uint32 ret = _cachedDataChecksum;
-      if (_orderedIndex) for (int32 i=_orderedIndex->GetNumItems()-1; i>=0; i--) ret += (*_orderedIndex)[i]()->GetNodeName().CalculateChecksum();
+      if (_orderedIndex) for (const DataNodeIndex::Entry * e = _orderedIndex->GetFirstEntry(); e; e = _orderedIndex->GetNextEntry(e)) ret += e->GetItem()()->GetNodeName().CalculateChecksum();
       if (_children) for (HashtableIterator<const String *, DataNodeRef> iter(*_children); iter.HasData(); iter++) ret += iter.GetValue()()->CalculateChecksum(maxRecursionDepth-1);
       return ret;
    }
@@ -419,10 +699,11 @@ void DataNode :: PrintToStream(FILE * optFile, uint32 maxRecursionDepth, int ind
    {
       if (_orderedIndex)
       {
-         for (uint32 i=0; i<_orderedIndex->GetNumItems(); i++)
+         uint32 i = 0;
+         for (const DataNodeIndex::Entry * e = _orderedIndex->GetFirstEntry(); e; e = _orderedIndex->GetNextEntry(e))
          {
             PrintIndent(optFile, indentLevel);
-            fprintf(optFile, "   Index slot " UINT32_FORMAT_SPEC " = %s\n", i, (*_orderedIndex)[i]()->GetNodeName()());
+            fprintf(optFile, "   Index slot " UINT32_FORMAT_SPEC " = %s\n", i++, e->GetItem()()->GetNodeName()());
          }
       }
       if (_children)
@@ -7,6 +7,7 @@
 #include "reflector/StorageReflectConstants.h"
 #include "support/NotCopyable.h"
 #include "regex/PathMatcher.h"
+#include "util/OrderStatisticTree.h"
 
 namespace muscle {
 
@@ -18,6 +19,9 @@ DECLARE_REFTYPES(DataNode);
 /** Iterator type for our child objects */
 typedef HashtableIterator<const String *, DataNodeRef> DataNodeRefIterator;
 
+/** Type of a DataNode's ordered-child index (supports O(log N) insertion, removal and lookup-by-position) */
+typedef OrderStatisticTree<DataNodeRef> DataNodeIndex;
+
 /** Each object of this class represents one node in the server-side data-storage tree.  */
 class DataNode MUSCLE_FINAL_CLASS : public RefCountable, private CountedObject<DataNode>, private NotCopyable
 {
@@ -167,8 +171,14 @@ public:
    /** Returns an iterator that can be used to iterate over our list of active subscribers */
    HashtableIterator<const String *, uint32> GetSubscribers() const {return _subscribers ? _subscribers->GetIterator() : HashtableIterator<const String *, uint32>();}
 
-   /** Returns a pointer to our ordered-child index */
-   const Queue<DataNodeRef> * GetIndex() const {return _orderedIndex;}
+   /** Returns a pointer to our ordered-child index, or NULL if we don't have one. */
+   const DataNodeIndex * GetIndex() const {return _orderedIndex;}
+
+   /** Returns the position of the specified child within our ordered-child index, or -1 if
+     * we don't have a child with that name, or the child isn't in our index.  This is an O(log N) lookup.
+     * @param childName Name of the child node to look up.
+     */
+   int32 GetIndexOfChild(const String & childName) const;
 
    /** Insert a new entry into our ordered-child list at the (nth) entry position.
     *  Don't call this function unless you really know what you are doing!
@@ -188,6 +198,42 @@ public:
     */
    status_t RemoveIndexEntryAt(uint32 removeIndex, StorageReflectSession * optNotifyWith);
 
+   /** Tells this node to maintain a secondary index of its children, sorted by the value of the specified
+     * field in their Messages.  The index is kept up to date as children are added, removed, or have their
+     * data changed, and it lets GetFieldIndexCandidates() find the children that might match a QueryFilter
+     * on that field without having to examine every child.  Only the first value in the field is indexed,
+     * and only if it is a string, or an int8, int16, int32, int64, float or double.
+     * @param fieldName Name of the Message field to index our children by.
+     * @return B_NO_ERROR on success (or if we already had an index on that field), or B_ERROR if out of memory.
+     */
+   status_t AddFieldIndex(const String & fieldName);
+
+   /** Removes the secondary index previously created by AddFieldIndex().
+     * @param fieldName Name of the Message field whose index should be removed.
+     * @return B_NO_ERROR on success, or B_ERROR if we had no index on that field.
+     */
+   status_t RemoveFieldIndex(const String & fieldName);
+
+   /** Returns true iff we have a secondary index on the specified field.
+     * @param fieldName Name of the Message field to check.
+     */
+   bool HasFieldIndex(const String & fieldName) const {return ((_fieldIndexes)&&(_fieldIndexes->ContainsKey(fieldName)));}
+
+   /** Returns true iff we have at least one secondary index on our children. */
+   bool HasFieldIndexes() const {return ((_fieldIndexes)&&(_fieldIndexes->HasItems()));}
+
+   /** Uses our secondary indexes to find the children whose data might match (filter).  Equality and range
+     * comparisons (==, <, <=, >, >=) by a StringQueryFilter or a numeric QueryFilter can be looked up this way,
+     * as can an AndOrQueryFilter operating in "and" mode that has at least one such child filter.
+     * @param filter The QueryFilter to look up candidates for.
+     * @param retCandidates On success, the candidate children are appended to this Queue.  This will be a
+     *                      superset of the children that match (filter), so the caller must still test each
+     *                      candidate against (filter) itself.
+     * @return B_NO_ERROR on success, or B_ERROR if (filter) can't be answered from any of our indexes (in
+     *         which case the caller will need to test all of our children against it).
+     */
+   status_t GetFieldIndexCandidates(const QueryFilter & filter, Queue<DataNodeRef> & retCandidates) const;
+
    /** Returns the largest ID value that this node has seen in one of its children, since the
      * time it was created or last cleared.  Note that child nodes' names are assumed to include
      * their ID value in ASCII format, possible with a preceding letter "I" (for indexed nodes).
@@ -240,6 +286,17 @@ public:
      */
    DataNode * GetRootNode() const {DataNode * r = const_cast<DataNode *>(this); while(r->GetParent()) r = r->GetParent(); return r;}
 
+   /** Returns a counter that is incremented whenever a node is added to or removed from the tree that this node is the root of.
+     * Only meaningful when called on a root node.  Useful for detecting when cached results of a path-matching traversal
+     * (e.g. StorageReflectSession's message routes) have become stale.
+     */
+   uint32 GetTreeStructureChangeCount() const {return _treeStructureChangeCount;}
+
+   /** Returns a counter that is incremented whenever SetData() is called on any node in the tree that this node is the root of.
+     * Only meaningful when called on a root node.  Useful for detecting when cached results of a QueryFilter-ed traversal have become stale.
+     */
+   uint32 GetTreeDataChangeCount() const {return _treeDataChangeCount;}
+
    /** Convenience function:  Given a depth value less than or equal to our depth, returns a pointer to our ancestor node at that depth.
      * @param depth The depth of the node we want returned, relative to the root of the tree.  Zero would be the root node, 
      *              one would be a child of the root node, and so on.
@@ -296,16 +353,28 @@ private:
    void Init(const String & nodeName, const MessageRef & initialValue);
    void SetParent(DataNode * _parent, StorageReflectSession * optNotifyWith);
    status_t RemoveIndexEntry(const String & key, StorageReflectSession * optNotifyWith);
+   status_t InsertIndexEntryAux(uint32 insertIndex, const DataNodeRef & child);
+   void UpdateFieldIndexes(DataNode * child);
+   void RemoveFromFieldIndexes(const DataNode * child);
+   void DeleteFieldIndexes();
+   uint32 GetIndexInsertionPoint(const String * optInsertBefore) const;
+   void DeleteIndex();
 
    DataNode * _parent;
    MessageRef _data;
    mutable uint32 _cachedDataChecksum;
    Hashtable<const String *, DataNodeRef> * _children;  // lazy-allocated
-   Queue<DataNodeRef> * _orderedIndex;  // only used when tracking the ordering of our children (lazy-allocated)
+   DataNodeIndex * _orderedIndex;  // only used when tracking the ordering of our children (lazy-allocated)
+   DataNodeIndex::Entry * _indexEntry;  // our entry in our parent's _orderedIndex, or NULL if we aren't in it
+
+   class FieldIndex;  // defined in DataNode.cpp
+   Hashtable<String, FieldIndex *> * _fieldIndexes;  // secondary indexes on our children's data, keyed by field name (lazy-allocated)
    uint32 _orderedCounter;
    String _nodeName;
    uint32 _depth;  // number of ancestors our node has (e.g. root's _depth is zero)
    uint32 _maxChildIDHint;  // keep track of the largest child ID, for easier allocation of non-conflicting future child IDs
+   uint32 _treeStructureChangeCount;  // only updated on the root node; see GetTreeStructureChangeCount()
+   uint32 _treeDataChangeCount;       // only updated on the root node; see GetTreeDataChangeCount()
 
    Hashtable<const String *, uint32> * _subscribers;  // lazy-allocated
 };
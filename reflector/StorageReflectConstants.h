@@ -33,7 +33,7 @@ enum
    PR_COMMAND_SETDATATREES,       /**< Sets an entire subtree of data from a single Message (Not implemented!) */
    PR_COMMAND_GETDATATREES,       /**< Returns an entire subtree of data as a single Message */
    PR_COMMAND_JETTISONDATATREES,  /**< Removes matching RESULT_DATATREES Messages from the outgoing queue */
-   PR_COMMAND_RESERVED14,         /**< reserved for future expansion */
+   PR_COMMAND_GETAGGREGATE,       /**< Returns a count/sum/min/max/average computed over the matching nodes */
    PR_COMMAND_RESERVED15,         /**< reserved for future expansion */
    PR_COMMAND_RESERVED16,         /**< reserved for future expansion */
    PR_COMMAND_RESERVED17,         /**< reserved for future expansion */
@@ -59,7 +59,7 @@ enum
    PR_RESULT_PONG,               /**< Response from a PR_COMMAND_PING message */
    PR_RESULT_ERRORACCESSDENIED,  /**< Your client isn't allowed to do something it tried to do */
    PR_RESULT_DATATREES,          /**< Reply to a PR_COMMAND_GETDATATREES message */
-   PR_RESULT_RESERVED5,          /**< reserved for future expansion */
+   PR_RESULT_AGGREGATE,          /**< Reply to a PR_COMMAND_GETAGGREGATE message */
    PR_RESULT_RESERVED6,          /**< reserved for future expansion */
    PR_RESULT_RESERVED7,          /**< reserved for future expansion */
    PR_RESULT_RESERVED8,          /**< reserved for future expansion */
@@ -130,6 +130,15 @@ enum
 #define PR_NAME_TREE_REQUEST_ID            "!TRid"      /**< Identifier field for associating PR_RESULT_DATATREES replies with PR_COMMAND_GETDATATREE commands */
 #define PR_NAME_REPLY_ENCODING             "!Enc"       /**< Parameter name holding int32 of MUSCLE_MESSAGE_ENCODING_* used to send to client */
 #define PR_NAME_MAXDEPTH                   "!MDep"      /**< If present as an int32 in PR_COMMAND_GETDATATREES, returned trees will be clipped to this maximum depth. (0==roots only) */
+#define PR_NAME_AGGREGATE_OP               "!AgOp"      /**< String in PR_COMMAND_GETAGGREGATE:  "count", "sum", "min", "max" or "avg" */
+#define PR_NAME_AGGREGATE_FIELD            "!AgFd"      /**< String in PR_COMMAND_GETAGGREGATE:  name of the numeric node-Message field to aggregate (not needed for "count") */
+#define PR_NAME_AGGREGATE_GROUP_BY         "!AgGb"      /**< String in PR_COMMAND_GETAGGREGATE:  if present, results are computed separately for each value of this node-Message field */
+#define PR_NAME_AGGREGATE_COUNT            "!AgCt"      /**< int64 in PR_RESULT_AGGREGATE:  number of nodes that were aggregated */
+#define PR_NAME_AGGREGATE_RESULT           "!AgRs"      /**< int64 or double in PR_RESULT_AGGREGATE:  the computed sum/min/max/average (absent for "count", or if there were no values).  int64 if all the values were integers (except for "avg") */
+#define PR_NAME_AGGREGATE_GROUPS           "!AgGr"      /**< Message in PR_RESULT_AGGREGATE:  holds one sub-Message (with count, result and group-value fields) per group-by value */
+#define PR_NAME_AGGREGATE_GROUP_VALUE      "!AgGv"      /**< String, int64 or double in each PR_NAME_AGGREGATE_GROUPS sub-Message:  the group-by value that the sub-Message's results are for */
+#define PR_NAME_PROJECTION                 "!Proj"      /**< String:  one or more field names (or wildcard patterns); if present in PR_COMMAND_GETDATA or alongside SUBSCRIBE: parameters, only matching fields of the node Messages are returned */
+#define PR_NAME_MIN_UPDATE_INTERVAL        "!MnUI"      /**< int64:  if present alongside SUBSCRIBE: parameters, the minimum number of microseconds between subscription updates for any one node */
 
 // Names in the output message generated by StorageReflectSession::SaveNodeTreeToMessage() */
 #define PR_NAME_NODEDATA      "data"   /**< this submessage is the payload of the current node */
@@ -174,6 +183,18 @@ enum
 //                           or any time a new node is added that matches the path, another 
 //                           PR_RESULT_DATAITEMS message will be sent to notify the client of
 //                           the change.
+//                           If the same PR_COMMAND_SETPARAMETERS message also contains a
+//                           PR_NAME_PROJECTION field (one or more field names or wildcard
+//                           patterns), the node Messages sent for the SUBSCRIBE: paths in that
+//                           message will contain only the matching fields.  (If a node matches
+//                           several subscriptions with different projections, or any
+//                           subscription without one, the entire node Message is sent)
+//                           Similarly, if the message contains a PR_NAME_MIN_UPDATE_INTERVAL int64
+//                           field, then updates for any given node matching those SUBSCRIBE: paths
+//                           will be sent no more often than once per that many microseconds; if the
+//                           node changes more often than that, only its most recent state is sent
+//                           when the interval has elapsed.  (If a node matches several such
+//                           subscriptions, the shortest interval applies)
 //
 //      PR_NAME_KEYS : If set, any non-"special" messages without a
 //                     PR_NAME_KEYS field will be reflected to clients
@@ -203,7 +224,9 @@ enum
 //                               value to be used by the session when sending data back to the client.
 //                               If unset, the default value (MUSCLE_MESSAGE_ENCODING_DEFAULT) is used.
 //                               Setting this parameter is useful if you want the server to compress
-//                               the data it sends back to your client.
+//                               the data it sends back to your client.  MUSCLE_MESSAGE_ENCODING_LZ4
+//                               is the cheapest choice for fast links; the MUSCLE_MESSAGE_ENCODING_ZLIB_*
+//                               encodings compress better but use more CPU.
 //      
 //
 // if 'what' is PR_COMMAND_GETPARAMETERS:
@@ -246,7 +269,28 @@ enum
 //    Each matching message is added with its full path as a field name.  
 //    A PR_NAME_FILTERS field may be added to further limit the nodes matched
 //    by the PR_NAME_KEYS field.
+//    A PR_NAME_PROJECTION field (one or more field names or wildcard patterns)
+//    may be added to have each returned node Message contain only the matching fields.
 // 
+// if 'what' is PR_COMMAND_GETAGGREGATE:
+//    Selects nodes the same way PR_COMMAND_GETDATA does (via PR_NAME_KEYS and
+//    optional PR_NAME_FILTERS fields), but instead of returning the nodes, computes
+//    the aggregate given in the PR_NAME_AGGREGATE_OP string ("count", "sum", "min",
+//    "max" or "avg") over the numeric field named in PR_NAME_AGGREGATE_FIELD, and
+//    returns only the result, in a PR_RESULT_AGGREGATE message.  The reply contains
+//    the fields of the command message (minus PR_NAME_FILTERS), plus PR_NAME_AGGREGATE_COUNT
+//    (the number of nodes aggregated) and PR_NAME_AGGREGATE_RESULT (the computed value).
+//    Integer values are summed exactly, as int64s; the result is an int64 if all the
+//    aggregated values were integers (except for "avg", which is always a double).
+//    Nodes that don't have the named field (as any numeric type) are ignored, except by "count".
+//    If a PR_NAME_AGGREGATE_GROUP_BY field name is specified, the results are instead
+//    computed separately for each distinct value (and type) of that field, and returned as
+//    sub-Messages of the PR_NAME_AGGREGATE_GROUPS Message, one per group-by value.  Each
+//    sub-Message is stored under the group-by value's text, and also holds the value itself
+//    (as a String, int64 or double) in its PR_NAME_AGGREGATE_GROUP_VALUE field.
+//    Nodes that don't have the group-by field are ignored in that case.
+//    If the command can't be parsed, it is bounced back in a PR_RESULT_ERRORUNIMPLEMENTED message.
+//
 // if 'what' is PR_COMMAND_INSERTORDEREDDATA:
 //    The session looks for one or more messages in the PR_NAME_KEYS field.  Each
 //    string represents a wildpath, rooted at this session's node (read: no leading
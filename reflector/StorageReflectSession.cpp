@@ -10,11 +10,26 @@ namespace muscle {
 #define DEFAULT_PATH_PREFIX "*/*"  // when we get a path name without a leading '/', prepend this
 #define DEFAULT_MAX_SUBSCRIPTION_MESSAGE_SIZE   50   // no more than 50 items/update message, please
 
+#ifndef MUSCLE_STORAGE_REFLECT_SESSION_MAX_CACHED_ROUTES
+# define MUSCLE_STORAGE_REFLECT_SESSION_MAX_CACHED_ROUTES 64  // max number of resolved message routes each session remembers
+#endif
+
 // field under which we file our shared data in the central-state message
 static const String SRS_SHARED_DATA = "srs_shared";
 
+// Pre-hashed keys for the field names that are looked up for every incoming command or node update
+static const FieldKey FK_KEYS(PR_NAME_KEYS);
+static const FieldKey FK_REMOVED_DATAITEMS(PR_NAME_REMOVED_DATAITEMS);
+static const FieldKey FK_PRIVILEGE_BITS(PR_NAME_PRIVILEGE_BITS);
+static const FieldKey FK_TREE_REQUEST_ID(PR_NAME_TREE_REQUEST_ID);
+static const FieldKey FK_SET_QUIETLY(PR_NAME_SET_QUIETLY);
+static const FieldKey FK_NODEDATA(PR_NAME_NODEDATA);
+static const FieldKey FK_NODEINDEX(PR_NAME_NODEINDEX);
+static const FieldKey FK_NODECHILDREN(PR_NAME_NODECHILDREN);
+
 StorageReflectSessionFactory :: StorageReflectSessionFactory()
    : _maxIncomingMessageSize(MUSCLE_NO_LIMIT)
+   , _incomingSpoolThreshold(MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD)
 {
    // empty
 }
@@ -34,12 +49,17 @@ AbstractReflectSessionRef StorageReflectSessionFactory :: CreateSession(const St
 
 status_t StorageReflectSessionFactory :: SetMaxIncomingMessageSizeFor(AbstractReflectSession * session) const
 {
-   if (_maxIncomingMessageSize != MUSCLE_NO_LIMIT) 
+   if ((_maxIncomingMessageSize != MUSCLE_NO_LIMIT)||(_incomingSpoolThreshold != MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD)||(_incomingSpoolDirectory.HasChars()))
    {
       if (session->GetGateway()() == NULL) session->SetGateway(session->CreateGateway());
       MessageIOGateway * gw = dynamic_cast<MessageIOGateway*>(session->GetGateway()());
-      if (gw) gw->SetMaxIncomingMessageSize(_maxIncomingMessageSize);
-         else return B_ERROR;
+      if (gw)
+      {
+         gw->SetMaxIncomingMessageSize(_maxIncomingMessageSize);
+         gw->SetIncomingMessageSpoolThreshold(_incomingSpoolThreshold);
+         gw->SetIncomingMessageSpoolDirectory(_incomingSpoolDirectory);
+      }
+      else return B_ERROR;
    }
    return B_NO_ERROR;
 }
@@ -48,6 +68,8 @@ StorageReflectSession ::
 StorageReflectSession() : 
    _parameters(PR_RESULT_PARAMETERS), 
    _sharedData(NULL),
+   _routeCacheStructureChangeCount(0),
+   _nextThrottledUpdateTime(MUSCLE_TIME_NEVER),
    _subscriptionsEnabled(true), 
    _maxSubscriptionMessageItems(DEFAULT_MAX_SUBSCRIPTION_MESSAGE_SIZE), 
    _indexingPresent(false),
@@ -197,6 +219,8 @@ Cleanup()
 
    if (_sharedData)
    {
+      SendPendingNodeChanges();  // since some of them may have come from us
+
       DataNodeRef hostNodeRef;
       if (GetGlobalRoot().GetChild(GetHostName(), hostNodeRef) == B_NO_ERROR)
       {
@@ -230,6 +254,11 @@ Cleanup()
    }
    _nextSubscriptionMessage.Reset();
    _nextIndexSubscriptionMessage.Reset();
+   _routeCache.Clear();
+   _subscriptionOptions.Clear();
+   _throttledUpdates.Clear();
+   _heldBackUpdates.Clear();
+   _nextThrottledUpdateTime = MUSCLE_TIME_NEVER;
 
    TCHECKPOINT;
 }
@@ -240,6 +269,54 @@ NotifySubscribersThatNodeChanged(DataNode & modifiedNode, const MessageRef & old
 {
    TCHECKPOINT;
 
+   Hashtable<DataNode *, PendingNodeChange> & pending = _sharedData->_pendingNodeChanges;
+   const PendingNodeChange * pc = pending.Get(&modifiedNode);
+   if ((pc)&&((isBeingRemoved)||(pc->_notifier != this)))
+   {
+      // These changes can't be merged, so the earlier one has to go out first
+      SendPendingNodeChange(modifiedNode);
+      pc = NULL;
+   }
+
+   if (isBeingRemoved) NotifySubscribersThatNodeChangedAux(modifiedNode, oldData, true);
+   else if ((pc == NULL)&&(modifiedNode.GetSubscribers().HasData()))
+   {
+      // Record the change; subscribers will hear about it (and any further changes to this node) in PushSubscriptionMessages()
+      if (pending.Put(&modifiedNode, PendingNodeChange(DataNodeRef(&modifiedNode), oldData, this)) != B_NO_ERROR) NotifySubscribersThatNodeChangedAux(modifiedNode, oldData, false);
+   }
+
+   TCHECKPOINT;
+}
+
+void
+StorageReflectSession ::
+SendPendingNodeChange(DataNode & node)
+{
+   PendingNodeChange pc;
+   if (_sharedData->_pendingNodeChanges.Remove(&node, pc) == B_NO_ERROR) pc._notifier->NotifySubscribersThatNodeChangedAux(*pc._node(), pc._oldData, false);
+}
+
+void
+StorageReflectSession ::
+SendPendingNodeChanges()
+{
+   TCHECKPOINT;
+
+   Hashtable<DataNode *, PendingNodeChange> & pending = _sharedData->_pendingNodeChanges;
+   while(pending.HasItems())
+   {
+      DataNode * node;
+      PendingNodeChange pc;
+      if (pending.RemoveFirst(node, pc) == B_NO_ERROR) pc._notifier->NotifySubscribersThatNodeChangedAux(*pc._node(), pc._oldData, false);
+   }
+}
+
+void 
+StorageReflectSession ::
+NotifySubscribersThatNodeChangedAux(DataNode & modifiedNode, const MessageRef & oldData, bool isBeingRemoved)
+{
+   TCHECKPOINT;
+
    for (HashtableIterator<const String *, uint32> subIter = modifiedNode.GetSubscribers(); subIter.HasData(); subIter++)
    {
       StorageReflectSession * next = dynamic_cast<StorageReflectSession *>(GetSession(*subIter.GetKey())());
@@ -271,6 +348,8 @@ NotifySubscribersOfNewNode(DataNode & newNode)
 {
    TCHECKPOINT;
 
+   if (_sharedData->_fieldIndexPaths.HasItems()) AddDeclaredFieldIndexes(newNode);
+
    for (HashtableIterator<const String *, AbstractReflectSessionRef> iter(GetSessions()); iter.HasData(); iter++)
    {
       StorageReflectSession * next = dynamic_cast<StorageReflectSession *>(iter.GetValue()());
@@ -280,6 +359,21 @@ NotifySubscribersOfNewNode(DataNode & newNode)
    TCHECKPOINT;
 }
 
+uint64
+StorageReflectSession ::
+GetPulseTime(const PulseArgs & args)
+{
+   return muscleMin(DumbReflectSession::GetPulseTime(args), _nextThrottledUpdateTime);
+}
+
+void
+StorageReflectSession ::
+Pulse(const PulseArgs & args)
+{
+   DumbReflectSession::Pulse(args);
+   if ((_sharedData)&&(args.GetCallbackTime() >= _nextThrottledUpdateTime)) SendHeldBackSubscriptionUpdates(args.GetCallbackTime());
+}
+
 void
 StorageReflectSession ::
 NodeCreated(DataNode & newNode)
@@ -345,9 +439,26 @@ NodeChangedAux(DataNode & modifiedNode, const MessageRef & nodeData, bool isBein
                PushSubscriptionMessages();
                NodeChangedAux(modifiedNode, nodeData, isBeingRemoved);  // and then start again
             }
-            else _nextSubscriptionMessage()->AddString(PR_NAME_REMOVED_DATAITEMS, np);
+            else 
+            {
+               if (_throttledUpdates.HasItems())
+               {
+                  // any held-back update for this node is moot now
+                  (void) _throttledUpdates.Remove(np);
+                  (void) _heldBackUpdates.Remove(np);
+               }
+               _nextSubscriptionMessage()->AddString(FK_REMOVED_DATAITEMS, np);
+            }
+         }
+         else 
+         {
+            const FieldProjection * projection = NULL;
+            uint64 minUpdateInterval = 0;
+            if (_subscriptionOptions.HasItems()) GetSubscriptionOptions(modifiedNode, projection, minUpdateInterval);
+
+            MessageRef data = projection ? GetProjectedData(*projection, nodeData) : nodeData;
+            if ((minUpdateInterval == 0)||(HoldBackSubscriptionUpdate(np, data, minUpdateInterval) == false)) _nextSubscriptionMessage()->AddMessage(np, data);
          }
-         else _nextSubscriptionMessage()->AddMessage(np, nodeData);
       }
       if (_nextSubscriptionMessage()->GetNumNames() >= _maxSubscriptionMessageItems) PushSubscriptionMessages(); 
    }
@@ -437,7 +548,7 @@ bool
 StorageReflectSession ::
 HasPrivilege(int priv) const
 {
-   return ((_parameters.GetInt32(PR_NAME_PRIVILEGE_BITS) & (1<<priv)) != 0);
+   return ((_parameters.GetInt32(FK_PRIVILEGE_BITS) & (1<<priv)) != 0);
 }
 
 void
@@ -482,10 +593,10 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
       {
          case PR_COMMAND_JETTISONDATATREES:
          {
-            if (msg.HasName(PR_NAME_TREE_REQUEST_ID, B_STRING_TYPE)) 
+            if (msg.HasName(FK_TREE_REQUEST_ID, B_STRING_TYPE)) 
             {
                const String * str;
-               for (int32 i=0; msg.FindString(PR_NAME_TREE_REQUEST_ID, i, &str) == B_NO_ERROR; i++) JettisonOutgoingSubtrees(str);
+               for (int32 i=0; msg.FindString(FK_TREE_REQUEST_ID, i, &str) == B_NO_ERROR; i++) JettisonOutgoingSubtrees(str);
             }
             else JettisonOutgoingSubtrees(NULL);
          }
@@ -497,11 +608,11 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
 
          case PR_COMMAND_GETDATATREES:
          {
-            const String * id = NULL; (void) msg.FindString(PR_NAME_TREE_REQUEST_ID, &id);
+            const String * id = NULL; (void) msg.FindString(FK_TREE_REQUEST_ID, &id);
             MessageRef reply = GetMessageFromPool(PR_RESULT_DATATREES);
-            if ((reply())&&((id==NULL)||(reply()->AddString(PR_NAME_TREE_REQUEST_ID, *id) == B_NO_ERROR)))
+            if ((reply())&&((id==NULL)||(reply()->AddString(FK_TREE_REQUEST_ID, *id) == B_NO_ERROR)))
             {
-               if (msg.HasName(PR_NAME_KEYS, B_STRING_TYPE)) 
+               if (msg.HasName(FK_KEYS, B_STRING_TYPE)) 
                {
                   int32 maxDepth = -1;  (void) msg.FindInt32(PR_NAME_MAXDEPTH, maxDepth);
 
@@ -531,7 +642,7 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
          {
             if (HasPrivilege(PR_PRIVILEGE_KICK))
             { 
-               if (msg.HasName(PR_NAME_KEYS, B_STRING_TYPE)) 
+               if (msg.HasName(FK_KEYS, B_STRING_TYPE)) 
                {
                   NodePathMatcher matcher;
                   (void) matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, msg, DEFAULT_PATH_PREFIX);
@@ -565,6 +676,21 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
             bool updateDefaultMessageRoute = false;
             bool subscribeQuietly = msg.HasName(PR_NAME_SUBSCRIBE_QUIETLY);
             Message getMsg(PR_COMMAND_GETDATA);
+
+            // If a projection was specified, it applies to all of the SUBSCRIBE: fields in this Message
+            FieldProjectionRef projection;
+            if (msg.HasName(PR_NAME_PROJECTION, B_STRING_TYPE))
+            {
+               projection.SetRef(newnothrow FieldProjection);
+               if (projection() == NULL) WARN_OUT_OF_MEMORY;
+               else if (projection()->SetFromMessage(msg) == B_NO_ERROR) (void) msg.CopyName(PR_NAME_PROJECTION, getMsg);
+               else projection.Reset();
+            }
+
+            // Likewise for a minimum interval between updates of any given node
+            int64 minUpdateInterval = 0;
+            if ((msg.FindInt64(PR_NAME_MIN_UPDATE_INTERVAL, minUpdateInterval) != B_NO_ERROR)||(minUpdateInterval < 0)) minUpdateInterval = 0;
+
             for (MessageFieldNameIterator it = msg.GetFieldNameIterator(); it.HasData(); it++)
             {
                const String & fn = it.GetFieldName();
@@ -609,7 +735,8 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
                         (void) temp.DoTraversal((PathMatchCallback)DoSubscribeRefCallbackFunc, this, GetGlobalRoot(), false, &incrementOne);
                      }
                   }
-                  if ((subscribeQuietly == false)&&(getMsg.AddString(PR_NAME_KEYS, path) == B_NO_ERROR))
+                  SetSubscriptionOptions(fixPath, projection, minUpdateInterval);
+                  if ((subscribeQuietly == false)&&(getMsg.AddString(FK_KEYS, path) == B_NO_ERROR))
                   {
                      // We have to have a filter message to match each string, to prevent "bleed-down" of earlier
                      // filters matching later strings.  So add a dummy filter Message if we don't have an actual one.
@@ -626,10 +753,10 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
                }
                else if ((fn == PR_NAME_KEYS)||(fn == PR_NAME_FILTERS))
                {
-                  msg.MoveName(fn, _defaultMessageRouteMessage);
+                  (void) msg.CopyName(fn, _defaultMessageRouteMessage);  // copied, not moved, so that it also goes into _parameters below
                   updateDefaultMessageRoute = true;
                }
-               else if (fn == PR_NAME_SUBSCRIBE_QUIETLY)
+               else if ((fn == PR_NAME_SUBSCRIBE_QUIETLY)||(fn == PR_NAME_PROJECTION)||(fn == PR_NAME_MIN_UPDATE_INTERVAL))
                {
                   // don't add this to the parameter set; it's just an "argument" for the SUBSCRIBE: fields.
                   copyField = false;
@@ -726,7 +853,7 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
          {
             bool updateDefaultMessageRoute = false;
             const String * nextName;
-            for (int i=0; msg.FindString(PR_NAME_KEYS, i, &nextName) == B_NO_ERROR; i++) 
+            for (int i=0; msg.FindString(FK_KEYS, i, &nextName) == B_NO_ERROR; i++) 
             {
                // Search the parameters message for all parameters that match (nextName)...
                StringMatcher matcher;
@@ -745,7 +872,7 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
 
          case PR_COMMAND_SETDATA:
          {
-            bool quiet = msg.HasName(PR_NAME_SET_QUIETLY);
+            bool quiet = msg.HasName(FK_SET_QUIETLY);
             for (MessageFieldNameIterator it = msg.GetFieldNameIterator(B_MESSAGE_TYPE); it.HasData(); it++)
             {
                MessageRef dataMsgRef;
@@ -770,7 +897,7 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
                   if (msg.FindString(iter.GetFieldName(), &value) == B_NO_ERROR)
                   {
                      Message temp;
-                     temp.AddString(PR_NAME_KEYS, iter.GetFieldName());
+                     temp.AddString(FK_KEYS, iter.GetFieldName());
 
                      NodePathMatcher matcher;
                      (void) matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, temp, NULL);
@@ -785,6 +912,10 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
             DoGetData(msg);
          break;
 
+         case PR_COMMAND_GETAGGREGATE:
+            if (DoGetAggregate(msg) != B_NO_ERROR) BounceMessage(PR_RESULT_ERRORUNIMPLEMENTED, msgRef);
+         break;
+
          case PR_COMMAND_REMOVEDATA:
          {
             NodePathMatcher matcher;
@@ -801,7 +932,7 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
 
          case PR_COMMAND_JETTISONRESULTS:
          {
-            if (msg.HasName(PR_NAME_KEYS, B_STRING_TYPE))
+            if (msg.HasName(FK_KEYS, B_STRING_TYPE))
             {
                NodePathMatcher matcher;
                matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, msg, DEFAULT_PATH_PREFIX);
@@ -830,15 +961,43 @@ MessageReceivedFromGateway(const MessageRef & msgRef, void * userData)
       (void) msg.ReplaceString(false, PR_NAME_SESSION, GetSessionIDString());
 
       // what code not in our reserved range:  must be a client-to-client message
-      if (msg.HasName(PR_NAME_KEYS, B_STRING_TYPE)) 
+      if (msg.HasName(FK_KEYS, B_STRING_TYPE)) 
       {
-         NodePathMatcher matcher;
-         (void) matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, msg, DEFAULT_PATH_PREFIX);
-         (void) matcher.DoTraversal((PathMatchCallback)PassMessageCallbackFunc, this, GetGlobalRoot(), true, const_cast<MessageRef *>(&msgRef));
+         if (msg.HasName(PR_NAME_FILTERS))
+         {
+            // Per-message QueryFilters are too varied to be worth caching, so we just do the traversal
+            NodePathMatcher matcher;
+            (void) matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, msg, DEFAULT_PATH_PREFIX);
+            (void) matcher.DoTraversal((PathMatchCallback)PassMessageCallbackFunc, this, GetGlobalRoot(), true, const_cast<MessageRef *>(&msgRef));
+         }
+         else
+         {
+            // The route key is the list of key strings, each one length-prefixed so that different lists can't collide
+            String routeKey = "k";
+            const String * key;
+            for (uint32 i=0; msg.FindString(PR_NAME_KEYS, i, &key) == B_NO_ERROR; i++)
+            {
+               char buf[32]; muscleSprintf(buf, UINT32_FORMAT_SPEC ":", key->Length());
+               routeKey += buf;
+               routeKey += *key;
+            }
+
+            CachedRouteRef route = GetCachedRoute(routeKey, NULL);
+            if (route() == NULL)
+            {
+               NodePathMatcher matcher;
+               (void) matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, msg, DEFAULT_PATH_PREFIX);
+               route = ComputeRoute(routeKey, matcher, ConstQueryFilterRef());
+            }
+            if (route()) SendMessageAlongRoute(*route(), msgRef, IsRoutingFlagSet(MUSCLE_ROUTING_FLAG_REFLECT_TO_SELF));
+         }
       }
-      else if (_parameters.HasName(PR_NAME_KEYS, B_STRING_TYPE)) 
+      else if (_parameters.HasName(FK_KEYS, B_STRING_TYPE)) 
       {
-         (void) _defaultMessageRoute.DoTraversal((PathMatchCallback)PassMessageCallbackFunc, this, GetGlobalRoot(), true, const_cast<MessageRef *>(&msgRef));
+         static const String _defaultRouteKey = "d";
+         CachedRouteRef route = GetCachedRoute(_defaultRouteKey, NULL);
+         if (route() == NULL) route = ComputeRoute(_defaultRouteKey, _defaultMessageRoute, ConstQueryFilterRef());
+         if (route()) SendMessageAlongRoute(*route(), msgRef, IsRoutingFlagSet(MUSCLE_ROUTING_FLAG_REFLECT_TO_SELF));
       }
       else DumbReflectSession::MessageReceivedFromGateway(msgRef, userData);
    }
@@ -850,40 +1009,65 @@ void StorageReflectSession :: UpdateDefaultMessageRoute()
 {
    _defaultMessageRoute.Clear();
    _defaultMessageRoute.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, _defaultMessageRouteMessage, DEFAULT_PATH_PREFIX);
+   (void) _routeCache.Remove("d");  // the cached default route is now out of date
 }
 
-/** A little bitty class just to hold the find-sessions-traversal's results properly */
-class FindMatchingSessionsData
+bool StorageReflectSession :: IsRouteCurrent(const CachedRoute & route) const
 {
-public:
-   FindMatchingSessionsData(Hashtable<const String *, AbstractReflectSessionRef> & results, uint32 maxResults)
-      : _results(results)
-      , _ret(B_NO_ERROR)
-      , _maxResults(maxResults)
+   const DataNode & root = GetGlobalRoot();
+   return ((route._structureChangeCount == root.GetTreeStructureChangeCount())&&((route._usesFilters == false)||(route._dataChangeCount == root.GetTreeDataChangeCount())));
+}
+
+StorageReflectSession::CachedRouteRef StorageReflectSession :: GetCachedRoute(const String & routeKey, const QueryFilter * optFilter) const
+{
+   if (_routeCache.IsEmpty()) return CachedRouteRef();
+
+   const uint32 structureChangeCount = GetGlobalRoot().GetTreeStructureChangeCount();
+   if (structureChangeCount != _routeCacheStructureChangeCount)
    {
-      // empty
+      // Every route computed before the change is stale now, so we might as well get rid of them all at once
+      _routeCacheStructureChangeCount = structureChangeCount;
+      for (HashtableIterator<String, CachedRouteRef> iter(_routeCache); iter.HasData(); iter++) if (IsRouteCurrent(*iter.GetValue()()) == false) (void) _routeCache.Remove(iter.GetKey());
    }
 
-   Hashtable<const String *, AbstractReflectSessionRef> & _results;
-   status_t _ret;
-   uint32 _maxResults;
-};
-
-AbstractReflectSessionRef StorageReflectSession :: FindMatchingSession(const String & nodePath, const ConstQueryFilterRef & filter, bool matchSelf) const
-{
-   AbstractReflectSessionRef ret;
-   Hashtable<const String *, AbstractReflectSessionRef> results;
-   if ((FindMatchingSessions(nodePath, filter, results, matchSelf, 1) == B_NO_ERROR)&&(results.HasItems())) ret = results.GetFirstValueWithDefault();
-   return ret;
+   const CachedRouteRef * r = _routeCache.Get(routeKey);
+   if (r)
+   {
+      const CachedRoute * route = r->GetItemPointer();
+      if ((route->_filter() == optFilter)&&(IsRouteCurrent(*route))) return *r;
+      (void) _routeCache.Remove(routeKey);  // stale, so get rid of it
+   }
+   return CachedRouteRef();
 }
 
-status_t StorageReflectSession :: FindMatchingSessions(const String & nodePath, const ConstQueryFilterRef & filter, Hashtable<const String *, AbstractReflectSessionRef> & retSessions, bool includeSelf, uint32 maxResults) const
+StorageReflectSession::CachedRouteRef StorageReflectSession :: ComputeRoute(const String & routeKey, NodePathMatcher & matcher, const ConstQueryFilterRef & optFilter) const
 {
    TCHECKPOINT;
 
-   status_t ret = B_NO_ERROR;
+   CachedRouteRef route(newnothrow CachedRoute);
+   if (route() == NULL) {WARN_OUT_OF_MEMORY; return CachedRouteRef();}
 
-   if (nodePath.HasChars())
+   const DataNode & root = GetGlobalRoot();
+   route()->_filter               = optFilter;
+   route()->_usesFilters          = (matcher.GetNumFilters() > 0);
+   route()->_structureChangeCount = root.GetTreeStructureChangeCount();
+   route()->_dataChangeCount      = root.GetTreeDataChangeCount();
+   (void) matcher.DoTraversal((PathMatchCallback)RecordRouteCallbackFunc, const_cast<StorageReflectSession *>(this), GetGlobalRoot(), true, route());
+   if (route()->_ret != B_NO_ERROR) return CachedRouteRef();  // out of memory; better to fail than to deliver to only some of the targets
+
+   if (MUSCLE_STORAGE_REFLECT_SESSION_MAX_CACHED_ROUTES > 0)
+   {
+      while(_routeCache.GetNumItems() >= MUSCLE_STORAGE_REFLECT_SESSION_MAX_CACHED_ROUTES) (void) _routeCache.RemoveFirst();  // the oldest route goes first
+      (void) _routeCache.Put(routeKey, route);
+   }
+   return route;
+}
+
+StorageReflectSession::CachedRouteRef StorageReflectSession :: GetRouteForPath(const String & nodePath, const ConstQueryFilterRef & filter) const
+{
+   const String routeKey = nodePath.Prepend("s");
+   CachedRouteRef route = GetCachedRoute(routeKey, filter());
+   if (route() == NULL)
    {
       const char * s;
       String temp;
@@ -895,11 +1079,51 @@ status_t StorageReflectSession :: FindMatchingSessions(const String & nodePath,
       }
 
       NodePathMatcher matcher;
-      if (matcher.PutPathString(s, filter) == B_NO_ERROR)
+      if (matcher.PutPathString(s, filter) == B_NO_ERROR) route = ComputeRoute(routeKey, matcher, filter);
+   }
+   return route;
+}
+
+void StorageReflectSession :: SendMessageAlongRoute(const CachedRoute & route, const MessageRef & msgRef, bool includeSelf)
+{
+   for (uint32 i=0; i<route._sessionIDs.GetNumItems(); i++)
+   {
+      AbstractReflectSessionRef sref = GetSession(route._sessionIDs[i]);
+      StorageReflectSession * next = static_cast<StorageReflectSession *>(sref());  // RecordRouteCallback() only records StorageReflectSessions
+      if ((next)&&((next != this)||(includeSelf)))
       {
-         FindMatchingSessionsData data(retSessions, maxResults);
-         (void) matcher.DoTraversal((PathMatchCallback)FindSessionsCallbackFunc, const_cast<StorageReflectSession*>(this), GetGlobalRoot(), true, &data);
-         ret = data._ret;
+         // If a recipient changed the tree's structure, the remaining nodes may be gone, so we can't pass them along any more
+         DataNode * node = (route._structureChangeCount == GetGlobalRoot().GetTreeStructureChangeCount()) ? route._nodes[i] : NULL;
+         next->MessageReceivedFromSession(*this, msgRef, node);
+      }
+   }
+}
+
+AbstractReflectSessionRef StorageReflectSession :: FindMatchingSession(const String & nodePath, const ConstQueryFilterRef & filter, bool matchSelf) const
+{
+   AbstractReflectSessionRef ret;
+   Hashtable<const String *, AbstractReflectSessionRef> results;
+   if ((FindMatchingSessions(nodePath, filter, results, matchSelf, 1) == B_NO_ERROR)&&(results.HasItems())) ret = results.GetFirstValueWithDefault();
+   return ret;
+}
+
+status_t StorageReflectSession :: FindMatchingSessions(const String & nodePath, const ConstQueryFilterRef & filter, Hashtable<const String *, AbstractReflectSessionRef> & retSessions, bool includeSelf, uint32 maxResults) const
+{
+   TCHECKPOINT;
+
+   status_t ret = B_NO_ERROR;
+
+   if (nodePath.HasChars())
+   {
+      ConstCachedRouteRef route = GetRouteForPath(nodePath, filter);
+      if (route())
+      {
+         const Queue<String> & sessionIDs = route()->_sessionIDs;
+         for (uint32 i=0; (i<sessionIDs.GetNumItems())&&(retSessions.GetNumItems() < maxResults); i++)
+         {
+            AbstractReflectSessionRef sref = GetSession(sessionIDs[i]);
+            if ((sref())&&(retSessions.Put(&sref()->GetSessionIDString(), sref) != B_NO_ERROR)) {ret = B_ERROR; break;}
+         }
       }
       else ret = B_ERROR;
    }
@@ -915,23 +1139,11 @@ status_t StorageReflectSession :: SendMessageToMatchingSessions(const MessageRef
 
    if (nodePath.HasChars())
    {
-      const char * s;
-      String temp;
-      if (nodePath.StartsWith("/")) s = nodePath()+1;
-      else
-      {
-         temp = nodePath.Prepend(DEFAULT_PATH_PREFIX "/");
-         s = temp();
-      }
+      ConstCachedRouteRef route = GetRouteForPath(nodePath, filter);
+      if (route() == NULL) return B_ERROR;
 
-      NodePathMatcher matcher;
-      if (matcher.PutPathString(s, filter) == B_NO_ERROR)
-      {
-         void * sendMessageData[] = {const_cast<MessageRef *>(&msgRef), &includeSelf}; // gotta include the includeSelf param too, alas
-         (void) matcher.DoTraversal((PathMatchCallback)SendMessageCallbackFunc, this, GetGlobalRoot(), true, sendMessageData);
-         return B_NO_ERROR;
-      }
-      return B_ERROR;
+      SendMessageAlongRoute(*route(), msgRef, includeSelf);
+      return B_NO_ERROR;
    }
    else
    {
@@ -991,12 +1203,56 @@ status_t StorageReflectSession :: FindMatchingNodes(const String & nodePath, con
    return ret;
 }
 
-int
-StorageReflectSession ::
-SendMessageCallback(DataNode & node, void * userData)
+int StorageReflectSession :: AddFieldIndexCallback(DataNode & node, void * userData)
+{
+   (void) node.AddFieldIndex(*static_cast<const String *>(userData));
+   return node.GetDepth();
+}
+
+int StorageReflectSession :: RemoveFieldIndexCallback(DataNode & node, void * userData)
+{
+   const String & fieldName = *static_cast<const String *>(userData);
+   const PathMatcher * pm = _sharedData->_fieldIndexPaths.Get(fieldName);
+   String np;
+   if ((pm == NULL)||(node.GetNodePath(np) != B_NO_ERROR)||(pm->MatchesPath(np(), NULL, NULL) == false)) (void) node.RemoveFieldIndex(fieldName);  // unless another declaration still wants it
+   return node.GetDepth();
+}
+
+status_t StorageReflectSession :: AddFieldIndex(const String & nodePath, const String & fieldName)
+{
+   String fixPath(nodePath);
+   NodePathMatcher matcher;
+   matcher.AdjustStringPrefix(fixPath, DEFAULT_PATH_PREFIX);
+
+   PathMatcher * pm = _sharedData->_fieldIndexPaths.GetOrPut(fieldName);
+   if ((pm == NULL)||(pm->PutPathString(fixPath, ConstQueryFilterRef()) != B_NO_ERROR)||(matcher.PutPathString(fixPath, ConstQueryFilterRef()) != B_NO_ERROR)) return B_ERROR;
+
+   (void) matcher.DoTraversal((PathMatchCallback)AddFieldIndexCallbackFunc, this, GetGlobalRoot(), false, const_cast<String *>(&fieldName));
+   return B_NO_ERROR;
+}
+
+status_t StorageReflectSession :: RemoveFieldIndex(const String & nodePath, const String & fieldName)
+{
+   String fixPath(nodePath);
+   NodePathMatcher matcher;
+   matcher.AdjustStringPrefix(fixPath, DEFAULT_PATH_PREFIX);
+
+   PathMatcher * pm = _sharedData->_fieldIndexPaths.Get(fieldName);
+   if ((pm == NULL)||(pm->RemovePathString(fixPath) != B_NO_ERROR)) return B_ERROR;
+   if (pm->GetEntries().IsEmpty()) (void) _sharedData->_fieldIndexPaths.Remove(fieldName);
+
+   if (matcher.PutPathString(fixPath, ConstQueryFilterRef()) == B_NO_ERROR) (void) matcher.DoTraversal((PathMatchCallback)RemoveFieldIndexCallbackFunc, this, GetGlobalRoot(), false, const_cast<String *>(&fieldName));
+   return B_NO_ERROR;
+}
+
+void StorageReflectSession :: AddDeclaredFieldIndexes(DataNode & newNode)
 {
-   void ** a = (void **) userData;
-   return PassMessageCallbackAux(node, *((MessageRef *)a[0]), *((bool *)a[1]));
+   String np;
+   if (newNode.GetNodePath(np) == B_NO_ERROR)
+   {
+      for (HashtableIterator<String, PathMatcher> iter(_sharedData->_fieldIndexPaths); iter.HasData(); iter++) 
+         if (iter.GetValue().MatchesPath(np(), NULL, NULL)) (void) newNode.AddFieldIndex(iter.GetKey());
+   }
 }
 
 status_t StorageReflectSession :: InsertOrderedData(const MessageRef & msgRef, Hashtable<String, DataNodeRef> * optNewNodes)
@@ -1037,14 +1293,233 @@ DoGetData(const Message & msg)
    NodePathMatcher matcher;
    matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, msg, DEFAULT_PATH_PREFIX);
 
+   FieldProjection projection;
+   const bool useProjection = ((msg.HasName(PR_NAME_PROJECTION, B_STRING_TYPE))&&(projection.SetFromMessage(msg) == B_NO_ERROR));
+
    MessageRef messageArray[2];  // first is the DATAITEMS message, second is the INDEXUPDATED message (both demand-allocated)
-   (void) matcher.DoTraversal((PathMatchCallback)GetDataCallbackFunc, this, GetGlobalRoot(), true, messageArray);
+   void * args[] = {messageArray, useProjection ? &projection : NULL};
+   (void) matcher.DoTraversal((PathMatchCallback)GetDataCallbackFunc, this, GetGlobalRoot(), true, args);
 
    // Send any still-pending "get" results...
    SendGetDataResults(messageArray[0]);
    SendGetDataResults(messageArray[1]);
 }
 
+enum {
+   AGGREGATE_OP_COUNT = 0,
+   AGGREGATE_OP_SUM,
+   AGGREGATE_OP_MIN,
+   AGGREGATE_OP_MAX,
+   AGGREGATE_OP_AVG,
+   NUM_AGGREGATE_OPS
+};
+static const char * _aggregateOpNames[] = {"count", "sum", "min", "max", "avg"};
+
+/** Running totals for one group of nodes in an aggregate-traversal.  Integer values are
+  * accumulated separately from floating point values, so that integer results stay exact.
+  */
+class AggregateTotals
+{
+public:
+   AggregateTotals() : _count(0), _numFloatValues(0), _intSum(0), _intMin(0), _intMax(0), _floatSum(0.0), _floatMin(0.0), _floatMax(0.0) {/* empty */}
+
+   void AddIntegerValue(int64 v)
+   {
+      if (_count == _numFloatValues) _intMin = _intMax = v;  // first integer value
+      else
+      {
+         if (v < _intMin) _intMin = v;
+         if (v > _intMax) _intMax = v;
+      }
+      _intSum += v;
+      _count++;
+   }
+
+   void AddFloatValue(double v)
+   {
+      if (_numFloatValues == 0) _floatMin = _floatMax = v;
+      else
+      {
+         if (v < _floatMin) _floatMin = v;
+         if (v > _floatMax) _floatMax = v;
+      }
+      _floatSum += v;
+      _numFloatValues++;
+      _count++;
+   }
+
+   status_t SaveToMessage(uint32 op, Message & msg) const
+   {
+      if (msg.AddInt64(PR_NAME_AGGREGATE_COUNT, _count) != B_NO_ERROR) return B_ERROR;
+      if ((op == AGGREGATE_OP_COUNT)||((_count == 0)&&(op != AGGREGATE_OP_SUM))) return B_NO_ERROR;
+
+      const bool hasInts = (_count > _numFloatValues);
+      if ((_numFloatValues == 0)&&(op != AGGREGATE_OP_AVG))
+      {
+         // All values were integers, so the result is an exact int64
+         switch(op)
+         {
+            case AGGREGATE_OP_SUM: return msg.AddInt64(PR_NAME_AGGREGATE_RESULT, _intSum);
+            case AGGREGATE_OP_MIN: return msg.AddInt64(PR_NAME_AGGREGATE_RESULT, _intMin);
+            case AGGREGATE_OP_MAX: return msg.AddInt64(PR_NAME_AGGREGATE_RESULT, _intMax);
+            default:               return B_NO_ERROR;
+         }
+      }
+
+      const double sum = ((double)_intSum)+_floatSum;
+      switch(op)
+      {
+         case AGGREGATE_OP_SUM: return msg.AddDouble(PR_NAME_AGGREGATE_RESULT, sum);
+         case AGGREGATE_OP_MIN: return msg.AddDouble(PR_NAME_AGGREGATE_RESULT, hasInts ? muscleMin((double)_intMin, _floatMin) : _floatMin);
+         case AGGREGATE_OP_MAX: return msg.AddDouble(PR_NAME_AGGREGATE_RESULT, hasInts ? muscleMax((double)_intMax, _floatMax) : _floatMax);
+         case AGGREGATE_OP_AVG: return msg.AddDouble(PR_NAME_AGGREGATE_RESULT, sum/_count);
+         default:               return B_NO_ERROR;
+      }
+   }
+
+   uint64 _count;           // number of values (or nodes, for AGGREGATE_OP_COUNT) aggregated
+   uint64 _numFloatValues;  // how many of those values were floats or doubles
+   int64 _intSum;
+   int64 _intMin;
+   int64 _intMax;
+   double _floatSum;
+   double _floatMin;
+   double _floatMax;
+};
+
+/** A little bitty class just to hold the aggregate-traversal's state properly */
+class AggregateData
+{
+public:
+   AggregateData(uint32 op, const String & fieldName, const String & groupByFieldName)
+      : _op(op)
+      , _fieldName(fieldName)
+      , _groupByFieldName(groupByFieldName)
+      , _ret(B_NO_ERROR)
+   {
+      // empty
+   }
+
+   uint32 _op;
+   const String & _fieldName;
+   const String & _groupByFieldName;
+   AggregateTotals _totals;                     // used when there is no group-by field
+   Hashtable<String, AggregateTotals> _groups;  // type-tagged group-by value (see GetAggregateGroupKey()) -> totals for that group
+   status_t _ret;
+};
+
+// Retrieves the first value of the given integer field as an int64, regardless of its width
+static status_t GetAggregateIntegerValue(const Message & msg, const String & fieldName, uint32 type, int64 & retValue)
+{
+   switch(type)
+   {
+      case B_INT8_TYPE:  {int8  v; if (msg.FindInt8( fieldName, v) != B_NO_ERROR) return B_ERROR; retValue = v;} break;
+      case B_INT16_TYPE: {int16 v; if (msg.FindInt16(fieldName, v) != B_NO_ERROR) return B_ERROR; retValue = v;} break;
+      case B_INT32_TYPE: {int32 v; if (msg.FindInt32(fieldName, v) != B_NO_ERROR) return B_ERROR; retValue = v;} break;
+      case B_INT64_TYPE: return msg.FindInt64(fieldName, retValue);
+      default:           return B_ERROR;
+   }
+   return B_NO_ERROR;
+}
+
+// Retrieves the first value of the given float or double field as a double
+static status_t GetAggregateFloatValue(const Message & msg, const String & fieldName, uint32 type, double & retValue)
+{
+   switch(type)
+   {
+      case B_FLOAT_TYPE:  {float v; if (msg.FindFloat(fieldName, v) != B_NO_ERROR) return B_ERROR; retValue = v;} return B_NO_ERROR;
+      case B_DOUBLE_TYPE: return msg.FindDouble(fieldName, retValue);
+      default:            return B_ERROR;
+   }
+}
+
+// Retrieves the first value of the given string or numeric field, as a String that identifies its group.
+// The first character of the key tags the value's type ('s', 'i' or 'd'), so that e.g. "5" and 5 are different groups.
+static status_t GetAggregateGroupKey(const Message & msg, const String & fieldName, String & retKey)
+{
+   uint32 type;
+   if (msg.GetInfo(fieldName, &type) != B_NO_ERROR) return B_ERROR;
+   if (type == B_STRING_TYPE)
+   {
+      const String * s;
+      if (msg.FindString(fieldName, &s) != B_NO_ERROR) return B_ERROR;
+      retKey = "s";
+      retKey += *s;
+      return B_NO_ERROR;
+   }
+
+   char buf[64];
+   int64 iv;
+   double dv;
+        if (GetAggregateIntegerValue(msg, fieldName, type, iv) == B_NO_ERROR) muscleSprintf(buf, "i" INT64_FORMAT_SPEC, iv);
+   else if (GetAggregateFloatValue(msg, fieldName, type, dv)   == B_NO_ERROR) muscleSprintf(buf, "d%.17g", dv);  // enough digits to round-trip any double
+   else return B_ERROR;
+
+   retKey = buf;
+   return B_NO_ERROR;
+}
+
+// Adds the group-by value encoded in (groupKey) to (msg) as a field of its original type, and returns its text
+static status_t SaveAggregateGroupValue(const String & groupKey, Message & msg, String & retText)
+{
+   retText = groupKey.Substring(1);
+   switch(groupKey[0])
+   {
+      case 's': return msg.AddString(PR_NAME_AGGREGATE_GROUP_VALUE, retText);
+      case 'i': return msg.AddInt64(PR_NAME_AGGREGATE_GROUP_VALUE, Atoll(retText()));
+      case 'd': return msg.AddDouble(PR_NAME_AGGREGATE_GROUP_VALUE, atof(retText()));
+      default:  return B_ERROR;
+   }
+}
+
+status_t
+StorageReflectSession ::
+DoGetAggregate(const Message & msg)
+{
+   TCHECKPOINT;
+
+   const String * opName;
+   if ((msg.HasName(FK_KEYS, B_STRING_TYPE) == false)||(msg.FindString(PR_NAME_AGGREGATE_OP, &opName) != B_NO_ERROR)) return B_ERROR;
+
+   uint32 op = 0;
+   while((op < NUM_AGGREGATE_OPS)&&(opName->EqualsIgnoreCase(_aggregateOpNames[op]) == false)) op++;
+   if (op == NUM_AGGREGATE_OPS) return B_ERROR;
+
+   String fieldName, groupByFieldName;
+   if ((msg.FindString(PR_NAME_AGGREGATE_FIELD, fieldName) != B_NO_ERROR)&&(op != AGGREGATE_OP_COUNT)) return B_ERROR;
+   (void) msg.FindString(PR_NAME_AGGREGATE_GROUP_BY, groupByFieldName);
+
+   NodePathMatcher matcher;
+   if (matcher.PutPathsFromMessage(PR_NAME_KEYS, PR_NAME_FILTERS, msg, DEFAULT_PATH_PREFIX) != B_NO_ERROR) return B_ERROR;
+
+   AggregateData data(op, fieldName, groupByFieldName);
+   (void) matcher.DoTraversal((PathMatchCallback)AggregateCallbackFunc, this, GetGlobalRoot(), true, &data);
+   if (data._ret != B_NO_ERROR) return B_ERROR;
+
+   // The reply echoes the command's fields, so that the client can tell which query it answers
+   MessageRef reply = GetMessageFromPool(msg);
+   if (reply() == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+   reply()->what = PR_RESULT_AGGREGATE;
+   (void) reply()->RemoveName(PR_NAME_FILTERS);
+
+   if (groupByFieldName.HasChars())
+   {
+      MessageRef groups = GetMessageFromPool();
+      if (groups() == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+      for (HashtableIterator<String, AggregateTotals> iter(data._groups); iter.HasData(); iter++)
+      {
+         String groupText;
+         MessageRef groupMsg = GetMessageFromPool();
+         if ((groupMsg() == NULL)||(iter.GetValue().SaveToMessage(op, *groupMsg()) != B_NO_ERROR)||(SaveAggregateGroupValue(iter.GetKey(), *groupMsg(), groupText) != B_NO_ERROR)||(groups()->AddMessage(groupText, groupMsg) != B_NO_ERROR)) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+      }
+      if (reply()->AddMessage(PR_NAME_AGGREGATE_GROUPS, groups) != B_NO_ERROR) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+   }
+   else if (data._totals.SaveToMessage(op, *reply()) != B_NO_ERROR) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+
+   MessageReceivedFromSession(*this, reply, NULL);
+   return B_NO_ERROR;
+}
+
 void
 StorageReflectSession ::
 SendGetDataResults(MessageRef & replyMessage)
@@ -1091,6 +1566,7 @@ PushSubscriptionMessages()
 {
    TCHECKPOINT;
 
+   SendPendingNodeChanges();
    if (_sharedData->_subsDirty)
    {
       _sharedData->_subsDirty = false;
@@ -1105,6 +1581,7 @@ PushSubscriptionMessages()
             nextSession->PushSubscriptionMessage(nextSession->_nextIndexSubscriptionMessage);
          }
       }
+      _sharedData->_projectedData.Clear();  // the projected updates have all been sent now
       PushSubscriptionMessages();  // in case these generated even more messages...
    }
 }
@@ -1144,20 +1621,21 @@ PassMessageCallbackAux(DataNode & node, const MessageRef & msgRef, bool includeS
 
 int
 StorageReflectSession ::
-FindSessionsCallback(DataNode & node, void * userData)
+RecordRouteCallback(DataNode & node, void * userData)
 {
    TCHECKPOINT;
 
    AbstractReflectSessionRef sref = GetSession(node.GetAncestorNode(NODE_DEPTH_SESSIONNAME, &node)->GetNodeName());
-
-   StorageReflectSession * next = dynamic_cast<StorageReflectSession *>(sref());
-   FindMatchingSessionsData * data = static_cast<FindMatchingSessionsData *>(userData);
-   if ((next)&&(data->_results.Put(&next->GetSessionIDString(), sref) != B_NO_ERROR))
+   if (dynamic_cast<StorageReflectSession *>(sref()))
    {
-      data->_ret = B_ERROR;  // Oops, out of memory!
-      return -1;  // abort now
+      CachedRoute * route = static_cast<CachedRoute *>(userData);
+      if ((route->_sessionIDs.AddTail(sref()->GetSessionIDString()) != B_NO_ERROR)||(route->_nodes.AddTail(&node) != B_NO_ERROR))
+      {
+         route->_ret = B_ERROR;  // Oops, out of memory!
+         return -1;  // abort now
+      }
    }
-   else return (data->_results.GetNumItems() == data->_maxResults) ? -1 : NODE_DEPTH_SESSIONNAME; // This causes the traversal to immediately skip to the next session
+   return NODE_DEPTH_SESSIONNAME; // This causes the traversal to immediately skip to the next session
 }
 
 int
@@ -1221,7 +1699,9 @@ GetDataCallback(DataNode & node, void * userData)
 {
    TCHECKPOINT;
 
-   MessageRef * messageArray = (MessageRef *) userData;
+   void ** args = (void **) userData;
+   MessageRef * messageArray = (MessageRef *) args[0];
+   const FieldProjection * projection = (const FieldProjection *) args[1];
 
    // Make sure (node) isn't part of our own tree!  If it is, move immediately to the next session
    if ((_indexingPresent == false)&&(IsRoutingFlagSet(MUSCLE_ROUTING_FLAG_REFLECT_TO_SELF) == false)&&(GetSession(node.GetAncestorNode(NODE_DEPTH_SESSIONNAME, &node)->GetNodeName())() == this)) return NODE_DEPTH_SESSIONNAME;
@@ -1232,7 +1712,14 @@ GetDataCallback(DataNode & node, void * userData)
    String np;
    if ((resultMsg())&&(node.GetNodePath(np) == B_NO_ERROR))
    {
-      (void) resultMsg()->AddMessage(np, node.GetData());
+      MessageRef data = node.GetData();
+      if ((projection)&&(data()))
+      {
+         MessageRef projectedData = projection->Apply(*data());
+         if (projectedData()) data = projectedData;
+                         else WARN_OUT_OF_MEMORY;  // better to send too much than nothing at all
+      }
+      (void) resultMsg()->AddMessage(np, data);
       if (resultMsg()->GetNumNames() >= _maxSubscriptionMessageItems) SendGetDataResults(resultMsg);
    }
    else 
@@ -1242,7 +1729,7 @@ GetDataCallback(DataNode & node, void * userData)
    }
 
    // But indices we need to send to ourself no matter what, as they are generated on the server side.
-   const Queue<DataNodeRef> * index = node.GetIndex();
+   const DataNodeIndex * index = node.GetIndex();
    if (index)
    {
       uint32 indexLen = index->GetNumItems();
@@ -1255,10 +1742,11 @@ GetDataCallback(DataNode & node, void * userData)
          {
             char clearStr[] = {INDEX_OP_CLEARED, '\0'};
             (void) indexUpdateMsg()->AddString(np, clearStr);
-            for (uint32 i=0; i<indexLen; i++) 
+            uint32 i = 0;
+            for (const DataNodeIndex::Entry * e = index->GetFirstEntry(); e; e = index->GetNextEntry(e)) 
             {
-               char temp[100]; muscleSprintf(temp, "%c" UINT32_FORMAT_SPEC ":", INDEX_OP_ENTRYINSERTED, i);
-               (void) indexUpdateMsg()->AddString(np, (*index)[i]()->GetNodeName().Prepend(temp));
+               char temp[100]; muscleSprintf(temp, "%c" UINT32_FORMAT_SPEC ":", INDEX_OP_ENTRYINSERTED, i++);
+               (void) indexUpdateMsg()->AddString(np, e->GetItem()()->GetNodeName().Prepend(temp));
             }
             if (indexUpdateMsg()->GetNumNames() >= _maxSubscriptionMessageItems) SendGetDataResults(messageArray[1]);
          }
@@ -1273,6 +1761,46 @@ GetDataCallback(DataNode & node, void * userData)
    return node.GetDepth();  // continue traveral as usual
 }
 
+int
+StorageReflectSession ::
+AggregateCallback(DataNode & node, void * userData)
+{
+   TCHECKPOINT;
+
+   // As with GetDataCallback(), our own nodes are skipped unless our client asked to see them
+   if ((IsRoutingFlagSet(MUSCLE_ROUTING_FLAG_REFLECT_TO_SELF) == false)&&(GetSession(node.GetAncestorNode(NODE_DEPTH_SESSIONNAME, &node)->GetNodeName())() == this)) return NODE_DEPTH_SESSIONNAME;
+
+   AggregateData * data = static_cast<AggregateData *>(userData);
+   const Message * msg = node.GetData()();
+   if (msg == NULL) return node.GetDepth();
+
+   AggregateTotals * totals = &data->_totals;
+   if (data->_groupByFieldName.HasChars())
+   {
+      String groupKey;
+      if (GetAggregateGroupKey(*msg, data->_groupByFieldName, groupKey) != B_NO_ERROR) return node.GetDepth();  // nodes without a group-by value aren't counted
+
+      totals = data->_groups.GetOrPut(groupKey);
+      if (totals == NULL)
+      {
+         WARN_OUT_OF_MEMORY;
+         data->_ret = B_ERROR;
+         return -1;  // abort now
+      }
+   }
+
+   uint32 type;
+   if (data->_op == AGGREGATE_OP_COUNT) totals->_count++;
+   else if (msg->GetInfo(data->_fieldName, &type) == B_NO_ERROR)
+   {
+      int64 iv;
+      double dv;
+           if (GetAggregateIntegerValue(*msg, data->_fieldName, type, iv) == B_NO_ERROR) totals->AddIntegerValue(iv);
+      else if (GetAggregateFloatValue(*msg, data->_fieldName, type, dv)   == B_NO_ERROR) totals->AddFloatValue(dv);
+   }
+   return node.GetDepth();  // continue traversal as usual
+}
+
 int
 StorageReflectSession ::
 RemoveDataCallback(DataNode & node, void * userData)
@@ -1334,10 +1862,57 @@ ReorderDataCallback(DataNode & node, void * userData)
    return node.GetDepth();
 }
 
+// Supplies a DataNode's path clauses to PathMatcher::VisitMatchingEntries(), by walking up the node's ancestors
+class DataNodePathClauseSource : public PathMatcher::PathClauseSource
+{
+public:
+   DataNodePathClauseSource(const DataNode & node) : _node(node) {/* empty */}
+
+   virtual const String & GetClauseFromEnd(uint32 idxFromEnd) const
+   {
+      const DataNode * n = &_node;
+      for (uint32 i=0; i<idxFromEnd; i++) n = n->GetParent();
+      return n->GetNodeName();
+   }
+
+private:
+   const DataNode & _node;
+};
+
+// Context for the NodePathMatcher callbacks below
+class NodeMatchArgs
+{
+public:
+   NodeMatchArgs(ConstMessageRef & optData, DataNode & node) : _optData(optData), _node(node), _matchCount(0) {/* empty */}
+
+   ConstMessageRef & _optData;
+   DataNode & _node;
+   uint32 _matchCount;
+};
+
+static bool MatchesNodeCallback(const PathMatcherEntry & entry, void * userData)
+{
+   NodeMatchArgs * args = (NodeMatchArgs *) userData;
+   return (entry.FilterMatches(args->_optData, &args->_node) == false);  // stop at the first entry that matches
+}
+
+static bool GetMatchCountCallback(const PathMatcherEntry & entry, void * userData)
+{
+   NodeMatchArgs * args = (NodeMatchArgs *) userData;
+   if (entry.FilterMatches(args->_optData, &args->_node)) args->_matchCount++;
+   return true;
+}
+
 bool
 StorageReflectSession :: NodePathMatcher ::
 MatchesNode(DataNode & node, ConstMessageRef & optData, int rootDepth) const
 {
+   if (rootDepth == 0)
+   {
+      NodeMatchArgs args(optData, node);
+      return (VisitMatchingEntries(DataNodePathClauseSource(node), node.GetDepth(), MatchesNodeCallback, &args) == false);
+   }
+
    for (HashtableIterator<String, PathMatcherEntry> iter(GetEntries()); iter.HasData(); iter++) if (PathMatches(node, optData, iter.GetValue(), rootDepth)) return true;
    return false;
 }
@@ -1348,12 +1923,220 @@ GetMatchCount(DataNode & node, const Message * optData, int rootDepth) const
 {
    TCHECKPOINT;
 
-   int matchCount = 0;
    ConstMessageRef fakeRef(optData, false);
+   if (rootDepth == 0)
+   {
+      NodeMatchArgs args(fakeRef, node);
+      (void) VisitMatchingEntries(DataNodePathClauseSource(node), node.GetDepth(), GetMatchCountCallback, &args);
+      return args._matchCount;
+   }
+
+   int matchCount = 0;
    for (HashtableIterator<String, PathMatcherEntry> iter(GetEntries()); iter.HasData(); iter++) if (PathMatches(node, fakeRef, iter.GetValue(), rootDepth)) matchCount++;
    return matchCount;
 }
 
+status_t StorageReflectSession :: FieldProjection :: SetFromMessage(const Message & msg)
+{
+   _matchers.Clear();
+   _key.Clear();
+
+   const String * pattern;
+   for (uint32 i=0; msg.FindString(PR_NAME_PROJECTION, i, &pattern) == B_NO_ERROR; i++)
+   {
+      StringMatcherRef smRef(GetStringMatcherPool()->ObtainObject());
+      if ((smRef() == NULL)||(smRef()->SetPattern(*pattern) != B_NO_ERROR)||(_matchers.AddTail(smRef) != B_NO_ERROR)) return B_ERROR;
+
+      // length-prefixed, so that different sets of patterns can't produce the same key
+      char buf[32]; muscleSprintf(buf, UINT32_FORMAT_SPEC ":", pattern->Length());
+      _key += buf;
+      _key += *pattern;
+   }
+   return _matchers.HasItems() ? B_NO_ERROR : B_ERROR;
+}
+
+MessageRef StorageReflectSession :: FieldProjection :: Apply(const Message & msg) const
+{
+   MessageRef ret = GetMessageFromPool(msg.what);
+   if (ret() == NULL) return ret;
+
+   for (MessageFieldNameIterator it = msg.GetFieldNameIterator(); it.HasData(); it++)
+   {
+      const String & fn = it.GetFieldName();
+      for (uint32 i=0; i<_matchers.GetNumItems(); i++)
+      {
+         if (_matchers[i]()->Match(fn))
+         {
+            if (msg.CopyName(fn, *ret()) != B_NO_ERROR) return MessageRef();
+            break;
+         }
+      }
+   }
+   return ret;
+}
+
+void StorageReflectSession :: SetSubscriptionOptions(const String & fixPath, const ConstFieldProjectionRef & projection, uint64 minUpdateInterval)
+{
+   const PathMatcherEntry * e = _subscriptions.GetEntries().Get(fixPath);
+   if (e)
+   {
+      StringMatcherQueueRef parser = e->GetParser();
+      if ((projection())||(minUpdateInterval > 0)) (void) _subscriptionOptions.Put(parser(), SubscriptionOptions(parser, projection, minUpdateInterval));
+                                              else (void) _subscriptionOptions.Remove(parser());
+   }
+}
+
+bool StorageReflectSession :: GetSubscriptionOptionsCallback(const PathMatcherEntry & entry, void * userData)
+{
+   void ** args = (void **) userData;
+   const StorageReflectSession * This = (const StorageReflectSession *) args[0];
+   const FieldProjection ** retProjection = (const FieldProjection **) args[1];
+   bool * sendAllFields = (bool *) args[2];
+   uint64 * retMinUpdateInterval = (uint64 *) args[3];
+
+   const SubscriptionOptions * so = This->_subscriptionOptions.Get(entry.GetParser()());
+   const FieldProjection * p = so ? so->_projection() : NULL;
+   if ((p)&&((*retProjection == NULL)||((*retProjection)->GetKey() == p->GetKey()))) *retProjection = p;
+   else *sendAllFields = true;  // an unprojected subscription, or two different projections:  the client gets everything
+
+   // The most demanding subscription determines how often the client gets updates
+   *retMinUpdateInterval = muscleMin(*retMinUpdateInterval, so ? so->_minUpdateInterval : (uint64)0);
+
+   return ((*sendAllFields == false)||(*retMinUpdateInterval > 0));  // no point looking any further once neither option applies
+}
+
+void StorageReflectSession :: GetSubscriptionOptions(const DataNode & node, const FieldProjection * & retProjection, uint64 & retMinUpdateInterval) const
+{
+   retProjection = NULL;
+   retMinUpdateInterval = MUSCLE_TIME_NEVER;
+
+   bool sendAllFields = false;
+   void * args[] = {(void *) this, &retProjection, &sendAllFields, &retMinUpdateInterval};
+   (void) _subscriptions.VisitMatchingEntries(DataNodePathClauseSource(node), node.GetDepth(), GetSubscriptionOptionsCallback, args);
+
+   if (sendAllFields) retProjection = NULL;
+   if (retMinUpdateInterval == MUSCLE_TIME_NEVER) retMinUpdateInterval = 0;
+}
+
+void StorageReflectSession :: ScheduleThrottledUpdateTime(uint64 when)
+{
+   if (when < _nextThrottledUpdateTime)
+   {
+      _nextThrottledUpdateTime = when;
+      InvalidatePulseTime();
+   }
+}
+
+bool StorageReflectSession :: HoldBackSubscriptionUpdate(const String & nodePath, const MessageRef & nodeData, uint64 minUpdateInterval)
+{
+   const uint64 now = GetRunTime64();
+   ThrottledNodeUpdate * tu = _throttledUpdates.Get(nodePath);
+   if (tu == NULL)
+   {
+      // First update for this node:  it goes out right away, but we remember when it went (until that no longer matters)
+      if (_throttledUpdates.Put(nodePath, ThrottledNodeUpdate(now, minUpdateInterval)) == B_NO_ERROR) ScheduleThrottledUpdateTime(now+minUpdateInterval);
+      return false;
+   }
+
+   tu->_minUpdateInterval = minUpdateInterval;
+   const uint64 dueTime = tu->_lastSendTime + minUpdateInterval;
+   MessageRef * heldBackData = _heldBackUpdates.Get(nodePath);
+   if ((heldBackData == NULL)&&(now >= dueTime))
+   {
+      tu->_lastSendTime = now;
+      (void) _throttledUpdates.MoveToBack(nodePath);  // keeps the table sorted by last send time
+      ScheduleThrottledUpdateTime(now+minUpdateInterval);
+      return false;
+   }
+
+   // The new update replaces any older held-back update, since the client only needs the latest one
+   if (heldBackData) *heldBackData = nodeData;
+   else if (_heldBackUpdates.Put(nodePath, nodeData) != B_NO_ERROR) return false;  // out of memory?  Then just send it now
+
+   ScheduleThrottledUpdateTime(dueTime);
+   return true;
+}
+
+void StorageReflectSession :: SendHeldBackSubscriptionUpdates(uint64 now)
+{
+   TCHECKPOINT;
+
+   _nextThrottledUpdateTime = MUSCLE_TIME_NEVER;
+   for (HashtableIterator<String, MessageRef> iter(_heldBackUpdates); iter.HasData(); iter++)
+   {
+      const String & nodePath = iter.GetKey();
+      ThrottledNodeUpdate * tu = _throttledUpdates.Get(nodePath);
+      const uint64 dueTime = tu ? (tu->_lastSendTime + tu->_minUpdateInterval) : now;
+      if (now >= dueTime)
+      {
+         if (_nextSubscriptionMessage() == NULL) _nextSubscriptionMessage = GetMessageFromPool(PR_RESULT_DATAITEMS);
+         if ((_nextSubscriptionMessage() == NULL)||(_nextSubscriptionMessage()->AddMessage(nodePath, iter.GetValue()) != B_NO_ERROR))
+         {
+            WARN_OUT_OF_MEMORY;
+            _nextThrottledUpdateTime = now;  // try again next time
+            break;
+         }
+         _sharedData->_subsDirty = true;
+         if (tu)
+         {
+            tu->_lastSendTime = now;
+            (void) _throttledUpdates.MoveToBack(nodePath);
+         }
+         (void) _heldBackUpdates.Remove(nodePath);
+         if (_nextSubscriptionMessage()->GetNumNames() >= _maxSubscriptionMessageItems) PushSubscriptionMessages();
+      }
+      else _nextThrottledUpdateTime = muscleMin(_nextThrottledUpdateTime, dueTime);
+   }
+
+   // Forget about nodes that have been idle for longer than their update interval, since their next update can go out right away anyway.
+   // The table is sorted by last send time, so we only need to look at the entries at its front.
+   const String * nodePath;
+   while((nodePath = _throttledUpdates.GetFirstKey()) != NULL)
+   {
+      const ThrottledNodeUpdate * tu = _throttledUpdates.GetFirstValue();
+      const uint64 dueTime = tu->_lastSendTime + tu->_minUpdateInterval;
+      if (now < dueTime)
+      {
+         _nextThrottledUpdateTime = muscleMin(_nextThrottledUpdateTime, dueTime);
+         break;
+      }
+      if (_heldBackUpdates.ContainsKey(*nodePath)) break;  // only possible if we ran out of memory above
+      (void) _throttledUpdates.RemoveFirst();
+   }
+
+   PushSubscriptionMessages();
+}
+
+void StorageReflectSession :: DropUnsubscribedHeldBackUpdates()
+{
+   for (HashtableIterator<String, MessageRef> iter(_heldBackUpdates); iter.HasData(); iter++)
+   {
+      const String & nodePath = iter.GetKey();
+      if (_subscriptions.MatchesPath(nodePath(), NULL, NULL) == false)
+      {
+         (void) _throttledUpdates.Remove(nodePath);
+         (void) _heldBackUpdates.Remove(nodePath);
+      }
+   }
+}
+
+MessageRef StorageReflectSession :: GetProjectedData(const FieldProjection & projection, const MessageRef & nodeData)
+{
+   if (nodeData() == NULL) return nodeData;
+
+   const ProjectedData * pd = _sharedData->_projectedData.Get(projection.GetKey());
+   if ((pd)&&(pd->_source() == nodeData())) return pd->_projected;  // another subscriber already needed this exact projection
+
+   MessageRef ret = projection.Apply(*nodeData());
+   if (ret() == NULL)
+   {
+      WARN_OUT_OF_MEMORY;
+      return nodeData;  // better to send too much than nothing at all
+   }
+   (void) _sharedData->_projectedData.Put(projection.GetKey(), ProjectedData(nodeData, ret));
+   return ret;
+}
+
 bool
 StorageReflectSession :: NodePathMatcher ::
 PathMatches(DataNode & node, ConstMessageRef & optData, const PathMatcherEntry & entry, int rootDepth) const
@@ -1406,6 +2189,21 @@ DoTraversalAux(TraversalContext & data, DataNode & node)
       }
    }
 
+   if ((parsersHaveWildcards)&&(data.IsUseFiltersOkay())&&(node.HasFieldIndexes()))
+   {
+      // If every path that matches at this level filters on a field that (node) has an index on, we only need to look at the children that the index hands us
+      Queue<DataNodeRef> candidates;
+      if (GetFieldIndexCandidates(data, node, depth, candidates) == B_NO_ERROR)
+      {
+         for (uint32 i=0; i<candidates.GetNumItems(); i++)
+         {
+            DataNode * nextChild = candidates[i]();
+            if ((nextChild->GetParent() == &node)&&(CheckChildForTraversal(data, nextChild, -1, depth))) return depth;  // (the callback may have removed it)
+         }
+         return node.GetDepth();
+      }
+   }
+
    if (parsersHaveWildcards)
    {
       // general case -- iterate over all children of our node and see if any match
@@ -1460,6 +2258,43 @@ DoTraversalAux(TraversalContext & data, DataNode & node)
    return node.GetDepth();
 }
 
+status_t
+StorageReflectSession :: NodePathMatcher ::
+GetFieldIndexCandidates(const TraversalContext & data, const DataNode & node, int depth, Queue<DataNodeRef> & retCandidates) const
+{
+   uint32 numUsedEntries = 0;
+   for (HashtableIterator<String, PathMatcherEntry> iter(GetEntries()); iter.HasData(); iter++)
+   {
+      const StringMatcherQueue * nextQueue = iter.GetValue().GetParser()();
+      const int numClauses = nextQueue ? (int)nextQueue->GetStringMatchers().GetNumItems() : 0;
+      if (numClauses > depth-data.GetRootDepth())
+      {
+         // This path has to end with (node)'s children, and filter them on an indexed field; otherwise we'd miss some matches
+         const QueryFilter * filter = iter.GetValue().GetFilter()();
+         if ((numClauses != depth-data.GetRootDepth()+1)||(filter == NULL)||(node.GetFieldIndexCandidates(*filter, retCandidates) != B_NO_ERROR)) return B_ERROR;
+         numUsedEntries++;
+      }
+   }
+   if (numUsedEntries == 0) return B_ERROR;
+
+   if (numUsedEntries > 1)
+   {
+      // Several paths may have nominated the same child; we only want to visit each child once
+      Hashtable<DataNode *, Void> alreadyDid;
+      Queue<DataNodeRef> uniqueCandidates;
+      for (uint32 i=0; i<retCandidates.GetNumItems(); i++)
+      {
+         DataNode * nextChild = retCandidates[i]();
+         if (alreadyDid.ContainsKey(nextChild) == false)
+         {
+            if ((alreadyDid.PutWithDefault(nextChild) != B_NO_ERROR)||(uniqueCandidates.AddTail(retCandidates[i]) != B_NO_ERROR)) return B_ERROR;
+         }
+      }
+      retCandidates.SwapContents(uniqueCandidates);
+   }
+   return B_NO_ERROR;
+}
+
 bool
 StorageReflectSession :: NodePathMatcher ::
 DoDirectChildLookup(TraversalContext & data, const DataNode & node, const String & key, int32 entryIdx, Hashtable<DataNode *, Void> & alreadyDid, int & depth)
@@ -1630,7 +2465,7 @@ JettisonOutgoingResults(const NodePathMatcher * matcher)
                // Remove any PR_NAME_REMOVED_DATAITEMS entries that match... 
                int nextr = 0;
                const String * rname;
-               while(msg->FindString(PR_NAME_REMOVED_DATAITEMS, nextr, &rname) == B_NO_ERROR)
+               while(msg->FindString(FK_REMOVED_DATAITEMS, nextr, &rname) == B_NO_ERROR)
                {
                   if (matcher->MatchesPath(rname->Cstr(), NULL, NULL)) msg->RemoveData(PR_NAME_REMOVED_DATAITEMS, nextr);
                                                                   else nextr++;
@@ -1679,14 +2514,14 @@ StorageReflectSession :: CloneDataNodeSubtree(const DataNode & node, const Strin
    }
 
    // Lastly, if he has an index, make sure the clone ends up with an equivalent index
-   const Queue<DataNodeRef> * index = node.GetIndex();
+   const DataNodeIndex * index = node.GetIndex();
    if (index)
    {
       DataNode * clone = GetDataNode(destPath);
       if (clone)
       {
-         uint32 idxLen = index->GetNumItems();
-         for (uint32 i=0; i<idxLen; i++) if (clone->InsertIndexEntryAt(i, this, (*index)[i]()->GetNodeName()) != B_NO_ERROR) return B_ERROR;
+         uint32 i = 0;
+         for (const DataNodeIndex::Entry * e = index->GetFirstEntry(); e; e = index->GetNextEntry(e)) if (clone->InsertIndexEntryAt(i++, this, e->GetItem()()->GetNodeName()) != B_NO_ERROR) return B_ERROR;
       }
       else return B_ERROR;
    }
@@ -1703,29 +2538,28 @@ StorageReflectSession :: SaveNodeTreeToMessage(Message & msg, const DataNode * n
    {
       MessageRef payload = node->GetData();
       if ((optPruner)&&(optPruner->MatchPath(path, payload) == false)) return B_NO_ERROR;
-      if ((saveData)&&(msg.AddMessage(PR_NAME_NODEDATA, payload) != B_NO_ERROR)) return B_ERROR;
+      if ((saveData)&&(msg.AddMessage(FK_NODEDATA, payload) != B_NO_ERROR)) return B_ERROR;
    }
    
    if ((node->HasChildren())&&(maxDepth > 0))
    {
       // Save the node-index, if there is one
-      const Queue<DataNodeRef> * index = node->GetIndex();
+      const DataNodeIndex * index = node->GetIndex();
       if (index)
       {
-         uint32 indexSize = index->GetNumItems();
-         if (indexSize > 0)
+         if (index->HasItems())
          {
             MessageRef indexMsgRef(GetMessageFromPool());
-            if ((indexMsgRef() == NULL)||(msg.AddMessage(PR_NAME_NODEINDEX, indexMsgRef) != B_NO_ERROR)) return B_ERROR;
+            if ((indexMsgRef() == NULL)||(msg.AddMessage(FK_NODEINDEX, indexMsgRef) != B_NO_ERROR)) return B_ERROR;
             Message * indexMsg = indexMsgRef();
-            for (uint32 i=0; i<indexSize; i++) if (indexMsg->AddString(PR_NAME_KEYS, (*index)[i]()->GetNodeName()) != B_NO_ERROR) return B_ERROR;
+            for (const DataNodeIndex::Entry * e = index->GetFirstEntry(); e; e = index->GetNextEntry(e)) if (indexMsg->AddString(FK_KEYS, e->GetItem()()->GetNodeName()) != B_NO_ERROR) return B_ERROR;
          }
       }
 
       // Then save the children, recursing to each one as necessary
       {
          MessageRef childrenMsgRef(GetMessageFromPool());
-         if ((childrenMsgRef() == NULL)||(msg.AddMessage(PR_NAME_NODECHILDREN, childrenMsgRef) != B_NO_ERROR)) return B_ERROR;
+         if ((childrenMsgRef() == NULL)||(msg.AddMessage(FK_NODECHILDREN, childrenMsgRef) != B_NO_ERROR)) return B_ERROR;
          for (DataNodeRefIterator childIter = node->GetChildIterator(); childIter.HasData(); childIter++)
          {
             DataNode * child = childIter.GetValue()();
@@ -1752,7 +2586,7 @@ StorageReflectSession :: RestoreNodeTreeFromMessage(const Message & msg, const S
    if (loadData)
    {
       MessageRef payload;
-      if (msg.FindMessage(PR_NAME_NODEDATA, payload) != B_NO_ERROR) return B_ERROR;
+      if (msg.FindMessage(FK_NODEDATA, payload) != B_NO_ERROR) return B_ERROR;
       if ((optPruner)&&(optPruner->MatchPath(path, payload) == false)) return B_NO_ERROR;
       if (SetDataNode(path, payload, true, true, quiet, appendToIndex) != B_NO_ERROR) return B_ERROR;
    }
@@ -1763,16 +2597,16 @@ StorageReflectSession :: RestoreNodeTreeFromMessage(const Message & msg, const S
    }
 
    MessageRef childrenRef;
-   if ((maxDepth > 0)&&(msg.FindMessage(PR_NAME_NODECHILDREN, childrenRef) == B_NO_ERROR)&&(childrenRef()))
+   if ((maxDepth > 0)&&(msg.FindMessage(FK_NODECHILDREN, childrenRef) == B_NO_ERROR)&&(childrenRef()))
    {
       // First recurse to the indexed nodes, adding them as indexed children
       Hashtable<const String *, uint32> indexLookup;
       {
          MessageRef indexRef;
-         if (msg.FindMessage(PR_NAME_NODEINDEX, indexRef) == B_NO_ERROR)
+         if (msg.FindMessage(FK_NODEINDEX, indexRef) == B_NO_ERROR)
          {
             const String * nextFieldName;
-            for (int i=0; indexRef()->FindString(PR_NAME_KEYS, i, &nextFieldName) == B_NO_ERROR; i++)
+            for (int i=0; indexRef()->FindString(FK_KEYS, i, &nextFieldName) == B_NO_ERROR; i++)
             {
                MessageRef nextChildRef;
                if (childrenRef()->FindMessage(*nextFieldName, nextChildRef) == B_NO_ERROR) 
@@ -1817,6 +2651,7 @@ status_t StorageReflectSession :: RemoveParameter(const String & paramName, bool
    {
       String str = paramName.Substring(10);
       _subscriptions.AdjustStringPrefix(str, DEFAULT_PATH_PREFIX);
+      SetSubscriptionOptions(str, ConstFieldProjectionRef(), 0);
       if (_subscriptions.RemovePathString(str) == B_NO_ERROR)
       {
          // Remove the references from this subscription from all nodes
@@ -1824,6 +2659,7 @@ status_t StorageReflectSession :: RemoveParameter(const String & paramName, bool
          (void) temp.PutPathString(str, ConstQueryFilterRef());
          long decrementOne = -1;
          (void) temp.DoTraversal((PathMatchCallback)DoSubscribeRefCallbackFunc, this, GetGlobalRoot(), false, &decrementOne);
+         if (_heldBackUpdates.HasItems()) DropUnsubscribedHeldBackUpdates();  // so our client won't get updates for nodes it no longer subscribes to
       }
    }
    else if (paramName == PR_NAME_REFLECT_TO_SELF)            SetRoutingFlag(MUSCLE_ROUTING_FLAG_REFLECT_TO_SELF,      false);
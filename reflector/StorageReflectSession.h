@@ -30,9 +30,28 @@ public:
    /** Returns our current setting for the maximum incoming message size for sessions we produce. */
    uint32 GetMaxIncomingMessageSize() const {return _maxIncomingMessageSize;}
 
+   /** Sets the incoming-Message spool threshold that we will set on the gateways of the sessions we create.
+     * See MessageIOGateway::SetIncomingMessageSpoolThreshold() for details.
+     * @param numBytes Incoming Message bodies larger than this many bytes will be spooled to a temporary file.
+     *                 Defaults to MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD (MUSCLE_NO_LIMIT, i.e. no spooling).
+     */
+   void SetIncomingMessageSpoolThreshold(uint32 numBytes) {_incomingSpoolThreshold = numBytes;}
+
+   /** Returns our current setting for the incoming-Message spool threshold for sessions we produce. */
+   uint32 GetIncomingMessageSpoolThreshold() const {return _incomingSpoolThreshold;}
+
+   /** Sets the directory that the gateways of the sessions we create will put their spool files in.
+     * See MessageIOGateway::SetIncomingMessageSpoolDirectory() for details.
+     * @param dir The directory's path, or an empty String (the default) to use TMPDIR or /tmp.
+     */
+   void SetIncomingMessageSpoolDirectory(const String & dir) {_incomingSpoolDirectory = dir;}
+
+   /** Returns our current setting for the spool directory for sessions we produce. */
+   const String & GetIncomingMessageSpoolDirectory() const {return _incomingSpoolDirectory;}
+
 protected:
-   /** If we have a limited maximum size for incoming messages, then this method 
-     * demand-allocates the session's gateway, and set its max incoming message size if possible.
+   /** If we have a limited maximum size for incoming messages, or a spool threshold, then this method 
+     * demand-allocates the session's gateway, and sets its max incoming message size and spool settings if possible.
      * @param session the session whose gateway we should call SetMaxIncomingMessageSize() on
      * @return B_NO_ERROR on success, or B_ERROR on failure (out of memory or the created gateway
      *         wasn't a MessageIOGateway)
@@ -41,6 +60,8 @@ protected:
 
 private:
    uint32 _maxIncomingMessageSize;
+   uint32 _incomingSpoolThreshold;
+   String _incomingSpoolDirectory;
 };
 DECLARE_REFTYPES(StorageReflectSessionFactory);
 
@@ -107,6 +128,12 @@ public:
    /** Returns a human-readable label for this session type:  "Session" */
    virtual const char * GetTypeName() const {return "Session";}
 
+   /** Overridden to schedule the sending of any subscription updates that are being held back by PR_NAME_MIN_UPDATE_INTERVAL */
+   virtual uint64 GetPulseTime(const PulseArgs & args);
+
+   /** Overridden to send any subscription updates whose PR_NAME_MIN_UPDATE_INTERVAL has elapsed */
+   virtual void Pulse(const PulseArgs & args);
+
    /** Prints to stdout a report of what sessions are currently present on this server, and how
      * much memory each of them is currently using for various things.  Useful for understanding
      * what your RAM is being used for.
@@ -279,6 +306,7 @@ protected:
       bool DoDirectChildLookup(TraversalContext & data, const DataNode & node, const String & key, int32 entryIdx, Hashtable<DataNode *, Void> & alreadyDid, int & depth);
       bool PathMatches(DataNode & node, ConstMessageRef & optData, const PathMatcherEntry & entry, int rootDepth) const;
       bool CheckChildForTraversal(TraversalContext & data, DataNode * nextChild, int32 optKnownMatchingEntryIndex, int & depth);
+      status_t GetFieldIndexCandidates(const TraversalContext & data, const DataNode & node, int depth, Queue<DataNodeRef> & retCandidates) const;
    };
 
    friend class DataNode;
@@ -353,6 +381,26 @@ protected:
      */
    DataNodeRef FindMatchingNode(const String & nodePath, const ConstQueryFilterRef & filter) const;
 
+   /** Declares a secondary index on the specified field, for the children of every node that matches (nodePath).
+     * Nodes that match (nodePath) now, and any that are created to match it later, will keep their children
+     * sorted by that field's value (see DataNode::AddFieldIndex()), so that queries that use an equality or range
+     * StringQueryFilter or numeric QueryFilter on that field to select among those children (e.g. a GETDATA
+     * of the children of (nodePath) with an Int32QueryFilter on the field) can be answered without examining every child.
+     * The declaration is shared by all sessions, and stays in effect until RemoveFieldIndex() is called.
+     * @param nodePath Wildcarded path of the nodes whose children should be indexed.  Relative paths are
+     *                 interpreted as they are in subscriptions (i.e. relative to every session's node).
+     * @param fieldName Name of the Message field to index.
+     * @return B_NO_ERROR on success, or B_ERROR on failure (out of memory?)
+     */
+   status_t AddFieldIndex(const String & nodePath, const String & fieldName);
+
+   /** Removes a declaration previously made by AddFieldIndex(), and the indexes it created.
+     * @param nodePath The path that was passed to AddFieldIndex().
+     * @param fieldName The field name that was passed to AddFieldIndex().
+     * @return B_NO_ERROR on success, or B_ERROR if no such declaration was found.
+     */
+   status_t RemoveFieldIndex(const String & nodePath, const String & fieldName);
+
    /** Convenience method (used by some customized daemons) -- Given a source node and a destination path,
     * Make (path) a deep, recursive clone of (node).
     * @param sourceNode Reference to a DataNode to clone.
@@ -373,6 +421,9 @@ protected:
    status_t CloneDataNodeSubtree(const DataNode & sourceNode, const String & destPath, bool allowOverwriteData=true, bool allowCreateNode=true, bool quiet=false, bool addToTargetIndex=false, const String * optInsertBefore = NULL, const ITraversalPruner * optPruner = NULL);
 
    /** Tells other sessions that we have modified (node) in our node subtree.
+    *  Note that creations and modifications are batched:  the subscribers' NodeChanged() methods
+    *  are called once per changed node, the next time PushSubscriptionMessages() is called, with
+    *  the node's data as of the first change and its current data.  Removals are reported immediately.
     *  @param node The node that has been modfied.
     *  @param oldData If the node is being modified, this argument contains the node's previously
     *                 held data.  If it is being created, this is a NULL reference.  If the node
@@ -408,7 +459,8 @@ protected:
    virtual void NodeIndexChanged(DataNode & node, char op, uint32 index, const String & key);
 
    /**
-    * Takes any messages that were created in the NodeChanged() callbacks and 
+    * Calls NodeChanged() for any node changes that are still pending, and then takes
+    * any messages that were created in the NodeChanged() callbacks and 
     * sends them to their owner's MessageReceivedFromSession() method for
     * processing and eventual forwarding to the client.
     */
@@ -420,6 +472,14 @@ protected:
     */
    void DoGetData(const Message & getMsg);
 
+   /**
+    * Executes an aggregating tree traversal based on the PR_NAME_KEYS, PR_NAME_FILTERS and PR_NAME_AGGREGATE_*
+    * fields of the given PR_COMMAND_GETAGGREGATE message, and sends the resulting PR_RESULT_AGGREGATE message to our client.
+    * @param aggMsg a Message specifying which nodes to aggregate over, and how.
+    * @returns B_NO_ERROR on success, or B_ERROR if (aggMsg) couldn't be parsed (or we ran out of memory).
+    */
+   status_t DoGetAggregate(const Message & aggMsg);
+
    /**
     * Executes a node-removal traversal using the given NodePathMatcher.
     * Note that you may find it easier to call RemoveDataNodes() than to call this method directly.
@@ -507,6 +567,9 @@ private:
    void PushSubscriptionMessage(MessageRef & msgRef); 
    void SendGetDataResults(MessageRef & msg);
    void NodeChangedAux(DataNode & modifiedNode, const MessageRef & nodeData, bool isBeingRemoved);
+   void NotifySubscribersThatNodeChangedAux(DataNode & modifiedNode, const MessageRef & oldData, bool isBeingRemoved);
+   void SendPendingNodeChange(DataNode & node);
+   void SendPendingNodeChanges();
    void UpdateDefaultMessageRoute();
    status_t RemoveParameter(const String & paramName, bool & retUpdateDefaultMessageRoute);
    int PassMessageCallbackAux(DataNode & node, const MessageRef & msgRef, bool matchSelfOkay);
@@ -517,12 +580,102 @@ private:
    DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, ReorderDataCallback);    /** Matching nodes area reordered in their parent's index */
    DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, GetSubtreesCallback);    /** Matching nodes are added in to the user Message as archived subtrees */
    DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, GetDataCallback);        /** Matching nodes are added to the (userData) Message */
+   DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, AggregateCallback);      /** Matching nodes' values are added to the (userData) running totals */
    DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, RemoveDataCallback);     /** Matching nodes are placed in a list (userData) for later removal. */
    DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, DoSubscribeRefCallback); /** Matching nodes are ref'd or unref'd with subscribed session IDs */
    DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, ChangeQueryFilterCallback); /** Matching nodes are ref'd or unref'd depending on the QueryFilter change */
-   DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, FindSessionsCallback);   /** Sessions of matching nodes are added to the given Hashtable */
    DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, FindNodesCallback);      /** Matching nodes are added to the given Queue */
-   DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, SendMessageCallback);    /** Similar to PassMessageCallback except matchSelf is an argument */
+   DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, AddFieldIndexCallback);  /** Matching nodes get a secondary index on the field named by (userData) */
+   DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, RemoveFieldIndexCallback); /** Matching nodes lose their secondary index on the field named by (userData) */
+
+   void AddDeclaredFieldIndexes(DataNode & newNode);
+
+   /** The set of target sessions that a given message-route resolved to, as remembered by our route cache.
+     * The entry stays valid until the node tree's structure changes (or, for routes that use QueryFilters,
+     * until any node's data changes), at which point it gets recomputed on demand.  It holds no references
+     * to the sessions or nodes, so that it never keeps a detached session or a removed node alive.
+     */
+   class CachedRoute : public RefCountable
+   {
+   public:
+      CachedRoute() : _structureChangeCount(0), _dataChangeCount(0), _usesFilters(false), _ret(B_NO_ERROR) {/* empty */}
+
+      Queue<String> _sessionIDs;                   // the matching sessions' ID strings, in traversal order (looked up again at send time)
+      Queue<DataNode *> _nodes;                    // the first matching node in each of those sessions (only valid while the tree's structure is unchanged)
+      ConstQueryFilterRef _filter;                 // the filter that was passed in with the path (if any)
+      uint32 _structureChangeCount;                // the tree's GetTreeStructureChangeCount() when we were computed
+      uint32 _dataChangeCount;                     // the tree's GetTreeDataChangeCount() when we were computed
+      bool _usesFilters;                           // true iff our result depends on the contents of the nodes
+      status_t _ret;                               // set to B_ERROR if we ran out of memory while computing the route
+   };
+   DECLARE_REFTYPES(CachedRoute);
+
+   CachedRouteRef GetCachedRoute(const String & routeKey, const QueryFilter * optFilter) const;
+   bool IsRouteCurrent(const CachedRoute & route) const;
+   CachedRouteRef ComputeRoute(const String & routeKey, NodePathMatcher & matcher, const ConstQueryFilterRef & optFilter) const;
+   CachedRouteRef GetRouteForPath(const String & nodePath, const ConstQueryFilterRef & filter) const;
+   void SendMessageAlongRoute(const CachedRoute & route, const MessageRef & msgRef, bool includeSelf);
+
+   DECLARE_MUSCLE_TRAVERSAL_CALLBACK(StorageReflectSession, RecordRouteCallback);    /** Sessions of matching nodes are added to the given CachedRoute */
+
+   /** A set of field names (or wildcard patterns) that node Messages should be reduced to before they are
+     * sent to the client, as specified by a PR_NAME_PROJECTION field.
+     */
+   class FieldProjection : public RefCountable
+   {
+   public:
+      FieldProjection() {/* empty */}
+
+      /** Sets our patterns from the PR_NAME_PROJECTION strings in (msg).  Returns B_ERROR if there are none (or out of memory). */
+      status_t SetFromMessage(const Message & msg);
+
+      /** Returns a Message containing only those fields of (msg) whose names match one of our patterns,
+        * or a NULL reference on failure (out of memory).
+        */
+      MessageRef Apply(const Message & msg) const;
+
+      /** Returns a string that uniquely identifies our set of patterns */
+      const String & GetKey() const {return _key;}
+
+   private:
+      Queue<StringMatcherRef> _matchers;
+      String _key;
+   };
+   DECLARE_REFTYPES(FieldProjection);
+
+   /** Remembers the projection and minimum update interval that apply to one of our SUBSCRIBE: paths.  Holding a
+     * reference to the subscription's parser keeps its pointer (which is what we look these options up by) unique.
+     */
+   class SubscriptionOptions
+   {
+   public:
+      SubscriptionOptions() : _minUpdateInterval(0) {/* empty */}
+      SubscriptionOptions(const StringMatcherQueueRef & parser, const ConstFieldProjectionRef & projection, uint64 minUpdateInterval) : _parser(parser), _projection(projection), _minUpdateInterval(minUpdateInterval) {/* empty */}
+
+      StringMatcherQueueRef _parser;
+      ConstFieldProjectionRef _projection;
+      uint64 _minUpdateInterval;  // in microseconds; zero means no throttling
+   };
+
+   /** The update-throttling state of one node, for subscriptions with a minimum update interval */
+   class ThrottledNodeUpdate
+   {
+   public:
+      ThrottledNodeUpdate() : _lastSendTime(0), _minUpdateInterval(0) {/* empty */}
+      ThrottledNodeUpdate(uint64 lastSendTime, uint64 minUpdateInterval) : _lastSendTime(lastSendTime), _minUpdateInterval(minUpdateInterval) {/* empty */}
+
+      uint64 _lastSendTime;       // when we last sent an update for this node to our client
+      uint64 _minUpdateInterval;  // how long to wait after that before sending the next one
+   };
+
+   void SetSubscriptionOptions(const String & fixPath, const ConstFieldProjectionRef & projection, uint64 minUpdateInterval);
+   void GetSubscriptionOptions(const DataNode & node, const FieldProjection * & retProjection, uint64 & retMinUpdateInterval) const;
+   MessageRef GetProjectedData(const FieldProjection & projection, const MessageRef & nodeData);
+   static bool GetSubscriptionOptionsCallback(const PathMatcherEntry & entry, void * userData);
+   bool HoldBackSubscriptionUpdate(const String & nodePath, const MessageRef & nodeData, uint64 minUpdateInterval);
+   void SendHeldBackSubscriptionUpdates(uint64 now);
+   void DropUnsubscribedHeldBackUpdates();
+   void ScheduleThrottledUpdateTime(uint64 when);
 
    /**
     * Called by SetParent() to tell us that (node) has been created at a given location.
@@ -538,6 +691,29 @@ private:
     */
    void NotifySubscribersOfNewNode(DataNode & newNode);
 
+   /** A node's data, and the result of applying a FieldProjection to it */
+   class ProjectedData
+   {
+   public:
+      ProjectedData() {/* empty */}
+      ProjectedData(const MessageRef & source, const MessageRef & projected) : _source(source), _projected(projected) {/* empty */}
+
+      MessageRef _source;     // held so that its pointer can't be reused by a different Message while we're cached
+      MessageRef _projected;
+   };
+
+   /** A node change whose subscriber notifications haven't been sent yet (see NotifySubscribersThatNodeChanged()) */
+   class PendingNodeChange
+   {
+   public:
+      PendingNodeChange() : _notifier(NULL) {/* empty */}
+      PendingNodeChange(const DataNodeRef & node, const MessageRef & oldData, StorageReflectSession * notifier) : _node(node), _oldData(oldData), _notifier(notifier) {/* empty */}
+
+      DataNodeRef _node;                     // keeps the node around until we've notified its subscribers
+      MessageRef _oldData;                   // the node's data before the first of the batched changes (NULL if it was just created)
+      StorageReflectSession * _notifier;     // the session whose NotifySubscribersThatNodeChanged() was called
+   };
+
    /** This class holds data that needs to be shared by all attached instances
      * of the StorageReflectSession class.  An instance of this class is stored
      * on demand in the central-state Message.
@@ -549,6 +725,9 @@ private:
 
       DataNodeRef _root;
       bool _subsDirty;
+      Hashtable<String, PathMatcher> _fieldIndexPaths;  // field name -> paths of the nodes whose children are indexed on that field
+      Hashtable<DataNode *, PendingNodeChange> _pendingNodeChanges;  // changed nodes (in order of first change) whose subscribers haven't been told yet
+      Hashtable<String, ProjectedData> _projectedData;  // projection key -> most recently projected node data, so each update is projected only once per distinct projection
    };
 
    /** Sets up the global root and other shared data */
@@ -576,6 +755,24 @@ private:
    NodePathMatcher _defaultMessageRoute;  
    Message _defaultMessageRouteMessage;
 
+   /** Recently used message routes (keyed by path) and the sessions they resolved to */
+   mutable Hashtable<String, CachedRouteRef> _routeCache;
+
+   /** The tree's structure-change count when we last purged stale routes from _routeCache */
+   mutable uint32 _routeCacheStructureChangeCount;
+
+   /** Options for those of our subscriptions that have a projection or minimum update interval, keyed by the subscription's parser */
+   Hashtable<const StringMatcherQueue *, SubscriptionOptions> _subscriptionOptions;
+
+   /** node path -> update-throttling state, for recently updated nodes matched by subscriptions with a minimum update interval.  Ordered by last send time, oldest first. */
+   Hashtable<String, ThrottledNodeUpdate> _throttledUpdates;
+
+   /** node path -> the most recent subscription update for that node that is being held back */
+   Hashtable<String, MessageRef> _heldBackUpdates;
+
+   /** When the next held-back subscription update is due to be sent, or MUSCLE_TIME_NEVER if there are none */
+   uint64 _nextThrottledUpdateTime;
+
    /** Whether or not we set to report subscription updates or not */
    bool _subscriptionsEnabled;            
 
@@ -28,6 +28,7 @@ status_t PathMatcher :: RemovePathString(const String & wildpath)
    PathMatcherEntry temp;
    if (_entries.Remove(wildpath, temp) == B_NO_ERROR)
    {
+      _trieDirty = true;
       if (temp.GetFilter()()) _numFilters--;
       return B_NO_ERROR;
    }
@@ -62,6 +63,7 @@ status_t PathMatcher :: PutPathString(const String & path, const ConstQueryFilte
             if (newQ->GetStringMatchers().AddTail(smRef) != B_NO_ERROR) return B_ERROR;
             lastSlashPos = slashPos;
          }
+         _trieDirty = true;  // Put() might have reallocated the table even if it failed
          if (_entries.Put(path, PathMatcherEntry(qRef, filter)) == B_NO_ERROR)
          {
             if (filter()) _numFilters++;
@@ -113,6 +115,7 @@ status_t PathMatcher :: PutPathsFromMatcher(const PathMatcher & matcher)
 {
    TCHECKPOINT;
 
+   _trieDirty = true;
    for (HashtableIterator<String, PathMatcherEntry> iter(matcher.GetEntries(), HTIT_FLAG_NOREGISTER); iter.HasData(); iter++)
    {
       if (_entries.Put(iter.GetKey(), iter.GetValue()) == B_NO_ERROR)
@@ -124,39 +127,173 @@ status_t PathMatcher :: PutPathsFromMatcher(const PathMatcher & matcher)
    return B_NO_ERROR;
 }
 
+// Supplies the clauses of a path string that has already been split up into a Queue
+class QueuePathClauseSource : public PathMatcher::PathClauseSource
+{
+public:
+   QueuePathClauseSource(const Queue<String> & clauses) : _clauses(clauses) {/* empty */}
+
+   virtual const String & GetClauseFromEnd(uint32 idxFromEnd) const {return _clauses[_clauses.GetNumItems()-(idxFromEnd+1)];}
+
+private:
+   const Queue<String> & _clauses;
+};
+
+// Context for MatchesPathCallback()
+class MatchesPathArgs
+{
+public:
+   MatchesPathArgs(const Message * optMessage, const DataNode * optNode) : _msg(optMessage, false), _optNode(optNode) {/* empty */}
+
+   ConstMessageRef _msg;
+   const DataNode * _optNode;
+};
+
+static bool MatchesPathCallback(const PathMatcherEntry & entry, void * userData)
+{
+   MatchesPathArgs * args = (MatchesPathArgs *) userData;
+   return (entry.FilterMatches(args->_msg, args->_optNode) == false);  // stop the visit at the first entry that matches
+}
+
 bool PathMatcher :: MatchesPath(const char * path, const Message * optMessage, const DataNode * optNode) const
 {
    TCHECKPOINT;
 
-   uint32 numClauses = GetPathDepth(path);
+   if (_entries.IsEmpty()) return false;
+
+   Queue<String> clauses;
+   StringTokenizer tok(path+((path[0]=='/')?1:0), "/");
+   const char * nextToken;
+   while((nextToken = tok()) != NULL) if (clauses.AddTail(nextToken) != B_NO_ERROR) return false;
+
+   MatchesPathArgs args(optMessage, optNode);
+   return (VisitMatchingEntries(QueuePathClauseSource(clauses), clauses.GetNumItems(), MatchesPathCallback, &args) == false);
+}
+
+bool PathMatcher :: VisitMatchingEntries(const PathClauseSource & clauses, uint32 numClauses, PathMatcherEntryCallback cb, void * userData) const
+{
+   if ((_trieDirty)&&(RebuildTrie() != B_NO_ERROR))
+   {
+      // Out of memory?  Then we'll do it the slow way, by testing each entry separately
+      for (HashtableIterator<String, PathMatcherEntry> iter(_entries, HTIT_FLAG_NOREGISTER); iter.HasData(); iter++)
+         if ((EntryMatchesClauses(iter.GetValue(), clauses, numClauses))&&(cb(iter.GetValue(), userData) == false)) return false;
+      return true;
+   }
+   return VisitMatchingEntriesAux(0, 0, clauses, numClauses, cb, userData);
+}
+
+bool PathMatcher :: VisitMatchingEntriesAux(uint32 nodeIndex, uint32 level, const PathClauseSource & clauses, uint32 numClauses, PathMatcherEntryCallback cb, void * userData) const
+{
+   const TrieNode & node = _trieNodes[nodeIndex];
+   if (level == numClauses)
+   {
+      for (uint32 i=0; i<node._entries.GetNumItems(); i++) if (cb(*node._entries[i], userData) == false) return false;
+      return true;
+   }
+
+   const String & clause = clauses.GetClauseFromEnd(level);
+   if (node._literalChildren.HasItems())
+   {
+      const uint32 * childIndex = node._literalChildren.Get(clause);
+      if ((childIndex)&&(VisitMatchingEntriesAux(*childIndex, level+1, clauses, numClauses, cb, userData) == false)) return false;
+   }
+   for (uint32 i=0; i<node._wildcardChildren.GetNumItems(); i++)
+   {
+      const TrieWildcardChild & wc = node._wildcardChildren[i];
+      const StringMatcher * sm = wc._matcher();
+      if (((sm == NULL)||(sm->Match(clause)))&&(VisitMatchingEntriesAux(wc._childIndex, level+1, clauses, numClauses, cb, userData) == false)) return false;
+   }
+   return true;
+}
+
+bool PathMatcher :: EntryMatchesClauses(const PathMatcherEntry & entry, const PathClauseSource & clauses, uint32 numClauses) const
+{
+   const StringMatcherQueue * smq = entry.GetParser()();
+   if ((smq == NULL)||(smq->GetStringMatchers().GetNumItems() != numClauses)) return false;
+
+   const Queue<StringMatcherRef> & sms = smq->GetStringMatchers();
+   for (uint32 i=0; i<numClauses; i++)
+   {
+      const StringMatcher * sm = sms[numClauses-(i+1)]();
+      if ((sm)&&(sm->Match(clauses.GetClauseFromEnd(i)) == false)) return false;
+   }
+   return true;
+}
+
+status_t PathMatcher :: RebuildTrie() const
+{
+   TCHECKPOINT;
+
+   _trieNodes.Clear();
+
+   // Reserve space for the worst case (no shared clauses at all) up front, so that our TrieNodes never get moved around while we're building
+   uint32 maxNodes = 1;
    for (HashtableIterator<String, PathMatcherEntry> iter(_entries, HTIT_FLAG_NOREGISTER); iter.HasData(); iter++)
    {
-      const StringMatcherQueue * nextSubscription = iter.GetValue().GetParser()();      
-      if ((nextSubscription)&&(nextSubscription->GetStringMatchers().GetNumItems() == numClauses))
+      const StringMatcherQueue * smq = iter.GetValue().GetParser()();
+      if (smq) maxNodes += smq->GetStringMatchers().GetNumItems();
+   }
+   if ((_trieNodes.EnsureSize(maxNodes) != B_NO_ERROR)||(_trieNodes.AddTail() != B_NO_ERROR)) return B_ERROR;
+
+   for (HashtableIterator<String, PathMatcherEntry> iter(_entries, HTIT_FLAG_NOREGISTER); iter.HasData(); iter++)
+   {
+      const PathMatcherEntry & entry = iter.GetValue();
+      const StringMatcherQueue * smq = entry.GetParser()();
+      if (smq == NULL) continue;
+
+      const Queue<StringMatcherRef> & sms = smq->GetStringMatchers();
+      uint32 nodeIndex = 0;
+      for (int32 i=((int32)sms.GetNumItems())-1; i>=0; i--)
       {
-         bool matched = true;  // default
+         const StringMatcherRef & smRef = sms[i];
+         const StringMatcher * sm = smRef();
+
+         // A clause can go into the literal-lookup table only if it is guaranteed to match its own text and nothing else
+         String literal;
+         bool isLiteral = ((sm)&&(sm->IsPatternUnique()));
+         if (isLiteral)
+         {
+            literal = RemoveEscapeChars(sm->GetPattern());
+            isLiteral = sm->Match(literal);
+         }
 
-         StringTokenizer tok(path+((path[0]=='/')?1:0), "/");
-         for (uint32 j=0; j<numClauses; j++)
+         TrieNode & node = _trieNodes[nodeIndex];
+         uint32 childIndex = MUSCLE_NO_LIMIT;
+         if (isLiteral)
          {
-            const char * nextToken = tok();
-            const StringMatcher * nextMatcher = nextSubscription->GetStringMatchers().GetItemAt(j)->GetItemPointer();
-            if ((nextToken == NULL)||((nextMatcher)&&(nextMatcher->Match(nextToken) == false))) 
+            const uint32 * ci = node._literalChildren.Get(literal);
+            if (ci) childIndex = *ci;
+            else
             {
-               matched = false;
-               break;
+               childIndex = _trieNodes.GetNumItems();
+               if ((_trieNodes.AddTail() != B_NO_ERROR)||(node._literalChildren.Put(literal, childIndex) != B_NO_ERROR)) return B_ERROR;
             }
          }
-
-         if (matched) 
+         else
          {
-            ConstMessageRef constMsg(optMessage, false);
-            const QueryFilter * filter = iter.GetValue().GetFilter()();
-            if ((filter == NULL)||(optMessage == NULL)||(filter->Matches(constMsg, optNode))) return true;
+            for (uint32 j=0; j<node._wildcardChildren.GetNumItems(); j++)
+            {
+               const TrieWildcardChild & wc = node._wildcardChildren[j];
+               const StringMatcher * other = wc._matcher();
+               if ((other == sm)||((other)&&(sm)&&(*other == *sm)))
+               {
+                  childIndex = wc._childIndex;
+                  break;
+               }
+            }
+            if (childIndex == MUSCLE_NO_LIMIT)
+            {
+               childIndex = _trieNodes.GetNumItems();
+               if ((_trieNodes.AddTail() != B_NO_ERROR)||(node._wildcardChildren.AddTail(TrieWildcardChild(smRef, childIndex)) != B_NO_ERROR)) return B_ERROR;
+            }
          }
+         nodeIndex = childIndex;
       }
+      if (_trieNodes[nodeIndex]._entries.AddTail(&entry) != B_NO_ERROR) return B_ERROR;
    }
-   return false;
+
+   _trieDirty = false;
+   return B_NO_ERROR;
 }
 
 // Returns a pointer into (path) after the (depth)'th '/' char
@@ -217,6 +354,22 @@ String StringMatcherQueue :: ToString() const
    return ret;
 }
 
+void PathMatcherEntry :: SetFilter(const ConstQueryFilterRef & filter)
+{
+   _filter = filter;
+   _compiledFilter.Reset();
+   if (filter())
+   {
+      CompiledQueryFilter * cf = newnothrow CompiledQueryFilter;
+      if (cf)
+      {
+         _compiledFilter.SetRef(cf);
+         if (cf->SetFilter(filter) != B_NO_ERROR) _compiledFilter.Reset();  // FilterMatches() will just call (filter) directly
+      }
+      else WARN_OUT_OF_MEMORY;
+   }
+}
+
 /** Returns a human-readable string representing this PathMatcherEntry, for easier debugging */
 String PathMatcherEntry :: ToString() const
 {
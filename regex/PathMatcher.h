@@ -53,7 +53,7 @@ public:
      * @param parser Reference to the list of StringMatcher objects that represent our wildcarded path.
      * @param filter Optional reference to the QueryFilter object that filters matching nodes by content.
      */
-   PathMatcherEntry(const StringMatcherQueueRef & parser, const ConstQueryFilterRef & filter) : _parser(parser), _filter(filter) {/* empty */}
+   PathMatcherEntry(const StringMatcherQueueRef & parser, const ConstQueryFilterRef & filter) : _parser(parser) {SetFilter(filter);}
 
    /** Returns a reference to our list of StringMatchers. */
    StringMatcherQueueRef GetParser() const {return _parser;}
@@ -62,9 +62,11 @@ public:
    ConstQueryFilterRef GetFilter() const {return _filter;}
 
    /** Sets our QueryFilter object to the specified reference.  Pass in a NULL reference to remove any existing QueryFilter.
+     * The QueryFilter is compiled (see CompiledQueryFilter) so that FilterMatches() can evaluate it quickly; if you
+     * modify the QueryFilter afterwards, call SetFilter() again.
      * @param filter read-only reference to the QueryFilter to use, or a NULL reference.
      */
-   void SetFilter(const ConstQueryFilterRef & filter) {_filter = filter;}
+   void SetFilter(const ConstQueryFilterRef & filter);
 
    /** Returns true iff we our filter matches the given Message, or if either (optMsg) or our filter is NULL. 
      * @param optMsg if non-NULL, the Message to match against.  (If NULL, then we'll just return true)
@@ -72,8 +74,13 @@ public:
      */
    bool FilterMatches(ConstMessageRef & optMsg, const DataNode * optNode) const
    {
+      if (optMsg() == NULL) return true;
+
+      const CompiledQueryFilter * cf = _compiledFilter();
+      if (cf) return cf->Matches(optMsg, optNode);
+
       const QueryFilter * filter = GetFilter()();
-      return ((filter == NULL)||(optMsg() == NULL)||(filter->Matches(optMsg, optNode)));
+      return ((filter == NULL)||(filter->Matches(optMsg, optNode)));
    }
 
    /** Returns a human-readable string representing this PathMatcherEntry, for easier debugging */
@@ -82,6 +89,7 @@ public:
 private:
    StringMatcherQueueRef _parser;
    ConstQueryFilterRef _filter;
+   ConstCompiledQueryFilterRef _compiledFilter;
 };
 
 /** This class is used to do efficient regex-pattern-matching of one or more query strings (e.g. ".*./.*./j*remy/fries*") 
@@ -93,18 +101,27 @@ private:
   * As of MUSCLE 2.40, this class also supports QueryFilter objects, so that only nodes whose Messages match the
   * criteria of the QueryFilter are considered to match the query.  This filtering is optional -- specify a null
   * ConstQueryFilterRef to disable it.
+  * Internally, all of the query strings are merged into a single clause-wise trie (with identical literal clauses
+  * sharing a Hashtable lookup, and identical wildcard clauses sharing a single StringMatcher test), so that finding
+  * all the entries that match a given path takes one traversal rather than one pass per entry.
   */
 class PathMatcher : public RefCountable
 {
 public:
    /** Default Constructor.  Creates a PathMatcher with no query strings in it */
-   PathMatcher() : _numFilters(0) {/* empty */}
+   PathMatcher() : _numFilters(0), _trieDirty(true) {/* empty */}
+
+   /** @copydoc DoxyTemplate::DoxyTemplate(const DoxyTemplate &) */
+   PathMatcher(const PathMatcher & rhs) : RefCountable(rhs), _entries(rhs._entries), _numFilters(rhs._numFilters), _trieDirty(true) {/* empty */}
 
    /** Destructor */
    ~PathMatcher() {/* empty */}
 
+   /** @copydoc DoxyTemplate::operator=(const DoxyTemplate &) */
+   PathMatcher & operator = (const PathMatcher & rhs) {_entries = rhs._entries; _numFilters = rhs._numFilters; _trieDirty = true; return *this;}
+
    /** Removes all path nodes from this object */
-   void Clear() {_entries.Clear(); _numFilters = 0;}
+   void Clear() {_entries.Clear(); _numFilters = 0; _trieDirty = true;}
 
    /** Parses the given query string (e.g. "12.18.240.15/1234/beshare/j*") to this PathMatcher's set of query strings.
     *  Note that the search strings are always treated as relative paths -- if you pass in a search string with
@@ -183,9 +200,69 @@ public:
    /** Returns the number of QueryFilters we are currently using. */
    uint32 GetNumFilters() const {return _numFilters;}
 
+   /** Interface for an object that supplies the clauses of a path to VisitMatchingEntries().
+     * The clauses are requested last-clause-first, since that is the cheapest order for e.g. walking up a DataNode's parents.
+     */
+   class PathClauseSource
+   {
+   public:
+      /** Default constructor */
+      PathClauseSource() {/* empty */}
+
+      /** Destructor */
+      virtual ~PathClauseSource() {/* empty */}
+
+      /** Should return the specified clause of the path.
+        * @param idxFromEnd index of the clause to return:  0 is the path's last clause, 1 is its second-to-last clause, and so on.
+        */
+      virtual const String & GetClauseFromEnd(uint32 idxFromEnd) const = 0;
+   };
+
+   /** Callback type for VisitMatchingEntries().  Should return true to continue the visit, or false to end it early. */
+   typedef bool (*PathMatcherEntryCallback)(const PathMatcherEntry & entry, void * userData);
+
+   /** Calls (cb) once for each of our entries whose wildcarded path matches the given path.  Only the paths are
+     * checked here; the callback can call PathMatcherEntry::FilterMatches() if it cares about the QueryFilters also.
+     * @param clauses object that supplies the clauses of the path to match against.
+     * @param numClauses the number of clauses in the path (only entries with this many clauses can match)
+     * @param cb the callback function to call for each matching entry
+     * @param userData value to pass through to (cb)
+     * @returns false if (cb) ended the visit early by returning false, or true otherwise.
+     */
+   bool VisitMatchingEntries(const PathClauseSource & clauses, uint32 numClauses, PathMatcherEntryCallback cb, void * userData) const;
+
 private:
+   // One wildcarded clause leading out of a TrieNode
+   class TrieWildcardChild
+   {
+   public:
+      TrieWildcardChild() : _childIndex(0) {/* empty */}
+      TrieWildcardChild(const StringMatcherRef & matcher, uint32 childIndex) : _matcher(matcher), _childIndex(childIndex) {/* empty */}
+
+      StringMatcherRef _matcher;  // NULL ref means "*", i.e. match anything
+      uint32 _childIndex;         // index of the child TrieNode in _trieNodes
+   };
+
+   // One level of the trie; the root node represents the last clause of each path, its children the second-to-last, etc.
+   class TrieNode
+   {
+   public:
+      TrieNode() {/* empty */}
+
+      Hashtable<String, uint32> _literalChildren;    // non-wildcarded clause text -> index of the child TrieNode in _trieNodes
+      Queue<TrieWildcardChild> _wildcardChildren;  // one per distinct wildcarded clause
+      Queue<const PathMatcherEntry *> _entries;     // entries whose paths have all of their clauses matched once we've reached this node
+   };
+
+   status_t RebuildTrie() const;
+   bool VisitMatchingEntriesAux(uint32 nodeIndex, uint32 level, const PathClauseSource & clauses, uint32 numClauses, PathMatcherEntryCallback cb, void * userData) const;
+   bool EntryMatchesClauses(const PathMatcherEntry & entry, const PathClauseSource & clauses, uint32 numClauses) const;
+
    Hashtable<String, PathMatcherEntry> _entries;
    uint32 _numFilters;  // count how many filters are installed; so we can optimize when there are none
+
+   mutable Queue<TrieNode> _trieNodes;  // node #0 is the root; rebuilt on demand whenever _entries has changed
+   mutable bool _trieDirty;
 };
 DECLARE_REFTYPES(PathMatcher);
 
@@ -211,8 +211,11 @@ bool StringQueryFilter :: Matches(ConstMessageRef & msg, const DataNode *) const
       if (_assumeDefault) ps = &_default;
                      else return false;
    }
+   return MatchesString(*ps);
+}
 
-   const String & s = *ps;
+bool StringQueryFilter :: MatchesString(const String & s) const
+{
    switch(_op)
    {
       case OP_EQUAL_TO:                            return s == _value;
@@ -432,4 +435,351 @@ void SetGlobalQueryFilterFactory(const QueryFilterFactoryRef & newFactory)
    _customQueryFilterFactoryRef = newFactory;
 }
 
+enum {
+   OPCODE_CONSTANT = 0, // matches iff (_operator) is non-zero
+   OPCODE_WHAT_CODE,    // matches iff the Message's what-code is in the range [_value._what[0], _value._what[1]]
+   OPCODE_EXISTS,       // matches iff our field item is present
+   OPCODE_INTEGER,      // compares our (bool or integer) field item against _value._int
+   OPCODE_FLOAT,        // compares our (float or double) field item against _value._float
+   OPCODE_STRING,       // passes our String field item to the StringQueryFilter's MatchesString() method
+   OPCODE_CALL          // calls the QueryFilter's Matches() method
+};
+
+static const uint32 JUMP_MATCH       = MUSCLE_NO_LIMIT;    // pseudo-instruction-index:  the Message matches
+static const uint32 JUMP_NO_MATCH    = MUSCLE_NO_LIMIT-1;  // pseudo-instruction-index:  the Message doesn't match
+static const uint32 MAX_CACHED_SLOTS = 32;                 // one bit per field slot in Matches()'s resolved-slots mask
+
+template <typename DataType> static inline bool CompareCompiledValues(uint8 op, const DataType & valueInMsg, const DataType & value)
+{
+   // Note that the OP_* values are the same for all NumericQueryFilter types
+   switch(op)
+   {
+      case Int32QueryFilter::OP_EQUAL_TO:                 return (valueInMsg == value);
+      case Int32QueryFilter::OP_LESS_THAN:                return (valueInMsg <  value);
+      case Int32QueryFilter::OP_GREATER_THAN:             return (valueInMsg >  value);
+      case Int32QueryFilter::OP_LESS_THAN_OR_EQUAL_TO:    return (valueInMsg <= value);
+      case Int32QueryFilter::OP_GREATER_THAN_OR_EQUAL_TO: return (valueInMsg >= value);
+      case Int32QueryFilter::OP_NOT_EQUAL_TO:             return (valueInMsg != value);
+      default:                                            /* do nothing */  break;
+   }
+   return false;
+}
+
+static inline int64 GetCompiledIntegerItem(uint32 typeCode, const void * item)
+{
+   switch(typeCode)
+   {
+      case B_BOOL_TYPE:  return *(static_cast<const bool  *>(item)) ? 1 : 0;
+      case B_INT8_TYPE:  return *(static_cast<const int8  *>(item));
+      case B_INT16_TYPE: return *(static_cast<const int16 *>(item));
+      case B_INT32_TYPE: return *(static_cast<const int32 *>(item));
+      default:           return *(static_cast<const int64 *>(item));
+   }
+}
+
+static inline double GetCompiledFloatItem(uint32 typeCode, const void * item)
+{
+   return (typeCode == B_FLOAT_TYPE) ? (double)(*(static_cast<const float *>(item))) : *(static_cast<const double *>(item));
+}
+
+static inline const void * LookupCompiledSlot(const Message * msg, const FieldKey & key, uint32 typeCode, uint32 index)
+{
+   const void * ret;
+   return (msg->FindDataItem(key, typeCode, index, &ret) == B_NO_ERROR) ? ret : NULL;
+}
+
+status_t CompiledQueryFilter :: SetFilter(const ConstQueryFilterRef & filter)
+{
+   _filter = filter;
+   _slots.Clear();
+   _instructions.Clear();
+   if (filter() == NULL) return B_NO_ERROR;
+
+   // labels[n] holds the index of the instruction that label #n refers to.  Labels #0 and #1 are the final outcomes.
+   Queue<uint32> labels;
+   if ((labels.AddTail(JUMP_MATCH) == B_NO_ERROR)&&(labels.AddTail(JUMP_NO_MATCH) == B_NO_ERROR)&&(CompileAux(filter(), 0, 1, labels) == B_NO_ERROR))
+   {
+      for (uint32 i=0; i<_instructions.GetNumItems(); i++)
+      {
+         Instruction & in = _instructions[i];
+         in._onTrue  = labels[in._onTrue];
+         in._onFalse = labels[in._onFalse];
+      }
+      _instructions.Normalize();  // so that Matches() can walk them as a C array
+      return B_NO_ERROR;
+   }
+
+   // Out of memory; Matches() will fall back to calling (filter) directly
+   _slots.Clear();
+   _instructions.Clear();
+   return B_ERROR;
+}
+
+status_t CompiledQueryFilter :: CompileAux(const QueryFilter * filter, uint32 trueLabel, uint32 falseLabel, Queue<uint32> & labels)
+{
+   if (filter == NULL) return AddInstruction(OPCODE_CONSTANT, NULL, trueLabel, falseLabel);  // a NULL child filter never matches
+
+   switch(filter->TypeCode())
+   {
+      case QUERY_FILTER_TYPE_WHATCODE:
+      {
+         const WhatCodeQueryFilter * wf = dynamic_cast<const WhatCodeQueryFilter *>(filter);
+         Instruction * in;
+         if (wf)
+         {
+            if (AddInstruction(OPCODE_WHAT_CODE, filter, trueLabel, falseLabel, &in) != B_NO_ERROR) return B_ERROR;
+            in->_value._what[0] = wf->GetMinWhatCode();
+            in->_value._what[1] = wf->GetMaxWhatCode();
+            return B_NO_ERROR;
+         }
+      }
+      break;
+
+      case QUERY_FILTER_TYPE_VALUEEXISTS:
+      {
+         const ValueExistsQueryFilter * vf = dynamic_cast<const ValueExistsQueryFilter *>(filter);
+         if (vf)
+         {
+            // Only the fixed-size types and Strings are compiled, since FindData() treats the other types specially
+            switch(vf->GetTypeCode())
+            {
+               case B_BOOL_TYPE:  case B_DOUBLE_TYPE: case B_FLOAT_TYPE: case B_INT64_TYPE: case B_INT32_TYPE:
+               case B_INT16_TYPE: case B_INT8_TYPE:   case B_POINT_TYPE: case B_RECT_TYPE:  case B_STRING_TYPE:
+               {
+                  Instruction * in;
+                  uint32 slot;
+                  if ((GetSlot(vf->GetFieldName(), vf->GetTypeCode(), 0, slot) != B_NO_ERROR)||(AddInstruction(OPCODE_EXISTS, filter, trueLabel, falseLabel, &in) != B_NO_ERROR)) return B_ERROR;
+                  in->_slot     = slot;
+                  in->_typeCode = vf->GetTypeCode();
+                  return B_NO_ERROR;
+               }
+            }
+         }
+      }
+      break;
+
+      case QUERY_FILTER_TYPE_BOOL:   {const BoolQueryFilter   * nf = dynamic_cast<const BoolQueryFilter   *>(filter); if (nf) return CompileNumeric(*nf, true,  trueLabel, falseLabel);} break;
+      case QUERY_FILTER_TYPE_DOUBLE: {const DoubleQueryFilter * nf = dynamic_cast<const DoubleQueryFilter *>(filter); if (nf) return CompileNumeric(*nf, false, trueLabel, falseLabel);} break;
+      case QUERY_FILTER_TYPE_FLOAT:  {const FloatQueryFilter  * nf = dynamic_cast<const FloatQueryFilter  *>(filter); if (nf) return CompileNumeric(*nf, false, trueLabel, falseLabel);} break;
+      case QUERY_FILTER_TYPE_INT64:  {const Int64QueryFilter  * nf = dynamic_cast<const Int64QueryFilter  *>(filter); if (nf) return CompileNumeric(*nf, true,  trueLabel, falseLabel);} break;
+      case QUERY_FILTER_TYPE_INT32:  {const Int32QueryFilter  * nf = dynamic_cast<const Int32QueryFilter  *>(filter); if (nf) return CompileNumeric(*nf, true,  trueLabel, falseLabel);} break;
+      case QUERY_FILTER_TYPE_INT16:  {const Int16QueryFilter  * nf = dynamic_cast<const Int16QueryFilter  *>(filter); if (nf) return CompileNumeric(*nf, true,  trueLabel, falseLabel);} break;
+      case QUERY_FILTER_TYPE_INT8:   {const Int8QueryFilter   * nf = dynamic_cast<const Int8QueryFilter   *>(filter); if (nf) return CompileNumeric(*nf, true,  trueLabel, falseLabel);} break;
+
+      case QUERY_FILTER_TYPE_STRING:
+      {
+         const StringQueryFilter * sf = dynamic_cast<const StringQueryFilter *>(filter);
+         if (sf)
+         {
+            Instruction * in;
+            uint32 slot;
+            if ((GetSlot(sf->GetFieldName(), B_STRING_TYPE, sf->GetIndex(), slot) != B_NO_ERROR)||(AddInstruction(OPCODE_STRING, filter, trueLabel, falseLabel, &in) != B_NO_ERROR)) return B_ERROR;
+            in->_slot       = slot;
+            in->_typeCode   = B_STRING_TYPE;
+            in->_hasDefault = sf->IsAssumedDefault();
+            return B_NO_ERROR;
+         }
+      }
+      break;
+
+      case QUERY_FILTER_TYPE_ANDOR:
+      {
+         const AndOrQueryFilter * af = dynamic_cast<const AndOrQueryFilter *>(filter);
+         if (af)
+         {
+            const Queue<ConstQueryFilterRef> & kids = af->GetChildren();
+            const uint32 numKids   = kids.GetNumItems();
+            const uint32 threshold = muscleMin(af->GetMinMatchCount(), numKids);
+            if (numKids == 0)         return AddInstruction(OPCODE_CONSTANT, filter, trueLabel, falseLabel);  // an empty AndOrQueryFilter never matches
+            if (threshold == numKids) return CompileChildren(kids, true,  trueLabel, falseLabel, labels);     // AND
+            if (threshold == 1)       return CompileChildren(kids, false, trueLabel, falseLabel, labels);     // OR
+         }
+      }
+      break;
+
+      case QUERY_FILTER_TYPE_NANDNOT:
+      {
+         const NandNotQueryFilter * nf = dynamic_cast<const NandNotQueryFilter *>(filter);
+         if (nf)
+         {
+            const Queue<ConstQueryFilterRef> & kids = nf->GetChildren();
+            const uint32 numKids   = kids.GetNumItems();
+            const uint32 threshold = muscleMin(nf->GetMaxMatchCount(), numKids);
+            if (numKids == 0)           return AddInstruction(OPCODE_CONSTANT, filter, trueLabel, falseLabel);  // an empty NandNotQueryFilter never matches
+            if (threshold+1 >= numKids) return CompileChildren(kids, true,  falseLabel, trueLabel, labels);     // NAND == NOT(AND)
+            if (threshold == 0)         return CompileChildren(kids, false, falseLabel, trueLabel, labels);     // NOR  == NOT(OR)
+         }
+      }
+      break;
+   }
+
+   // Anything we don't know how to compile, we'll just call
+   return AddInstruction(OPCODE_CALL, filter, trueLabel, falseLabel);
+}
+
+status_t CompiledQueryFilter :: CompileChildren(const Queue<ConstQueryFilterRef> & kids, bool isAnd, uint32 trueLabel, uint32 falseLabel, Queue<uint32> & labels)
+{
+   const uint32 numKids = kids.GetNumItems();
+   for (uint32 i=0; i<numKids; i++)
+   {
+      // Each child either decides the outcome, or continues on to the next child's first instruction
+      uint32 nextLabel = isAnd ? trueLabel : falseLabel;
+      if (i+1 < numKids)
+      {
+         nextLabel = labels.GetNumItems();
+         if (labels.AddTail(JUMP_NO_MATCH) != B_NO_ERROR) return B_ERROR;  // placeholder; set below
+      }
+
+      if (CompileAux(kids[i](), isAnd ? nextLabel : trueLabel, isAnd ? falseLabel : nextLabel, labels) != B_NO_ERROR) return B_ERROR;
+      if (i+1 < numKids) labels[nextLabel] = _instructions.GetNumItems();
+   }
+   return B_NO_ERROR;
+}
+
+template<typename DataType, uint32 DataTypeCode, uint32 ClassTypeCode>
+status_t CompiledQueryFilter :: CompileNumeric(const NumericQueryFilter<DataType, DataTypeCode, ClassTypeCode> & filter, bool isInteger, uint32 trueLabel, uint32 falseLabel)
+{
+   if (filter.GetMaskOp() != NQF_MASK_OP_NONE) return AddInstruction(OPCODE_CALL, &filter, trueLabel, falseLabel);  // masked comparisons aren't compiled
+
+   Instruction * in;
+   uint32 slot;
+   if ((GetSlot(filter.GetFieldName(), DataTypeCode, filter.GetIndex(), slot) != B_NO_ERROR)||(AddInstruction(isInteger ? OPCODE_INTEGER : OPCODE_FLOAT, &filter, trueLabel, falseLabel, &in) != B_NO_ERROR)) return B_ERROR;
+   in->_operator   = filter.GetOperator();
+   in->_slot       = slot;
+   in->_typeCode   = DataTypeCode;
+   in->_hasDefault = filter.IsAssumedDefault();
+   if (isInteger)
+   {
+      in->_value._int   = (int64) filter.GetValue();
+      in->_default._int = (int64) filter.GetAssumedDefault();
+   }
+   else
+   {
+      in->_value._float   = (double) filter.GetValue();
+      in->_default._float = (double) filter.GetAssumedDefault();
+   }
+   return B_NO_ERROR;
+}
+
+status_t CompiledQueryFilter :: AddInstruction(uint8 opCode, const QueryFilter * filter, uint32 trueLabel, uint32 falseLabel, Instruction ** optRetInstruction)
+{
+   Instruction * in = _instructions.AddTailAndGet();
+   if (in == NULL) return B_ERROR;
+
+   in->_opCode  = opCode;
+   in->_filter  = filter;
+   in->_onTrue  = trueLabel;
+   in->_onFalse = falseLabel;
+   if (optRetInstruction) *optRetInstruction = in;
+   return B_NO_ERROR;
+}
+
+status_t CompiledQueryFilter :: GetSlot(const String & fieldName, uint32 typeCode, uint32 index, uint32 & retSlot)
+{
+   for (uint32 i=0; i<_slots.GetNumItems(); i++)
+   {
+      const FieldSlot & s = _slots[i];
+      if ((s._typeCode == typeCode)&&(s._index == index)&&(s._key.GetFieldName() == fieldName))
+      {
+         retSlot = i;
+         return B_NO_ERROR;
+      }
+   }
+
+   retSlot = _slots.GetNumItems();
+   return _slots.AddTail(FieldSlot(fieldName, typeCode, index));
+}
+
+bool CompiledQueryFilter :: Matches(ConstMessageRef & msg, const DataNode * optNode) const
+{
+   uint32 numInstructions;
+   const Instruction * program = _instructions.GetArrayPointer(0, numInstructions);
+   if (program == NULL)
+   {
+      const QueryFilter * filter = _filter();
+      return ((filter == NULL)||(filter->Matches(msg, optNode)));
+   }
+
+   const Message * m = msg();
+   const void * slotItems[MAX_CACHED_SLOTS];
+   uint32 resolvedSlots = 0;  // bit (n) is set iff slotItems[n] has been looked up already
+
+   uint32 pc = 0;
+   while(true)
+   {
+      const Instruction & in = program[pc];
+      bool result = false;
+      switch(in._opCode)
+      {
+         case OPCODE_CONSTANT:
+            result = (in._operator != 0);
+         break;
+
+         case OPCODE_WHAT_CODE:
+            result = muscleInRange(m->what, in._value._what[0], in._value._what[1]);
+         break;
+
+         case OPCODE_CALL:
+            result = in._filter->Matches(msg, optNode);
+            if (msg() != m)
+            {
+               // The filter retargetted (msg), so our cached field items are no longer valid
+               m = msg();
+               resolvedSlots = 0;
+            }
+         break;
+
+         default:
+         {
+            const void * item;
+            if (in._slot < MAX_CACHED_SLOTS)
+            {
+               const uint32 bit = (1<<in._slot);
+               if ((resolvedSlots & bit) == 0)
+               {
+                  const FieldSlot & slot = _slots[in._slot];
+                  slotItems[in._slot] = LookupCompiledSlot(m, slot._key, slot._typeCode, slot._index);
+                  resolvedSlots |= bit;
+               }
+               item = slotItems[in._slot];
+            }
+            else
+            {
+               const FieldSlot & slot = _slots[in._slot];
+               item = LookupCompiledSlot(m, slot._key, slot._typeCode, slot._index);
+            }
+
+            switch(in._opCode)
+            {
+               case OPCODE_EXISTS:
+                  result = (item != NULL);
+               break;
+
+               case OPCODE_INTEGER:
+                       if (item)           result = CompareCompiledValues(in._operator, GetCompiledIntegerItem(in._typeCode, item), in._value._int);
+                  else if (in._hasDefault) result = CompareCompiledValues(in._operator, in._default._int, in._value._int);
+               break;
+
+               case OPCODE_FLOAT:
+                       if (item)           result = CompareCompiledValues(in._operator, GetCompiledFloatItem(in._typeCode, item), in._value._float);
+                  else if (in._hasDefault) result = CompareCompiledValues(in._operator, in._default._float, in._value._float);
+               break;
+
+               case OPCODE_STRING:
+               {
+                  const StringQueryFilter * sf = static_cast<const StringQueryFilter *>(in._filter);
+                       if (item)           result = sf->MatchesString(*(static_cast<const String *>(item)));
+                  else if (in._hasDefault) result = sf->MatchesString(sf->GetAssumedDefault());
+               }
+               break;
+            }
+         }
+         break;
+      }
+
+      pc = result ? in._onTrue : in._onFalse;
+      if (pc >= JUMP_NO_MATCH) return (pc == JUMP_MATCH);
+   }
+}
+
 } // end namespace muscle
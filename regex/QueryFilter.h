@@ -103,6 +103,12 @@ public:
    virtual bool Matches(ConstMessageRef & msg, const DataNode * optNode) const {(void) optNode; return muscleInRange(msg()->what, _minWhatCode, _maxWhatCode);}
    virtual uint32 TypeCode() const {return QUERY_FILTER_TYPE_WHATCODE;}
 
+   /** Returns the minimum 'what' code we will match on, as specified in our constructor. */
+   uint32 GetMinWhatCode() const {return _minWhatCode;}
+
+   /** Returns the maximum 'what' code we will match on, as specified in our constructor. */
+   uint32 GetMaxWhatCode() const {return _maxWhatCode;}
+
 private:
    uint32 _minWhatCode;
    uint32 _maxWhatCode;
@@ -352,6 +358,9 @@ public:
      */
    void UnsetAssumedDefault() {_default = DataType(); _assumeDefault = false;}
 
+   /** Returns the assumed default value.  Only meaningful if IsAssumedDefault() returns true. */
+   const DataType & GetAssumedDefault() const {return _default;}
+
    /** Sets the mask operation to perform on the discovered data value before applying the OP_* test.
      * Note that mask operations are not defined for floats, doubles, Points, or Rects.
      * @param maskOp a NQF_MASK_OP_* value.  Default value is NQF_MASK_OP_NONE.
@@ -755,6 +764,15 @@ public:
      */
    void UnsetAssumedDefault() {_default.Clear(); _assumeDefault = false;}
 
+   /** Returns the assumed default value.  Only meaningful if IsAssumedDefault() returns true. */
+   const String & GetAssumedDefault() const {return _default;}
+
+   /** Returns true iff the given String satisfies our operator and value.  This is the test that Matches()
+     * applies to the String it finds in the Message (or to the assumed default, if it doesn't find one).
+     * @param s The String to test.
+     */
+   bool MatchesString(const String & s) const;
+
 private:
    void FreeMatcher();
    bool DoMatch(const String & s) const;
@@ -924,6 +942,100 @@ QueryFilterFactoryRef GetGlobalQueryFilterFactory();
   */
 void SetGlobalQueryFilterFactory(const QueryFilterFactoryRef & newFactory);
 
+/** This class compiles a tree of QueryFilter objects into a flat sequence of instructions, so that the tree
+  * can be tested against many Messages more cheaply than by calling its Matches() methods directly:
+  *   - Each distinct field item (name, type and index) that the tree refers to is looked up in the Message
+  *     at most once per Matches() call, using a pre-hashed FieldKey, no matter how many filters test it.
+  *   - AND, OR, NAND and NOR filters become short-circuiting jumps between instructions, rather than
+  *     loops of virtual Matches() calls.
+  *   - Numeric comparisons are done inline, against values that were converted to int64 or double at compile time.
+  * Filters that can't be compiled (e.g. XorQueryFilters, masked numeric comparisons, MessageQueryFilters,
+  * RawDataQueryFilters, or user-defined QueryFilter subclasses) are called via their Matches() method as usual,
+  * so Matches() always returns the same result that the source QueryFilter's Matches() method would.
+  * @note The compiled instructions are a snapshot of the source QueryFilter tree.  If you modify the tree
+  *       after calling SetFilter(), call SetFilter() again.
+  */
+class CompiledQueryFilter : public RefCountable
+{
+public:
+   /** Default constructor.  Creates a CompiledQueryFilter with no filter, which matches every Message. */
+   CompiledQueryFilter() {/* empty */}
+
+   /** Constructor.  Compiles the given QueryFilter.
+     * @param filter The QueryFilter tree to compile.  May be a NULL reference.
+     */
+   CompiledQueryFilter(const ConstQueryFilterRef & filter) {(void) SetFilter(filter);}
+
+   /** Compiles the given QueryFilter tree, replacing any previously compiled instructions.
+     * @param filter The QueryFilter tree to compile.  May be a NULL reference, in which case every Message will match.
+     * @returns B_NO_ERROR on success, or B_ERROR if we ran out of memory.  (On failure, Matches() will still work,
+     *          by calling (filter)'s Matches() method directly)
+     */
+   status_t SetFilter(const ConstQueryFilterRef & filter);
+
+   /** Returns the QueryFilter that was passed to SetFilter() (or to our constructor). */
+   const ConstQueryFilterRef & GetFilter() const {return _filter;}
+
+   /** Returns the same result as GetFilter()()->Matches(msg, optNode) would, or true if we have no filter.
+     * @param msg Reference to the Message to test.  Must not be a NULL reference.
+     * @param optNode The DataNode associated with (msg), if any.  It is passed on to any non-compiled filters.
+     */
+   bool Matches(ConstMessageRef & msg, const DataNode * optNode) const;
+
+   /** Returns the number of instructions our QueryFilter tree was compiled into (zero if it wasn't compiled). */
+   uint32 GetNumInstructions() const {return _instructions.GetNumItems();}
+
+   /** Returns the number of distinct field items our compiled instructions look up. */
+   uint32 GetNumFieldSlots() const {return _slots.GetNumItems();}
+
+private:
+   class FieldSlot
+   {
+   public:
+      FieldSlot() : _key(""), _typeCode(B_ANY_TYPE), _index(0) {/* empty */}
+      FieldSlot(const String & fieldName, uint32 typeCode, uint32 index) : _key(fieldName), _typeCode(typeCode), _index(index) {/* empty */}
+
+      FieldKey _key;
+      uint32 _typeCode;
+      uint32 _index;
+   };
+
+   union InstructionValue
+   {
+      int64 _int;
+      double _float;
+      uint32 _what[2];
+   };
+
+   class Instruction
+   {
+   public:
+      Instruction() : _opCode(0), _operator(0), _hasDefault(false), _slot(0), _typeCode(B_ANY_TYPE), _onTrue(0), _onFalse(0), _filter(NULL) {_value._int = _default._int = 0;}
+
+      uint8 _opCode;      // one of the OPCODE_* values
+      uint8 _operator;    // the OP_* value of the QueryFilter this instruction was compiled from
+      bool _hasDefault;   // true iff (_default) should be used when our field item isn't present
+      uint32 _slot;       // index of the FieldSlot we test
+      uint32 _typeCode;   // type code of the FieldSlot we test
+      uint32 _onTrue;     // index of the instruction to execute next if our test succeeds (or a JUMP_* value)
+      uint32 _onFalse;    // index of the instruction to execute next if our test fails (or a JUMP_* value)
+      InstructionValue _value;
+      InstructionValue _default;
+      const QueryFilter * _filter;  // the QueryFilter this instruction was compiled from
+   };
+
+   status_t CompileAux(const QueryFilter * filter, uint32 trueLabel, uint32 falseLabel, Queue<uint32> & labels);
+   status_t CompileChildren(const Queue<ConstQueryFilterRef> & kids, bool isAnd, uint32 trueLabel, uint32 falseLabel, Queue<uint32> & labels);
+   template<typename DataType, uint32 DataTypeCode, uint32 ClassTypeCode> status_t CompileNumeric(const NumericQueryFilter<DataType, DataTypeCode, ClassTypeCode> & filter, bool isInteger, uint32 trueLabel, uint32 falseLabel);
+   status_t AddInstruction(uint8 opCode, const QueryFilter * filter, uint32 trueLabel, uint32 falseLabel, Instruction ** optRetInstruction = NULL);
+   status_t GetSlot(const String & fieldName, uint32 typeCode, uint32 index, uint32 & retSlot);
+
+   ConstQueryFilterRef _filter;
+   Queue<FieldSlot> _slots;
+   Queue<Instruction> _instructions;
+};
+DECLARE_REFTYPES(CompiledQueryFilter);
+
 } // end namespace muscle
 
 #endif
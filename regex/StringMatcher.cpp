@@ -47,6 +47,9 @@ void StringMatcher :: Reset()
    if (IsBitSet(STRINGMATCHER_BIT_REGEXVALID)) regfree(&_regExp);
    _bits = 0;
    _ranges.Clear();
+   _globClauses.Clear();
+   _globTokens.Clear();
+   _globClasses.Clear();
    _pattern.Clear();
 }
 
@@ -69,6 +72,10 @@ status_t StringMatcher :: SetPattern(const String & s, bool isSimple)
    const char * str = _pattern();
    String regexPattern;
    _ranges.Clear();
+   _globClauses.Clear();
+   _globTokens.Clear();
+   _globClasses.Clear();
+   bool isGlob = false;
    if (isSimple)
    {
       // Special case:  if the first char is a tilde, ignore it, but set the negate-bit.
@@ -119,29 +126,38 @@ status_t StringMatcher :: SetPattern(const String & s, bool isSimple)
          {
             if ((str[0] == '\\')&&(str[1] == '<')) str++;  // special case escape of initial < for "\<15-23>"
 
-            regexPattern = "^(";
-
-            bool escapeMode = false;
-            for (const char * ptr = str; *ptr != '\0'; ptr++)
+            // Most simple patterns can be matched without any help from the regex library
+            isGlob = (ParseGlobPattern(str) == B_NO_ERROR);
+            if (isGlob == false)
             {
-               char c = *ptr;
+               _globClauses.Clear();
+               _globTokens.Clear();
+               _globClasses.Clear();
 
-               if (escapeMode) escapeMode = false;
-               else
+               regexPattern = "^(";
+
+               bool escapeMode = false;
+               for (const char * ptr = str; *ptr != '\0'; ptr++)
                {
-                  switch(c)
+                  char c = *ptr;
+
+                  if (escapeMode) escapeMode = false;
+                  else
                   {
-                     case ',':  c = '|';              break;  // commas are treated as union-bars
-                     case '.':  regexPattern += '\\'; break;  // dots are considered literals, so escape those
-                     case '*':  regexPattern += '.';  break;  // hmmm.
-                     case '?':  c = '.';              break;  // question marks mean any-single-char
-                     case '\\': escapeMode = true;    break;  // don't transform the next character!
+                     switch(c)
+                     {
+                        case ',':  c = '|';              break;  // commas are treated as union-bars
+                        case '.':  regexPattern += '\\'; break;  // dots are considered literals, so escape those
+                        case '*':  regexPattern += '.';  break;  // hmmm.
+                        case '?':  c = '.';              break;  // question marks mean any-single-char
+                        case '\\': escapeMode = true;    break;  // don't transform the next character!
+                     }
                   }
+                  regexPattern += c;
                }
-               regexPattern += c;
+               if (escapeMode) regexPattern += '\\';  // just in case the user left a trailing backslash
+               regexPattern += ")$";
             }
-            if (escapeMode) regexPattern += '\\';  // just in case the user left a trailing backslash
-            regexPattern += ")$";
          }
       }
    }
@@ -155,9 +171,11 @@ status_t StringMatcher :: SetPattern(const String & s, bool isSimple)
    }
 
    SetBit(STRINGMATCHER_BIT_UVLIST, (onlyWildcardCharsAreCommas)&&(_ranges.IsEmpty())&&(IsBitSet(STRINGMATCHER_BIT_NEGATE) == false));
+   SetBit(STRINGMATCHER_BIT_GLOBVALID, isGlob);
 
    // And compile the new one
-   if (_ranges.IsEmpty())
+   if (isGlob) return B_NO_ERROR;  // for globs we parsed ourself, we don't need a valid regex either
+   else if (_ranges.IsEmpty())
    {
       int rc = regcomp(&_regExp, regexPattern.HasChars() ? regexPattern() : str, REG_EXTENDED);
       if (rc == REG_ESPACE) WARN_OUT_OF_MEMORY;
@@ -168,7 +186,195 @@ status_t StringMatcher :: SetPattern(const String & s, bool isSimple)
    else return B_NO_ERROR;  // for range queries, we don't need a valid regex
 }
 
+// Returns true iff (c) would be transformed by SetPattern() or has a special meaning to regcomp() when found inside a bracket-expression
+static bool IsTroublesomeCharClassChar(char c)
+{
+   switch(c)
+   {
+      case '[': case '\\': case ',': case '.': case '*': case '?':
+         return true;
+
+      default:
+         return ((c & 0x80) != 0);  // collation of non-ASCII chars is locale-dependent, so leave those to regcomp() also
+   }
+}
+
+status_t StringMatcher :: ParseGlobPattern(const char * str)
+{
+   while(true)
+   {
+      GlobClause * clause = _globClauses.AddTailAndGet();
+      if (clause == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+
+      clause->_firstToken = _globTokens.GetNumItems();
+      uint32 numStars = 0, numSingles = 0;
+      while((*str != '\0')&&(*str != ','))
+      {
+         GlobToken t;
+         char c = *str++;
+         switch(c)
+         {
+            case '*':
+               t._type = GLOB_TOKEN_TYPE_STAR;
+            break;
+
+            case '?':
+               t._type = GLOB_TOKEN_TYPE_ANY;
+            break;
+
+            case '\\':
+               c = *str;
+               if (c == '\0') c = '\\';  // a trailing backslash matches a backslash
+               else
+               {
+                  // Escaped letters and digits (e.g. \w or \1), and the GNU anchors \< \> \` \' mean something special to regcomp()
+                  if ((muscleInRange(c, 'a', 'z'))||(muscleInRange(c, 'A', 'Z'))||(muscleInRange(c, '0', '9'))||(c == '<')||(c == '>')||(c == '`')||(c == '\'')) return B_ERROR;
+                  str++;
+               }
+               t._char = (uint8) c;
+            break;
+
+            case '[':
+            {
+               GlobCharClass cc;
+               const bool negate = (*str == '^');
+               if (negate) str++;
+               if (*str == ']') return B_ERROR;  // leading-bracket-as-literal syntax; let regcomp() deal with it
+
+               bool closed = false;
+               bool isFirst = true;
+               while(*str != '\0')
+               {
+                  char lo = *str++;
+                  if (lo == ']') {closed = true; break;}
+                  if (IsTroublesomeCharClassChar(lo)) return B_ERROR;
+                  if ((lo == '-')&&(isFirst == false)&&(*str != ']')) return B_ERROR;  // a dash is only a literal at the start or end
+
+                  char hi = lo;
+                  if ((lo != '-')&&(str[0] == '-')&&(str[1] != ']')&&(str[1] != '\0'))
+                  {
+                     hi = str[1];
+                     if ((IsTroublesomeCharClassChar(hi))||(hi == '-')||(hi < lo)) return B_ERROR;
+                     str += 2;
+                  }
+                  for (uint32 i=(uint8)lo; i<=(uint8)hi; i++) cc.SetChar((uint8)i);
+                  isFirst = false;
+               }
+               if (closed == false) return B_ERROR;  // unterminated bracket-expression
+               if (negate) cc.Invert();
+
+               if (_globClasses.AddTail(cc) != B_NO_ERROR) return B_ERROR;
+               t._type       = GLOB_TOKEN_TYPE_CLASS;
+               t._classIndex = (uint16) (_globClasses.GetNumItems()-1);
+            }
+            break;
+
+            case '(': case ')': case '|': case '+': case '^': case '$': case '{': case '}': case ']':
+               return B_ERROR;  // actual regex syntax, so we'll need regcomp() for this pattern
+
+            default:
+               t._char = (uint8) c;
+            break;
+         }
+
+         if (t._type == GLOB_TOKEN_TYPE_STAR)
+         {
+            // consecutive stars are equivalent to a single star
+            if ((_globTokens.GetNumItems() > clause->_firstToken)&&(_globTokens.Tail()._type == GLOB_TOKEN_TYPE_STAR)) continue;
+            numStars++;
+         }
+         else if (t._type != GLOB_TOKEN_TYPE_CHAR) numSingles++;
+
+         if (_globTokens.AddTail(t) != B_NO_ERROR) return B_ERROR;
+      }
+
+      clause->_numTokens = _globTokens.GetNumItems()-clause->_firstToken;
+      if (clause->_numTokens == 0) return B_ERROR;  // empty alternatives are a regcomp() matter
+
+      if ((numSingles == 0)&&(numStars <= 2))
+      {
+         const GlobToken * tokens   = &_globTokens[clause->_firstToken];
+         const bool startsWithStar  = (tokens[0]._type == GLOB_TOKEN_TYPE_STAR);
+         const bool endsWithStar    = (tokens[clause->_numTokens-1]._type == GLOB_TOKEN_TYPE_STAR);
+         const uint32 numEndStars   = (startsWithStar?1:0) + (((endsWithStar)&&(clause->_numTokens > 1))?1:0);
+         if (numEndStars == numStars)
+         {
+            for (uint32 i=0; i<clause->_numTokens; i++) if (tokens[i]._type == GLOB_TOKEN_TYPE_CHAR) clause->_literal += (char) tokens[i]._char;
+
+                 if (numStars == 0)    clause->_type = GLOB_CLAUSE_TYPE_LITERAL;
+            else if (numStars == 2)    clause->_type = GLOB_CLAUSE_TYPE_CONTAINS;
+            else if (startsWithStar)   clause->_type = GLOB_CLAUSE_TYPE_SUFFIX;
+            else                       clause->_type = GLOB_CLAUSE_TYPE_PREFIX;
+         }
+         else clause->_type = GLOB_CLAUSE_TYPE_GENERAL;
+      }
+      else clause->_type = GLOB_CLAUSE_TYPE_GENERAL;
+
+      if (clause->_type != GLOB_CLAUSE_TYPE_GENERAL)
+      {
+         // The literal text is all we need, so we can reclaim this clause's tokens
+         while(_globTokens.GetNumItems() > clause->_firstToken) (void) _globTokens.RemoveTail();
+         clause->_firstToken = clause->_numTokens = 0;
+      }
+
+      if (*str == '\0') return B_NO_ERROR;
+      str++;  // skip past the comma
+   }
+}
+
+bool StringMatcher :: GlobClauseMatches(const GlobClause & clause, const char * str, uint32 len) const
+{
+   const String & lit = clause._literal;
+   const uint32 litLen = lit.Length();
+   switch(clause._type)
+   {
+      case GLOB_CLAUSE_TYPE_LITERAL:  return ((len == litLen)&&(memcmp(str, lit(), litLen) == 0));
+      case GLOB_CLAUSE_TYPE_PREFIX:   return ((len >= litLen)&&(memcmp(str, lit(), litLen) == 0));
+      case GLOB_CLAUSE_TYPE_SUFFIX:   return ((len >= litLen)&&(memcmp(str+len-litLen, lit(), litLen) == 0));
+      case GLOB_CLAUSE_TYPE_CONTAINS: return ((len >= litLen)&&(strstr(str, lit()) != NULL));
+
+      case GLOB_CLAUSE_TYPE_GENERAL:
+      {
+         // Classic iterative wildcard match:  on a mismatch, back up to just after the most recent star and let it eat one more char
+         const GlobToken * tokens = &_globTokens[clause._firstToken];
+         const uint32 numTokens   = clause._numTokens;
+         uint32 ti = 0, si = 0, starTi = MUSCLE_NO_LIMIT, starSi = 0;
+         while(si < len)
+         {
+            if (ti < numTokens)
+            {
+               const GlobToken & t = tokens[ti];
+               if (t._type == GLOB_TOKEN_TYPE_STAR) {starTi = ti++; starSi = si; continue;}
+
+               const uint8 c = (uint8) str[si];
+               bool ok;
+               switch(t._type)
+               {
+                  case GLOB_TOKEN_TYPE_CHAR:  ok = (c == t._char);                          break;
+                  case GLOB_TOKEN_TYPE_CLASS: ok = _globClasses[t._classIndex].HasChar(c); break;
+                  default:                    ok = true;                                   break;
+               }
+               if (ok) {ti++; si++; continue;}
+            }
+            if (starTi == MUSCLE_NO_LIMIT) return false;
+            ti = starTi+1;
+            si = ++starSi;
+         }
+         while((ti < numTokens)&&(tokens[ti]._type == GLOB_TOKEN_TYPE_STAR)) ti++;
+         return (ti == numTokens);
+      }
+
+      default:
+         return false;
+   }
+}
+
 bool StringMatcher :: Match(const char * const str) const
+{
+   return MatchAux(str, IsBitSet(STRINGMATCHER_BIT_GLOBVALID) ? (uint32)strlen(str) : 0);
+}
+
+bool StringMatcher :: MatchAux(const char * const str, uint32 len) const
 {
    TCHECKPOINT;
 
@@ -176,7 +382,11 @@ bool StringMatcher :: Match(const char * const str) const
 
    if (_ranges.IsEmpty())
    {
-      if (IsBitSet(STRINGMATCHER_BIT_REGEXVALID)) ret = (regexec(&_regExp, str, 0, NULL, 0) != REG_NOMATCH);
+      if (IsBitSet(STRINGMATCHER_BIT_GLOBVALID))
+      {
+         for (uint32 i=0; i<_globClauses.GetNumItems(); i++) if (GlobClauseMatches(_globClauses[i], str, len)) {ret = true; break;}
+      }
+      else if (IsBitSet(STRINGMATCHER_BIT_REGEXVALID)) ret = (regexec(&_regExp, str, 0, NULL, 0) != REG_NOMATCH);
    }
    else if (muscleInRange(str[0], '0', '9'))
    {
@@ -24,7 +24,10 @@
 
 namespace muscle {
 
-/** This class uses the regex library to implement "simple" string matching (similar to filename globbing in bash) as well as full regular expression pattern-matching. */
+/** This class uses the regex library to implement "simple" string matching (similar to filename globbing in bash) as well as full regular expression pattern-matching.
+  * Simple patterns that use only literal characters, commas, wildcards (* and ?) and character-classes (e.g. [0-9]) are matched
+  * directly (via memcmp(), strstr() or a small glob-matcher) rather than being passed through regexec(), since they are much more common.
+  */
 class StringMatcher MUSCLE_FINAL_CLASS : public RefCountable
 {
 public:
@@ -103,7 +106,7 @@ public:
      * @param matchString a string to match against using our current expression.
      * @return true iff (matchString) matches, false otherwise.
      */
-   inline bool Match(const String & matchString) const {return Match(matchString());}
+   inline bool Match(const String & matchString) const {return MatchAux(matchString(), matchString.Length());}
 
    /** If set true, Match() will return the logical opposite of what
      * it would otherwise return; e.g. it will return true only when
@@ -140,8 +143,68 @@ private:
       STRINGMATCHER_BIT_CANMATCHMULTIPLEVALUES = (1<<2),
       STRINGMATCHER_BIT_SIMPLE                 = (1<<3),
       STRINGMATCHER_BIT_UVLIST                 = (1<<4),
+      STRINGMATCHER_BIT_GLOBVALID              = (1<<5),
+   };
+
+   enum {
+      GLOB_CLAUSE_TYPE_LITERAL = 0,  // e.g. "foo"
+      GLOB_CLAUSE_TYPE_PREFIX,       // e.g. "foo*"
+      GLOB_CLAUSE_TYPE_SUFFIX,       // e.g. "*foo" (or just "*")
+      GLOB_CLAUSE_TYPE_CONTAINS,     // e.g. "*foo*"
+      GLOB_CLAUSE_TYPE_GENERAL,      // anything else, e.g. "client[0-9]" or "f?o*bar"
+      NUM_GLOB_CLAUSE_TYPES
+   };
+
+   enum {
+      GLOB_TOKEN_TYPE_CHAR = 0,      // matches one specific character
+      GLOB_TOKEN_TYPE_ANY,           // matches any single character (?)
+      GLOB_TOKEN_TYPE_CLASS,         // matches any single character in a character-class (e.g. [0-9])
+      GLOB_TOKEN_TYPE_STAR,          // matches any sequence of zero or more characters (*)
+      NUM_GLOB_TOKEN_TYPES
+   };
+
+   // One token of a GLOB_CLAUSE_TYPE_GENERAL clause
+   class GlobToken
+   {
+   public:
+      GlobToken() : _type(GLOB_TOKEN_TYPE_CHAR), _char(0), _classIndex(0) {/* empty */}
+      GlobToken(uint8 type, uint8 c, uint16 classIndex) : _type(type), _char(c), _classIndex(classIndex) {/* empty */}
+
+      uint8 _type;        // GLOB_TOKEN_TYPE_*
+      uint8 _char;        // the character to match, for GLOB_TOKEN_TYPE_CHAR
+      uint16 _classIndex; // index into _globClasses, for GLOB_TOKEN_TYPE_CLASS
+   };
+
+   // A 256-bit set of the characters that a character-class token will accept
+   class GlobCharClass
+   {
+   public:
+      GlobCharClass() {memset(_bits, 0, sizeof(_bits));}
+
+      void SetChar(uint8 c) {_bits[c/32] |= (((uint32)1)<<(c%32));}
+      bool HasChar(uint8 c) const {return ((_bits[c/32] & (((uint32)1)<<(c%32))) != 0);}
+      void Invert() {for (uint32 i=0; i<ARRAYITEMS(_bits); i++) _bits[i] = ~_bits[i];}
+
+   private:
+      uint32 _bits[8];
    };
 
+   // One comma-separated alternative of a simple pattern
+   class GlobClause
+   {
+   public:
+      GlobClause() : _type(GLOB_CLAUSE_TYPE_LITERAL), _firstToken(0), _numTokens(0) {/* empty */}
+
+      uint8 _type;         // GLOB_CLAUSE_TYPE_*
+      String _literal;     // the literal text to look for, for the LITERAL, PREFIX, SUFFIX and CONTAINS types
+      uint32 _firstToken;  // index of our first token in _globTokens, for the GENERAL type
+      uint32 _numTokens;   // number of tokens we have in _globTokens, for the GENERAL type
+   };
+
+   bool MatchAux(const char * str, uint32 len) const;
+   status_t ParseGlobPattern(const char * str);
+   bool GlobClauseMatches(const GlobClause & clause, const char * str, uint32 len) const;
+
    class IDRange
    {
    public:
@@ -160,6 +223,10 @@ private:
    String _pattern;
    regex_t _regExp;
    Queue<IDRange> _ranges;
+
+   Queue<GlobClause> _globClauses;
+   Queue<GlobToken> _globTokens;
+   Queue<GlobCharClass> _globClasses;
 }; 
 DECLARE_REFTYPES(StringMatcher);
 
@@ -4,6 +4,7 @@
 # include "dataio/FileDataIO.h"
 #endif
 
+#include "iogateway/MessageIOGateway.h"
 #include "reflector/ReflectServer.h"
 #include "reflector/DumbReflectSession.h"
 #include "reflector/StorageReflectSession.h"
@@ -34,6 +35,7 @@ int muscledmainAux(int argc, char ** argv, void * cookie)
    uint32 maxSendRate        = MUSCLE_NO_LIMIT;
    uint32 maxCombinedRate    = MUSCLE_NO_LIMIT;
    uint32 maxMessageSize     = MUSCLE_NO_LIMIT;
+   uint32 spoolThreshold     = MUSCLE_MESSAGE_IO_GATEWAY_DEFAULT_SPOOL_THRESHOLD;
    uint32 maxSessions        = MUSCLE_NO_LIMIT;
    uint32 maxSessionsPerHost = MUSCLE_NO_LIMIT;
 
@@ -60,6 +62,7 @@ int muscledmainAux(int argc, char ** argv, void * cookie)
       Log(MUSCLE_LOG_INFO, "                [maxsendrate=kBps] [maxreceiverate=kBps]\n");
       Log(MUSCLE_LOG_INFO, "                [maxcombinedrate=kBps] [maxmessagesize=k]\n");
       Log(MUSCLE_LOG_INFO, "                [maxsessions=num] [maxsessionsperhost=num]\n");
+      Log(MUSCLE_LOG_INFO, "                [spoolthreshold=k] [spooldir=path]\n");
       Log(MUSCLE_LOG_INFO, "                [localhost=ipaddress] [daemon]\n");
       Log(MUSCLE_LOG_INFO, " - port may be any number between 1 and 65536\n");
       Log(MUSCLE_LOG_INFO, " - listen is like port, except it includes a local interface IP as well.\n");
@@ -79,6 +82,9 @@ int muscledmainAux(int argc, char ** argv, void * cookie)
       Log(MUSCLE_LOG_INFO, "   privall assigns all privileges to the matching IP addresses.\n");
       Log(MUSCLE_LOG_INFO, " - remap tells muscled to treat connections from a given IP address\n");
       Log(MUSCLE_LOG_INFO, "   as if they are coming from another (for stupid NAT tricks, etc)\n");
+      Log(MUSCLE_LOG_INFO, " - spoolthreshold tells muscled to spool incoming Messages bigger than\n");
+      Log(MUSCLE_LOG_INFO, "   that many kilobytes to temporary files in spooldir (default=TMPDIR or /tmp),\n");
+      Log(MUSCLE_LOG_INFO, "   instead of holding them in RAM.  If no value is given, 1024k is used.\n");
       Log(MUSCLE_LOG_INFO, " - If daemon is specified, muscled will run as a background process.\n");
       return(5);
    }
@@ -131,6 +137,14 @@ int muscledmainAux(int argc, char ** argv, void * cookie)
       maxMessageSize = k*1024L;
    }
 
+   if (args.FindString("spoolthreshold", &value) == B_NO_ERROR)
+   {
+      int k = atoi(value);
+      if (k <= 0) k = 1024;  // a bare "spoolthreshold" keyword means spool anything over a megabyte
+      LogTime(MUSCLE_LOG_INFO, "Spooling incoming messages larger than %i kilobyte%s to disk.\n", k, (k==1)?"":"s");
+      spoolThreshold = k*1024L;
+   }
+
    if (args.FindString("maxsendrate", &value) == B_NO_ERROR)
    {
       float k = (float) atof(value);
@@ -248,6 +262,8 @@ int muscledmainAux(int argc, char ** argv, void * cookie)
    // Set up the Session Factory.  This factory object creates the new StorageReflectSessions
    // as needed when people connect, and also has a filter to keep out the riff-raff.
    StorageReflectSessionFactory factory; factory.SetMaxIncomingMessageSize(maxMessageSize);
+   factory.SetIncomingMessageSpoolThreshold(spoolThreshold);
+   if (args.FindString("spooldir", &value) == B_NO_ERROR) factory.SetIncomingMessageSpoolDirectory(value);
    FilterSessionFactory filter(ReflectSessionFactoryRef(&factory, false), maxSessionsPerHost, maxSessions);
    filter.SetInputPolicy(inputPolicyRef);
    filter.SetOutputPolicy(outputPolicyRef);
@@ -1193,8 +1193,11 @@ public:
 };
 
 /** Hash function for arbitrary data.  Note that the current implementation of this function
-  * is MurmurHash2/Aligned, taken from http://murmurhash.googlepages.com/ and used as public domain code.
-  * Thanks to Austin Appleby for the cool algorithm!
+  * is a wyhash-style multiply-and-fold hash (with a SIMD-accelerated striped loop for long inputs);
+  * if MUSCLE_USE_MURMUR2_HASH_FUNCTION is defined at compile time, MurmurHash2/Aligned (taken from
+  * http://murmurhash.googlepages.com/ and used as public domain code) is used instead.
+  * Thanks to Wang Yi and Austin Appleby for the cool algorithms!
+  * Note that hash values are only guaranteed to be consistent within a given build of MUSCLE.
   * @param key Pointer to the data to hash
   * @param numBytes Number of bytes to hash start at (key)
   * @param seed An arbitrary number that affects the output values.  Defaults to zero.
@@ -1203,7 +1206,7 @@ public:
 uint32 CalculateHashCode(const void * key, uint32 numBytes, uint32 seed = 0);
 
 /** Same as HashCode(), but this version produces a 64-bit result.
-  * This code is also part of MurmurHash2, written by Austin Appleby
+  * Uses the same back-end algorithm as CalculateHashCode() does (see above).
   * @param key Pointer to the data to hash
   * @param numBytes Number of bytes to hash start at (key)
   * @param seed An arbitrary number that affects the output values.  Defaults to zero.
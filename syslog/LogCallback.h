@@ -274,6 +274,14 @@ public:
      */
    void SetFileCompressionEnabled(bool enable) {_compressionEnabled = enable;}
 
+   /** Sets the object that old log files should be compressed in parallel with, or NULL to compress them in the calling thread.
+     * @param runner The IParallelJobRunner to use when compressing log files (e.g. a ThreadPoolJobRunner), or NULL.
+     */
+   void SetFileCompressionJobRunner(IParallelJobRunner * runner) {_compressionJobRunner = runner;}
+
+   /** Returns the object that was passed to SetFileCompressionJobRunner().  Defaults to NULL. */
+   IParallelJobRunner * GetFileCompressionJobRunner() const {return _compressionJobRunner;}
+
    /** Set the severity-threshold under which log entries will be added to the log file.
      * @param logLevel a MUSCLE_LOG_* value.
      */
@@ -297,6 +305,7 @@ private:
    uint32 _maxLogFileSize;
    uint32 _maxNumLogFiles;
    bool _compressionEnabled;
+   IParallelJobRunner * _compressionJobRunner;
 
    String _activeLogFileName;
    FileDataIO _logFile;
@@ -24,6 +24,7 @@
 
 #if !defined(MUSCLE_INLINE_LOGGING) && defined(MUSCLE_ENABLE_ZLIB_ENCODING)
 # include "zlib/zlib/zlib.h"
+# include "zlib/ZLibParallelDeflate.h"
 #endif
 
 #if defined(__APPLE__)
@@ -1537,6 +1538,7 @@ DefaultFileLogger :: DefaultFileLogger()
    , _maxLogFileSize(MUSCLE_NO_LIMIT)
    , _maxNumLogFiles(MUSCLE_NO_LIMIT)
    , _compressionEnabled(false)
+   , _compressionJobRunner(NULL)
    , _logFileOpenAttemptFailed(false)
 {
    // empty
@@ -1656,6 +1658,62 @@ status_t DefaultFileLogger :: EnsureLogFileCreated(const LogCallbackArgs & a)
    return (_logFile.GetFile() != NULL) ? B_NO_ERROR : B_ERROR;
 }
 
+#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+// Writes (inIO)'s contents to a gzip file, pigz-style:  each batch of data is deflated as several chunks, concurrently, via (runner)
+static status_t ParallelGZipFile(FileDataIO & inIO, const String & gzName, IParallelJobRunner * runner)
+{
+   FileDataIO outIO(muscleFopen(gzName(), "wb"));
+   if (outIO.GetFile() == NULL)
+   {
+      LogTime(MUSCLE_LOG_ERROR, "Could not open compressed Log file [%s]!\n", gzName());
+      return B_ERROR;
+   }
+
+   // gzip member header, as described in RFC 1952:  magic, deflate method, no flags, no mtime, max-compression flag, unknown OS
+   static const uint8 gzipHeader[] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 255};
+   if (outIO.WriteFully(gzipHeader, sizeof(gzipHeader)) != sizeof(gzipHeader)) return B_ERROR;
+
+   const uint32 batchSize  = 8*MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE;
+   const uint32 windowSize = 32*1024;
+   uint8 * inBuf  = newnothrow_array(uint8, windowSize+batchSize);  // the first (windowSize) bytes hold the tail of the previous batch, for priming
+   uint8 * outBuf = newnothrow_array(uint8, GetZLibParallelDeflateBound(batchSize));
+   status_t ret = ((inBuf)&&(outBuf)) ? B_NO_ERROR : B_ERROR;
+   if (ret != B_NO_ERROR) WARN_OUT_OF_MEMORY;
+
+   uLong crc = crc32(0L, Z_NULL, 0);
+   uint32 totalRaw = 0;
+   uint32 historySize = 0;
+   bool atEOF = false;
+   while((ret == B_NO_ERROR)&&(atEOF == false))
+   {
+      uint8 * batch = inBuf+windowSize;
+      const uint32 numRaw = inIO.ReadFully(batch, batchSize);
+      atEOF = (numRaw < batchSize);
+
+      const int32 numDeflated = ZLibParallelDeflateRawChunks(batch, numRaw, batch-historySize, historySize, 9, atEOF, outBuf, runner);
+      if ((numDeflated < 0)||(outIO.WriteFully(outBuf, numDeflated) != (uint32)numDeflated)) ret = B_ERROR;
+
+      crc = crc32(crc, batch, numRaw);
+      totalRaw += numRaw;  // gzip only stores the low 32 bits of the size anyway
+
+      // Keep the tail end of this batch around, so the next batch can refer back to it (only the last batch can be short)
+      if (numRaw >= windowSize)
+      {
+         memcpy(inBuf, batch+numRaw-windowSize, windowSize);
+         historySize = windowSize;
+      }
+   }
+   delete [] inBuf;
+   delete [] outBuf;
+   if (ret != B_NO_ERROR) return B_ERROR;
+
+   uint8 gzipTrailer[8];
+   muscleCopyOut(&gzipTrailer[0], B_HOST_TO_LENDIAN_INT32((uint32)crc));
+   muscleCopyOut(&gzipTrailer[4], B_HOST_TO_LENDIAN_INT32(totalRaw));
+   return (outIO.WriteFully(gzipTrailer, sizeof(gzipTrailer)) == sizeof(gzipTrailer)) ? B_NO_ERROR : B_ERROR;
+}
+#endif
+
 void DefaultFileLogger :: CloseLogFile()
 {
    if (_logFile.GetFile())
@@ -1672,45 +1730,58 @@ void DefaultFileLogger :: CloseLogFile()
          if (inIO.GetFile() != NULL)
          {
             String gzName = oldFileName + ".gz";
-            gzFile gzOut = gzopen(gzName(), "wb9"); // 9 for maximum compression
-            if (gzOut != Z_NULL)
+            if (_compressionJobRunner)
             {
-               bool ok = true;
-
-               const uint32 bufSize = 128*1024;
-               char * buf = newnothrow char[bufSize];
-               if (buf)
+               if (ParallelGZipFile(inIO, gzName, _compressionJobRunner) == B_NO_ERROR)
                {
-                  while(1)
-                  {
-                     int32 bytesRead = inIO.Read(buf, bufSize);
-                     if (bytesRead < 0) break;  // EOF
+                  inIO.Shutdown();
+                  if (remove(oldFileName()) != 0) LogTime(MUSCLE_LOG_ERROR, "Error deleting log file [%s] after compressing it to [%s]!\n", oldFileName(), gzName());
+                  oldFileName = gzName;
+               }
+               else if ((remove(gzName()) != 0)&&(errno != ENOENT)) LogTime(MUSCLE_LOG_ERROR, "Error deleting gzip'd log file [%s] after compression failed!\n", gzName());
+            }
+            else
+            {
+               gzFile gzOut = gzopen(gzName(), "wb9"); // 9 for maximum compression
+               if (gzOut != Z_NULL)
+               {
+                  bool ok = true;
 
-                     int bytesWritten = gzwrite(gzOut, buf, bytesRead);
-                     if (bytesWritten <= 0)
+                  const uint32 bufSize = 128*1024;
+                  char * buf = newnothrow char[bufSize];
+                  if (buf)
+                  {
+                     while(1)
                      {
-                        ok = false;  // write error, oh dear
-                        break;
+                        int32 bytesRead = inIO.Read(buf, bufSize);
+                        if (bytesRead < 0) break;  // EOF
+
+                        int bytesWritten = gzwrite(gzOut, buf, bytesRead);
+                        if (bytesWritten <= 0)
+                        {
+                           ok = false;  // write error, oh dear
+                           break;
+                        }
                      }
+                     delete [] buf;
                   }
-                  delete [] buf;
-               }
-               else WARN_OUT_OF_MEMORY;
+                  else WARN_OUT_OF_MEMORY;
 
-               gzclose(gzOut);
+                  gzclose(gzOut);
 
-               if (ok)
-               {
-                  inIO.Shutdown();
-                  if (remove(oldFileName()) != 0) LogTime(MUSCLE_LOG_ERROR, "Error deleting log file [%s] after compressing it to [%s]!\n", oldFileName(), gzName());
-                  oldFileName = gzName;
-               }
-               else
-               {
-                  if (remove(gzName()) != 0) LogTime(MUSCLE_LOG_ERROR, "Error deleting gzip'd log file [%s] after compression failed!\n", gzName());
+                  if (ok)
+                  {
+                     inIO.Shutdown();
+                     if (remove(oldFileName()) != 0) LogTime(MUSCLE_LOG_ERROR, "Error deleting log file [%s] after compressing it to [%s]!\n", oldFileName(), gzName());
+                     oldFileName = gzName;
+                  }
+                  else
+                  {
+                     if (remove(gzName()) != 0) LogTime(MUSCLE_LOG_ERROR, "Error deleting gzip'd log file [%s] after compression failed!\n", gzName());
+                  }
                }
+               else LogTime(MUSCLE_LOG_ERROR, "Could not open compressed Log file [%s]!\n", gzName());
             }
-            else LogTime(MUSCLE_LOG_ERROR, "Could not open compressed Log file [%s]!\n", gzName());
          }
          else LogTime(MUSCLE_LOG_ERROR, "Could not reopen Log file [%s] to compress it!\n", oldFileName());
       }
@@ -1938,6 +2009,17 @@ status_t SetFileLogCompressionEnabled(bool enable)
 #endif
 }
 
+status_t SetFileLogCompressionJobRunner(IParallelJobRunner * runner)
+{
+   if (LockLog() == B_NO_ERROR)
+   {
+      _dfl.SetFileCompressionJobRunner(runner);
+      (void) UnlockLog();
+      return B_NO_ERROR;
+   }
+   else return B_ERROR;
+}
+
 void CloseCurrentLogFile()
 {
    if (LockLog() == B_NO_ERROR)
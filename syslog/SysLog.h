@@ -13,6 +13,7 @@ namespace muscle {
 
 class String;
 class LogCallbackArgs;
+class IParallelJobRunner;
 
 /** log level constants to use with SetLogLevel(), GetLogLevel() */
 enum
@@ -110,6 +111,7 @@ inline status_t SetFileLogMaximumSize(uint32)         {return B_NO_ERROR;}
 inline status_t SetOldLogFilesPattern(const String &) {return B_NO_ERROR;}
 inline status_t SetMaxNumLogFiles(uint32)             {return B_NO_ERROR;}
 inline status_t SetFileLogCompressionEnabled(bool)    {return B_NO_ERROR;}
+inline status_t SetFileLogCompressionJobRunner(IParallelJobRunner *) {return B_NO_ERROR;}
 inline status_t SetConsoleLogLevel(int)               {return B_NO_ERROR;}
 inline void CloseCurrentLogFile()                     {/* empty */}
 #else
@@ -215,6 +217,19 @@ status_t SetMaxNumLogFiles(uint32 maxNumLogFiles);
   */
 status_t SetFileLogCompressionEnabled(bool enable);
 
+/** Specifies an object that log files should be compressed in parallel with, when they are compressed.
+  * If set, each closed log file will be compressed pigz-style:  in chunks that are deflated concurrently
+  * via (runner), rather than all in the calling thread.  The resulting .gz file is an ordinary gzip file.
+  * Note that the log is locked while a log file is being compressed, so (runner) shouldn't use threads
+  * that might try to log something while it is running (e.g. give it a ThreadPool of its own).
+  * Has no effect unless log file compression is enabled (see SetFileLogCompressionEnabled()).
+  * @param runner The object to compress log files with (e.g. a ThreadPoolJobRunner), or NULL to compress
+  *               log files in the calling thread (which is the default).  The object must remain valid
+  *               until it is unregistered (by calling this function again) or the process exits.
+  * @returns B_NO_ERROR on success, or B_ERROR if the log lock couldn't be locked for some reason.
+  */
+status_t SetFileLogCompressionJobRunner(IParallelJobRunner * runner);
+
 /** Sets the log filter level for logging to stdout.
  *  Any calls to Log*() that specify a log level greater than (loglevel)
  *  will be suppressed.  Default level is MUSCLE_LOG_INFO.
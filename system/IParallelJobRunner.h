@@ -0,0 +1,73 @@
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
+
+#ifndef MuscleIParallelJobRunner_h
+#define MuscleIParallelJobRunner_h
+
+#include "support/MuscleSupport.h"
+
+namespace muscle {
+
+/** Signature of a function that an IParallelJobRunner can call.
+  * @param jobIndex Index of the job to execute, in the range [0, numJobs).
+  * @param userData The user-data pointer that was passed to IParallelJobRunner::RunJobs().
+  */
+typedef void (*ParallelJobFunc)(uint32 jobIndex, void * userData);
+
+/** Interface for an object that executes jobs asynchronously (e.g. in some other thread), strictly one at a time,
+  * and in the order they were queued.  Obtained via IParallelJobRunner::CreateSerialJobQueue().
+  */
+class ISerialJobQueue
+{
+public:
+   /** Default constructor */
+   ISerialJobQueue() {/* empty */}
+
+   /** Destructor.  Implementations should block until every job that was queued has finished executing. */
+   virtual ~ISerialJobQueue() {/* empty */}
+
+   /** Queues a job for execution, and returns immediately.  Some time later, (func)(0, userData)
+     * will be called, after all the jobs that were queued before this one have returned.
+     * @param func The function to call.
+     * @param userData Passed verbatim to (func).
+     * @returns B_NO_ERROR if the job was queued, or B_ERROR if it couldn't be (in which case it will never be executed).
+     */
+   virtual status_t QueueJob(ParallelJobFunc func, void * userData) = 0;
+
+   /** Blocks until every job that was queued before this call has finished executing. */
+   virtual void WaitForJobsToComplete() = 0;
+};
+
+/** Interface for an object that can execute a batch of independent jobs concurrently.
+  * Code that can split its work into independent jobs (e.g. ZLibParallelDeflateRawChunks())
+  * can accept one of these, so that it doesn't have to know about (or link against) the ThreadPool class.
+  * See ThreadPoolJobRunner (in ThreadPool.h) for an implementation that uses a ThreadPool.
+  */
+class IParallelJobRunner
+{
+public:
+   /** Default constructor */
+   IParallelJobRunner() {/* empty */}
+
+   /** Destructor */
+   virtual ~IParallelJobRunner() {/* empty */}
+
+   /** Should call (func)(i, userData) exactly once for each (i) in the range [0, numJobs), in any order and
+     * with as many calls executing at once as is practical, and return only after all of the calls have returned.
+     * @param numJobs The number of jobs to execute.
+     * @param func The function to call for each job.
+     * @param userData Passed verbatim to (func).
+     * @returns B_NO_ERROR if all the jobs were executed, or B_ERROR if the jobs couldn't be executed
+     *          (in which case no calls to (func) should have been made).
+     */
+   virtual status_t RunJobs(uint32 numJobs, ParallelJobFunc func, void * userData) = 0;
+
+   /** Returns a newly allocated ISerialJobQueue that executes its jobs using the same resources that this object
+     * uses, or NULL if serial job queues aren't supported.  The caller is responsible for deleting the returned object.
+     * Default implementation always returns NULL.
+     */
+   virtual ISerialJobQueue * CreateSerialJobQueue() {return NULL;}
+};
+
+} // end namespace muscle
+
+#endif
@@ -61,6 +61,19 @@
 # include <mach/mach_time.h>
 #endif
 
+#ifndef MUSCLE_USE_MURMUR2_HASH_FUNCTION
+# if !defined(MUSCLE_AVOID_SIMD_HASHING) && defined(__AVX2__)
+#  define MUSCLE_HASH_USE_AVX2
+#  include <immintrin.h>
+# elif !defined(MUSCLE_AVOID_SIMD_HASHING) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#  define MUSCLE_HASH_USE_SSE2
+#  include <emmintrin.h>
+# endif
+# if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#  include <intrin.h>  // for _umul128()
+# endif
+#endif
+
 #ifdef MUSCLE_ENABLE_DEADLOCK_FINDER
 # include "system/AtomicCounter.h"
 # include "system/ThreadLocalStorage.h"
@@ -1656,6 +1669,8 @@ bool IsCurrentThreadMainThread()
 }
 #endif
 
+#ifdef MUSCLE_USE_MURMUR2_HASH_FUNCTION
+
 uint32 CalculateHashCode(const void * key, uint32 numBytes, uint32 seed)
 {
 #define MURMUR2_MIX(h,k,m) { k *= m; k ^= k >> r; k *= m; h *= m; h ^= k; }
@@ -1810,6 +1825,230 @@ uint64 CalculateHashCode64(const void * key, unsigned int numBytes, unsigned int
    return h;
 }
 
+#else
+
+// The default hash function is a wyhash-style multiply-and-fold hash (after Wang Yi's public-domain
+// wyhash, https://github.com/wangyi-fudan/wyhash), which handles the short keys (field names, node
+// names) that dominate MUSCLE's Hashtable traffic in a handful of instructions.  Inputs of
+// MUSCLE_HASH_STRIPED_INPUT_THRESHOLD bytes or more are fed through an xxHash3-style striped
+// accumulator loop instead, which is vectorized with SSE2 (or AVX2, if enabled at compile time)
+// on x86 CPUs.  The scalar and the vectorized code paths compute exactly the same values.
+
+static const uint64 _hashSecret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+static const uint64 _stripeSecret[8] = {0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x85ebca77c2b2ae63ULL, 0x27d4eb2f165667c5ULL, 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL};
+
+#define MUSCLE_HASH_STRIPED_INPUT_THRESHOLD 256  // inputs at least this long go through the striped accumulator loop
+#define HASH_STRIPE_LANES       8                // number of 64-bit accumulators
+#define HASH_STRIPE_SIZE        (HASH_STRIPE_LANES*sizeof(uint64))  // bytes consumed per stripe (64)
+#define HASH_STRIPES_PER_BLOCK  8                // accumulators get scrambled after this many stripes
+#define HASH_SCRAMBLE_PRIME     0x9E3779B1       // 32-bit multiplier used when scrambling the accumulators
+
+static inline uint64 HashRead64(const uint8 * p) {uint64 v; memcpy(&v, p, sizeof(v)); return B_LENDIAN_TO_HOST_INT64(v);}
+static inline uint64 HashRead32(const uint8 * p) {uint32 v; memcpy(&v, p, sizeof(v)); return B_LENDIAN_TO_HOST_INT32(v);}
+
+// Computes the 128-bit product of (a) and (b); on return (a) holds the low 64 bits and (b) holds the high 64 bits
+static inline void HashMultiply128(uint64 & a, uint64 & b)
+{
+#if defined(__SIZEOF_INT128__)
+   __uint128_t r = a; r *= b;
+   a = (uint64) r;
+   b = (uint64) (r>>64);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+   a = _umul128(a, b, &b);
+#else
+   const uint64 ha = a>>32, hb = b>>32, la = (uint32)a, lb = (uint32)b;
+   const uint64 rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+   const uint64 t  = rl+(rm0<<32);
+   const uint64 lo = t+(rm1<<32);
+   b = rh+(rm0>>32)+(rm1>>32)+(t<rl)+(lo<t);
+   a = lo;
+#endif
+}
+
+static inline uint64 HashMix(uint64 a, uint64 b) {HashMultiply128(a, b); return a^b;}
+
+#if defined(MUSCLE_HASH_USE_AVX2)
+static void HashAccumulateStripes(uint64 * acc, const uint8 * p, uint64 numStripes, const uint64 * keys)
+{
+   __m256i a[2] = {_mm256_loadu_si256((const __m256i *)(acc+0)), _mm256_loadu_si256((const __m256i *)(acc+4))};
+   for (uint64 s=0; s<numStripes; s++)
+   {
+      for (uint32 v=0; v<ARRAYITEMS(a); v++)
+      {
+         const __m256i d  = _mm256_loadu_si256((const __m256i *)(p+(s*HASH_STRIPE_SIZE)+(v*sizeof(__m256i))));
+         const __m256i dk = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i *)(keys+s+(v*4))));
+         const __m256i pr = _mm256_mul_epu32(dk, _mm256_shuffle_epi32(dk, _MM_SHUFFLE(0,3,0,1)));  // (low 32 bits)*(high 32 bits)
+         a[v] = _mm256_add_epi64(a[v], _mm256_add_epi64(pr, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1,0,3,2))));
+      }
+   }
+   _mm256_storeu_si256((__m256i *)(acc+0), a[0]);
+   _mm256_storeu_si256((__m256i *)(acc+4), a[1]);
+}
+
+static void HashScrambleAccumulators(uint64 * acc, const uint64 * keys)
+{
+   const __m256i prime = _mm256_set1_epi32((int)HASH_SCRAMBLE_PRIME);
+   for (uint32 v=0; v<HASH_STRIPE_LANES; v+=4)
+   {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(acc+v));
+      a = _mm256_xor_si256(_mm256_xor_si256(a, _mm256_srli_epi64(a, 47)), _mm256_loadu_si256((const __m256i *)(keys+v)));
+      a = _mm256_add_epi64(_mm256_mul_epu32(a, prime), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime), 32));
+      _mm256_storeu_si256((__m256i *)(acc+v), a);
+   }
+}
+#elif defined(MUSCLE_HASH_USE_SSE2)
+static void HashAccumulateStripes(uint64 * acc, const uint8 * p, uint64 numStripes, const uint64 * keys)
+{
+   __m128i a[4];
+   for (uint32 v=0; v<ARRAYITEMS(a); v++) a[v] = _mm_loadu_si128((const __m128i *)(acc+(v*2)));
+   for (uint64 s=0; s<numStripes; s++)
+   {
+      for (uint32 v=0; v<ARRAYITEMS(a); v++)
+      {
+         const __m128i d  = _mm_loadu_si128((const __m128i *)(p+(s*HASH_STRIPE_SIZE)+(v*sizeof(__m128i))));
+         const __m128i dk = _mm_xor_si128(d, _mm_loadu_si128((const __m128i *)(keys+s+(v*2))));
+         const __m128i pr = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0,3,0,1)));  // (low 32 bits)*(high 32 bits)
+         a[v] = _mm_add_epi64(a[v], _mm_add_epi64(pr, _mm_shuffle_epi32(d, _MM_SHUFFLE(1,0,3,2))));
+      }
+   }
+   for (uint32 v=0; v<ARRAYITEMS(a); v++) _mm_storeu_si128((__m128i *)(acc+(v*2)), a[v]);
+}
+
+static void HashScrambleAccumulators(uint64 * acc, const uint64 * keys)
+{
+   const __m128i prime = _mm_set1_epi32((int)HASH_SCRAMBLE_PRIME);
+   for (uint32 v=0; v<HASH_STRIPE_LANES; v+=2)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i *)(acc+v));
+      a = _mm_xor_si128(_mm_xor_si128(a, _mm_srli_epi64(a, 47)), _mm_loadu_si128((const __m128i *)(keys+v)));
+      a = _mm_add_epi64(_mm_mul_epu32(a, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), prime), 32));
+      _mm_storeu_si128((__m128i *)(acc+v), a);
+   }
+}
+#else
+static void HashAccumulateStripes(uint64 * acc, const uint8 * p, uint64 numStripes, const uint64 * keys)
+{
+   for (uint64 s=0; s<numStripes; s++)
+   {
+      const uint8 * sp = p+(s*HASH_STRIPE_SIZE);
+      for (uint32 i=0; i<HASH_STRIPE_LANES; i++)
+      {
+         const uint64 dv = HashRead64(sp+(i*sizeof(uint64)));
+         const uint64 dk = dv ^ keys[s+i];
+         acc[i^1] += dv;
+         acc[i]   += (dk & 0xFFFFFFFF) * (dk >> 32);
+      }
+   }
+}
+
+static void HashScrambleAccumulators(uint64 * acc, const uint64 * keys)
+{
+   for (uint32 i=0; i<HASH_STRIPE_LANES; i++)
+   {
+      uint64 a = acc[i];
+      a ^= (a >> 47);
+      a ^= keys[i];
+      acc[i] = a * HASH_SCRAMBLE_PRIME;
+   }
+}
+#endif
+
+static uint64 HashLongInput(const uint8 * p, uint64 numBytes, uint64 seed)
+{
+   // keys[] holds the per-lane secrets twice over, so that stripe #s of each block can use (keys+s) as its key-set
+   uint64 keys[2*HASH_STRIPE_LANES];
+   for (uint32 i=0; i<ARRAYITEMS(keys); i++) keys[i] = _stripeSecret[i%HASH_STRIPE_LANES] + seed;
+
+   uint64 acc[HASH_STRIPE_LANES] = {0xC2B2AE3DULL, 0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x85EBCA77C2B2AE63ULL, 0x85EBCA77ULL, 0x27D4EB2F165667C5ULL, 0x9E3779B1ULL};
+
+   const uint64 blockSize = HASH_STRIPE_SIZE*HASH_STRIPES_PER_BLOCK;
+   const uint64 numBlocks = (numBytes-1)/blockSize;  // the last (possibly full) block is always handled by the tail-code below
+   for (uint64 b=0; b<numBlocks; b++)
+   {
+      HashAccumulateStripes(acc, p+(b*blockSize), HASH_STRIPES_PER_BLOCK, keys);
+      HashScrambleAccumulators(acc, keys+HASH_STRIPE_LANES);
+   }
+
+   const uint64 tailBytes = numBytes-(numBlocks*blockSize);  // 1..blockSize bytes remain
+   HashAccumulateStripes(acc, p+(numBlocks*blockSize), (tailBytes-1)/HASH_STRIPE_SIZE, keys);
+   HashAccumulateStripes(acc, p+numBytes-HASH_STRIPE_SIZE, 1, keys+HASH_STRIPE_LANES-1);  // the final stripe may overlap the previous one
+
+   uint64 ret = numBytes*_hashSecret[1];
+   for (uint32 i=0; i<HASH_STRIPE_LANES; i+=2) ret += HashMix(acc[i]^keys[i+1], acc[i+1]^keys[i+2]);
+   ret ^= (ret >> 37);
+   ret *= 0x165667919E3779F9ULL;
+   ret ^= (ret >> 32);
+   return ret;
+}
+
+static inline uint64 HashFinish(uint64 a, uint64 b, uint64 numBytes, uint64 seed)
+{
+   a ^= _hashSecret[1];
+   b ^= seed;
+   HashMultiply128(a, b);
+   return HashMix(a^_hashSecret[0]^numBytes, b^_hashSecret[1]);
+}
+
+// Handles inputs that are between 17 and (MUSCLE_HASH_STRIPED_INPUT_THRESHOLD-1) bytes long
+static uint64 HashMediumInput(const uint8 * p, uint64 numBytes, uint64 seed)
+{
+   uint64 i = numBytes;
+   if (i > 48)
+   {
+      uint64 see1 = seed, see2 = seed;
+      do {
+         seed = HashMix(HashRead64(p)   ^_hashSecret[1], HashRead64(p+8) ^seed);
+         see1 = HashMix(HashRead64(p+16)^_hashSecret[2], HashRead64(p+24)^see1);
+         see2 = HashMix(HashRead64(p+32)^_hashSecret[3], HashRead64(p+40)^see2);
+         p += 48;
+         i -= 48;
+      } while(i > 48);
+      seed ^= see1^see2;
+   }
+   while(i > 16)
+   {
+      seed = HashMix(HashRead64(p)^_hashSecret[1], HashRead64(p+8)^seed);
+      i -= 16;
+      p += 16;
+   }
+   return HashFinish(HashRead64(p+i-16), HashRead64(p+i-8), numBytes, seed);
+}
+
+// Short inputs are handled inline, since they are by far the most common case (field names, node names, etc)
+static inline uint64 HashBytes(const uint8 * p, uint64 numBytes, uint64 seed)
+{
+   seed = (seed == 0) ? 0x1ff5c2923a788d2cULL : (seed^HashMix(seed^_hashSecret[0], _hashSecret[1]));  // the constant is HashMix(_hashSecret[0], _hashSecret[1]), precomputed
+   if (numBytes > 16) return (numBytes < MUSCLE_HASH_STRIPED_INPUT_THRESHOLD) ? HashMediumInput(p, numBytes, seed) : HashLongInput(p, numBytes, seed);
+
+   uint64 a, b;
+   if (numBytes >= 4)
+   {
+      const uint64 mid = (numBytes>>3)<<2;
+      a = (HashRead32(p)<<32)            | HashRead32(p+mid);
+      b = (HashRead32(p+numBytes-4)<<32) | HashRead32(p+numBytes-4-mid);
+   }
+   else if (numBytes > 0)
+   {
+      a = (((uint64)p[0])<<16) | (((uint64)p[numBytes>>1])<<8) | p[numBytes-1];
+      b = 0;
+   }
+   else a = b = 0;
+   return HashFinish(a, b, numBytes, seed);
+}
+
+uint32 CalculateHashCode(const void * key, uint32 numBytes, uint32 seed)
+{
+   const uint64 h = HashBytes((const uint8 *) key, numBytes, seed);
+   return (uint32) (h ^ (h>>32));
+}
+
+uint64 CalculateHashCode64(const void * key, unsigned int numBytes, unsigned int seed)
+{
+   return HashBytes((const uint8 *) key, numBytes, seed);
+}
+
+#endif
+
 #ifndef MUSCLE_AVOID_OBJECT_COUNTING
 
 static ObjectCounterBase * _firstObjectCounter = NULL;
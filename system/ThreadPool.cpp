@@ -228,4 +228,140 @@ status_t ThreadPool :: StartInternalThread(Thread & thread)
    return thread.StartInternalThread();
 }
 
+// State shared by the threads that are executing a batch of jobs for ThreadPoolJobRunner::RunJobs()
+class ParallelJobBatch
+{
+public:
+   ParallelJobBatch(uint32 numJobs, ParallelJobFunc func, void * userData) : _numJobs(numJobs), _nextJobIndex(0), _func(func), _userData(userData) {/* empty */}
+
+   // Executes jobs until there are no more jobs left to start
+   void ExecuteJobs()
+   {
+      while(1)
+      {
+         uint32 jobIndex;
+         {
+            MutexGuard mg(_lock);
+            if (_nextJobIndex >= _numJobs) return;
+            jobIndex = _nextJobIndex++;
+         }
+         _func(jobIndex, _userData);
+      }
+   }
+
+private:
+   Mutex _lock;
+   const uint32 _numJobs;
+   uint32 _nextJobIndex;
+   const ParallelJobFunc _func;
+   void * _userData;
+};
+
+class ParallelJobWorker : public IThreadPoolClient
+{
+public:
+   ParallelJobWorker() : IThreadPoolClient(NULL), _batch(NULL) {/* empty */}
+
+   void SetBatch(ParallelJobBatch * batch) {_batch = batch;}
+
+protected:
+   virtual void MessageReceivedFromThreadPool(const MessageRef & /*msg*/, uint32 /*numLeft*/) {_batch->ExecuteJobs();}
+
+private:
+   ParallelJobBatch * _batch;
+};
+
+status_t ThreadPoolJobRunner :: RunJobs(uint32 numJobs, ParallelJobFunc func, void * userData)
+{
+   ParallelJobBatch batch(numJobs, func, userData);
+
+   // We'll execute jobs in this thread too, so we only need help from (parallelism-1) ThreadPool threads
+   uint32 numWorkers = ((_threadPool)&&(numJobs > 1)) ? (muscleMin(numJobs, _threadPool->GetMaxThreadCount()+1, muscleMax(_maxParallelism, (uint32)1))-1) : 0;
+   MessageRef startMsg = (numWorkers > 0) ? GetMessageFromPool() : MessageRef();
+   if (startMsg() == NULL) numWorkers = 0;
+
+   ParallelJobWorker * workers = (numWorkers > 0) ? newnothrow_array(ParallelJobWorker, numWorkers) : NULL;
+   if ((numWorkers > 0)&&(workers == NULL)) {WARN_OUT_OF_MEMORY; numWorkers = 0;}
+
+   for (uint32 i=0; i<numWorkers; i++)
+   {
+      workers[i].SetBatch(&batch);
+      workers[i].SetThreadPool(_threadPool);
+      (void) workers[i].SendMessageToThreadPool(startMsg);  // if this fails, the jobs will just get executed by the rest of us
+   }
+
+   batch.ExecuteJobs();
+
+   for (uint32 i=0; i<numWorkers; i++) workers[i].SetThreadPool(NULL);  // blocks until the worker's jobs are done
+   delete [] workers;
+   return B_NO_ERROR;
+}
+
+// Executes queued jobs one at a time, in order, via the IThreadPoolClient's guarantee that its Messages are handled in order
+class ThreadPoolSerialJobQueue : public ISerialJobQueue, private IThreadPoolClient
+{
+public:
+   ThreadPoolSerialJobQueue(ThreadPool * threadPool, const MessageRef & tokenMsg) : IThreadPoolClient(threadPool), _tokenMsg(tokenMsg) {/* empty */}
+
+   virtual ~ThreadPoolSerialJobQueue() {SetThreadPool(NULL);}  // blocks until our queued jobs are done
+
+   virtual status_t QueueJob(ParallelJobFunc func, void * userData)
+   {
+      {
+         MutexGuard mg(_lock);
+         if (_jobs.AddTail(SerialJob(func, userData)) != B_NO_ERROR) return B_ERROR;
+      }
+      if (SendMessageToThreadPool(_tokenMsg) == B_NO_ERROR) return B_NO_ERROR;
+
+      MutexGuard mg(_lock);
+      (void) _jobs.RemoveTail();  // roll back, since this job will never get a token
+      return B_ERROR;
+   }
+
+   virtual void WaitForJobsToComplete()
+   {
+      ThreadPool * tp = GetThreadPool();
+      SetThreadPool(NULL);  // blocks until all our pending callbacks have completed
+      SetThreadPool(tp);
+   }
+
+protected:
+   virtual void MessageReceivedFromThreadPool(const MessageRef & /*msg*/, uint32 /*numLeft*/)
+   {
+      SerialJob job;
+      {
+         MutexGuard mg(_lock);
+         if (_jobs.RemoveHead(job) != B_NO_ERROR) return;
+      }
+      job._func(0, job._userData);
+   }
+
+private:
+   class SerialJob
+   {
+   public:
+      SerialJob() : _func(NULL), _userData(NULL) {/* empty */}
+      SerialJob(ParallelJobFunc func, void * userData) : _func(func), _userData(userData) {/* empty */}
+
+      ParallelJobFunc _func;
+      void * _userData;
+   };
+
+   Mutex _lock;
+   Queue<SerialJob> _jobs;
+   const MessageRef _tokenMsg;  // one token is sent to the ThreadPool per queued job
+};
+
+ISerialJobQueue * ThreadPoolJobRunner :: CreateSerialJobQueue()
+{
+   if (_threadPool == NULL) return NULL;
+
+   MessageRef tokenMsg = GetMessageFromPool();
+   if (tokenMsg() == NULL) return NULL;
+
+   ISerialJobQueue * ret = newnothrow ThreadPoolSerialJobQueue(_threadPool, tokenMsg);
+   if (ret == NULL) WARN_OUT_OF_MEMORY;
+   return ret;
+}
+
 } // end namespace muscle
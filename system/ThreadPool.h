@@ -3,6 +3,7 @@
 #ifndef MuscleThreadPool_h
 #define MuscleThreadPool_h
 
+#include "system/IParallelJobRunner.h"
 #include "system/Thread.h"
 #include "system/Mutex.h"
 #include "util/Queue.h"
@@ -164,6 +165,40 @@ private:
    Hashtable<IThreadPoolClient *, ConstSocketRef> _waitingForCompletion; // Clients who are blocked in UnregisterClient() waiting for Messages to complete processing
 };
 
+/** An IParallelJobRunner that executes its jobs on the threads of a ThreadPool.
+  * The calling thread executes jobs too, while it waits for the ThreadPool's threads to finish.
+  * Note that RunJobs() must not be called from within one of the ThreadPool's own threads,
+  * since it blocks until the ThreadPool's threads have handled its jobs.
+  */
+class ThreadPoolJobRunner : public IParallelJobRunner
+{
+public:
+   /** Constructor.
+     * @param threadPool The ThreadPool to execute jobs on.  If NULL, all jobs will be executed in the calling thread.
+     * @param maxParallelism The maximum number of threads (including the calling thread) to execute a
+     *                       batch of jobs with.  Defaults to MUSCLE_NO_LIMIT, meaning that the ThreadPool's
+     *                       maximum thread count (plus one, for the calling thread) is the only limit.
+     */
+   ThreadPoolJobRunner(ThreadPool * threadPool, uint32 maxParallelism = MUSCLE_NO_LIMIT) : _threadPool(threadPool), _maxParallelism(maxParallelism) {/* empty */}
+
+   virtual status_t RunJobs(uint32 numJobs, ParallelJobFunc func, void * userData);
+
+   /** Returns a new ISerialJobQueue that executes its jobs in our ThreadPool's threads, or NULL if
+     * we don't have a ThreadPool (or we're out of memory).
+     */
+   virtual ISerialJobQueue * CreateSerialJobQueue();
+
+   /** Returns the ThreadPool that was passed to our constructor. */
+   ThreadPool * GetThreadPool() const {return _threadPool;}
+
+   /** Returns the maximum parallelism value that was passed to our constructor. */
+   uint32 GetMaxParallelism() const {return _maxParallelism;}
+
+private:
+   ThreadPool * _threadPool;
+   uint32 _maxParallelism;
+};
+
 } // end namespace muscle
 
 #endif
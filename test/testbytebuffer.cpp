@@ -71,6 +71,47 @@ static void Test(uint32 dataFlags)
 }
 
 // This program exercises the ByteBuffer class.
+static void TestLZ4(const char * desc, const ByteBuffer & raw)
+{
+   ByteBufferRef compressed = LZ4CompressByteBuffer(raw.GetBuffer(), raw.GetNumBytes());
+   if (compressed() == NULL) {printf("LZ4 compression of %s data failed!\n", desc); return;}
+
+   ByteBufferRef decompressed = LZ4DecompressByteBuffer(compressed()->GetBuffer(), compressed()->GetNumBytes());
+   if ((decompressed() == NULL)||(*decompressed() != raw)) printf("LZ4 round-trip of %s data failed!\n", desc);
+                                                      else printf("LZ4 compressed " UINT32_FORMAT_SPEC " bytes of %s data to " UINT32_FORMAT_SPEC " bytes.\n", raw.GetNumBytes(), desc, compressed()->GetNumBytes());
+
+   // Corrupt or truncated data must be rejected, never read or written out of bounds
+   for (uint32 i=1; i<compressed()->GetNumBytes(); i+=(compressed()->GetNumBytes()/50)+1)
+   {
+      if (LZ4DecompressByteBuffer(compressed()->GetBuffer(), compressed()->GetNumBytes()-i)()) printf("LZ4 decompression of truncated %s data succeeded!\n", desc);
+      ByteBuffer corrupt(*compressed());
+      corrupt.GetBuffer()[i] ^= 0x5A;
+      (void) LZ4DecompressByteBuffer(corrupt.GetBuffer(), corrupt.GetNumBytes());
+   }
+}
+
+static void TestLZ4()
+{
+   ByteBuffer b;
+   TestLZ4("empty", b);
+
+   (void) b.SetBuffer(5, (const uint8 *) "hello");
+   TestLZ4("tiny", b);
+
+   String text;
+   for (uint32 i=0; i<500; i++) text += String("Line %1:  the quick brown fox jumps over the lazy dog.\n").Arg(i%37);
+   (void) b.SetBuffer(text.Length(), (const uint8 *) text());
+   TestLZ4("text", b);
+
+   (void) b.SetNumBytes(100000, false);
+   memset(b.GetBuffer(), 'x', b.GetNumBytes());
+   TestLZ4("run-length", b);
+
+   uint32 noise = 42;
+   for (uint32 i=0; i<b.GetNumBytes(); i++) {noise = (noise*1103515245)+12345; b.GetBuffer()[i] = (uint8)(noise>>16);}
+   TestLZ4("random", b);
+}
+
 int main(int argc, char ** argv) 
 {
    if (argc > 1)
@@ -95,6 +136,7 @@ int main(int argc, char ** argv)
       Test(DATA_FLAG_NATIVE_ENDIAN);
       Test(DATA_FLAG_LITTLE_ENDIAN);
       Test(DATA_FLAG_BIG_ENDIAN);
+      TestLZ4();
    }
    return 0;
 }
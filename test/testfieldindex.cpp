@@ -0,0 +1,211 @@
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
+
+#include <stdio.h>
+#include "reflector/ReflectServer.h"
+#include "reflector/StorageReflectSession.h"
+#include "system/SetupSystem.h"
+
+using namespace muscle;
+
+// This test checks that queries answered via a node's secondary field indexes (see DataNode::AddFieldIndex())
+// always find exactly the same nodes as the same queries run against an identical, unindexed subtree,
+// while the children's data is randomly set, replaced and removed.
+
+static int _numFailures = 0;
+static bool _quick = false;
+
+static uint32 _randState = 12345;
+static uint32 GetRand(uint32 range) {_randState = (_randState*1103515245)+12345; return (_randState>>8)%range;}
+
+static const char * _stringValues[] = {"", "apple", "Apple", "banana", "cherry", "app", "nana", "zebra"};
+
+static const int64 BIG_INT64 = ((int64)1)<<62;  // values near this one are too big to be told apart once converted to double
+
+static int64 GetRandomInt64() {return GetRand(2) ? (BIG_INT64+GetRand(5)-2) : (((int64)GetRand(7))-3);}
+static double GetRandomDouble() {return (((double)GetRand(9))-4.0)*0.25;}
+
+// Returns a Message for a child node, with values in the indexed fields (sometimes missing, repeated, or of an unexpected type)
+static MessageRef MakeRandomMessage()
+{
+   MessageRef msg = GetMessageFromPool(GetRand(3));
+   if (msg() == NULL) return MessageRef();
+
+   if (GetRand(5)) {msg()->AddInt32("i32", GetRand(6)); if (GetRand(3) == 0) msg()->AddInt32("i32", GetRand(6));}
+   switch(GetRand(6))
+   {
+      case 0:  /* empty */                                          break;
+      case 1:  msg()->AddInt32("i64", GetRand(4));                   break;  // same field name, different type
+      default: msg()->AddInt64("i64", GetRandomInt64());            break;
+   }
+   if (GetRand(5)) msg()->AddDouble("dbl", GetRandomDouble());
+   if (GetRand(5)) msg()->AddString("str", _stringValues[GetRand(ARRAYITEMS(_stringValues))]);
+   if (GetRand(2)) msg()->AddInt32("other", GetRand(3));  // not indexed
+   return msg;
+}
+
+// Returns a randomly generated QueryFilter that tests the fields set by MakeRandomMessage()
+static ConstQueryFilterRef MakeRandomFilter(int depth)
+{
+   const uint32 choice = GetRand((depth > 0) ? 7 : 6);
+   switch(choice)
+   {
+      case 0:  return ConstQueryFilterRef(new Int32QueryFilter("i32", GetRand(6), GetRand(6), GetRand(4)?0:1));
+      case 1:  return ConstQueryFilterRef(new Int64QueryFilter("i64", GetRand(6), GetRandomInt64()));
+      case 2:  return ConstQueryFilterRef(new DoubleQueryFilter("dbl", GetRand(6), GetRandomDouble()));
+      case 3:  return ConstQueryFilterRef(new StringQueryFilter("str", GetRand(StringQueryFilter::NUM_STRING_OPERATORS-2), _stringValues[GetRand(ARRAYITEMS(_stringValues))]));
+      case 4:  return ConstQueryFilterRef(new Int32QueryFilter("other", GetRand(6), GetRand(3)));
+      case 5:  return ConstQueryFilterRef(new Int32QueryFilter("i64", GetRand(6), GetRand(4)));  // matches only the int32-typed values
+
+      default:
+      {
+         AndOrQueryFilter * f = new AndOrQueryFilter(GetRand(3) ? MUSCLE_NO_LIMIT : 1);
+         const uint32 numKids = GetRand(4);
+         for (uint32 i=0; i<numKids; i++) f->GetChildren().AddTail(MakeRandomFilter(depth-1));
+         return ConstQueryFilterRef(f);
+      }
+   }
+}
+
+static void Check(bool ok, const char * what)
+{
+   if (ok == false)
+   {
+      printf("ERROR:  %s\n", what);
+      _numFailures++;
+   }
+}
+
+/** Runs the whole test from inside the server's event loop, then ends it */
+class DriverSession : public StorageReflectSession
+{
+public:
+   DriverSession() {/* empty */}
+
+   virtual uint64 GetPulseTime(const PulseArgs & args) {return muscleMin(StorageReflectSession::GetPulseTime(args), args.GetScheduledTime()+MillisToMicros(10));}
+
+   virtual void Pulse(const PulseArgs & args)
+   {
+      StorageReflectSession::Pulse(args);
+      if (_numFailures == 0) RunTest();
+      EndServer();
+   }
+
+private:
+   // Gives the child named (childName) the same new random data (or removes it) in both subtrees
+   void ChangeChild(const String & childName)
+   {
+      if (GetRand(5) == 0)
+      {
+         (void) RemoveDataNodes(String("plain/") + childName);
+         (void) RemoveDataNodes(String("idx/")   + childName);
+      }
+      else
+      {
+         MessageRef msg = MakeRandomMessage();
+         Check(SetDataNode(String("plain/") + childName, msg) == B_NO_ERROR, "SetDataNode() failed on the plain subtree");
+         Check(SetDataNode(String("idx/")   + childName, msg) == B_NO_ERROR, "SetDataNode() failed on the indexed subtree");
+      }
+   }
+
+   status_t GetMatchingNames(const char * parentPath, const ConstQueryFilterRef & filter, Hashtable<String, Void> & retNames) const
+   {
+      Queue<DataNodeRef> nodes;
+      if (FindMatchingNodes(String(parentPath)+"/*", filter, nodes) != B_NO_ERROR) return B_ERROR;
+      for (uint32 i=0; i<nodes.GetNumItems(); i++) if (retNames.PutWithDefault(nodes[i]()->GetNodeName()) != B_NO_ERROR) return B_ERROR;
+      return (retNames.GetNumItems() == nodes.GetNumItems()) ? B_NO_ERROR : B_ERROR;  // an indexed traversal mustn't return the same node twice
+   }
+
+   // Checks that (idxNode)'s indexes hand back only its current children, including every child that matches (filter)
+   void CheckIndexCandidates(const DataNode & idxNode, const QueryFilter & filter)
+   {
+      Queue<DataNodeRef> candidates;
+      if (idxNode.GetFieldIndexCandidates(filter, candidates) != B_NO_ERROR) return;  // not answerable from the indexes; that's okay
+
+      Hashtable<const DataNode *, Void> candidateSet;
+      for (uint32 i=0; i<candidates.GetNumItems(); i++)
+      {
+         const DataNode * c = candidates[i]();
+         if (c->GetParent() != &idxNode) {Check(false, "GetFieldIndexCandidates() returned a node that is no longer a child"); return;}
+         (void) candidateSet.PutWithDefault(c);
+      }
+      for (DataNodeRefIterator it = idxNode.GetChildIterator(); it.HasData(); it++)
+      {
+         const DataNode * child = it.GetValue()();
+         ConstMessageRef data = child->GetData();
+         if ((filter.Matches(data, child))&&(candidateSet.ContainsKey(child) == false)) {Check(false, "GetFieldIndexCandidates() missed a matching child"); return;}
+      }
+   }
+
+   void CompareQueryResults(const DataNode & idxNode, const ConstQueryFilterRef & filter)
+   {
+      CheckIndexCandidates(idxNode, *filter());
+
+      Hashtable<String, Void> plainNames, idxNames;
+      Check(GetMatchingNames("plain", filter, plainNames) == B_NO_ERROR, "query of the plain subtree failed");
+      Check(GetMatchingNames("idx",   filter, idxNames)   == B_NO_ERROR, "query of the indexed subtree failed (or returned duplicates)");
+
+      bool same = (plainNames.GetNumItems() == idxNames.GetNumItems());
+      for (HashtableIterator<String, Void> iter(plainNames); ((same)&&(iter.HasData())); iter++) same = idxNames.ContainsKey(iter.GetKey());
+      if (same == false)
+      {
+         printf("Indexed query found " UINT32_FORMAT_SPEC " nodes, but the unindexed query found " UINT32_FORMAT_SPEC "!  Filter was:\n", idxNames.GetNumItems(), plainNames.GetNumItems());
+         MessageRef archive = GetMessageFromPool();
+         if ((archive())&&(filter()->SaveToArchive(*archive()) == B_NO_ERROR)) archive()->PrintToStream();
+         Check(false, "indexed and unindexed queries disagreed");
+      }
+   }
+
+   void RunTest()
+   {
+      static const uint32 NUM_CHILDREN = 60;
+
+      // Declare some of the indexes before the indexed node exists, and one afterwards, so that both code paths get used
+      Check(AddFieldIndex("idx", "i32") == B_NO_ERROR, "AddFieldIndex(i32) failed");
+      Check(AddFieldIndex("idx", "i64") == B_NO_ERROR, "AddFieldIndex(i64) failed");
+      Check(AddFieldIndex("idx", "str") == B_NO_ERROR, "AddFieldIndex(str) failed");
+      for (uint32 i=0; i<NUM_CHILDREN; i++) ChangeChild(String("c%1").Arg(i));
+      Check(AddFieldIndex("idx", "dbl") == B_NO_ERROR, "AddFieldIndex(dbl) failed");
+
+      DataNodeRef idxNode   = FindMatchingNode("idx",   ConstQueryFilterRef());
+      DataNodeRef plainNode = FindMatchingNode("plain", ConstQueryFilterRef());
+      if ((idxNode() == NULL)||(plainNode() == NULL)) {Check(false, "the test subtrees weren't created"); return;}
+      Check((idxNode()->HasFieldIndex("i32"))&&(idxNode()->HasFieldIndex("i64"))&&(idxNode()->HasFieldIndex("dbl"))&&(idxNode()->HasFieldIndex("str")), "the indexed node is missing an index");
+      Check(plainNode()->HasFieldIndexes() == false, "the plain node has an index");
+
+      const uint32 numIterations = _quick ? 2000 : 20000;
+      for (uint32 i=0; ((i<numIterations)&&(_numFailures == 0)); i++)
+      {
+         ChangeChild(String("c%1").Arg(GetRand(NUM_CHILDREN)));
+         CompareQueryResults(*idxNode(), MakeRandomFilter(2));
+
+         if (i == numIterations/2)
+         {
+            // Dropping an index must leave the other ones working
+            Check(RemoveFieldIndex("idx", "i32") == B_NO_ERROR, "RemoveFieldIndex(i32) failed");
+            Check((idxNode()->HasFieldIndex("i32") == false)&&(idxNode()->HasFieldIndex("i64")), "RemoveFieldIndex() removed the wrong index");
+         }
+      }
+   }
+};
+
+int main(int argc, char ** argv)
+{
+   CompleteSetupSystem css;
+
+   _quick = ((argc > 1)&&(strcmp(argv[1], "quick") == 0));
+   printf("Testing DataNode field indexes...\n");
+   {
+      ReflectServer server;
+      if (server.AddNewSession(AbstractReflectSessionRef(newnothrow DriverSession)) == B_NO_ERROR) (void) server.ServerProcessLoop();
+      else Check(false, "couldn't add the driver session");
+      server.Cleanup();
+   }
+
+   if (_numFailures > 0)
+   {
+      printf("%i field index tests FAILED!\n", _numFailures);
+      return 10;
+   }
+   printf("All field index tests passed.\n");
+   return 0;
+}
@@ -4,6 +4,7 @@
 #include "iogateway/MessageIOGateway.h"
 #include "dataio/FileDataIO.h"
 #include "system/SetupSystem.h"
+#include "system/ThreadPool.h"
 #include "zlib/ZLibDataIO.h"
 
 using namespace muscle;
@@ -17,6 +18,122 @@ DataIORef GetFileRef(FILE * file)
 //   return DataIORef(new FileDataIO(file)); 
 }
 
+// A small structured Message, of the sort that gets sent many times a second
+static MessageRef CreateTelemetryMessage(int i)
+{
+   MessageRef m = GetMessageFromPool(MAKETYPE("TeLm"));
+   TEST(m()->AddInt32("sequence_number", i));
+   TEST(m()->AddFloat("temperature_celsius", 20.0f+i));
+   TEST(m()->AddString("sensor_location", (i%2)?"left":"right"));
+   MessageRef sub = GetMessageFromPool(i);
+   TEST(sub()->AddInt64("timestamp_microseconds", i*1000));
+   if (i%10 == 0) TEST(sub()->AddBool(String("occasional_field_%1").Arg(i), true));  // new names keep turning up
+   TEST(m()->AddMessage("status_details", sub));
+   return m;
+}
+
+// A log-record Message whose text is repetitive enough that LZ4 ought to shrink it a lot
+static MessageRef CreateLogMessage(int i)
+{
+   MessageRef m = CreateTelemetryMessage(i);
+   String text;
+   for (int j=0; j<40; j++) text += String("%1: sensor %2 reported temperature %3 (status nominal)\n").Arg(j).Arg((i+j)%4).Arg(20+((i+j)%8));
+   TEST(m()->AddString("log_text", text));
+   return m;
+}
+
+// A Message whose payload is random bytes, which LZ4 can't shrink, so the gateway should send it uncompressed
+static MessageRef CreateRandomDataMessage(int i)
+{
+   MessageRef m = GetMessageFromPool(MAKETYPE("RaNd"));
+   uint8 data[1024];
+   for (uint32 j=0; j<sizeof(data); j++) data[j] = (uint8) rand();
+   TEST(m()->AddInt32("sequence_number", i));
+   TEST(m()->AddData("random_bytes", B_RAW_TYPE, data, sizeof(data)));
+   return m;
+}
+
+// Compresses every outgoing Message on its own, as is necessary when sending over UDP
+class IndependentMessageIOGateway : public MessageIOGateway
+{
+public:
+   IndependentMessageIOGateway(int32 encoding) : MessageIOGateway(encoding) {/* empty */}
+
+protected:
+   virtual bool AreOutgoingMessagesIndependent() const {return true;}
+};
+
+// A MessageIOGateway that lets us look at the buffers it would send
+class FlattenTestMessageIOGateway : public MessageIOGateway
+{
+public:
+   ByteBufferRef Flatten(const MessageRef & msg) const {return FlattenHeaderAndMessage(msg);}
+};
+
+// A FileDataIO that remembers the largest single write made to it
+class MaxWriteFileDataIO : public FileDataIO
+{
+public:
+   MaxWriteFileDataIO(FILE * f) : FileDataIO(f), _maxWriteSize(0) {/* empty */}
+
+   virtual int32 Write(const void * buffer, uint32 size)
+   {
+      const int32 ret = FileDataIO::Write(buffer, size);
+      if (ret > _maxWriteSize) _maxWriteSize = ret;
+      return ret;
+   }
+
+   int32 _maxWriteSize;
+};
+
+// Writes (msgs) to (fileName) via (g), and returns the number of bytes written
+static uint32 WriteMessagesToFile(const char * fileName, MessageIOGateway & g, const Queue<MessageRef> & msgs)
+{
+   uint32 numBytes = 0;
+   FILE * f = muscleFopen(fileName, "wb");
+   if (f)
+   {
+      g.SetDataIO(DataIORef(new FileDataIO(f)));
+      for (uint32 i=0; i<msgs.GetNumItems(); i++) TEST(g.AddOutgoingMessage(msgs[i]));
+      while(g.HasBytesToOutput())
+      {
+         const int32 numSent = g.DoOutput();
+         TESTSIZE(numSent);
+         if (numSent > 0) numBytes += numSent; else break;
+      }
+      g.SetDataIO(DataIORef());
+   }
+   else printf("Error, could not open test file %s!\n", fileName);
+   return numBytes;
+}
+
+// Reads Messages from (fileName) via (g), and returns the number of them that matched (expected)
+static uint32 ReadMessagesFromFile(const char * fileName, MessageIOGateway & g, const Queue<MessageRef> & expected)
+{
+   uint32 numMatched = 0;
+   FILE * in = muscleFopen(fileName, "rb");
+   if (in)
+   {
+      QueueGatewayMessageReceiver inQueue;
+      g.SetDataIO(DataIORef(new FileDataIO(in)));
+      uint32 numReceived = 0;
+      bool keepGoing = true;
+      while(keepGoing)
+      {
+         keepGoing = (g.DoInput(inQueue) >= 0);
+         MessageRef msgRef;
+         while(inQueue.RemoveHead(msgRef) == B_NO_ERROR)
+         {
+            while((numReceived < expected.GetNumItems())&&(*msgRef()->FlattenToByteBuffer()() != *expected[numReceived]()->FlattenToByteBuffer()())) numReceived++;  // skip over any dropped Messages
+            if (numReceived < expected.GetNumItems()) {numMatched++; numReceived++;}
+         }
+      }
+      g.SetDataIO(DataIORef());
+   }
+   else printf("Error, could not re-open test file %s!\n", fileName);
+   return numMatched;
+}
+
 // This program tests the functionality of the MessageIOGateway by writing a Message
 // out to a file, then reading it back in.
 int main(int argc, char ** argv) 
@@ -61,6 +178,411 @@ int main(int argc, char ** argv)
          printf("Done Reading!\n");
       }
       else printf("Error, could not re-open test file!\n");
+
+      // Now make sure that large Messages survive being streamed out incrementally
+      Queue<MessageRef> sentMessages;
+      f = muscleFopen("test_streamed.dat", "wb");
+      if (f)
+      {
+         printf("Outputting streamed test messages to test_streamed.dat...\n");
+         MessageIOGateway g;
+         g.SetOutgoingMessageStreamingThreshold(1000);  // so that our not-really-so-large Messages get streamed
+         MaxWriteFileDataIO * fdio = new MaxWriteFileDataIO(f);
+         g.SetDataIO(DataIORef(fdio));
+         for (int i=0; i<10; i++)
+         {
+            MessageRef m = GetMessageFromPool(MAKETYPE("BiGm"));
+            ByteBufferRef blob = GetByteBufferFromPool(i*50000);
+            for (uint32 j=0; j<blob()->GetNumBytes(); j++) blob()->GetBuffer()[j] = (uint8) (i+j);
+            TEST(m()->AddFlat("blob", blob));
+            MessageRef sub = GetMessageFromPool(i);
+            for (int j=0; j<i*100; j++) TEST(sub()->AddString("str", String("string #%1").Arg(j)));
+            TEST(m()->AddMessage("sub", sub));
+            TEST(m()->AddInt32("index", i));
+            TEST(g.AddOutgoingMessage(m));
+            TEST(sentMessages.AddTail(m));
+         }
+         while(g.HasBytesToOutput()) TESTSIZE(g.DoOutput());
+         if (fdio->_maxWriteSize > (int32)(MUSCLE_MESSAGE_IO_GATEWAY_STREAMING_CHUNK_SIZE+(2*sizeof(uint32)))) printf("Large Messages weren't streamed out!  (largest write was " INT32_FORMAT_SPEC " bytes)\n", fdio->_maxWriteSize);
+      }
+      else printf("Error, could not open streamed test file!\n");
+
+      // Read them back in twice:  once the usual way, and once with the larger ones spooled to disk as they arrive
+      for (int pass=0; pass<2; pass++)
+      {
+         const bool spool = (pass == 1);
+         in = muscleFopen("test_streamed.dat", "rb");
+         if (in)
+         {
+            printf("Reading streamed test messages from test_streamed.dat%s...\n", spool?" (spooled)":"");
+            MessageIOGateway g;
+            if (spool) g.SetIncomingMessageSpoolThreshold(1000);
+            g.SetDataIO(DataIORef(new FileDataIO(in)));
+            uint32 numReceived = 0, numMapped = 0;
+            MessageRef msgRef;
+            while(inQueue.RemoveHead(msgRef) == B_NO_ERROR) {/* empty */}  // discard anything left over from the previous test
+
+            bool keepGoing = true;
+            while(keepGoing)
+            {
+               keepGoing = (g.DoInput(inQueue) >= 0);
+               while(inQueue.RemoveHead(msgRef) == B_NO_ERROR) 
+               {
+                  if ((numReceived >= sentMessages.GetNumItems())||(*msgRef()->FlattenToByteBuffer()() != *sentMessages[numReceived]()->FlattenToByteBuffer()())) printf("Streamed Message #" UINT32_FORMAT_SPEC " didn't match what was sent!\n", numReceived);
+
+                  ByteBufferRef blob;
+                  if ((msgRef()->FindFlat("blob", blob) == B_NO_ERROR)&&(blob()->GetMemoryAllocationStrategy() != NULL))
+                  {
+                     // A memory-mapped blob should still be modifiable, just like any other ByteBuffer
+                     uint32 oldSize = blob()->GetNumBytes();
+                     uint8 lastByte = blob()->GetBuffer()[oldSize-1];
+                     TEST(blob()->AppendByte(0x42));
+                     if ((blob()->GetNumBytes() != oldSize+1)||(blob()->GetBuffer()[oldSize-1] != lastByte)||(blob()->GetBuffer()[oldSize] != 0x42)) printf("Memory-mapped blob in Message #" UINT32_FORMAT_SPEC " wasn't resized correctly!\n", numReceived);
+                     numMapped++;
+                  }
+                  numReceived++;
+               }
+            }
+            if (numReceived == sentMessages.GetNumItems()) printf("All " UINT32_FORMAT_SPEC " streamed Messages were received correctly (" UINT32_FORMAT_SPEC " with memory-mapped blobs).\n", numReceived, numMapped);
+                                                       else printf("Only " UINT32_FORMAT_SPEC " of " UINT32_FORMAT_SPEC " streamed Messages were received!\n", numReceived, sentMessages.GetNumItems());
+         }
+         else printf("Error, could not re-open streamed test file!\n");
+      }
+
+      // And that Messages survive the field-name-dictionary and LZ4 encodings:  compressible log records should
+      // come out well under their default-encoded size, while random data should fall back to being sent raw.
+      srand(0);  // we want this to be repeatable
+      const int32 encodings[]       = {MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY, MUSCLE_MESSAGE_ENCODING_LZ4, MUSCLE_MESSAGE_ENCODING_LZ4};
+      const char * encodingNames[]  = {"dictionary", "lz4", "lz4-random"};
+      MessageRef (*createFuncs[])(int) = {CreateTelemetryMessage, CreateLogMessage, CreateRandomDataMessage};
+      const uint32 maxPercents[]    = {100, 50, 100};  // encoded size, as a maximum percentage of the default-encoded size
+      for (uint32 e=0; e<ARRAYITEMS(encodings); e++)
+      {
+         const String fileName = String("test_%1.dat").Arg(encodingNames[e]);
+         Queue<MessageRef> encMessages;
+         uint32 defaultEncodingBytes = 0, encodedBytes = 0;
+         f = muscleFopen(fileName(), "wb");
+         if (f)
+         {
+            printf("Outputting %s-encoded test messages to %s...\n", encodingNames[e], fileName());
+            MessageIOGateway g(encodings[e]);
+            g.SetDataIO(DataIORef(new FileDataIO(f)));
+            for (int i=0; i<100; i++)
+            {
+               MessageRef m = createFuncs[e](i);
+               TEST(g.AddOutgoingMessage(m));
+               TEST(encMessages.AddTail(m));
+               defaultEncodingBytes += 2*sizeof(uint32)+m()->FlattenedSize();
+            }
+            while(g.HasBytesToOutput())
+            {
+               int32 numSent = g.DoOutput();
+               TESTSIZE(numSent);
+               if (numSent > 0) encodedBytes += numSent;
+            }
+         }
+         else printf("Error, could not open %s test file!\n", encodingNames[e]);
+
+         in = muscleFopen(fileName(), "rb");
+         if (in)
+         {
+            printf("Reading %s-encoded test messages from %s...\n", encodingNames[e], fileName());
+            MessageIOGateway g;
+            g.SetDataIO(DataIORef(new FileDataIO(in)));
+            uint32 numReceived = 0;
+            MessageRef msgRef;
+            while(inQueue.RemoveHead(msgRef) == B_NO_ERROR) {/* empty */}  // discard anything left over from the previous test
+
+            bool keepGoing = true;
+            while(keepGoing)
+            {
+               keepGoing = (g.DoInput(inQueue) >= 0);
+               while(inQueue.RemoveHead(msgRef) == B_NO_ERROR) 
+               {
+                  if ((numReceived >= encMessages.GetNumItems())||(*msgRef()->FlattenToByteBuffer()() != *encMessages[numReceived]()->FlattenToByteBuffer()())) printf("%s-encoded Message #" UINT32_FORMAT_SPEC " didn't match what was sent!\n", encodingNames[e], numReceived);
+                  numReceived++;
+               }
+            }
+            if (numReceived == encMessages.GetNumItems()) printf("All " UINT32_FORMAT_SPEC " %s-encoded Messages were received correctly (" UINT32_FORMAT_SPEC " bytes, vs " UINT32_FORMAT_SPEC " bytes with the default encoding).\n", numReceived, encodingNames[e], encodedBytes, defaultEncodingBytes);
+                                                      else printf("Only " UINT32_FORMAT_SPEC " of " UINT32_FORMAT_SPEC " %s-encoded Messages were received!\n", numReceived, encMessages.GetNumItems(), encodingNames[e]);
+
+            if (((uint64)encodedBytes)*100 > ((uint64)defaultEncodingBytes)*maxPercents[e]) printf("Error, %s-encoded Messages took " UINT32_FORMAT_SPEC " bytes, which is more than " UINT32_FORMAT_SPEC "%% of the " UINT32_FORMAT_SPEC " bytes they take with the default encoding!\n", encodingNames[e], encodedBytes, maxPercents[e], defaultEncodingBytes);
+         }
+         else printf("Error, could not re-open %s test file!\n", encodingNames[e]);
+      }
+
+      // And that a preset dictionary helps zlib with small Messages that must each be compressed independently
+      {
+         Queue<ConstByteBufferRef> samples;  // "captured" traffic, to train the dictionary with
+         for (int i=0; i<20; i++) TEST(samples.AddTail(CreateTelemetryMessage(1000+i)()->FlattenToByteBuffer()));
+         const ConstByteBufferRef dict = ZLibCodec::BuildPresetDictionary(samples);
+
+         Queue<MessageRef> msgs;
+         for (int i=0; i<100; i++) TEST(msgs.AddTail(CreateTelemetryMessage(i)));
+
+         IndependentMessageIOGateway plainWriter(MUSCLE_MESSAGE_ENCODING_ZLIB_6);
+         const uint32 plainBytes = WriteMessagesToFile("test_zlibdict.dat", plainWriter, msgs);
+
+         IndependentMessageIOGateway dictWriter(MUSCLE_MESSAGE_ENCODING_ZLIB_6);
+         dictWriter.SetZLibPresetDictionary(dict);
+         const uint32 dictBytes = WriteMessagesToFile("test_zlibdict.dat", dictWriter, msgs);
+
+         MessageIOGateway dictReader;
+         dictReader.SetZLibPresetDictionary(dict);
+         const uint32 numMatched = ReadMessagesFromFile("test_zlibdict.dat", dictReader, msgs);
+         if (numMatched == msgs.GetNumItems()) printf("All " UINT32_FORMAT_SPEC " preset-dictionary zlib Messages were received correctly (" UINT32_FORMAT_SPEC " bytes, vs " UINT32_FORMAT_SPEC " bytes without the dictionary).\n", numMatched, dictBytes, plainBytes);
+                                          else printf("Only " UINT32_FORMAT_SPEC " of " UINT32_FORMAT_SPEC " preset-dictionary zlib Messages were received!\n", numMatched, msgs.GetNumItems());
+         if (dictBytes >= plainBytes) printf("The preset dictionary didn't make the Messages any smaller!\n");
+
+         MessageIOGateway noDictReader;  // should reject every Message that was compressed with the dictionary
+         if (ReadMessagesFromFile("test_zlibdict.dat", noDictReader, msgs) == msgs.GetNumItems()) printf("A reader without the preset dictionary was able to read all the Messages!\n");
+
+         // A codec with the wrong dictionary (or none) should be able to tell that's why it can't inflate the data
+         ZLibCodec dictCodec, otherDictCodec, noDictCodec;
+         TEST(dictCodec.SetPresetDictionary(dict));
+         ByteBufferRef otherDict = GetByteBufferFromPool(1000);
+         for (uint32 i=0; i<otherDict()->GetNumBytes(); i++) otherDict()->GetBuffer()[i] = (uint8) (i*7);
+         TEST(otherDictCodec.SetPresetDictionary(otherDict));
+         ByteBufferRef flat = msgs[0]()->FlattenToByteBuffer();
+         ByteBufferRef comp = flat() ? dictCodec.Deflate(*flat(), true) : ByteBufferRef();
+         if (comp() == NULL) printf("Couldn't deflate with the preset dictionary!\n");
+         else
+         {
+            if ((otherDictCodec.Inflate(*comp())() != NULL)||(otherDictCodec.GetMismatchedPresetDictionaryID() != dictCodec.GetPresetDictionaryID())) printf("A codec with a different preset dictionary didn't report the mismatch!\n");
+            if ((noDictCodec.Inflate(*comp())()    != NULL)||(noDictCodec.GetMismatchedPresetDictionaryID()    != dictCodec.GetPresetDictionaryID())) printf("A codec with no preset dictionary didn't report the mismatch!\n");
+            ZLibCodec sameDictCodec;
+            TEST(sameDictCodec.SetPresetDictionary(dict));
+            ByteBufferRef infl = sameDictCodec.Inflate(*comp());
+            if ((infl() == NULL)||(*infl() != *flat())||(sameDictCodec.GetMismatchedPresetDictionaryID() != 0)) printf("A codec with the same preset dictionary couldn't inflate the data!\n");
+            else printf("Preset dictionary mismatches were detected correctly.\n");
+         }
+      }
+
+      // And that large data can be deflated on several threads at once, without the reader having to know about it
+      {
+         ThreadPool pool(4);
+         ThreadPoolJobRunner runner(&pool);
+
+         MessageRef bigMsg = GetMessageFromPool();
+         for (int i=0; i<20000; i++) TEST(bigMsg()->AddMessage("telemetry", CreateTelemetryMessage(i)));
+         ByteBufferRef raw = bigMsg()->FlattenToByteBuffer();
+
+         // The gateway's single-pass flatten shouldn't leave lots of unused space in the buffers it queues up
+         FlattenTestMessageIOGateway flattenGateway;
+         ByteBufferRef flat = flattenGateway.Flatten(bigMsg);
+         if ((flat() == NULL)||(flat()->GetNumBytes() != raw()->GetNumBytes()+(2*sizeof(uint32)))) printf("FlattenHeaderAndMessage() didn't flatten the big Message correctly!\n");
+         else if (flat()->GetNumAllocatedBytes() > flat()->GetNumBytes()+(flat()->GetNumBytes()/8)) printf("FlattenHeaderAndMessage() left " UINT32_FORMAT_SPEC " of " UINT32_FORMAT_SPEC " bytes unused!\n", flat()->GetNumAllocatedBytes()-flat()->GetNumBytes(), flat()->GetNumAllocatedBytes());
+
+         ZLibCodec serialCodec(6), parallelCodec(6), inflateCodec(6);
+         ByteBufferRef serialComp   = serialCodec.Deflate(*raw(), true);
+         ByteBufferRef parallelComp = parallelCodec.DeflateParallel(raw()->GetBuffer(), raw()->GetNumBytes(), runner);
+         ByteBufferRef inflated     = parallelComp() ? inflateCodec.Inflate(*parallelComp()) : ByteBufferRef();
+         if ((inflated())&&(*inflated() == *raw())) printf("Parallel-deflated " UINT32_FORMAT_SPEC " bytes were inflated correctly (" UINT32_FORMAT_SPEC " bytes, vs " UINT32_FORMAT_SPEC " bytes single-threaded).\n", raw()->GetNumBytes(), parallelComp()->GetNumBytes(), serialComp()->GetNumBytes());
+                                                 else printf("Parallel-deflated data didn't inflate correctly!\n");
+
+         // The codec's next (dependent) buffer must still be decodable after a parallel one
+         const uint8 moreData[] = "Some more data, for a dependent buffer to hold.  Some more data, for a dependent buffer to hold.";
+         ByteBufferRef moreComp = parallelCodec.Deflate(moreData, sizeof(moreData), false);
+         ByteBufferRef moreInflated = moreComp() ? inflateCodec.Inflate(*moreComp()) : ByteBufferRef();
+         if ((moreInflated() == NULL)||(*moreInflated() != ByteBuffer(sizeof(moreData), moreData))) printf("Buffer deflated after a parallel-deflated buffer didn't inflate correctly!\n");
+
+         // Also via a MessageIOGateway
+         Queue<MessageRef> bigMsgs;
+         for (int i=0; i<3; i++) TEST(bigMsgs.AddTail(bigMsg));
+         MessageIOGateway parallelWriter(MUSCLE_MESSAGE_ENCODING_ZLIB_6);
+         parallelWriter.SetZLibParallelDeflate(&runner, 64*1024);
+         (void) WriteMessagesToFile("test_zlibparallel.dat", parallelWriter, bigMsgs);
+         MessageIOGateway parallelReader;
+         const uint32 numMatched = ReadMessagesFromFile("test_zlibparallel.dat", parallelReader, bigMsgs);
+         if (numMatched == bigMsgs.GetNumItems()) printf("All " UINT32_FORMAT_SPEC " parallel-deflated Messages were received correctly.\n", numMatched);
+                                              else printf("Only " UINT32_FORMAT_SPEC " of " UINT32_FORMAT_SPEC " parallel-deflated Messages were received!\n", numMatched, bigMsgs.GetNumItems());
+
+         // And via a ZLibDataIO
+         FILE * fpOut = muscleFopen("test_zlibparallel.dat", "wb");
+         if (fpOut)
+         {
+            ZLibDataIO zOut(DataIORef(new FileDataIO(fpOut)));
+            TEST(zOut.SetParallelDeflate(&runner));
+            for (uint32 i=0; i<raw()->GetNumBytes(); )
+            {
+               const int32 bytesWritten = zOut.Write(raw()->GetBuffer()+i, raw()->GetNumBytes()-i);  // not WriteFully(), since Write() may legitimately return 0
+               if (bytesWritten < 0) {printf("ZLibDataIO write failed!\n"); break;}
+               i += bytesWritten;
+            }
+            zOut.Shutdown();
+         }
+         FILE * fpIn = muscleFopen("test_zlibparallel.dat", "rb");
+         if (fpIn)
+         {
+            ZLibDataIO zIn(DataIORef(new FileDataIO(fpIn)));
+            ByteBuffer readBack;
+            uint8 buf[16*1024];
+            int32 numRead;
+            while((numRead = zIn.Read(buf, sizeof(buf))) >= 0) TEST(readBack.AppendBytes(buf, numRead));  // ReadFully() would stop early when Read() returns 0
+            if (readBack == *raw()) printf("Parallel-deflated ZLibDataIO data was read back correctly.\n");
+                               else printf("Parallel-deflated ZLibDataIO data wasn't read back correctly!\n");
+         }
+
+         // And when compressing a rotated log file
+         const char * logFileName = "test_zlibparallel.log";
+         TEST(SetFileLogName(logFileName));
+         TEST(SetFileLogLevel(MUSCLE_LOG_DEBUG));
+         TEST(SetFileLogCompressionEnabled(true));
+         TEST(SetFileLogCompressionJobRunner(&runner));
+         const uint32 numLogLines = 50000;
+         for (uint32 i=0; i<numLogLines; i++) LogTime(MUSCLE_LOG_DEBUG, "Parallel log compression test line #" UINT32_FORMAT_SPEC "\n", i);
+         CloseCurrentLogFile();
+         TEST(SetFileLogLevel(MUSCLE_LOG_NONE));
+         TEST(SetFileLogCompressionJobRunner(NULL));
+
+         const String gzName = String(logFileName) + ".gz";
+         gzFile gzIn = gzopen(gzName(), "rb");
+         if (gzIn != Z_NULL)
+         {
+            String text;
+            char buf[16*1024];
+            int numRead;
+            while((numRead = gzread(gzIn, buf, sizeof(buf))) > 0) text += String(buf, numRead);
+            gzclose(gzIn);
+            if ((numRead == 0)&&(text.Contains(String("line #%1\n").Arg(numLogLines-1)))) printf("Parallel-compressed log file was decompressed correctly.\n");
+                                                                                         else printf("Parallel-compressed log file didn't decompress correctly!\n");
+         }
+         else printf("Parallel-compressed log file [%s] wasn't created!\n", gzName());
+      }
+
+      // And that adaptive compression moves the level in the right direction
+      {
+         AdaptiveCompressionController c;
+         c.SetParameters(1000, 2, 0.5f, 9);
+         c.Reset(6, 0);
+         uint64 now = 0;
+         for (int i=0; i<4; i++)  // slow, saturated link with CPU to spare:  compress harder
+         {
+            c.CompressionPerformed(100000, 20000, 100);
+            c.OutputPerformed(20000, true);
+            (void) c.Update(now += 1000);
+         }
+         const int raisedLevel = c.GetCompressionLevel();
+         for (int i=0; i<4; i++)  // fast link that never fills up:  compression is just wasting CPU
+         {
+            c.CompressionPerformed(100000, 20000, 100);
+            c.OutputPerformed(20000, false);
+            (void) c.Update(now += 1000);
+         }
+         const int loweredLevel = c.GetCompressionLevel();
+         for (int i=0; i<2; i++)  // incompressible data:  turn compression off
+         {
+            c.CompressionPerformed(100000, 99000, 100);
+            c.OutputPerformed(99000, true);
+            (void) c.Update(now += 1000);
+         }
+         if ((raisedLevel == 8)&&(loweredLevel == 6)&&(c.GetCompressionLevel() == 0)) printf("AdaptiveCompressionController chose the expected compression levels.\n");
+                                                                                 else printf("AdaptiveCompressionController chose levels %i, %i and %i, expected 8, 6 and 0!\n", raisedLevel, loweredLevel, c.GetCompressionLevel());
+
+         // Messages sent while the level is changing must all still be readable by an ordinary MessageIOGateway
+         Queue<MessageRef> msgs;
+         for (int i=0; i<20; i++) TEST(msgs.AddTail(CreateTelemetryMessage(i)));
+
+         MessageIOGateway adaptiveWriter(MUSCLE_MESSAGE_ENCODING_ZLIB_9);
+         adaptiveWriter.SetAdaptiveCompressionEnabled(true);
+         adaptiveWriter.GetAdaptiveCompressionController().SetParameters(1, 1, 0.5f, 9);  // a file never fills up, so the level should step down to zero
+         FILE * f = muscleFopen("test_adaptive.dat", "wb");
+         if (f)
+         {
+            adaptiveWriter.SetDataIO(DataIORef(new FileDataIO(f)));
+            for (uint32 i=0; i<msgs.GetNumItems(); i++)
+            {
+               TEST(adaptiveWriter.AddOutgoingMessage(msgs[i]));
+               while(adaptiveWriter.HasBytesToOutput()) if (adaptiveWriter.DoOutput() <= 0) break;
+               Snooze64(MillisToMicros(20));  // make sure each call ends a measurement window, even with a coarse GetRunTime64() clock
+            }
+            adaptiveWriter.SetDataIO(DataIORef());
+
+            const AdaptiveCompressionController & ac = adaptiveWriter.GetAdaptiveCompressionController();
+            MessageIOGateway reader;
+            const uint32 numMatched = ReadMessagesFromFile("test_adaptive.dat", reader, msgs);
+            if (numMatched == msgs.GetNumItems()) printf("All " UINT32_FORMAT_SPEC " adaptively-compressed Messages were received correctly (final level %i after " UINT32_FORMAT_SPEC " level changes).\n", numMatched, ac.GetCompressionLevel(), ac.GetNumLevelChanges());
+                                             else printf("Only " UINT32_FORMAT_SPEC " of " UINT32_FORMAT_SPEC " adaptively-compressed Messages were received!\n", numMatched, msgs.GetNumItems());
+            if (ac.GetCompressionLevel() != 0) printf("Adaptive compression didn't switch itself off for a link that never fills up!\n");
+         }
+         else printf("Error, could not open test_adaptive.dat!\n");
+      }
+
+      // And that the outgoing-Message pipeline sends exactly the same bytes as the event-loop thread would have
+      {
+         ThreadPool pool(2);
+         ThreadPoolJobRunner runner(&pool);
+
+         Queue<MessageRef> msgs;
+         for (int i=0; i<200; i++) TEST(msgs.AddTail(CreateTelemetryMessage(i)));
+
+         // With this threshold, about half of the Messages get streamed out rather than flattened (when the encoding allows it)
+         const uint32 streamingThreshold = msgs[1]()->FlattenedSize();
+
+         const int32 pipelineEncodings[] = {MUSCLE_MESSAGE_ENCODING_DEFAULT, MUSCLE_MESSAGE_ENCODING_ZLIB_6, MUSCLE_MESSAGE_ENCODING_FIELD_NAME_DICTIONARY};
+         for (uint32 e=0; e<ARRAYITEMS(pipelineEncodings); e++)
+         {
+            MessageIOGateway serialWriter(pipelineEncodings[e]);
+            serialWriter.SetOutgoingMessageStreamingThreshold(streamingThreshold);
+            const uint32 serialBytes = WriteMessagesToFile("test_pipeline.dat", serialWriter, msgs);
+            ByteBufferRef serialData = GetByteBufferFromPool(serialBytes);
+            FILE * f = muscleFopen("test_pipeline.dat", "rb");
+            if ((f)&&(serialData())) {if (fread(serialData()->GetBuffer(), 1, serialBytes, f) != serialBytes) printf("Couldn't read back the serially-written Messages!\n"); fclose(f);}
+
+            MessageIOGateway pipelinedWriter(pipelineEncodings[e]);
+            pipelinedWriter.SetOutgoingMessageStreamingThreshold(streamingThreshold);
+            TEST(pipelinedWriter.SetOutgoingMessagePipeline(&runner, 8));
+            const uint32 pipelinedBytes = WriteMessagesToFile("test_pipeline.dat", pipelinedWriter, msgs);
+            ByteBufferRef pipelinedData = GetByteBufferFromPool(pipelinedBytes);
+            f = muscleFopen("test_pipeline.dat", "rb");
+            if ((f)&&(pipelinedData())) {if (fread(pipelinedData()->GetBuffer(), 1, pipelinedBytes, f) != pipelinedBytes) printf("Couldn't read back the pipelined Messages!\n"); fclose(f);}
+
+            MessageIOGateway reader;
+            const uint32 numMatched = ReadMessagesFromFile("test_pipeline.dat", reader, msgs);
+            if ((serialData())&&(pipelinedData())&&(*serialData() == *pipelinedData())&&(numMatched == msgs.GetNumItems())) printf("All " UINT32_FORMAT_SPEC " pipelined Messages (encoding " INT32_FORMAT_SPEC ") were sent correctly (" UINT32_FORMAT_SPEC " bytes).\n", numMatched, pipelineEncodings[e], pipelinedBytes);
+            else printf("Pipelined Messages (encoding " INT32_FORMAT_SPEC ") weren't sent correctly!  (" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " bytes, " UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " Messages)\n", pipelineEncodings[e], pipelinedBytes, serialBytes, numMatched, msgs.GetNumItems());
+         }
+      }
+
+      // A pipeline and parallel deflate that share a one-thread ThreadPool mustn't deadlock, and should produce the same bytes as parallel deflate alone
+      {
+         ThreadPool pool(1);
+         ThreadPoolJobRunner runner(&pool);
+
+         Queue<MessageRef> msgs;
+         MessageRef bigMsg = GetMessageFromPool(MAKETYPE("BiGm"));
+         for (int i=0; i<10000; i++) TEST(bigMsg()->AddString("line", String("This is line #%1 of the big Message").Arg(i)));  // a few chunks' worth
+         TEST(msgs.AddTail(bigMsg));
+         TEST(msgs.AddTail(CreateTelemetryMessage(0)));
+
+         MessageIOGateway parallelWriter(MUSCLE_MESSAGE_ENCODING_ZLIB_6);
+         parallelWriter.SetZLibParallelDeflate(&runner, MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE);
+         const uint32 parallelBytes = WriteMessagesToFile("test_pipeline.dat", parallelWriter, msgs);
+         ByteBufferRef parallelData = GetByteBufferFromPool(parallelBytes);
+         FILE * f = muscleFopen("test_pipeline.dat", "rb");
+         if ((f)&&(parallelData())) {if (fread(parallelData()->GetBuffer(), 1, parallelBytes, f) != parallelBytes) printf("Couldn't read back the parallel-deflated Messages!\n"); fclose(f);}
+
+         CountedMessageIOGateway pipelinedWriter(MUSCLE_MESSAGE_ENCODING_ZLIB_6);
+         pipelinedWriter.SetZLibParallelDeflate(&runner, MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE);
+         TEST(pipelinedWriter.SetOutgoingMessagePipeline(&runner));
+
+         // The Messages in the pipeline should still be counted as outgoing bytes
+         uint32 expectedCount = 0;
+         for (uint32 i=0; i<msgs.GetNumItems(); i++) {TEST(pipelinedWriter.AddOutgoingMessage(msgs[i])); expectedCount += msgs[i]()->FlattenedSize();}
+         if (pipelinedWriter.GetNumOutgoingDataBytes() != expectedCount) printf("CountedMessageIOGateway counted " UINT32_FORMAT_SPEC " outgoing bytes; expected " UINT32_FORMAT_SPEC "!\n", pipelinedWriter.GetNumOutgoingDataBytes(), expectedCount);
+         pipelinedWriter.Reset();
+
+         const uint32 pipelinedBytes = WriteMessagesToFile("test_pipeline.dat", pipelinedWriter, msgs);
+         if (pipelinedWriter.GetNumOutgoingDataBytes() != 0) printf("CountedMessageIOGateway didn't count the pipelined Messages back out!  (" UINT32_FORMAT_SPEC " bytes left)\n", pipelinedWriter.GetNumOutgoingDataBytes());
+         ByteBufferRef pipelinedData = GetByteBufferFromPool(pipelinedBytes);
+         f = muscleFopen("test_pipeline.dat", "rb");
+         if ((f)&&(pipelinedData())) {if (fread(pipelinedData()->GetBuffer(), 1, pipelinedBytes, f) != pipelinedBytes) printf("Couldn't read back the pipelined Messages!\n"); fclose(f);}
+
+         MessageIOGateway reader;
+         const uint32 numMatched = ReadMessagesFromFile("test_pipeline.dat", reader, msgs);
+         if ((parallelData())&&(pipelinedData())&&(*parallelData() == *pipelinedData())&&(numMatched == msgs.GetNumItems())) printf("Pipelined parallel-deflate Messages were sent correctly (" UINT32_FORMAT_SPEC " bytes).\n", pipelinedBytes);
+         else printf("Pipelined parallel-deflate Messages weren't sent correctly!  (" UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " bytes, " UINT32_FORMAT_SPEC "/" UINT32_FORMAT_SPEC " Messages)\n", pipelinedBytes, parallelBytes, numMatched, msgs.GetNumItems());
+      }
    }
    else if (argc > 1)
    {
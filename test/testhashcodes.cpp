@@ -0,0 +1,127 @@
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
+
+#include <stdio.h>
+
+#include "system/SetupSystem.h"
+#include "util/Hashtable.h"
+#include "util/String.h"
+#include "util/TimeUtilityFunctions.h"
+
+using namespace muscle;
+
+// A plain copy of the MurmurHash2 algorithm (MUSCLE's hash function through v6.72), so that
+// we have a baseline to compare the speed of the current CalculateHashCode() against.
+static uint32 ReferenceMurmurHash2(const void * key, uint32 numBytes, uint32 seed)
+{
+   const uint32 m = 0x5bd1e995;
+   const int32  r = 24;
+
+   const uint8 * data = (const uint8 *) key;
+   uint32 h = seed ^ numBytes;
+   while(numBytes >= 4)
+   {
+      uint32 k; memcpy(&k, data, sizeof(k));
+      k *= m; k ^= k >> r; k *= m; h *= m; h ^= k;
+      data     += 4;
+      numBytes -= 4;
+   }
+   switch(numBytes)
+   {
+      case 3: h ^= data[2] << 16;  // fall through
+      case 2: h ^= data[1] << 8;   // fall through
+      case 1: h ^= data[0];
+              h *= m;
+   };
+   h ^= h >> 13;
+   h *= m;
+   h ^= h >> 15;
+   return h;
+}
+
+static int _numFailures = 0;
+
+static void Fail(const char * what, uint32 numBytes)
+{
+   printf("FAILURE:  %s (numBytes=" UINT32_FORMAT_SPEC ")\n", what, numBytes);
+   _numFailures++;
+}
+
+// Makes sure the hash of a buffer doesn't depend on its alignment, and that lengths/seeds/bit-flips all affect the result
+static void TestSanity(const uint8 * buf, uint32 maxBytes)
+{
+   Hashtable<uint64, uint32> seen;
+   uint8 shifted[4096+16];
+   for (uint32 numBytes=0; numBytes<=maxBytes; numBytes++)
+   {
+      const uint64 h = CalculateHashCode64(buf, numBytes);
+      for (uint32 align=1; align<16; align++)
+      {
+         memcpy(shifted+align, buf, numBytes);
+         if (CalculateHashCode64(shifted+align, numBytes) != h) Fail("hash value depends on buffer alignment", numBytes);
+      }
+      if (CalculateHashCode64(buf, numBytes, 1) == h) Fail("seed doesn't affect hash value", numBytes);
+      if (seen.ContainsKey(h)) Fail("prefixes of different lengths hash to the same value", numBytes);
+      (void) seen.Put(h, numBytes);
+
+      if (numBytes > 0)
+      {
+         memcpy(shifted, buf, numBytes);
+         shifted[numBytes/2] ^= 0x01;
+         if (CalculateHashCode64(shifted, numBytes) == h) Fail("flipping a bit didn't change the hash value", numBytes);
+      }
+   }
+}
+
+// Prints a digest of many hash values, so that the output of different builds (e.g. -DMUSCLE_AVOID_SIMD_HASHING) can be compared
+static uint64 CalculateDigest(const uint8 * buf, uint32 maxBytes)
+{
+   uint64 ret = 0;
+   for (uint32 numBytes=0; numBytes<=maxBytes; numBytes++) ret = (ret*31) + CalculateHashCode64(buf, numBytes, numBytes) + CalculateHashCode(buf, numBytes);
+   return ret;
+}
+
+static void Benchmark(const uint8 * buf, uint32 numBytes, uint32 numIterations)
+{
+   // Both functions are called via function-pointers, so that neither one gets inlined into the loop
+   typedef uint32 (*HashFunc)(const void *, uint32, uint32);
+   HashFunc volatile murmurFunc = ReferenceMurmurHash2;
+   HashFunc volatile muscleFunc = CalculateHashCode;
+   HashFunc mf = murmurFunc, cf = muscleFunc;
+
+   uint32 sum = 0;  // used only to keep the optimizer from throwing away our loops
+   uint64 startTime = GetRunTime64();
+   for (uint32 i=0; i<numIterations; i++) sum += mf(buf+(i&7), numBytes, 0);
+   const uint64 murmurTime = muscleMax(GetRunTime64()-startTime, (uint64)1);
+
+   startTime = GetRunTime64();
+   for (uint32 i=0; i<numIterations; i++) sum += cf(buf+(i&7), numBytes, 0);
+   const uint64 newTime = muscleMax(GetRunTime64()-startTime, (uint64)1);
+
+   const double murmurNanos = (1000.0*murmurTime)/numIterations;
+   const double newNanos    = (1000.0*newTime)/numIterations;
+   printf("%6u bytes:  MurmurHash2 %8.2fns/hash  CalculateHashCode() %8.2fns/hash  (%.2fx speedup, %.0f MB/s) [" UINT32_FORMAT_SPEC "]\n", (unsigned int) numBytes, murmurNanos, newNanos, murmurNanos/newNanos, (numBytes*1000.0)/newNanos, sum&0x1);
+}
+
+// This program checks the sanity of CalculateHashCode() and benchmarks it against MurmurHash2.
+int main(int argc, char ** argv)
+{
+   CompleteSetupSystem css;
+
+   static uint8 buf[65536+8];
+   for (uint32 i=0; i<sizeof(buf); i++) buf[i] = (uint8) ((i*7)+(i>>8));
+
+   TestSanity(buf, 2048);
+   printf("Hash digest is " XINT64_FORMAT_SPEC "\n", CalculateDigest(buf, 4096));
+
+   const bool quick = ((argc > 1)&&(strcmp(argv[1], "quick") == 0));
+   const uint32 lengths[] = {3, 4, 6, 8, 10, 12, 16, 20, 24, 32, 48, 64, 100, 128, 256, 1024, 4096, 65536};  // field names and node names are typically 4-32 bytes long
+   for (uint32 i=0; i<ARRAYITEMS(lengths); i++) Benchmark(buf, lengths[i], (quick?100000:50000000)/muscleMax((uint32)1, lengths[i]/64));
+
+   if (_numFailures > 0)
+   {
+      printf("%i hash code tests FAILED!\n", _numFailures);
+      return 10;
+   }
+   printf("All hash code tests passed.\n");
+   return 0;
+}
@@ -169,6 +169,26 @@ int main(int, char **)
    if (getButter()) printf("GetMessage = [%s]\n", getButter()->ToString()()); 
                else printf("GetMessage = NULL\n");
 
+   printf("Testing the FieldKey methods...\n");
+   {
+      static const FieldKey int32Key("int32");
+      static const FieldKey friesnerKey("Friesner");
+      static const FieldKey newKey("a_field_added_via_a_field_key");
+      int32 i32;
+      if ((msg.FindInt32(int32Key, i32) != B_NO_ERROR)||(i32 != msg.GetInt32("int32"))||(msg.GetInt32(int32Key) != i32)) printf("FindInt32(FieldKey) failed!\n");
+      if (msg.HasName(friesnerKey, B_STRING_TYPE) == false) printf("HasName(FieldKey) failed!\n");
+      if (msg.HasName(friesnerKey, B_INT32_TYPE)) printf("HasName(FieldKey) ignored the type code!\n");
+      if (msg.GetString(friesnerKey, "<not found>", 1) != msg.GetString("Friesner", "<not found>", 1)) printf("GetString(FieldKey) failed!\n");
+      NEGATIVETEST(msg.AddInt32(friesnerKey, 5));  // wrong type for the existing field
+      TEST(msg.AddString(newKey, "one"));
+      TEST(msg.AddString(newKey, "two"));
+      TEST(msg.ReplaceString(false, newKey, 1, "TWO"));
+      TEST(msg.ReplaceString(true, newKey, 2, "three"));
+      if ((msg.GetNumValuesInName(newKey) != 3)||(msg.GetString("a_field_added_via_a_field_key", "", 1) != "TWO")) printf("Add/ReplaceString(FieldKey) failed!\n");
+      TEST(msg.RemoveName(newKey));
+      if (msg.HasName("a_field_added_via_a_field_key")) printf("RemoveName(FieldKey) failed!\n");
+   }
+
    Message subMessage(1);
    TEST(subMessage.AddString("I am a", "sub message!"));
    TEST(subMessage.AddInt32("My age is", 32));
@@ -317,6 +337,111 @@ int main(int, char **)
    
    PrintHexBytes(buf, flatSize);
 
+   {
+      ByteBuffer appendBuf;
+      TEST(appendBuf.AppendBytes((const uint8 *) "hdr", 3));
+      TEST(msg.AppendFlattenedToByteBuffer(appendBuf));
+      if ((appendBuf.GetNumBytes() != 3+flatSize)||(memcmp(appendBuf.GetBuffer(), "hdr", 3) != 0)||(memcmp(appendBuf.GetBuffer()+3, buf, flatSize) != 0)) printf("AppendFlattenedToByteBuffer() didn't produce the same bytes as Flatten()!\n");
+      if (msg.AppendFlattenedToByteBuffer(appendBuf, flatSize-1) == B_NO_ERROR) printf("AppendFlattenedToByteBuffer() ignored its size limit!\n");
+      if (appendBuf.GetNumBytes() != 3+flatSize) printf("AppendFlattenedToByteBuffer() didn't restore the buffer's length after failing!\n");
+   }
+
+   printf("Testing IncrementalMessageFlattener...\n");
+   {
+      MessageRef bigMsg(new Message(msg));
+      ByteBufferRef blob = GetByteBufferFromPool(100000);
+      for (uint32 i=0; i<blob()->GetNumBytes(); i++) blob()->GetBuffer()[i] = (uint8) i;
+      TEST(bigMsg()->AddFlat("blob", blob));
+      TEST(bigMsg()->AddMessage("nested", MessageRef(new Message(msg))));
+      TEST(bigMsg()->AddFlat("blob", blob));
+
+      ByteBuffer expected;
+      TEST(bigMsg()->AppendFlattenedToByteBuffer(expected));
+
+      const uint32 chunkSizes[] = {1, 7, 4096, 1000000};
+      ByteBuffer chunk(1000000);
+      for (uint32 i=0; i<ARRAYITEMS(chunkSizes); i++)
+      {
+         IncrementalMessageFlattener imf;
+         TEST(imf.SetMessage(bigMsg));
+         if (imf.GetFlattenedSize() != expected.GetNumBytes()) printf("IncrementalMessageFlattener computed the wrong size (" UINT32_FORMAT_SPEC " vs " UINT32_FORMAT_SPEC ")!\n", imf.GetFlattenedSize(), expected.GetNumBytes());
+
+         ByteBuffer generated;
+         while(imf.HasBytesRemaining())
+         {
+            const uint32 numBytes = imf.GetNextBytes(chunk.GetBuffer(), chunkSizes[i]);
+            if (numBytes == 0) {printf("IncrementalMessageFlattener stopped early!\n"); break;}
+            TEST(generated.AppendBytes(chunk.GetBuffer(), numBytes));
+         }
+         if (generated != expected) printf("IncrementalMessageFlattener (chunkSize=" UINT32_FORMAT_SPEC ") didn't produce the same bytes as Flatten()!\n", chunkSizes[i]);
+      }
+   }
+
+   printf("Testing field-name-dictionary encoding...\n");
+   {
+      MessageRef bigMsg(new Message(msg));
+      TEST(bigMsg()->AddFlat("blob", GetByteBufferFromPool(100000)));  // so that some length-prefixes need more than one byte
+      TEST(bigMsg()->AddString(String("x").Pad(300), "a field name too long for the dictionary"));
+
+      const Message * msgs[] = {&msg, &msg, bigMsg(), &msg, bigMsg()};
+      MessageFieldNameDictionary sendDict, recvDict;
+      uint32 firstSize = 0;
+      for (uint32 i=0; i<ARRAYITEMS(msgs); i++)
+      {
+         ByteBuffer encoded;
+         TEST(msgs[i]->AppendDictionaryEncodedToByteBuffer(encoded, sendDict));
+         if (i == 0) firstSize = encoded.GetNumBytes();
+         if (i == 1) printf("Dictionary-encoded size:  " UINT32_FORMAT_SPEC " bytes the first time, " UINT32_FORMAT_SPEC " bytes the second time (vs " UINT32_FORMAT_SPEC " bytes flattened)\n", firstSize, encoded.GetNumBytes(), flatSize);
+         if ((i == 1)&&(encoded.GetNumBytes() >= firstSize)) printf("Dictionary encoding didn't get any smaller the second time!\n");
+
+         Message decoded;
+         if (decoded.UnflattenDictionaryEncoded(encoded.GetBuffer(), encoded.GetNumBytes(), recvDict) != B_NO_ERROR) printf("UnflattenDictionaryEncoded() failed on Message #" UINT32_FORMAT_SPEC "!\n", i);
+         else if (*decoded.FlattenToByteBuffer()() != *msgs[i]->FlattenToByteBuffer()()) printf("Dictionary-encoded Message #" UINT32_FORMAT_SPEC " didn't decode correctly!\n", i);
+
+         if (i > 0)
+         {
+            MessageFieldNameDictionary emptyDict;
+            if (decoded.UnflattenDictionaryEncoded(encoded.GetBuffer(), encoded.GetNumBytes(), emptyDict) == B_NO_ERROR) printf("UnflattenDictionaryEncoded() accepted field-name IDs it had never seen!\n");
+         }
+      }
+      if (sendDict.GetNumNames() != recvDict.GetNumNames()) printf("Dictionaries got out of sync (" UINT32_FORMAT_SPEC " vs " UINT32_FORMAT_SPEC " names)!\n", sendDict.GetNumNames(), recvDict.GetNumNames());
+   }
+
+   printf("Testing columnar encoding of numeric arrays...\n");
+   {
+      Message samples(1234);
+      uint32 noise = 42;
+      for (int32 i=0; i<1000; i++)
+      {
+         noise = (noise*1103515245)+12345;  // a simple LCG, so that the output is repeatable
+         TEST(samples.AddInt32( "counter",     1000+(i*3)));
+         TEST(samples.AddInt64( "timestamp",   ((int64)1500000000000000LL)+(i*1000)+(i%7)));
+         TEST(samples.AddFloat( "temperature", 20.0f+((i/50)*0.5f)));
+         TEST(samples.AddDouble("pressure",    101.25+((i/100)*0.125)));
+         TEST(samples.AddInt32( "noise",       (int32)noise));   // incompressible, so it should be sent as-is
+         TEST(samples.AddInt64( "descending",  ((int64)(-i))*123456789LL));
+      }
+      for (uint32 i=0; i<8; i++) TEST(samples.AddInt32("short", 5));
+      TEST(samples.AddInt32("single", 7));
+
+      MessageFieldNameDictionary sendDict, recvDict;
+      ByteBuffer encoded;
+      TEST(samples.AppendDictionaryEncodedToByteBuffer(encoded, sendDict));
+      printf("Columnar-encoded size:  " UINT32_FORMAT_SPEC " bytes (vs " UINT32_FORMAT_SPEC " bytes flattened)\n", encoded.GetNumBytes(), samples.FlattenedSize());
+      if (encoded.GetNumBytes() >= samples.FlattenedSize()/2) printf("Columnar encoding didn't save as much space as expected!\n");
+
+      Message decoded;
+      if (decoded.UnflattenDictionaryEncoded(encoded.GetBuffer(), encoded.GetNumBytes(), recvDict) != B_NO_ERROR) printf("UnflattenDictionaryEncoded() failed on columnar data!\n");
+      else if (*decoded.FlattenToByteBuffer()() != *samples.FlattenToByteBuffer()()) printf("Columnar-encoded Message didn't decode correctly!\n");
+
+      // Truncated input must be rejected rather than mis-decoded
+      for (uint32 i=1; i<encoded.GetNumBytes(); i+=(encoded.GetNumBytes()/97)+1)
+      {
+         MessageFieldNameDictionary truncDict;
+         if (decoded.UnflattenDictionaryEncoded(encoded.GetBuffer(), encoded.GetNumBytes()-i, truncDict) == B_NO_ERROR) printf("UnflattenDictionaryEncoded() accepted a Message truncated by " UINT32_FORMAT_SPEC " bytes!\n", i);
+      }
+   }
+
    Message copy;
    if (copy.Unflatten(buf, flatSize) == B_NO_ERROR)
    {
@@ -2,7 +2,10 @@
 
 #include <stdio.h>
 
+#include "regex/PathMatcher.h"
 #include "regex/QueryFilter.h"
+#include "system/SetupSystem.h"
+#include "util/TimeUtilityFunctions.h"
 
 using namespace muscle;
 
@@ -18,9 +21,224 @@ void printSep(const char * title)
 #define COMMAND_HELLO   0x1234
 #define COMMAND_GOODBYE 0x4321
 
+static uint32 _randState = 12345;
+static uint32 GetRand(uint32 range) {_randState = (_randState*1103515245)+12345; return (_randState>>8)%range;}
+
+static const char * _stringValues[] = {"", "apple", "Apple", "banana", "cherry", "app", "nana", "zebra"};
+
+// Returns a randomly generated QueryFilter tree that tests the fields set by MakeRandomMessage()
+static ConstQueryFilterRef MakeRandomFilter(int depth)
+{
+   const uint32 choice = GetRand((depth > 0) ? 12 : 8);
+   switch(choice)
+   {
+      case 0:  return ConstQueryFilterRef(new WhatCodeQueryFilter(GetRand(3), GetRand(3)));
+      case 1:  return ConstQueryFilterRef(new ValueExistsQueryFilter(GetRand(2)?"int":"str", GetRand(2)?B_INT32_TYPE:B_STRING_TYPE));
+      case 2:
+      {
+         Int32QueryFilter * f = GetRand(4) ? new Int32QueryFilter("int", GetRand(6), GetRand(5), GetRand(2)) : new Int32QueryFilter("int", GetRand(6), GetRand(5), 0, GetRand(5));
+         if (GetRand(5) == 0) f->SetMask(GetRand(NUM_NQF_MASK_OPS), GetRand(8));
+         return ConstQueryFilterRef(f);
+      }
+      case 3:  return ConstQueryFilterRef(new DoubleQueryFilter("dbl", GetRand(6), GetRand(4)*0.5));
+      case 4:  return ConstQueryFilterRef(new Int8QueryFilter("i8", GetRand(6), (int8)GetRand(4)));
+      case 5:  return ConstQueryFilterRef(new BoolQueryFilter("bool", GetRand(6), GetRand(2)!=0));
+      case 6:  return ConstQueryFilterRef(new FloatQueryFilter("flt", GetRand(6), GetRand(4)*0.25f, 0, 0.5f));
+      case 7:
+      {
+         const char * v = _stringValues[GetRand(ARRAYITEMS(_stringValues))];
+         return ConstQueryFilterRef(GetRand(3) ? new StringQueryFilter("str", GetRand(StringQueryFilter::NUM_STRING_OPERATORS-2), v) : new StringQueryFilter("str", GetRand(StringQueryFilter::NUM_STRING_OPERATORS-2), v, 0, "banana"));
+      }
+
+      default:
+      {
+         MultiQueryFilter * mf;
+         const uint32 numKids = GetRand(4);
+         switch(choice)
+         {
+            case 8:  mf = new AndOrQueryFilter(MUSCLE_NO_LIMIT); break;
+            case 9:  mf = new AndOrQueryFilter(GetRand(numKids+2)); break;
+            case 10: mf = new NandNotQueryFilter(GetRand(numKids+1)); break;
+            default: mf = new XorQueryFilter; break;
+         }
+         for (uint32 i=0; i<numKids; i++) mf->GetChildren().AddTail(GetRand(10) ? MakeRandomFilter(depth-1) : ConstQueryFilterRef());
+         return ConstQueryFilterRef(mf);
+      }
+   }
+}
+
+static MessageRef MakeRandomMessage()
+{
+   MessageRef msg = GetMessageFromPool(GetRand(3));
+   if (GetRand(4)) {msg()->AddInt32("int", GetRand(5)); if (GetRand(2)) msg()->AddInt32("int", GetRand(5));}
+   if (GetRand(4)) msg()->AddDouble("dbl", GetRand(4)*0.5);
+   if (GetRand(4)) msg()->AddInt8("i8", (int8)GetRand(4));
+   if (GetRand(4)) msg()->AddBool("bool", GetRand(2)!=0);
+   if (GetRand(4)) msg()->AddFloat("flt", GetRand(4)*0.25f);
+   if (GetRand(4)) msg()->AddString("str", _stringValues[GetRand(ARRAYITEMS(_stringValues))]);
+   return msg;
+}
+
+// Verifies that CompiledQueryFilter always gives the same answers as the QueryFilter trees it was compiled from
+static int TestCompiledQueryFilters(bool quick)
+{
+   printf("Testing CompiledQueryFilter...\n");
+
+   Queue<MessageRef> msgs;
+   for (uint32 i=0; i<200; i++) msgs.AddTail(MakeRandomMessage());
+
+   const uint32 numFilters = quick ? 2000 : 20000;
+   for (uint32 i=0; i<numFilters; i++)
+   {
+      ConstQueryFilterRef filter = MakeRandomFilter(3);
+      CompiledQueryFilter cf(filter);
+      for (uint32 j=0; j<msgs.GetNumItems(); j++)
+      {
+         ConstMessageRef m1 = msgs[j];
+         ConstMessageRef m2 = msgs[j];
+         if (filter()->Matches(m1, NULL) != cf.Matches(m2, NULL))
+         {
+            printf("CompiledQueryFilter gave the wrong answer for filter #" UINT32_FORMAT_SPEC " and Message #" UINT32_FORMAT_SPEC "!\n", i, j);
+            Message archive; filter()->SaveToArchive(archive); archive.PrintToStream();
+            msgs[j]()->PrintToStream();
+            return 10;
+         }
+      }
+   }
+
+   // Time a ten-way AND of range tests, with and without compiling it
+   AndOrQueryFilter * af = new AndOrQueryFilter(MUSCLE_NO_LIMIT);
+   ConstQueryFilterRef andRef(af);
+   for (uint32 i=0; i<5; i++)
+   {
+      af->GetChildren().AddTail(ConstQueryFilterRef(new Int32QueryFilter("int", Int32QueryFilter::OP_GREATER_THAN_OR_EQUAL_TO, 0)));
+      af->GetChildren().AddTail(ConstQueryFilterRef(new DoubleQueryFilter("dbl", DoubleQueryFilter::OP_LESS_THAN, 100.0)));
+   }
+   MessageRef timeMsg = GetMessageFromPool();
+   for (uint32 i=0; i<20; i++) timeMsg()->AddInt32(String("other%1").Arg(i), i);
+   timeMsg()->AddInt32("int", 5);
+   timeMsg()->AddDouble("dbl", 5.0);
+
+   CompiledQueryFilter compiledAnd(andRef);
+   const uint32 numIterations = quick ? 100000 : 1000000;
+   uint32 count = 0;
+   ConstMessageRef constTimeMsg = timeMsg;
+   uint64 startTime = GetRunTime64();
+   for (uint32 i=0; i<numIterations; i++) if (andRef()->Matches(constTimeMsg, NULL)) count++;
+   const uint64 interpretedTime = GetRunTime64()-startTime;
+   startTime = GetRunTime64();
+   for (uint32 i=0; i<numIterations; i++) if (compiledAnd.Matches(constTimeMsg, NULL)) count++;
+   const uint64 compiledTime = GetRunTime64()-startTime;
+   if (count != 2*numIterations) {printf("Timed filter didn't match!\n"); return 10;}
+   printf("Evaluated a ten-way AND " UINT32_FORMAT_SPEC " times:  interpreted=" UINT64_FORMAT_SPEC "us, compiled=" UINT64_FORMAT_SPEC "us (" UINT32_FORMAT_SPEC " instructions, " UINT32_FORMAT_SPEC " field slots)\n", numIterations, interpretedTime, compiledTime, compiledAnd.GetNumInstructions(), compiledAnd.GetNumFieldSlots());
+   return 0;
+}
+
+// The straightforward way to see if a PathMatcher matches a path:  test every entry separately
+static bool BruteForceMatchesPath(const PathMatcher & pm, const char * path, const Message * optMsg)
+{
+   const uint32 numClauses = GetPathDepth(path);
+   for (HashtableIterator<String, PathMatcherEntry> iter(pm.GetEntries()); iter.HasData(); iter++)
+   {
+      const Queue<StringMatcherRef> & sms = iter.GetValue().GetParser()()->GetStringMatchers();
+      if (sms.GetNumItems() != numClauses) continue;
+
+      bool matched = true;
+      for (uint32 i=0; i<numClauses; i++)
+      {
+         const StringMatcher * sm = sms[i]();
+         if ((sm)&&(sm->Match(GetPathClauseString(i, path)) == false)) {matched = false; break;}
+      }
+      ConstMessageRef msgRef(optMsg, false);
+      if ((matched)&&(iter.GetValue().FilterMatches(msgRef, NULL))) return true;
+   }
+   return false;
+}
+
+static String MakeRandomPath(const char ** clauses, uint32 numClauses)
+{
+   String ret;
+   const uint32 depth = 1+GetRand(4);
+   for (uint32 i=0; i<depth; i++)
+   {
+      if (i > 0) ret += '/';
+      ret += clauses[GetRand(numClauses)];
+   }
+   return ret;
+}
+
+// Verifies that PathMatcher's merged trie gives the same answers as testing each of its entries separately
+static int TestPathMatcher(bool quick)
+{
+   printf("Testing PathMatcher...\n");
+
+   const char * patternClauses[] = {"a", "b", "c*", "*", "?", "x,y", "~a", "<1-5>", "3", "[ab]", "\\<3>", "ca?"};
+   const char * pathClauses[]    = {"a", "b", "c", "cat", "x", "y", "3", "7", "ab", "<3>"};
+
+   MessageRef matchMsg = GetMessageFromPool(1);
+   MessageRef otherMsg = GetMessageFromPool(2);
+   ConstQueryFilterRef whatFilter(new WhatCodeQueryFilter(1));
+
+   const uint32 numRounds = quick ? 20 : 200;
+   for (uint32 r=0; r<numRounds; r++)
+   {
+      PathMatcher pm;
+      const uint32 numPatterns = 1+GetRand(50);
+      for (uint32 i=0; i<numPatterns; i++) (void) pm.PutPathString(MakeRandomPath(patternClauses, ARRAYITEMS(patternClauses)), GetRand(4) ? ConstQueryFilterRef() : whatFilter);
+
+      for (uint32 pass=0; pass<2; pass++)
+      {
+         if (pass == 1)
+         {
+            // make sure the trie gets rebuilt after removals and copies, too
+            Queue<String> keys;
+            for (HashtableIterator<String, PathMatcherEntry> iter(pm.GetEntries()); iter.HasData(); iter++) if (GetRand(2)) keys.AddTail(iter.GetKey());
+            for (uint32 i=0; i<keys.GetNumItems(); i++) (void) pm.RemovePathString(keys[i]);
+            PathMatcher copy(pm);
+            pm = copy;
+         }
+
+         for (uint32 i=0; i<500; i++)
+         {
+            const String path = MakeRandomPath(pathClauses, ARRAYITEMS(pathClauses));
+            const Message * optMsg = (GetRand(3) == 0) ? NULL : (GetRand(2) ? matchMsg() : otherMsg());
+            if (pm.MatchesPath(path(), optMsg, NULL) != BruteForceMatchesPath(pm, path(), optMsg))
+            {
+               printf("PathMatcher gave the wrong answer for path [%s] (round " UINT32_FORMAT_SPEC ", pass " UINT32_FORMAT_SPEC ")!\n", path(), r, pass);
+               for (HashtableIterator<String, PathMatcherEntry> iter(pm.GetEntries()); iter.HasData(); iter++) printf("   entry [%s] %s\n", iter.GetKey()(), iter.GetValue().ToString()());
+               return 10;
+            }
+         }
+      }
+   }
+
+   // Time a session-like set of 200 subscriptions
+   PathMatcher pm;
+   for (uint32 i=0; i<200; i++) (void) pm.PutPathString(String("*/*/node%1").Arg(i), ConstQueryFilterRef());
+   const uint32 numIterations = quick ? 2000 : 20000;
+   uint32 count = 0;
+   uint64 startTime = GetRunTime64();
+   for (uint32 i=0; i<numIterations; i++) if (BruteForceMatchesPath(pm, "host/session/node150", NULL)) count++;
+   const uint64 bruteTime = GetRunTime64()-startTime;
+   startTime = GetRunTime64();
+   for (uint32 i=0; i<numIterations; i++) if (pm.MatchesPath("host/session/node150", NULL, NULL)) count++;
+   const uint64 trieTime = GetRunTime64()-startTime;
+   if (count != 2*numIterations) {printf("Timed path didn't match!\n"); return 10;}
+   printf("Matched a path against 200 subscriptions " UINT32_FORMAT_SPEC " times:  one-by-one=" UINT64_FORMAT_SPEC "us, trie=" UINT64_FORMAT_SPEC "us\n", numIterations, bruteTime, trieTime);
+   return 0;
+}
+
 // This program exercises the Message class.
-int main(void) 
+int main(int argc, char ** argv) 
 {
+   CompleteSetupSystem css;
+
+   const int cqfRet = TestCompiledQueryFilters((argc > 1)&&(strcmp(argv[1], "quick") == 0));
+   if (cqfRet != 0) return cqfRet;
+
+   const int pmRet = TestPathMatcher((argc > 1)&&(strcmp(argv[1], "quick") == 0));
+   if (pmRet != 0) return pmRet;
+
    Message m1;
    m1.AddFloat("va", 1.0f);
    printf("m1=" UINT32_FORMAT_SPEC "\n", m1.FlattenedSize());
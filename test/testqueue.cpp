@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include "system/SetupSystem.h"
+#include "util/OrderStatisticTree.h"
 #include "util/Queue.h"
 #include "util/String.h"
 #include "util/StringTokenizer.h"
@@ -26,6 +27,13 @@ void PrintToStream(const Queue<int> & q)
    }
 }
 
+// Compares an OrderStatisticTree item against a search key, for the GetLowerBound()/GetUpperBound() tests
+class IntKeyCompareFunctor
+{
+public:
+   int Compare(const int & item, const int & key, void *) const {return muscleCompare(item, key);}
+};
+
 // This program exercises the Queue class.
 int main(void) 
 {
@@ -320,6 +328,113 @@ int main(void)
 
       delete [] compareArray;
    }
+
+   // Check that OrderStatisticTree behaves the same as a Queue, when items are inserted and removed at random positions
+   printf("Testing OrderStatisticTree...\n");
+   {
+      Queue<int> q;
+      OrderStatisticTree<int> t;
+      Queue<OrderStatisticTree<int>::Entry *> entries;  // parallel to (q)
+      int counter = 0;
+      for (uint32 i=0; i<50000; i++)
+      {
+         const uint32 numItems = q.GetNumItems();
+         switch(rand()%4)
+         {
+            case 0: case 1:
+            {
+               const uint32 idx = rand()%(numItems+1);
+               OrderStatisticTree<int>::Entry * e;
+               TEST(t.InsertItemAt(idx, counter, &e));
+               TEST(q.InsertItemAt(idx, counter++));
+               TEST(entries.InsertItemAt(idx, e));
+            }
+            break;
+
+            case 2:
+               if (numItems > 0)
+               {
+                  const uint32 idx = rand()%numItems;
+                  int tVal = -1;
+                  TEST(t.RemoveItemAt(idx, &tVal));
+                  if (tVal != q[idx]) {printf("OrderStatisticTree::RemoveItemAt() returned %i, expected %i\n", tVal, q[idx]); MCRASH("OrderStatisticTree error");}
+                  TEST(q.RemoveItemAt(idx));
+                  TEST(entries.RemoveItemAt(idx));
+               }
+            break;
+
+            case 3:
+               if (numItems > 0)
+               {
+                  const uint32 idx = rand()%numItems;
+                  OrderStatisticTree<int>::Entry * e = entries[idx];
+                  if ((t.ContainsEntry(e) == false)||(t.GetIndexOf(e) != idx)||(e->GetItem() != q[idx])) {printf("OrderStatisticTree::GetIndexOf() failed for index " UINT32_FORMAT_SPEC "\n", idx); MCRASH("OrderStatisticTree error");}
+                  TEST(t.RemoveEntry(e));
+                  TEST(q.RemoveItemAt(idx));
+                  TEST(entries.RemoveItemAt(idx));
+               }
+            break;
+         }
+         if (t.GetNumItems() != q.GetNumItems()) MCRASH("OrderStatisticTree has the wrong number of items!");
+         if ((i%1000) == 0)
+         {
+            uint32 j = 0;
+            for (const OrderStatisticTree<int>::Entry * e = t.GetFirstEntry(); e; e = t.GetNextEntry(e),j++) if ((e->GetItem() != q[j])||(t[j] != q[j])) {printf("OrderStatisticTree mismatch at index " UINT32_FORMAT_SPEC "\n", j); MCRASH("OrderStatisticTree error");}
+            if (j != q.GetNumItems()) MCRASH("OrderStatisticTree iteration returned the wrong number of items!");
+         }
+      }
+      if (t.InsertItemAt(t.GetNumItems()+1, 0) == B_NO_ERROR) MCRASH("OrderStatisticTree allowed an out-of-range insert!");
+      t.Clear();
+      if (t.HasItems()) MCRASH("OrderStatisticTree::Clear() failed!");
+   }
+
+   // Check that GetLowerBound() and GetUpperBound() agree with a linear scan, on a sorted tree that contains duplicate keys
+   printf("Testing OrderStatisticTree::GetLowerBound() and GetUpperBound()...\n");
+   {
+      const IntKeyCompareFunctor cf;
+      OrderStatisticTree<int> t;
+      if ((t.GetLowerBound(5, cf) != 0)||(t.GetUpperBound(5, cf) != 0)) MCRASH("OrderStatisticTree bounds of an empty tree should be zero!");
+
+      Queue<int> q;  // kept sorted, parallel to (t)
+      for (uint32 i=0; i<5000; i++)
+      {
+         if ((q.HasItems())&&((rand()%3) == 0))
+         {
+            // Remove an item from the middle somewhere, to keep the tree's shape changing
+            const uint32 idx = rand()%q.GetNumItems();
+            TEST(t.RemoveItemAt(idx));
+            TEST(q.RemoveItemAt(idx));
+         }
+         else
+         {
+            // Insert a new value at its sorted position (after any equal values), as found via GetUpperBound()
+            const int val = rand()%200;
+            const uint32 idx = t.GetUpperBound(val, cf);
+            TEST(t.InsertItemAt(idx, val));
+            TEST(q.InsertItemAt(idx, val));
+         }
+
+         if ((i%100) == 0)
+         {
+            for (uint32 j=1; j<q.GetNumItems(); j++) if (q[j-1] > q[j]) MCRASH("OrderStatisticTree::GetUpperBound() gave an out-of-order insert position!");
+            for (int key=-1; key<=201; key++)
+            {
+               uint32 expectedLower = 0; while((expectedLower < q.GetNumItems())&&(q[expectedLower] < key)) expectedLower++;
+               uint32 expectedUpper = expectedLower; while((expectedUpper < q.GetNumItems())&&(q[expectedUpper] <= key)) expectedUpper++;
+               const uint32 lower = t.GetLowerBound(key, cf);
+               const uint32 upper = t.GetUpperBound(key, cf);
+               if ((lower != expectedLower)||(upper != expectedUpper))
+               {
+                  printf("OrderStatisticTree bounds for key %i were [" UINT32_FORMAT_SPEC ", " UINT32_FORMAT_SPEC "), expected [" UINT32_FORMAT_SPEC ", " UINT32_FORMAT_SPEC ")\n", key, lower, upper, expectedLower, expectedUpper);
+                  MCRASH("OrderStatisticTree bounds error");
+               }
+            }
+         }
+      }
+      t.Clear();
+      if (t.HasItems()) MCRASH("OrderStatisticTree::Clear() failed!");
+   }
+
    printf("Queue test complete.\n");
 
    return 0;
@@ -1,17 +1,113 @@
-/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */  
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
 
 #include <stdio.h>
 #include "regex/StringMatcher.h"
+#include "system/SetupSystem.h"
+#include "util/TimeUtilityFunctions.h"
 
 using namespace muscle;
 
+// Converts a simple wildcard pattern into the equivalent regex, the same way StringMatcher used to do it for every pattern
+static String SimplePatternToRegex(const char * str)
+{
+   String ret = "^(";
+   bool escapeMode = false;
+   for (const char * ptr = str; *ptr != '\0'; ptr++)
+   {
+      char c = *ptr;
+      if (escapeMode) escapeMode = false;
+      else
+      {
+         switch(c)
+         {
+            case ',':  c = '|';     break;
+            case '.':  ret += '\\'; break;
+            case '*':  ret += '.';  break;
+            case '?':  c = '.';     break;
+            case '\\': escapeMode = true; break;
+         }
+      }
+      ret += c;
+   }
+   if (escapeMode) ret += '\\';
+   return ret + ")$";
+}
+
+// Verifies that StringMatcher's non-regex matching of simple patterns gives the same results regexec() would give
+static int RunSelfTest()
+{
+   const char * patterns[] = {
+      "foo", "foo*", "*foo", "*foo*", "*", "**", "f?o", "f*o", "*o*o*", "foo,bar,baz", "foo*,*bar", "client[0-9]", "client[0-9][0-9]*",
+      "[^a-c]*", "[a-]x", "[-a]x", "x[]a]", "[abc", "a\\*b", "a\\,b", "a\\", "a.b", "??", "*?*", "a*b*c", "a(b|c)", "a+", "x{2}", "^x",
+      "\\w", "", "a,", ",a", "*a?b*c[0-9]?", "node_[a-zA-Z]*_[13579]"
+   };
+
+   const char * strings[] = {
+      "", "foo", "fo", "fooo", "xfoo", "xfoox", "bar", "baz", "foobar", "client5", "client55", "client", "clientX", "dog", "a-x", "-x", "ax", "xa",
+      "x]", "a*b", "axb", "a,b", "a\\", "a.b", "aXb", "ab", "abc", "aabbcc", "a?bc1c", "abc", "xx", "node_abc_3", "node__7", "node_a_2", "oo", "ooo"
+   };
+
+   uint32 numChecked = 0;
+   for (uint32 i=0; i<ARRAYITEMS(patterns); i++)
+   {
+      StringMatcher glob(patterns[i], true);
+      StringMatcher regex(SimplePatternToRegex(patterns[i]), false);
+      for (uint32 j=0; j<ARRAYITEMS(strings); j++)
+      {
+         const bool g = glob.Match(strings[j]);
+         if ((g != regex.Match(strings[j]))||(g != glob.Match(String(strings[j]))))
+         {
+            printf("ERROR:  pattern [%s] gave [%i] for string [%s], but regexec() says [%i]\n", patterns[i], g, strings[j], !g);
+            return 10;
+         }
+         numChecked++;
+      }
+
+      StringMatcher negated(String("~")+patterns[i], true);
+      for (uint32 j=0; j<ARRAYITEMS(strings); j++)
+      {
+         if ((negated.Match(strings[j]) == glob.Match(strings[j]))&&(strlen(patterns[i]) > 0))
+         {
+            printf("ERROR:  negated pattern [~%s] didn't negate the result for string [%s]\n", patterns[i], strings[j]);
+            return 10;
+         }
+      }
+   }
+   printf("All " UINT32_FORMAT_SPEC " pattern/string combinations matched the same as regexec().\n", numChecked);
+
+   // And a quick timing comparison, for the typical subscription-path case
+   const char * timePatterns[] = {"foo*", "*foo", "client[0-9]", "joe,bob,fred"};
+   const String testStr = "foosball";
+   const uint32 numIters = 200000;
+   for (uint32 i=0; i<ARRAYITEMS(timePatterns); i++)
+   {
+      StringMatcher glob(timePatterns[i], true);
+      StringMatcher regex(SimplePatternToRegex(timePatterns[i]), false);
+
+      uint32 count = 0;
+      uint64 startTime = GetRunTime64();
+      for (uint32 j=0; j<numIters; j++) if (glob.Match(testStr)) count++;
+      const uint64 globTime = GetRunTime64()-startTime;
+
+      startTime = GetRunTime64();
+      for (uint32 j=0; j<numIters; j++) if (regex.Match(testStr)) count++;
+      const uint64 regexTime = GetRunTime64()-startTime;
+
+      printf("Pattern [%s]:  " UINT32_FORMAT_SPEC " matches took " UINT64_FORMAT_SPEC " microseconds via glob, " UINT64_FORMAT_SPEC " microseconds via regexec() (count=" UINT32_FORMAT_SPEC ")\n", timePatterns[i], numIters, globTime, regexTime, count);
+   }
+   return 0;
+}
+
 // Just some quick testing of the StringMatcher class...
-int main(int argc, char ** argv) 
+int main(int argc, char ** argv)
 {
+   CompleteSetupSystem css;
+
    if (argc <= 1)
    {
       printf("Usage:  testregex 'pattern' 'str1' 'str2' [...]\n");
-      return 5;
+      printf("(No arguments specified, so running the built-in self-test instead)\n");
+      return RunSelfTest();
    }
 
    StringMatcher sm(argv[1]);
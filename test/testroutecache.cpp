@@ -0,0 +1,166 @@
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
+
+#include <stdio.h>
+#include "reflector/ReflectServer.h"
+#include "reflector/StorageReflectConstants.h"
+#include "reflector/StorageReflectSession.h"
+#include "system/SetupSystem.h"
+
+using namespace muscle;
+
+// This test checks that StorageReflectSession's cached message routes are recomputed whenever
+// the set of matching sessions or nodes changes, and that a cached route doesn't keep a
+// detached session alive.
+
+enum {
+   TEST_COMMAND_PING = 1953719668  // 'test'
+};
+
+static int _numFailures  = 0;
+static int _numDestroyed = 0;
+
+static void Check(bool ok, const char * what)
+{
+   if (ok == false)
+   {
+      printf("ERROR:  %s\n", what);
+      _numFailures++;
+   }
+}
+
+/** A StorageReflectSession that counts the pings it receives from other sessions */
+class CountingSession : public StorageReflectSession
+{
+public:
+   CountingSession() : _numPings(0), _numPingsWithNode(0) {/* empty */}
+   virtual ~CountingSession() {_numDestroyed++;}
+
+   virtual void MessageReceivedFromSession(AbstractReflectSession & from, const MessageRef & msgRef, void * userData)
+   {
+      if (msgRef()->what == TEST_COMMAND_PING)
+      {
+         _numPings++;
+         if (userData) _numPingsWithNode++;
+      }
+      else StorageReflectSession::MessageReceivedFromSession(from, msgRef, userData);
+   }
+
+   status_t PutNode(const char * path) {MessageRef msg = GetMessageFromPool(); return msg() ? SetDataNode(path, msg) : B_ERROR;}
+   status_t RemoveNode(const char * path) {return RemoveDataNodes(path);}
+
+   int _numPings;
+   int _numPingsWithNode;
+};
+
+/** The session that drives the test:  it sends pings to the other sessions, while changing the tree between sends */
+class DriverSession : public CountingSession
+{
+public:
+   DriverSession() : _step(0), _b(NULL), _c(NULL) {/* empty */}
+
+   virtual uint64 GetPulseTime(const PulseArgs & args) {return muscleMin(CountingSession::GetPulseTime(args), args.GetScheduledTime()+MillisToMicros(10));}
+
+   virtual void Pulse(const PulseArgs & args)
+   {
+      CountingSession::Pulse(args);
+      switch(_step++)
+      {
+         case 0: RunFirstStep();  break;
+         case 1: RunSecondStep(); break;
+         default: EndServer();    break;
+      }
+   }
+
+private:
+   void Ping(const char * path)
+   {
+      MessageRef ping = GetMessageFromPool(TEST_COMMAND_PING);
+      Check(SendMessageToMatchingSessions(ping, path, ConstQueryFilterRef(), false) == B_NO_ERROR, "SendMessageToMatchingSessions() failed");
+   }
+
+   void PingViaDefaultRoute(const char * keys)
+   {
+      MessageRef params = GetMessageFromPool(PR_COMMAND_SETPARAMETERS);
+      if ((params())&&(params()->AddString(PR_NAME_KEYS, keys) == B_NO_ERROR)) MessageReceivedFromGateway(params, NULL);
+      MessageReceivedFromGateway(GetMessageFromPool(TEST_COMMAND_PING), NULL);
+   }
+
+   uint32 CountMatches(const char * path)
+   {
+      Hashtable<const String *, AbstractReflectSessionRef> results;
+      return (FindMatchingSessions(path, ConstQueryFilterRef(), results, false) == B_NO_ERROR) ? results.GetNumItems() : 0;
+   }
+
+   CountingSession * AddCountingSession()
+   {
+      CountingSession * s = newnothrow CountingSession;
+      if (s == NULL) {WARN_OUT_OF_MEMORY; return NULL;}
+      return (AddNewSession(AbstractReflectSessionRef(s)) == B_NO_ERROR) ? s : NULL;
+   }
+
+   void RunFirstStep()
+   {
+      _b = AddCountingSession();
+      if ((_b == NULL)||(_b->PutNode("x") != B_NO_ERROR)) {Check(false, "couldn't set up session B"); return;}
+
+      Ping("x");
+      Check((_b->_numPings == 1)&&(_b->_numPingsWithNode == 1), "B didn't get the first ping");
+      Check(CountMatches("x") == 1, "FindMatchingSessions() didn't find B");
+
+      // A newly attached session with a matching node must be found, even though the route to "x" is cached
+      _c = AddCountingSession();
+      if ((_c == NULL)||(_c->PutNode("x") != B_NO_ERROR)||(_c->PutNode("y") != B_NO_ERROR)) {Check(false, "couldn't set up session C"); return;}
+      Ping("x");
+      Check((_b->_numPings == 2)&&(_c->_numPings == 1), "the cached route wasn't updated when C attached");
+      Check(CountMatches("x") == 2, "FindMatchingSessions() didn't find C");
+
+      // And a removed node must no longer be routed to
+      _c->RemoveNode("x");
+      Ping("x");
+      Check((_b->_numPings == 3)&&(_c->_numPings == 1), "the cached route wasn't updated when C's node was removed");
+      Check(CountMatches("x") == 1, "FindMatchingSessions() still found C");
+
+      // Changing our PR_NAME_KEYS parameter must change where our default-routed messages go
+      PingViaDefaultRoute("x");
+      Check((_b->_numPings == 4)&&(_c->_numPings == 1), "the default route didn't go to x");
+      PingViaDefaultRoute("y");
+      Check((_b->_numPings == 4)&&(_c->_numPings == 2), "the default route wasn't updated when PR_NAME_KEYS changed");
+
+      _b->EndSession();  // B will be detached at the next iteration of the event loop
+      _b = NULL;
+   }
+
+   void RunSecondStep()
+   {
+      Check(_numDestroyed == 1, "the detached session B wasn't destroyed (is a cached route keeping it alive?)");
+
+      Ping("x");  // the cached route still names B, but B is gone now
+      Check(_c->_numPings == 2, "C got a ping it shouldn't have");
+      Check(CountMatches("x") == 0, "FindMatchingSessions() found a detached session");
+   }
+
+   int _step;
+   CountingSession * _b;
+   CountingSession * _c;
+};
+
+int main(int, char **)
+{
+   CompleteSetupSystem css;
+
+   {
+      ReflectServer server;
+      if (server.AddNewSession(AbstractReflectSessionRef(newnothrow DriverSession)) == B_NO_ERROR) (void) server.ServerProcessLoop();
+      else Check(false, "couldn't add the driver session");
+      server.Cleanup();
+   }
+   Check(_numDestroyed == 3, "not all sessions were destroyed");
+
+   if (_numFailures > 0)
+   {
+      printf("%i route cache tests FAILED!\n", _numFailures);
+      return 10;
+   }
+   printf("All route cache tests passed.\n");
+   return 0;
+}
@@ -92,6 +92,77 @@ int main(void)
                                     else printf("ShrinkToFit() to tin failed!\n");
    }
 
+   {
+      printf("Testing cached hash codes...\n");
+
+      // Every kind of modification must invalidate the String's cached hash code
+      String s = "this string is long enough to be stored on the heap";
+      const uint32 origHash = s.HashCode();
+      if (s.HashCode() != origHash) {printf("Cached hash code changed!?\n"); exit(10);}
+
+      String copy = s;
+      if (copy.HashCode() != origHash) {printf("Copied String has the wrong hash code!\n"); exit(10);}
+
+      #define CHECK_HASH_AFTER(op) {op; if (s.HashCode() != CalculateHashCode(s(), s.Length())) {printf("Stale hash code after [%s]!\n", #op); exit(10);}}
+      CHECK_HASH_AFTER(s += 'x');
+      CHECK_HASH_AFTER(s += " and then some");
+      CHECK_HASH_AFTER(s[0] = 'T');
+      CHECK_HASH_AFTER((void) s.Replace("long", "LONG"));
+      CHECK_HASH_AFTER((void) s.Replace("LONG", "longer"));
+      CHECK_HASH_AFTER(s.TruncateChars(3));
+      CHECK_HASH_AFTER(s -= "heap");
+      CHECK_HASH_AFTER((void) s.ShrinkToFit());
+      CHECK_HASH_AFTER(s = copy);
+      CHECK_HASH_AFTER(s.Clear());
+      #undef CHECK_HASH_AFTER
+      printf("Cached hash code tests passed.\n");
+   }
+
+#ifndef MUSCLE_AVOID_STRING_INTERNING
+   {
+      printf("Testing interned Strings...\n");
+
+      const char * val = "some_fairly_long_field_name";
+      String a; if (a.SetInterned(val) != B_NO_ERROR) {printf("SetInterned() failed!\n"); exit(10);}
+      String b; if (b.UnflattenInterned((const uint8 *)val, (uint32)strlen(val)+1) != B_NO_ERROR) {printf("UnflattenInterned() failed!\n"); exit(10);}
+      if ((a.IsInterned() == false)||(b.IsInterned() == false)) {printf("Strings weren't interned!\n"); exit(10);}
+      if ((a() != b())||(a != val)) {printf("Interned Strings don't share their chars!\n"); exit(10);}
+      if (a.HashCode() != CalculateHashCode(val, (uint32)strlen(val))) {printf("Interned String has the wrong hash code!\n"); exit(10);}
+
+      String c = a;  // copying an interned String should share its buffer
+      if ((c.IsInterned() == false)||(c() != a())) {printf("Copy of interned String doesn't share its chars!\n"); exit(10);}
+
+      String shortStr; (void) shortStr.SetInterned("short");
+      if ((shortStr.IsInterned())||(shortStr != "short")) {printf("Short String was interned!\n"); exit(10);}
+
+      // Modifying an interned String must give it a private copy, and must not affect the other Strings
+      c += "_suffix";
+      if ((c.IsInterned())||(c != "some_fairly_long_field_name_suffix")||(a != val)||(b != val)) {printf("Modifying an interned String went wrong!\n"); exit(10);}
+      c = a; c[0] = 'S';
+      if ((c.IsInterned())||(c != "Some_fairly_long_field_name")||(a != val)) {printf("Modifying an interned String's char went wrong!\n"); exit(10);}
+      c = a; (void) c.Replace("long", "LONG");
+      if ((c != "some_fairly_LONG_field_name")||(a != val)) {printf("Replace() on an interned String went wrong!\n"); exit(10);}
+      c = a; (void) c.SetFromString(c, 5);  // substring of itself
+      if ((c != "fairly_long_field_name")||(a != val)) {printf("Self-substring of an interned String went wrong!\n"); exit(10);}
+      c = a; (void) c.SetCstr(c()+12);     // C string pointing into its own buffer
+      if ((c != "long_field_name")||(a != val)) {printf("SetCstr() from an interned String's own chars went wrong!\n"); exit(10);}
+      c = a; c.TruncateChars(5);
+      if ((c != "some_fairly_long_field")||(a != val)) {printf("TruncateChars() on an interned String went wrong!\n"); exit(10);}
+      c = a; if (c.Intern() != B_NO_ERROR) {printf("Intern() failed!\n"); exit(10);}  // should be a no-op
+      if (c() != a()) {printf("Re-interning changed the buffer!\n"); exit(10);}
+
+      // Entries should only be purged once no String refers to them any more
+      {
+         String temp; (void) temp.SetInterned("a_temporary_interned_string_value");
+         if (PurgeUnusedInternedStrings() != 0) {printf("Purged an entry that was still in use!\n"); exit(10);}
+      }
+      if (PurgeUnusedInternedStrings() != 1) {printf("Unused entry wasn't purged!\n"); exit(10);}
+      if ((a != val)||(b != val)||(a() != b())) {printf("Purge affected an in-use entry!\n"); exit(10);}
+
+      printf("Interned String tests passed.\n");
+   }
+#endif
+
 #ifdef TEST_REPLACE_METHOD
    while(1)
    {
@@ -3,6 +3,11 @@
 #include "util/MiscUtilityFunctions.h"
 #include "system/GlobalMemoryAllocator.h"
 
+#ifndef WIN32
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
 namespace muscle {
 
 void ByteBuffer :: AdoptBuffer(uint32 numBytes, uint8 * optBuffer)
@@ -183,6 +188,227 @@ ByteBufferRef GetByteBufferFromPool(ObjectPool<ByteBuffer> & pool, uint32 numByt
    return ref;
 }
 
+#ifndef WIN32
+static uintptr GetMemoryPageSize()
+{
+   static const long _pageSize = sysconf(_SC_PAGESIZE);
+   return (_pageSize > 0) ? (uintptr)_pageSize : 4096;
+}
+
+// Every buffer handed out or freed by this strategy is a memory-mapping, which lets memory-mapped
+// ByteBuffers be resized (or recycled) without the buffer ever being handed to free() by mistake.
+class MemoryMappedAllocationStrategy : public IMemoryAllocationStrategy
+{
+public:
+   MemoryMappedAllocationStrategy() {/* empty */}
+
+   virtual void * Malloc(size_t size)
+   {
+      void * ret = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+      return (ret == MAP_FAILED) ? NULL : ret;
+   }
+
+   virtual void * Realloc(void * ptr, size_t newSize, size_t oldSize, bool retainData)
+   {
+      void * newPtr = NULL;
+      if (newSize > 0)
+      {
+         newPtr = Malloc(newSize);
+         if (newPtr == NULL) return NULL;  // (ptr) remains valid, as with realloc()
+         if ((ptr)&&(retainData)) memcpy(newPtr, ptr, muscleMin(newSize, oldSize));
+      }
+      Free(ptr, oldSize);
+      return newPtr;
+   }
+
+   virtual void Free(void * ptr, size_t size)
+   {
+      if (ptr)
+      {
+         uintptr pageOffset = ((uintptr)ptr)%GetMemoryPageSize();  // file mappings needn't start on a page boundary
+         (void) munmap(((uint8 *)ptr)-pageOffset, size+pageOffset);
+      }
+   }
+};
+static MemoryMappedAllocationStrategy _memoryMappedAllocationStrategy;
+#endif
+
+ByteBufferRef GetMemoryMappedByteBuffer(int fd, uint64 fileOffset, uint32 numBytes)
+{
+#ifdef WIN32
+   (void) fd; (void) fileOffset; (void) numBytes;
+   return ByteBufferRef();  // not implemented
+#else
+   if (numBytes == 0) return GetByteBufferFromPool();
+
+   uint32 pageOffset = (uint32)(fileOffset%GetMemoryPageSize());
+   void * map = mmap(NULL, numBytes+pageOffset, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, (off_t)(fileOffset-pageOffset));
+   if (map == MAP_FAILED) return ByteBufferRef();
+
+   ByteBuffer * bb = newnothrow ByteBuffer(0, NULL, &_memoryMappedAllocationStrategy);
+   if (bb == NULL)
+   {
+      WARN_OUT_OF_MEMORY;
+      (void) munmap(map, numBytes+pageOffset);
+      return ByteBufferRef();
+   }
+   bb->AdoptBuffer(numBytes, ((uint8 *)map)+pageOffset);
+   return ByteBufferRef(bb);
+#endif
+}
+
+// Our LZ4CompressByteBuffer() and LZ4DecompressByteBuffer() functions use the LZ4 block format:  a series of
+// sequences, each consisting of a token byte (4 bits of literal-length, 4 bits of match-length), any extra
+// literal-length bytes, the literal bytes, a 16-bit little-endian match offset, and any extra match-length bytes.
+enum {
+   LZ4_MIN_MATCH         = 4,      // shorter matches than this aren't worth encoding
+   LZ4_LAST_LITERALS     = 5,      // the last 5 bytes of a block are always literals
+   LZ4_MATCH_SAFE_LENGTH = 12,     // and the last match must start at least this many bytes before the end of the block
+   LZ4_MAX_OFFSET        = 65535,
+   LZ4_HASH_BITS         = 12,     // i.e. a 16KB hash table on the stack
+   LZ4_SKIP_TRIGGER      = 6       // after (1<<LZ4_SKIP_TRIGGER) misses in a row, start skipping ahead faster through incompressible data
+};
+
+static inline uint32 LZ4Hash(uint32 fourBytes) {return (fourBytes*2654435761U)>>(32-LZ4_HASH_BITS);}
+
+static inline uint8 * LZ4WriteExtraLength(uint8 * op, uint32 len)
+{
+   while(len >= 255) {*op++ = 255; len -= 255;}
+   *op++ = (uint8) len;
+   return op;
+}
+
+static uint8 * LZ4WriteLiterals(uint8 * op, const uint8 * literals, uint32 numLiterals, uint32 matchLengthBits)
+{
+   *op++ = (uint8) ((muscleMin(numLiterals, (uint32)15)<<4) | matchLengthBits);
+   if (numLiterals >= 15) op = LZ4WriteExtraLength(op, numLiterals-15);
+   memcpy(op, literals, numLiterals);
+   return op+numLiterals;
+}
+
+static uint32 LZ4CompressBlock(const uint8 * src, uint32 srcLen, uint8 * dst)
+{
+   uint8 * op = dst;
+   const uint8 * anchor = src;  // start of the literals not yet written
+   if (srcLen > LZ4_MATCH_SAFE_LENGTH)
+   {
+      uint32 table[1<<LZ4_HASH_BITS];  // offsets (from src) of recently-seen 4-byte sequences
+      memset(table, 0, sizeof(table));
+
+      const uint8 * matchLimit = src+srcLen-LZ4_LAST_LITERALS;
+      const uint8 * lastStart  = src+srcLen-LZ4_MATCH_SAFE_LENGTH;
+      const uint8 * ip         = src+1;
+      uint32 searchCount       = 1<<LZ4_SKIP_TRIGGER;
+      while(ip <= lastStart)
+      {
+         const uint32 fourBytes = muscleCopyIn<uint32>(ip);
+         const uint32 h         = LZ4Hash(fourBytes);
+         const uint8 * ref      = src+table[h];
+         table[h] = (uint32)(ip-src);
+
+         if ((ref < ip)&&((ip-ref) <= LZ4_MAX_OFFSET)&&(muscleCopyIn<uint32>(ref) == fourBytes))
+         {
+            while((ip > anchor)&&(ref > src)&&(ip[-1] == ref[-1])) {ip--; ref--;}  // extend the match backwards...
+
+            const uint8 * mp = ip+LZ4_MIN_MATCH;  // ... and forwards
+            const uint8 * rp = ref+LZ4_MIN_MATCH;
+            while((mp+sizeof(uint64) <= matchLimit)&&(muscleCopyIn<uint64>(mp) == muscleCopyIn<uint64>(rp))) {mp += sizeof(uint64); rp += sizeof(uint64);}
+            while((mp < matchLimit)&&(*mp == *rp)) {mp++; rp++;}
+
+            const uint32 offset      = (uint32)(ip-ref);
+            const uint32 extraLength = (uint32)(mp-ip)-LZ4_MIN_MATCH;
+            op = LZ4WriteLiterals(op, anchor, (uint32)(ip-anchor), muscleMin(extraLength, (uint32)15));
+            *op++ = (uint8) offset;
+            *op++ = (uint8) (offset>>8);
+            if (extraLength >= 15) op = LZ4WriteExtraLength(op, extraLength-15);
+
+            ip = anchor = mp;
+            table[LZ4Hash(muscleCopyIn<uint32>(ip-2))] = (uint32)(ip-2-src);  // so that the next search has a recent candidate
+            searchCount = 1<<LZ4_SKIP_TRIGGER;
+         }
+         else ip += (searchCount++ >> LZ4_SKIP_TRIGGER);
+      }
+   }
+   return (uint32) (LZ4WriteLiterals(op, anchor, (uint32)(src+srcLen-anchor), 0)-dst);
+}
+
+static inline status_t LZ4ReadExtraLength(const uint8 * & ip, const uint8 * inEnd, uint32 & len)
+{
+   uint8 b;
+   do {
+      if ((ip >= inEnd)||(len > MUSCLE_NO_LIMIT-255)) return B_ERROR;
+      b = *ip++;
+      len += b;
+   } while(b == 255);
+   return B_NO_ERROR;
+}
+
+static status_t LZ4DecompressBlock(const uint8 * src, uint32 srcLen, uint8 * dst, uint32 dstLen)
+{
+   const uint8 * ip    = src;
+   const uint8 * inEnd = src+srcLen;
+   uint8 * op          = dst;
+   const uint8 * outEnd = dst+dstLen;
+   while(1)
+   {
+      if (ip >= inEnd) return B_ERROR;  // a valid block always ends with a literals-only sequence
+
+      const uint32 token = *ip++;
+
+      uint32 numLiterals = token>>4;
+      if ((numLiterals == 15)&&(LZ4ReadExtraLength(ip, inEnd, numLiterals) != B_NO_ERROR)) return B_ERROR;
+      if ((numLiterals > (uint32)(inEnd-ip))||(numLiterals > (uint32)(outEnd-op))) return B_ERROR;
+      memcpy(op, ip, numLiterals);
+      op += numLiterals;
+      ip += numLiterals;
+      if (ip == inEnd) return (op == outEnd) ? B_NO_ERROR : B_ERROR;  // the last sequence has literals only
+
+      if ((inEnd-ip) < 2) return B_ERROR;
+      const uint32 offset = ip[0] | (((uint32)ip[1])<<8);
+      ip += 2;
+      if ((offset == 0)||(offset > (uint32)(op-dst))) return B_ERROR;
+
+      uint32 matchLength = token & 0x0F;
+      if ((matchLength == 15)&&(LZ4ReadExtraLength(ip, inEnd, matchLength) != B_NO_ERROR)) return B_ERROR;
+      matchLength += LZ4_MIN_MATCH;
+      if (matchLength > (uint32)(outEnd-op)) return B_ERROR;
+
+      // The match may overlap the bytes it generates (e.g. offset=1 means "repeat the last byte"), so we can only copy in
+      // chunks that are no bigger than the offset
+      const uint8 * match = op-offset;
+      if (offset >= sizeof(uint64)) for (; matchLength >= sizeof(uint64); matchLength -= sizeof(uint64)) {memcpy(op, match, sizeof(uint64)); op += sizeof(uint64); match += sizeof(uint64);}
+      while(matchLength-- > 0) *op++ = *match++;
+   }
+}
+
+ByteBufferRef LZ4CompressByteBuffer(const uint8 * bytes, uint32 numBytes, uint32 addHeaderBytes)
+{
+   const uint64 maxSize = ((uint64)addHeaderBytes)+sizeof(uint32)+numBytes+(numBytes/255)+16;  // worst case, for incompressible data
+   if (maxSize > MUSCLE_NO_LIMIT) return ByteBufferRef();
+
+   ByteBufferRef ret = GetByteBufferFromPool((uint32)maxSize);
+   if (ret())
+   {
+      uint8 * b = ret()->GetBuffer()+addHeaderBytes;
+      muscleCopyOut(b, B_HOST_TO_LENDIAN_INT32(numBytes));  // so the decompressor knows how much to allocate
+      (void) ret()->SetNumBytes(addHeaderBytes+sizeof(uint32)+LZ4CompressBlock(bytes, numBytes, b+sizeof(uint32)), true);  // truncating never reallocates
+   }
+   return ret;
+}
+
+ByteBufferRef LZ4DecompressByteBuffer(const uint8 * bytes, uint32 numBytes)
+{
+   if (numBytes < sizeof(uint32)) return ByteBufferRef();
+
+   const uint32 rawSize = B_LENDIAN_TO_HOST_INT32(muscleCopyIn<uint32>(bytes));
+   bytes += sizeof(uint32); numBytes -= sizeof(uint32);
+   if (rawSize > ((uint64)numBytes)*256) return ByteBufferRef();  // LZ4 can't compress better than 255:1, so this must be corrupt data
+
+   ByteBufferRef ret = GetByteBufferFromPool(rawSize);
+   if ((ret())&&(LZ4DecompressBlock(bytes, numBytes, ret()->GetBuffer(), rawSize) != B_NO_ERROR)) ret.Reset();
+   return ret;
+}
+
 ByteBufferRef GetByteBufferFromPool(SeekableDataIO & dio) {return GetByteBufferFromPool(_bufferPool, dio);}
 
 ByteBufferRef GetByteBufferFromPool(ObjectPool<ByteBuffer> & pool, SeekableDataIO & dio)
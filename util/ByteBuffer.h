@@ -438,6 +438,38 @@ ByteBufferRef GetByteBufferFromPool(SeekableDataIO & dio);
  */
 ByteBufferRef GetByteBufferFromPool(ObjectPool<ByteBuffer> & pool, SeekableDataIO & dio);
 
+/** Returns a ByteBuffer whose bytes are a private (copy-on-write) memory-mapping of part of an open file,
+ *  rather than a copy of the file's data on the heap.  The mapping is released when the ByteBuffer is destroyed;
+ *  if the ByteBuffer is later resized, its contents are moved into an anonymous memory-mapping instead.
+ *  Note that the returned ByteBuffer is not taken from the ByteBuffer pool.
+ *  @param fd File descriptor of the file to map.  Must be open for reading.  May be closed after this call returns.
+ *  @param fileOffset Offset (in bytes) into the file of the first byte to map.  Need not be page-aligned.
+ *  @param numBytes Number of bytes to map.
+ *  @return Reference to a ByteBuffer object on success, or a NULL ref on failure (or if memory-mapping isn't supported on this OS).
+ */
+ByteBufferRef GetMemoryMappedByteBuffer(int fd, uint64 fileOffset, uint32 numBytes);
+
+/** Compresses the given bytes using MUSCLE's built-in LZ4-compatible compressor.  This gives a lower compression
+ *  ratio than zlib, but compresses several times faster, and decompresses faster still.  The compressed data is
+ *  an LZ4 block, preceded by a 4-byte little-endian count of the uncompressed bytes.
+ *  @param bytes Pointer to the data to compress
+ *  @param numBytes Number of bytes that (bytes) points to
+ *  @param addHeaderBytes If set to non-zero, the returned ByteBuffer will contain
+ *                    this many additional bytes at the beginning of the byte array,
+ *                    before the first compressed-data byte.  The values in these bytes
+ *                    are undefined; the caller can write header data to them if desired.
+ *  @returns a reference to a compressed ByteBuffer on success, or a NULL reference on failure (out of memory).
+ *           Note that incompressible data will come out slightly larger than it went in.
+ */
+ByteBufferRef LZ4CompressByteBuffer(const uint8 * bytes, uint32 numBytes, uint32 addHeaderBytes = 0);
+
+/** Given some data that was compressed by LZ4CompressByteBuffer(), returns a ByteBuffer containing the original data.
+ *  @param bytes Pointer to the data to uncompress (not including any header bytes that were added by LZ4CompressByteBuffer())
+ *  @param numBytes Number of bytes that (bytes) points to
+ *  @returns a reference to an uncompressed ByteBuffer on success, or a NULL reference on failure (out of memory, or corrupt data).
+ */
+ByteBufferRef LZ4DecompressByteBuffer(const uint8 * bytes, uint32 numBytes);
+
 /** Convenience method:  returns a read-only reference to an empty ByteBuffer */
 const ByteBuffer & GetEmptyByteBuffer();
 
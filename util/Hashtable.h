@@ -687,6 +687,21 @@ public:
      */
    const ValueType * Get(const KeyType & key) const {return GetValue(key);}
 
+   /** Same as Get(), except that instead of calling the hash functor on (key), the caller supplies (key)'s hash code.
+     * This is useful when the same key is looked up over and over again, since its hash code can then be computed once and re-used.
+     * @param key the key to lookup a value for
+     * @param hashCode the hash code of (key).  This MUST be the same value that our hash functor returns for (key)!
+     * @returns A pointer to the value associated with key on success, or NULL on failure (key-not-found)
+     */
+   ValueType * GetWithPrecomputedHash(const KeyType & key, uint32 hashCode) {HashtableEntryBase * e = this->GetEntry(AdjustHash(hashCode), key); return e ? &e->_value : NULL;}
+
+   /** As above, but read-only.
+     * @param key the key to lookup a value for
+     * @param hashCode the hash code of (key).  This MUST be the same value that our hash functor returns for (key)!
+     * @returns A pointer to the value associated with key on success, or NULL on failure (key-not-found)
+     */
+   const ValueType * GetWithPrecomputedHash(const KeyType & key, uint32 hashCode) const {const HashtableEntryBase * e = this->GetEntry(AdjustHash(hashCode), key); return e ? &e->_value : NULL;}
+
    /** Similar to Get(), except that if the specified key is not found, the ValueType's default value is returned.
      * @param key The key whose value should be returned.
      * @returns (key)'s associated value, or the default ValueType value.
@@ -1189,12 +1204,10 @@ private:
 
    void SwapEntryMaps(uint32 idx1, int32 idx2);
 
-   inline uint32 ComputeHash(const KeyType & key) const
-   {
-      uint32 ret = _hashFunctor(key);
-      if (ret == MUSCLE_HASHTABLE_INVALID_HASH_CODE) ret++;  // avoid using the guard value as a hash code (unlikely but possible)
-      return ret;
-   }
+   inline uint32 ComputeHash(const KeyType & key) const {return AdjustHash(_hashFunctor(key));}
+
+   // avoid using the guard value as a hash code (unlikely but possible)
+   static inline uint32 AdjustHash(uint32 hash) {return (hash == MUSCLE_HASHTABLE_INVALID_HASH_CODE) ? (hash+1) : hash;}
 
    inline bool AreKeysEqual(const KeyType & k1, const KeyType & k2) const
    {
@@ -1532,6 +1545,25 @@ public:
       }
    }
 
+   /** Same as PutIfNotAlreadyPresent(key, value), except that the caller supplies (key)'s hash code, instead of
+    *  having it be computed by our hash functor.  See also GetWithPrecomputedHash().
+    *  @param key The key that the new value is to be associated with.
+    *  @param hashCode the hash code of (key).  This MUST be the same value that our hash functor returns for (key)!
+    *  @param value The value to associate with the new key.
+    *  @return A pointer to the value object in the table on success, or NULL on failure (key already exists, out of memory)
+    */
+   ValueType * PutIfNotAlreadyPresentWithPrecomputedHash(const KeyType & key, uint32 hashCode, const ValueType & value)
+   {
+      const uint32 hash = this->AdjustHash(hashCode);
+      typename HashtableBase<KeyType,ValueType,HashFunctorType>::HashtableEntryBase * e = this->GetEntry(hash, key);
+      if (e) return NULL;
+      else
+      {
+         e = PutAux(hash, key, value, NULL, NULL);
+         return e ? &e->_value : NULL;
+      }
+   }
+
    /** Convenience method.  If the given key already exists in the Hashtable, this method returns NULL.
     *  Otherwise, this method puts a default value into the table and returns a pointer to the just-placed value.
     *  (average O(1) insertion time, unless auto-sorting is enabled, in which case it becomes O(N) insertion time)
@@ -1648,8 +1680,8 @@ private:
  *  or the STL's unordered_map<>, but with some useful features not typically found in hash table
  *  implementations.  These extra features include:
  *   - Any POD type or user type with a default constructor may be used as a Hashtable Key type.  
- *     If the type is a POD type, MUSCLE's CalculateHashCode() function (which is a wrapper 
- *     around the MurmurHash2 algorithm) will be used to scan the bytes of the Key object, in 
+ *     If the type is a POD type, MUSCLE's CalculateHashCode() function (which is a fast 
+ *     wyhash-style hash function) will be used to scan the bytes of the Key object, in 
  *     order to calculate a hash code for a given Key.  However, if the Key class has a method 
  *     with the signature "uint32 HashCode() const", then the HashCode() method will be automatically 
  *     called instead.  Unless -DMUSCLE_AVOID_CPLUSPLUS11 is defined, attempting to use
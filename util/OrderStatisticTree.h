@@ -0,0 +1,322 @@
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
+
+#ifndef MuscleOrderStatisticTree_h
+#define MuscleOrderStatisticTree_h
+
+#include "support/MuscleSupport.h"
+#include "support/NotCopyable.h"
+
+namespace muscle {
+
+/** This class implements a templated sequence container, similar to a Queue, except that inserting or removing
+ *  an item at any position, and looking up an item by its position, are all O(log N) operations.  It is implemented
+ *  as a treap (a randomized balanced binary tree) in which each node knows how many items are in its subtree.
+ *  In addition, each item is held in an Entry object that stays put for as long as the item is in the tree, so
+ *  callers can remember an item's Entry and later find out the item's current position (via GetIndexOf()) or remove
+ *  the item (via RemoveEntry()) in O(log N) time, without having to search for it.
+ *  Iterating over all the items in order via GetFirstEntry() and GetNextEntry() takes O(N) time.
+ */
+template <class ItemType> class OrderStatisticTree MUSCLE_FINAL_CLASS : private NotCopyable
+{
+public:
+   /** Holds one item in the tree.  An Entry's address remains valid until its item is removed from the tree. */
+   class Entry MUSCLE_FINAL_CLASS : private NotCopyable
+   {
+   public:
+      /** Returns a read-only reference to the item held by this Entry. */
+      const ItemType & GetItem() const {return _item;}
+
+      /** Returns a read/write reference to the item held by this Entry. */
+      ItemType & GetItem() {return _item;}
+
+   private:
+      friend class OrderStatisticTree<ItemType>;
+
+      Entry(const ItemType & item, uint32 priority) : _item(item), _left(NULL), _right(NULL), _parent(NULL), _count(1), _priority(priority) {/* empty */}
+
+      ItemType _item;
+      Entry * _left;
+      Entry * _right;
+      Entry * _parent;
+      uint32 _count;     // number of Entries in the subtree rooted at this Entry (including this one)
+      uint32 _priority;  // heap-ordering key that keeps the tree balanced (with high probability)
+   };
+
+   /** Default constructor.  Creates an empty tree. */
+   OrderStatisticTree() : _root(NULL), _randomState(0x9E3779B9) {/* empty */}
+
+   /** Destructor. */
+   ~OrderStatisticTree() {Clear();}
+
+   /** Returns the number of items in the tree. */
+   uint32 GetNumItems() const {return GetCount(_root);}
+
+   /** Returns true iff the tree contains no items. */
+   bool IsEmpty() const {return (_root == NULL);}
+
+   /** Returns true iff the tree contains at least one item. */
+   bool HasItems() const {return (_root != NULL);}
+
+   /** Removes all items from the tree.  Any Entry pointers previously returned become invalid. */
+   void Clear()
+   {
+      // Iterative post-order deletion, so there's no recursion
+      Entry * e = _root;
+      while(e)
+      {
+         if (e->_left) e = e->_left;
+         else if (e->_right) e = e->_right;
+         else
+         {
+            Entry * p = e->_parent;
+            if (p) {if (p->_left == e) p->_left = NULL; else p->_right = NULL;}
+            delete e;
+            e = p;
+         }
+      }
+      _root = NULL;
+   }
+
+   /** Inserts (item) into the tree, so that it will be at position (index).
+     * @param index The position to insert at.  Must be in the range [0, GetNumItems()].
+     * @param item The item to insert.
+     * @param optRetEntry If non-NULL, a pointer to the new Entry that holds (item) will be written here.
+     * @returns B_NO_ERROR on success, or B_ERROR if (index) was out of range or we ran out of memory.
+     */
+   status_t InsertItemAt(uint32 index, const ItemType & item, Entry ** optRetEntry = NULL)
+   {
+      if (index > GetNumItems()) return B_ERROR;
+
+      Entry * newEntry = newnothrow Entry(item, GetNextRandomNumber());
+      if (newEntry == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+
+      Entry * before;
+      Entry * after;
+      Split(_root, index, before, after);
+      _root = Merge(Merge(before, newEntry), after);
+      _root->_parent = NULL;
+
+      if (optRetEntry) *optRetEntry = newEntry;
+      return B_NO_ERROR;
+   }
+
+   /** Convenience method:  Appends (item) to the end of the tree.
+     * @param item The item to append.
+     * @param optRetEntry If non-NULL, a pointer to the new Entry that holds (item) will be written here.
+     * @returns B_NO_ERROR on success, or B_ERROR if we ran out of memory.
+     */
+   status_t AddTail(const ItemType & item, Entry ** optRetEntry = NULL) {return InsertItemAt(GetNumItems(), item, optRetEntry);}
+
+   /** Removes the item at position (index) from the tree.
+     * @param index The position of the item to remove.
+     * @param optRetItem If non-NULL, the removed item will be written here.
+     * @returns B_NO_ERROR on success, or B_ERROR if (index) was out of range.
+     */
+   status_t RemoveItemAt(uint32 index, ItemType * optRetItem = NULL)
+   {
+      Entry * e = GetEntryAt(index);
+      return e ? RemoveEntry(e, optRetItem) : B_ERROR;
+   }
+
+   /** Removes the specified Entry (and its item) from the tree.
+     * @param entry An Entry that is currently in this tree.  It will be deleted by this call.
+     * @param optRetItem If non-NULL, the removed item will be written here.
+     * @returns B_NO_ERROR on success, or B_ERROR if (entry) was NULL.
+     */
+   status_t RemoveEntry(Entry * entry, ItemType * optRetItem = NULL)
+   {
+      if (entry == NULL) return B_ERROR;
+
+      Entry * p = entry->_parent;
+      Entry * replacement = Merge(entry->_left, entry->_right);
+      if (replacement) replacement->_parent = p;
+           if (p == NULL)          _root       = replacement;
+      else if (p->_left == entry)  p->_left  = replacement;
+      else                         p->_right = replacement;
+      for (; p; p=p->_parent) p->_count--;
+
+      if (optRetItem) *optRetItem = entry->_item;
+      delete entry;
+      return B_NO_ERROR;
+   }
+
+   /** Returns the Entry at position (index), or NULL if (index) is out of range. */
+   Entry * GetEntryAt(uint32 index) const
+   {
+      Entry * e = _root;
+      while(e)
+      {
+         const uint32 leftCount = GetCount(e->_left);
+              if (index < leftCount)  e = e->_left;
+         else if (index == leftCount) return e;
+         else
+         {
+            index -= (leftCount+1);
+            e = e->_right;
+         }
+      }
+      return NULL;
+   }
+
+   /** Returns a pointer to the item at position (index), or NULL if (index) is out of range. */
+   const ItemType * GetItemAt(uint32 index) const {const Entry * e = GetEntryAt(index); return e ? &e->_item : NULL;}
+
+   /** Returns a pointer to the item at position (index), or NULL if (index) is out of range. */
+   ItemType * GetItemAt(uint32 index) {Entry * e = GetEntryAt(index); return e ? &e->_item : NULL;}
+
+   /** Returns a reference to the item at position (index).  (index) must be less than GetNumItems()! */
+   const ItemType & operator[](uint32 index) const {return *GetItemAt(index);}
+
+   /** Returns a reference to the item at position (index).  (index) must be less than GetNumItems()! */
+   ItemType & operator[](uint32 index) {return *GetItemAt(index);}
+
+   /** Returns the current position of (entry)'s item within the tree.
+     * @param entry An Entry that is currently in this tree.
+     */
+   uint32 GetIndexOf(const Entry * entry) const
+   {
+      uint32 ret = GetCount(entry->_left);
+      for (const Entry * p = entry->_parent; p; entry=p, p=p->_parent) if (p->_right == entry) ret += GetCount(p->_left)+1;
+      return ret;
+   }
+
+   /** Returns true iff (entry) is currently held by this tree (as opposed to some other tree).  O(log N).
+     * @param entry An Entry that is currently held by some OrderStatisticTree.
+     */
+   bool ContainsEntry(const Entry * entry) const
+   {
+      while(entry->_parent) entry = entry->_parent;
+      return (entry == _root);
+   }
+
+   /** Returns the first Entry in the tree, or NULL if the tree is empty. */
+   Entry * GetFirstEntry() const
+   {
+      Entry * e = _root;
+      if (e) while(e->_left) e = e->_left;
+      return e;
+   }
+
+   /** Returns the Entry that comes after (entry) in the tree, or NULL if (entry) is the last one.
+     * @param entry An Entry that is currently in this tree.
+     */
+   Entry * GetNextEntry(const Entry * entry) const
+   {
+      if (entry->_right)
+      {
+         Entry * e = entry->_right;
+         while(e->_left) e = e->_left;
+         return e;
+      }
+
+      Entry * p = entry->_parent;
+      while((p)&&(p->_right == entry)) {entry = p; p = p->_parent;}
+      return p;
+   }
+
+   /** For trees whose items are kept in sorted order:  Returns the position of the first item that is not less than (key).
+     * This is an O(log N) binary search.
+     * @param key The key value to search for.
+     * @param cf A functor whose Compare(const ItemType & item, const KeyType & key, void * cookie) method returns a negative
+     *           value if (item) sorts before (key), a positive value if (item) sorts after (key), or zero if they are equal.
+     * @param cookie Optional value to pass through to (cf)'s Compare() method.
+     * @returns A position in the range [0, GetNumItems()].
+     */
+   template<class KeyType, class CompareFunctorType> uint32 GetLowerBound(const KeyType & key, const CompareFunctorType & cf, void * cookie = NULL) const {return GetBound(key, cf, cookie, 0);}
+
+   /** For trees whose items are kept in sorted order:  Returns the position of the first item that is greater than (key).
+     * This is an O(log N) binary search.
+     * @param key The key value to search for.
+     * @param cf A functor, as described for GetLowerBound().
+     * @param cookie Optional value to pass through to (cf)'s Compare() method.
+     * @returns A position in the range [0, GetNumItems()].
+     */
+   template<class KeyType, class CompareFunctorType> uint32 GetUpperBound(const KeyType & key, const CompareFunctorType & cf, void * cookie = NULL) const {return GetBound(key, cf, cookie, 1);}
+
+private:
+   template<class KeyType, class CompareFunctorType> uint32 GetBound(const KeyType & key, const CompareFunctorType & cf, void * cookie, int minCompareResult) const
+   {
+      uint32 ret  = GetNumItems();
+      uint32 base = 0;  // number of items known to come before the subtree rooted at (e)
+      const Entry * e = _root;
+      while(e)
+      {
+         const uint32 leftCount = GetCount(e->_left);
+         if (cf.Compare(e->_item, key, cookie) >= minCompareResult)
+         {
+            ret = base+leftCount;
+            e   = e->_left;
+         }
+         else
+         {
+            base += (leftCount+1);
+            e     = e->_right;
+         }
+      }
+      return ret;
+   }
+
+   static uint32 GetCount(const Entry * e) {return e ? e->_count : 0;}
+   static void UpdateCount(Entry * e) {e->_count = GetCount(e->_left)+GetCount(e->_right)+1;}
+
+   // Splits the subtree rooted at (e) into (retLeft), which holds its first (numLeft) Entries, and (retRight), which holds the rest
+   static void Split(Entry * e, uint32 numLeft, Entry * & retLeft, Entry * & retRight)
+   {
+      if (e == NULL) {retLeft = retRight = NULL; return;}
+
+      const uint32 leftCount = GetCount(e->_left);
+      if (leftCount < numLeft)
+      {
+         Split(e->_right, numLeft-(leftCount+1), e->_right, retRight);
+         if (e->_right) e->_right->_parent = e;
+         if (retRight) retRight->_parent = NULL;
+         retLeft = e;
+      }
+      else
+      {
+         Split(e->_left, numLeft, retLeft, e->_left);
+         if (e->_left) e->_left->_parent = e;
+         if (retLeft) retLeft->_parent = NULL;
+         retRight = e;
+      }
+      UpdateCount(e);
+   }
+
+   // Joins two subtrees together (every Entry in (left) comes before every Entry in (right)) and returns the new subtree's root
+   static Entry * Merge(Entry * left, Entry * right)
+   {
+      if (left  == NULL) return right;
+      if (right == NULL) return left;
+
+      if (left->_priority > right->_priority)
+      {
+         left->_right = Merge(left->_right, right);
+         left->_right->_parent = left;
+         UpdateCount(left);
+         return left;
+      }
+      else
+      {
+         right->_left = Merge(left, right->_left);
+         right->_left->_parent = right;
+         UpdateCount(right);
+         return right;
+      }
+   }
+
+   uint32 GetNextRandomNumber()
+   {
+      // xorshift32:  good enough for balancing purposes, and deterministic
+      _randomState ^= (_randomState << 13);
+      _randomState ^= (_randomState >> 17);
+      _randomState ^= (_randomState << 5);
+      return _randomState;
+   }
+
+   Entry * _root;
+   uint32 _randomState;
+};
+
+} // end namespace muscle
+
+#endif
@@ -3,6 +3,9 @@
 #include "util/String.h"
 #include "support/Point.h"
 #include "support/Rect.h"
+#include "system/AtomicCounter.h"
+#include "system/Mutex.h"
+#include "util/Hashtable.h"
 #include <stdarg.h>
 
 #ifdef __APPLE__
@@ -11,26 +14,224 @@
 
 namespace muscle {
 
+// Each entry in the interned-strings table is a single heap block, laid out like this:
+//    [InternedStringHeader] [the chars, including the NUL terminator] [padding] [the uint32 hash code of the chars]
+// The hash code is placed where String::GetCachedHashCode() expects to find it; see GetHashCodeCacheOffset().
+// The table holds one reference to each entry, and each String that uses the entry holds another one.
+// Entries whose only remaining reference is the table's own are freed by PurgeUnusedInternedStrings().
+struct InternedStringHeader
+{
+   AtomicCounter _refCount;
+};
+static const uint32 INTERNED_STRING_HEADER_SIZE = ((sizeof(InternedStringHeader)+7)/8)*8;  // keeps the chars 8-byte-aligned
+
+static inline InternedStringHeader * GetInternedStringHeader(const char * chars) {return (InternedStringHeader *) (chars-INTERNED_STRING_HEADER_SIZE);}
+
+static void ReleaseInternedStringEntry(const char * chars)
+{
+   InternedStringHeader * header = GetInternedStringHeader(chars);
+   if (header->_refCount.AtomicDecrement())
+   {
+      header->~InternedStringHeader();
+      muscleFree(header);
+   }
+}
+
+// Lightweight (pointer, length) key, so that we can look up an entry without having to construct a String first
+class InternedStringKey
+{
+public:
+   InternedStringKey() : _chars(NULL), _length(0), _hashCode(0) {/* empty */}
+   InternedStringKey(const char * chars, uint32 length, uint32 hashCode) : _chars(chars), _length(length), _hashCode(hashCode) {/* empty */}
+
+   uint32 HashCode() const {return _hashCode;}
+   bool operator == (const InternedStringKey & rhs) const {return ((_hashCode == rhs._hashCode)&&(_length == rhs._length)&&(memcmp(_chars, rhs._chars, _length) == 0));}
+   bool operator != (const InternedStringKey & rhs) const {return !(*this == rhs);}
+
+private:
+   const char * _chars;
+   uint32 _length;
+   uint32 _hashCode;
+};
+
+class InternedStringTable
+{
+public:
+   InternedStringTable() : _autoPurgeThreshold(MIN_AUTO_PURGE_THRESHOLD) {/* empty */}
+
+   ~InternedStringTable()
+   {
+      // Entries that are still in use will be freed by the last String to release them
+      for (HashtableIterator<InternedStringKey, const char *> iter(_table); iter.HasData(); iter++) ReleaseInternedStringEntry(iter.GetValue());
+   }
+
+   // Returns a pointer to the chars of the entry for the given value (with a reference added on behalf of the caller), or NULL on failure.
+   const char * ObtainEntry(const char * str, uint32 len)
+   {
+      const uint32 hashCode = CalculateHashCode(str, len);  // done outside of the lock, since it doesn't need to be inside it
+
+      MutexGuard mg(_mutex);
+      const char * const * existing = _table.Get(InternedStringKey(str, len, hashCode));
+      if (existing)
+      {
+         (void) GetInternedStringHeader(*existing)->_refCount.AtomicIncrement();
+         return *existing;
+      }
+
+      if (_table.GetNumItems() >= _autoPurgeThreshold)
+      {
+         (void) PurgeAux();
+         _autoPurgeThreshold = muscleMax((uint32)MIN_AUTO_PURGE_THRESHOLD, 2*_table.GetNumItems());
+      }
+
+      const uint32 hashCodeOffset = GetHashCodeCacheOffset(len+1);
+      uint8 * block = (uint8 *) muscleAlloc(INTERNED_STRING_HEADER_SIZE+hashCodeOffset+sizeof(hashCode));
+      if (block == NULL) {WARN_OUT_OF_MEMORY; return NULL;}
+
+      InternedStringHeader * header = new (block) InternedStringHeader;
+      char * chars = (char *) (block+INTERNED_STRING_HEADER_SIZE);
+      memcpy(chars, str, len);
+      chars[len] = '\0';
+#ifdef MUSCLE_AVOID_CACHED_STRING_HASH_CODES
+      memcpy(chars+hashCodeOffset, &hashCode, sizeof(hashCode));
+#else
+      (void) new (chars+hashCodeOffset) String::HashCodeCacheSlot(hashCode);
+#endif
+      if (_table.Put(InternedStringKey(chars, len, hashCode), chars) != B_NO_ERROR)
+      {
+         header->~InternedStringHeader();
+         muscleFree(block);
+         return NULL;
+      }
+
+      (void) header->_refCount.AtomicIncrement();  // the table's reference
+      (void) header->_refCount.AtomicIncrement();  // the caller's reference
+      return chars;
+   }
+
+   uint32 Purge() {MutexGuard mg(_mutex); return PurgeAux();}
+   uint32 GetNumEntries() const {MutexGuard mg(_mutex); return _table.GetNumItems();}
+
+private:
+   enum {MIN_AUTO_PURGE_THRESHOLD = 1024};
+
+   uint32 PurgeAux()
+   {
+      uint32 ret = 0;
+      for (HashtableIterator<InternedStringKey, const char *> iter(_table); iter.HasData(); iter++)
+      {
+         const char * chars = iter.GetValue();
+         if (GetInternedStringHeader(chars)->_refCount.GetCount() == 1)  // only the table's reference is left, and only the table can add more
+         {
+            (void) _table.Remove(iter.GetKey());  // must be done before the free, since the key points to (chars)
+            ReleaseInternedStringEntry(chars);
+            ret++;
+         }
+      }
+      return ret;
+   }
+
+   mutable Mutex _mutex;
+   Hashtable<InternedStringKey, const char *> _table;
+   uint32 _autoPurgeThreshold;
+};
+
+static InternedStringTable & GetInternedStringTable()
+{
+   static InternedStringTable _internedStringTable;
+   return _internedStringTable;
+}
+
+uint32 PurgeUnusedInternedStrings() {return GetInternedStringTable().Purge();}
+uint32 GetNumInternedStrings() {return GetInternedStringTable().GetNumEntries();}
+
+status_t String::SetInterned(const char * str, uint32 maxLen)
+{
+   uint32 len = 0;
+   if (str) {while((len<maxLen)&&(str[len] != '\0')) len++;}
+
+#ifndef MUSCLE_AVOID_STRING_INTERNING
+   if (len > SMALL_MUSCLE_STRING_LENGTH)  // short strings are stored inline anyway, so there would be nothing to gain by sharing them
+   {
+      if ((IsInterned())&&(len == _length)&&(memcmp(_strData._bigBuffer, str, len) == 0)) return B_NO_ERROR;  // already done!
+
+      const char * chars = GetInternedStringTable().ObtainEntry(str, len);
+      if (chars == NULL) return B_ERROR;
+
+      ReleaseBuffer();  // must be done after ObtainEntry(), in case (str) points into our own buffer
+      _strData._bigBuffer = const_cast<char *>(chars);  // we'll never write to it, though
+      _bufferLen          = (len+1)|INTERNED_BUFFER_BIT;
+      _length             = len;
+      return B_NO_ERROR;
+   }
+#endif
+
+   return SetCstr(str, len);
+}
+
+void String::ReleaseInternedBuffer()
+{
+   ReleaseInternedStringEntry(_strData._bigBuffer);
+}
+
+status_t String::DetachFromInternedBuffer()
+{
+   const uint32 bufLen = _length+1;
+   char * newBuf = (char *) muscleAlloc(bufLen+HASH_CACHE_BYTES);
+   if (newBuf == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
+
+   memcpy(newBuf, _strData._bigBuffer, bufLen);
+   ReleaseInternedBuffer();
+   _strData._bigBuffer = newBuf;
+   _bufferLen          = bufLen;
+   InitCachedHashCode();
+   return B_NO_ERROR;
+}
+
 void String::ClearAndFlush()
 {
-   if (IsArrayDynamicallyAllocated()) muscleFree(_strData._bigBuffer);
+   ReleaseBuffer();
    ClearSmallBuffer();
    _bufferLen = sizeof(_strData._smallBuffer);
-   _length = 0; 
+   _length = 0;
 }
 
 status_t String::SetFromString(const String & s, uint32 firstChar, uint32 afterLastChar)
 {
    afterLastChar = muscleMin(afterLastChar, s.Length());
    uint32 len = (afterLastChar > firstChar) ? (afterLastChar-firstChar) : 0;
+   if ((s.IsInterned())&&(firstChar == 0)&&(len == s.Length()))
+   {
+      // Copying an interned String is just a matter of sharing its buffer
+      if ((IsInterned() == false)||(_strData._bigBuffer != s._strData._bigBuffer))
+      {
+         (void) GetInternedStringHeader(s._strData._bigBuffer)->_refCount.AtomicIncrement();
+         ReleaseBuffer();
+         _strData._bigBuffer = s._strData._bigBuffer;
+         _bufferLen          = s._bufferLen;
+         _length             = s._length;
+      }
+      return B_NO_ERROR;
+   }
+   if ((&s == this)&&(IsInterned())&&(len > 0))
+   {
+      // Detaching from our interned buffer would drop our reference to the chars we are about to copy, so copy them first
+      String temp;
+      if (temp.SetFromString(s, firstChar, afterLastChar) != B_NO_ERROR) return B_ERROR;
+      SwapContents(temp);
+      return B_NO_ERROR;
+   }
+
    if (len > 0)
    {
       if (EnsureBufferSize(len+1, false, false) != B_NO_ERROR) return B_ERROR;  // guaranteed not to realloc in the (&s==this) case
 
+      const uint32 hashCode = ((firstChar == 0)&&(len == s.Length())) ? s.GetCachedHashCode() : 0;  // read this before GetBuffer() invalidates it, in case (&s==this)
       char * b = GetBuffer();
       memmove(b, s()+firstChar, len);  // memmove() is used in case (&s==this)
       b[len]  = '\0';
       _length = len;
+      SetCachedHashCode(hashCode);  // if we copied all of (s), then (s)'s hash code is our hash code too
    }
    else ClearAndFlush();
 
@@ -45,6 +246,14 @@ status_t String::SetCstr(const char * str, uint32 maxLen)
    uint32 sLen = 0;
    if (str) {while((sLen<maxLen)&&(str[sLen] != '\0')) sLen++;}
    maxLen = muscleMin(maxLen, sLen);
+   if ((maxLen > 0)&&(IsInterned())&&(IsCharInLocalArray(str)))
+   {
+      // Detaching from our interned buffer would drop our reference to the chars we are about to copy, so copy them first
+      String temp;
+      if (temp.SetCstr(str, maxLen) != B_NO_ERROR) return B_ERROR;
+      SwapContents(temp);
+      return B_NO_ERROR;
+   }
    if (maxLen > 0)
    {
       if (str[maxLen-1] != '\0') maxLen++;  // make room to add the NUL byte if necessary
@@ -213,6 +422,13 @@ int32 String::Replace(const String & replaceMe, const String & withMe, uint32 ma
       if (temp.Prealloc(Length()+(perInstanceDelta*numInstances)) != B_NO_ERROR) return -1;
    }
 
+   else if (IsInterned())
+   {
+      // We're going to modify our chars in-place, so we'll need a private copy of them first
+      if (Contains(replaceMe) == false) return 0;  // no changes necessary!
+      if (DetachFromInternedBuffer() != B_NO_ERROR) return -1;
+   }
+
    // This code works for both the in-place and the copy-over modes!
    int32 ret = 0;
    const char * readPtr = Cstr();
@@ -250,7 +466,11 @@ int32 String::Replace(const String & replaceMe, const String & withMe, uint32 ma
                temp._length = (uint32) (writePtr-temp());
                SwapContents(temp);
             }
-            else _length = (uint32) (writePtr-Cstr());
+            else
+            {
+               _length = (uint32) (writePtr-Cstr());
+               SetCachedHashCode(0);  // since we modified our chars in-place, via (writePtr)
+            }
          }
          return ret;
       }
@@ -539,7 +759,7 @@ static uint32 NextPowerOfTwo(uint32 n)
    return n;
 }
 
-static uint32 GetNextBufferSize(uint32 bufLen)
+static uint32 GetNextBufferSize(uint32 bufLen, uint32 extraBytes)
 {
    // For very small strings, we'll try to conserve memory by betting that they won't expand much more
    if (bufLen < 32) return bufLen+SMALL_MUSCLE_STRING_LENGTH;
@@ -548,7 +768,7 @@ static uint32 GetNextBufferSize(uint32 bufLen)
    static const uint32 STRING_MALLOC_OVERHEAD = 12;  // we assume that malloc() might need as many as 12 bytes for book keeping
 
    // For medium-length strings, do a geometric expansion to reduce the number of reallocations
-   uint32 geomLen = NextPowerOfTwo((bufLen-1)*2);
+   uint32 geomLen = NextPowerOfTwo((bufLen-1)*2)-extraBytes;  // so that the allocation size will be a power of two, after the String adds its (extraBytes)
 #ifdef MUSCLE_ENABLE_MEMORY_TRACKING
    geomLen -= sizeof(size_t);  // so that the internal allocation size will be a power of two, after GlobalMemoryAllocator.cpp adds its header bytes
 #endif
@@ -557,8 +777,8 @@ static uint32 GetNextBufferSize(uint32 bufLen)
    // For large (multi-page) allocations, we'll increase by one page.  According to Trolltech, modern implementations
    // of realloc() don't actually copy the entire large buffer, they just rearrange the memory map and add
    // a new page to the end, so this will be more efficient than it appears.
-   uint32 curNumPages = (bufLen+STRING_MALLOC_OVERHEAD)/STRING_PAGE_SIZE; 
-   return ((curNumPages+1)*STRING_PAGE_SIZE)-STRING_MALLOC_OVERHEAD;
+   uint32 curNumPages = (bufLen+STRING_MALLOC_OVERHEAD+extraBytes)/STRING_PAGE_SIZE;
+   return ((curNumPages+1)*STRING_PAGE_SIZE)-(STRING_MALLOC_OVERHEAD+extraBytes);
 }
 
 // This method tries to ensure that at least (newBufLen) chars
@@ -567,13 +787,15 @@ static uint32 GetNextBufferSize(uint32 bufLen)
 // will be retained; otherwise it should be set right after this call returns...
 status_t String::EnsureBufferSize(uint32 requestedBufLen, bool retainValue, bool allowShrink)
 {
+   if ((IsInterned())&&(DetachFromInternedBuffer() != B_NO_ERROR)) return B_ERROR;  // we never resize (or write to) a shared interned buffer
+
    if (allowShrink ? (requestedBufLen == _bufferLen) : (requestedBufLen <= _bufferLen)) return B_NO_ERROR;
 
    // If we're doing a first-time allocation or a shrink, allocate exactly the number of the bytes requested.
    // If it's a re-allocation, allocate more than requested in the hopes avoiding another realloc in the future.
    char * newBuf = NULL;
    bool arrayWasDynamicallyAllocated = IsArrayDynamicallyAllocated();
-   uint32 newBufLen = ((allowShrink)||(requestedBufLen <= SMALL_MUSCLE_STRING_LENGTH+1)||((IsEmpty())&&(!arrayWasDynamicallyAllocated))) ? requestedBufLen : GetNextBufferSize(requestedBufLen);
+   uint32 newBufLen = ((allowShrink)||(requestedBufLen <= SMALL_MUSCLE_STRING_LENGTH+1)||((IsEmpty())&&(!arrayWasDynamicallyAllocated))) ? requestedBufLen : GetNextBufferSize(requestedBufLen, HASH_CACHE_BYTES);
    if (newBufLen == 0)
    {
       ClearAndFlush();
@@ -599,7 +821,7 @@ status_t String::EnsureBufferSize(uint32 requestedBufLen, bool retainValue, bool
          else
          {
             // Here we call muscleRealloc() to (hopefully) avoid unnecessary data copying
-            newBuf = (char *) muscleRealloc(_strData._bigBuffer, newBufLen);
+            newBuf = (char *) muscleRealloc(_strData._bigBuffer, newBufLen+HASH_CACHE_BYTES);
             if (newBuf == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
          }
       }
@@ -616,7 +838,7 @@ status_t String::EnsureBufferSize(uint32 requestedBufLen, bool retainValue, bool
          else
          {
             // Oops, muscleRealloc() won't do in this case.... we'll just have to copy the bytes over
-            newBuf = (char *) muscleAlloc(newBufLen);
+            newBuf = (char *) muscleAlloc(newBufLen+HASH_CACHE_BYTES);
             if (newBuf == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
             memcpy(newBuf, GetBuffer(), muscleMin(Length()+1, newBufLen));
          }
@@ -633,7 +855,7 @@ status_t String::EnsureBufferSize(uint32 requestedBufLen, bool retainValue, bool
       }
       else
       {
-         newBuf = (char *) muscleAlloc(newBufLen);
+         newBuf = (char *) muscleAlloc(newBufLen+HASH_CACHE_BYTES);
          if (newBuf == NULL) {WARN_OUT_OF_MEMORY; return B_ERROR;}
          newBuf[0] = '\0';  // avoid potential user-visible garbage bytes
          if (arrayWasDynamicallyAllocated) muscleFree(_strData._bigBuffer);
@@ -643,6 +865,7 @@ status_t String::EnsureBufferSize(uint32 requestedBufLen, bool retainValue, bool
    newBuf[muscleMin(Length(), newMaxLength)] = '\0';   // ensure new char array is terminated (it might not be if allowShrink is true)
    _strData._bigBuffer = newBuf;
    _bufferLen          = newBufLen;
+   InitCachedHashCode();  // the bytes in our newly (re)allocated hash-cache slot are uninitialized
 
    return B_NO_ERROR;
 }
@@ -16,6 +16,14 @@
 #include "syslog/SysLog.h"
 #include "system/GlobalMemoryAllocator.h"  // for muscleFree()
 
+#if defined(MUSCLE_AVOID_CPLUSPLUS11) && !defined(MUSCLE_SINGLE_THREAD_ONLY) && !defined(MUSCLE_AVOID_CACHED_STRING_HASH_CODES)
+# define MUSCLE_AVOID_CACHED_STRING_HASH_CODES  // the hash-code cache needs std::atomic to be thread-safe
+#endif
+
+#if !defined(MUSCLE_AVOID_CACHED_STRING_HASH_CODES) && !defined(MUSCLE_SINGLE_THREAD_ONLY)
+# include <atomic>
+#endif
+
 #ifdef __APPLE__
 // Using a forward declaration rather than an #include here to avoid pulling in other things like Mac's
 // Point and Rect typedefs, that can cause ambiguities with Muscle's Point and Rect classes.
@@ -26,6 +34,10 @@ typedef const struct __CFString * CFStringRef;
 namespace muscle {
 
 #ifndef DOXYGEN_SHOULD_IGNORE_THIS
+// Returns the offset (from the start of a String's heap buffer of (bufLen) bytes) of the uint32 that holds its cached hash code.
+// Rounded up to a 4-byte boundary so that the cached value can be accessed atomically.
+static inline uint32 GetHashCodeCacheOffset(uint32 bufLen) {return (bufLen+3)&~((uint32)3);}
+
 # ifdef MUSCLE_COUNT_STRING_COPY_OPERATIONS
 enum {
    STRING_OP_DEFAULT_CTOR = 0,
@@ -133,7 +145,7 @@ public:
    ~String() 
    {
       MUSCLE_INCREMENT_STRING_OP_COUNT(STRING_OP_DTOR);
-      if (IsArrayDynamicallyAllocated()) muscleFree(_strData._bigBuffer);
+      ReleaseBuffer();
    }
 
    /** Assignment Operator. 
@@ -229,7 +241,7 @@ public:
    /** Comparison Operator.  Returns true iff the two strings contain the same sequence of characters (as determined by memcmp()).
      * @param rhs A string to compare ourself with
      */
-   bool operator == (const String & rhs) const {return ((this == &rhs)||((Length() == rhs.Length())&&(memcmp(Cstr(), rhs.Cstr(), Length()) == 0)));}
+   bool operator == (const String & rhs) const {return ((Cstr() == rhs.Cstr())||((Length() == rhs.Length())&&(memcmp(Cstr(), rhs.Cstr(), Length()) == 0)));}  // equal pointers means same object, or shared interned chars
 
    /** Comparison Operator.  Returns true if the two strings are equal (as determined by strcmp())
      * @param rhs Pointer to a C string to compare with.  NULL pointers are considered a synonym for "".
@@ -527,7 +539,7 @@ public:
      * be greater than the value returned by Length(), since we allocate extra bytes to minimize
      * the number of reallocations that must be done as data is being added to a String.
      */
-   uint32 GetNumAllocatedBytes() const {return _bufferLen;}
+   uint32 GetNumAllocatedBytes() const {return GetBufferLength();}
 
    /** Returns the number of instances of (c) in this string. 
      * @param ch The character to count the number of instances of in this String.
@@ -840,8 +852,24 @@ public:
      */
    bool StartsWithIgnoreCase(const String & s) const           {return ToLowerCase().StartsWith(s.ToLowerCase());}
 
-   /** @copydoc DoxyTemplate::HashCode() const */
-   inline uint32 HashCode() const {return CalculateHashCode(Cstr(), Length());}
+   /** @copydoc DoxyTemplate::HashCode() const
+     * @note if this String's characters are stored on the heap (i.e. it is longer than SMALL_MUSCLE_STRING_LENGTH chars),
+     *       the computed hash code is cached and re-used by subsequent calls, until the String is modified.
+     *       The cache is accessed using relaxed atomic operations, so it's safe to call HashCode() on the same
+     *       (unchanging) String from multiple threads at once, as it is with any other const method.
+     *       Define MUSCLE_AVOID_CACHED_STRING_HASH_CODES to disable this caching.  (Caching is also disabled
+     *       automatically when MUSCLE_AVOID_CPLUSPLUS11 is defined, unless MUSCLE_SINGLE_THREAD_ONLY is also defined)
+     */
+   inline uint32 HashCode() const
+   {
+      uint32 ret = GetCachedHashCode();
+      if (ret == 0)
+      {
+         ret = CalculateHashCode(Cstr(), Length());
+         SetCachedHashCode(ret);
+      }
+      return ret;
+   }
 
    /** @copydoc DoxyTemplate::HashCode64() const */
    inline uint64 HashCode64() const {return CalculateHashCode64(Cstr(), Length());}
@@ -918,6 +946,42 @@ public:
     */
    status_t Unflatten(const uint8 *buf, uint32 size) {return SetCstr((const char *)buf, size);}
 
+   /** Same as Unflatten(), except that the resulting String is interned (see SetInterned() for details)
+    *  @param buf an array of (size) bytes.
+    *  @param size the number of bytes in (buf).
+    *  @return B_NO_ERROR on success, or B_ERROR on failure (out of memory).
+    */
+   status_t UnflattenInterned(const uint8 *buf, uint32 size) {return SetInterned((const char *)buf, size);}
+
+   /** Sets this String to the given value, and makes it use the interned (i.e. shared, reference-counted)
+    *  character buffer that is held for that value in MUSCLE's global interned-strings table.  All Strings
+    *  that are interned with the same value share a single character buffer (and a single pre-computed
+    *  hash code), and copying an interned String merely increments the buffer's reference count.
+    *  The shared buffer is never modified; if an interned String is modified, it first makes a private copy of its chars.
+    *  Interning is intended for values that recur many times, such as Message field names and DataNode names.
+    *  Strings that are short enough to be held inline (i.e. not longer than SMALL_MUSCLE_STRING_LENGTH) are never interned.
+    *  This method is thread-safe.
+    *  @param str The C-style string to set our value from.  If NULL, this String will become empty.
+    *  @param maxLen The maximum number of characters to place into this String (not including the NUL terminator byte).
+    *  @return B_NO_ERROR on success, or B_ERROR on failure (out of memory).
+    */
+   status_t SetInterned(const char * str, uint32 maxLen = MUSCLE_NO_LIMIT);
+
+   /** Convenience method:  Sets this String equal to (s), and makes it use the interned character buffer for that value.
+    *  If (s) is already interned, this is as cheap as a regular String-copy.
+    *  @param s The String to set our value from.
+    *  @return B_NO_ERROR on success, or B_ERROR on failure (out of memory).
+    */
+   status_t SetInterned(const String & s) {return s.IsInterned() ? SetFromString(s) : SetInterned(s(), s.Length());}
+
+   /** Convenience method:  Makes this String use the interned character buffer for its current value.
+    *  @return B_NO_ERROR on success, or B_ERROR on failure (out of memory).
+    */
+   status_t Intern() {return SetInterned(*this);}
+
+   /** Returns true iff this String's characters are currently held in a shared interned buffer.  (See SetInterned() for details) */
+   bool IsInterned() const {return ((_bufferLen & INTERNED_BUFFER_BIT) != 0);}
+
    /** Makes sure that we have pre-allocated enough space for a NUL-terminated string 
     *  at least (numChars) bytes long (not including the NUL byte).
     *  If not, this method will try to allocate the space.  
@@ -1123,12 +1187,49 @@ public:
    bool IsCharInLocalArray(const char * s) const {const char * b = Cstr(); return muscleInRange(s, b, b+_length);}
 
 private:
+   friend class InternedStringTable;  // so it can construct the HashCodeCacheSlot of its entries
+
    bool IsSpaceChar(char c) const {return ((c==' ')||(c=='\t')||(c=='\r')||(c=='\n'));}
    status_t EnsureBufferSize(uint32 newBufLen, bool retainValue, bool allowShrink);
    String ArgAux(const char * buf) const;
    bool IsArrayDynamicallyAllocated() const {return (_bufferLen>sizeof(_strData._smallBuffer));}
-   char * GetBuffer() {return IsArrayDynamicallyAllocated() ? _strData._bigBuffer : _strData._smallBuffer;}
+   char * GetBuffer() {if ((IsInterned())&&(DetachFromInternedBuffer() != B_NO_ERROR)) MCRASH("String::GetBuffer():  Out of memory!"); SetCachedHashCode(0); return IsArrayDynamicallyAllocated() ? _strData._bigBuffer : _strData._smallBuffer;}  // any write access invalidates our cached hash code
+   uint32 GetBufferLength() const {return (_bufferLen & ~INTERNED_BUFFER_BIT);}
+   void ReleaseBuffer() {if (IsInterned()) ReleaseInternedBuffer(); else if (IsArrayDynamicallyAllocated()) muscleFree(_strData._bigBuffer);}
+   void ReleaseInternedBuffer();
+   status_t DetachFromInternedBuffer();
+
+   // If this bit is set in (_bufferLen), then (_strData._bigBuffer) points into a shared entry in the interned-strings table
+   enum {INTERNED_BUFFER_BIT = 0x80000000};
    void ClearSmallBuffer() {memset(_strData._smallBuffer, 0, sizeof(_strData._smallBuffer));}
+
+#ifdef MUSCLE_AVOID_CACHED_STRING_HASH_CODES
+   enum {HASH_CACHE_BYTES = 0};
+   uint32 GetCachedHashCode() const {return 0;}
+   void SetCachedHashCode(uint32 /*hashCode*/) const {/* empty */}
+   void InitCachedHashCode() {/* empty */}
+#else
+   // When our chars are stored on the heap, our hash code is cached in a uint32 slot that is allocated just past
+   // the end of our buffer (rounded up to the next 4-byte boundary, hence the 3 extra bytes of HASH_CACHE_BYTES).
+   // A cached value of zero means "not calculated".  HashCode() is a const method and so may be called on the same
+   // String from several threads at once; that's why the slot is only accessed via relaxed atomic loads and stores.
+   // (The worst that can happen is that two threads both calculate the hash code and store the same value.)
+   // Interned buffers have their hash code pre-calculated, and since they are shared, we never write to them.
+   enum {HASH_CACHE_BYTES = sizeof(uint32)+3};
+#ifdef MUSCLE_SINGLE_THREAD_ONLY
+   typedef uint32 HashCodeCacheSlot;
+   static uint32 LoadCachedHashCode(const HashCodeCacheSlot * slot) {return *slot;}
+   static void StoreCachedHashCode(HashCodeCacheSlot * slot, uint32 hashCode) {*slot = hashCode;}
+#else
+   typedef std::atomic<uint32> HashCodeCacheSlot;
+   static uint32 LoadCachedHashCode(const HashCodeCacheSlot * slot) {return slot->load(std::memory_order_relaxed);}
+   static void StoreCachedHashCode(HashCodeCacheSlot * slot, uint32 hashCode) {slot->store(hashCode, std::memory_order_relaxed);}
+#endif
+   HashCodeCacheSlot * GetHashCodeCacheSlot() const {return reinterpret_cast<HashCodeCacheSlot *>(_strData._bigBuffer+GetHashCodeCacheOffset(GetBufferLength()));}
+   uint32 GetCachedHashCode() const {return IsArrayDynamicallyAllocated() ? LoadCachedHashCode(GetHashCodeCacheSlot()) : 0;}
+   void SetCachedHashCode(uint32 hashCode) const {if ((IsArrayDynamicallyAllocated())&&(IsInterned() == false)) StoreCachedHashCode(GetHashCodeCacheSlot(), hashCode);}
+   void InitCachedHashCode() {(void) new (GetHashCodeCacheSlot()) HashCodeCacheSlot(0);}  // must be called whenever a new heap buffer is put into place
+#endif
    void WriteNULTerminatorByte() {GetBuffer()[_length] = '\0';}
 
    union StringUnion {  // the StringUnion name is apparently necessary for muscleSwap() to work on the union
@@ -1136,7 +1237,7 @@ private:
       char _smallBuffer[SMALL_MUSCLE_STRING_LENGTH+1];  // inline character array.      Valid iff (_bufferLen <= sizeof(_smallBuffer))
    } _strData;
 
-   uint32 _bufferLen;         // Number of bytes pointed to by (GetBuffer())
+   uint32 _bufferLen;         // Number of bytes pointed to by (GetBuffer()), possibly OR'd with INTERNED_BUFFER_BIT
    uint32 _length;            // cached strlen(GetBuffer())
 
    void VerifyIndex(uint32 index) const 
@@ -1185,6 +1286,16 @@ public:
 /** Convenience method:  returns a string with no characters in it (a.k.a. "") */
 inline const String & GetEmptyString() {return GetDefaultObjectForType<String>();}
 
+/** Removes from the global interned-strings table any entries that are no longer in use by any String.
+  * This is done automatically whenever the table has doubled in size since its last purge, so you
+  * only need to call this if you want to reclaim the memory of unused entries immediately.
+  * @returns the number of entries that were removed from the table.
+  */
+uint32 PurgeUnusedInternedStrings();
+
+/** Returns the number of entries currently held in the global interned-strings table.  (Mainly useful for debugging) */
+uint32 GetNumInternedStrings();
+
 inline String operator+(const String & lhs, const String & rhs)  {String ret; (void) ret.Prealloc(lhs.Length()+rhs.Length());        ret = lhs; ret += rhs; return ret;}
 inline String operator+(const String & lhs, const char *rhs)     {String ret; (void) ret.Prealloc(lhs.Length()+(rhs?(uint32)strlen(rhs):0)); ret = lhs; ret += rhs; return ret;}
 inline String operator+(const char * lhs,   const String & rhs)  {String ret; (void) ret.Prealloc((lhs?(uint32)strlen(lhs):0)+rhs.Length()); ret = lhs; ret += rhs; return ret;}
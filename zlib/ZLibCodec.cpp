@@ -4,6 +4,8 @@
 
 #include "dataio/DataIO.h"
 #include "zlib/ZLibCodec.h"
+#include "zlib/ZLibParallelDeflate.h"
+#include "util/Hashtable.h"
 #include "system/GlobalMemoryAllocator.h"
 
 namespace muscle {
@@ -20,6 +22,9 @@ static void muscleZLibFree(void *, void * address) {using namespace muscle; musc
 
 ZLibCodec :: ZLibCodec(int compressionLevel)
    : _compressionLevel(muscleClamp(compressionLevel, 0, 9))
+   , _presetDictionaryID(0)
+   , _mismatchedPresetDictionaryID(0)
+   , _nextDeflateMustBeIndependent(false)
 {
    InitStream(_inflater);
    _inflateOkay = (inflateInit(&_inflater) == Z_OK);
@@ -57,6 +62,90 @@ void ZLibCodec :: InitStream(z_stream & stream)
    stream.opaque    = Z_NULL;
 }
 
+enum {
+   ZLIB_MAX_PRESET_DICTIONARY_SIZE = 32*1024  // zlib's window size; bytes further back than this can't be referenced anyway
+};
+
+status_t ZLibCodec :: SetPresetDictionary(const ConstByteBufferRef & dict)
+{
+   _presetDictionary   = dict;
+   _presetDictionaryID = 0;
+   if ((_presetDictionary())&&(_presetDictionary()->GetNumBytes() > ZLIB_MAX_PRESET_DICTIONARY_SIZE))
+   {
+      // Keep just the tail, so that the dictionary ID will match the bytes zlib actually uses
+      ByteBufferRef tail = GetByteBufferFromPool(ZLIB_MAX_PRESET_DICTIONARY_SIZE, _presetDictionary()->GetBuffer()+_presetDictionary()->GetNumBytes()-ZLIB_MAX_PRESET_DICTIONARY_SIZE);
+      if (tail() == NULL) return B_ERROR;
+      _presetDictionary = tail;
+   }
+   if ((_presetDictionary())&&(_presetDictionary()->GetNumBytes() == 0)) _presetDictionary.Reset();
+   if (_presetDictionary()) _presetDictionaryID = (uint32) adler32(adler32(0, Z_NULL, 0), _presetDictionary()->GetBuffer(), _presetDictionary()->GetNumBytes());
+
+   if ((_inflateOkay)&&(inflateReset(&_inflater) != Z_OK)) _inflateOkay = false;
+   return ((_deflateOkay)&&(ResetDeflater() == B_NO_ERROR)&&(_inflateOkay)) ? B_NO_ERROR : B_ERROR;
+}
+
+// Restarts the deflate stream, primed with our preset dictionary (if any)
+status_t ZLibCodec :: ResetDeflater()
+{
+   if ((deflateReset(&_deflater) == Z_OK)&&((_presetDictionary() == NULL)||(deflateSetDictionary(&_deflater, _presetDictionary()->GetBuffer(), _presetDictionary()->GetNumBytes()) == Z_OK)))
+   {
+      _nextDeflateMustBeIndependent = false;
+      return B_NO_ERROR;
+   }
+
+   _deflateOkay = false;
+   return B_ERROR;
+}
+
+// Calls inflate(), and supplies our preset dictionary if the stream asks for it
+int ZLibCodec :: InflateAux()
+{
+   _mismatchedPresetDictionaryID = 0;
+
+   int zRet = inflate(&_inflater, Z_SYNC_FLUSH);
+   if (zRet == Z_NEED_DICT)
+   {
+      if ((_presetDictionary())&&(_inflater.adler == _presetDictionaryID)&&(inflateSetDictionary(&_inflater, _presetDictionary()->GetBuffer(), _presetDictionary()->GetNumBytes()) == Z_OK)) zRet = inflate(&_inflater, Z_SYNC_FLUSH);
+      else _mismatchedPresetDictionaryID = (uint32) _inflater.adler;  // zlib puts the ID of the dictionary it wants here
+   }
+   return zRet;
+}
+
+ByteBufferRef ZLibCodec :: BuildPresetDictionary(const Queue<ConstByteBufferRef> & samples, uint32 maxDictionarySize)
+{
+   maxDictionarySize = muscleMin(maxDictionarySize, (uint32)ZLIB_MAX_PRESET_DICTIONARY_SIZE);
+
+   // Choose samples from the last one backwards, until we run out of room
+   Queue<uint32> chosen;
+   Hashtable<uint32, Void> seen;  // hash codes of the samples we've chosen so far
+   uint32 dictSize = 0;
+   for (int32 i=samples.GetNumItems()-1; (i>=0)&&(dictSize < maxDictionarySize); i--)
+   {
+      const ByteBuffer * b = samples[i]();
+      if ((b == NULL)||(b->GetNumBytes() == 0)) continue;
+
+      const uint32 hashCode = CalculateHashCode(b->GetBuffer(), b->GetNumBytes());
+      if (seen.ContainsKey(hashCode)) continue;
+      if ((seen.PutWithDefault(hashCode) != B_NO_ERROR)||(chosen.AddHead(i) != B_NO_ERROR)) return ByteBufferRef();
+      dictSize = muscleMin(dictSize+b->GetNumBytes(), maxDictionarySize);
+   }
+
+   ByteBufferRef ret = GetByteBufferFromPool(dictSize);
+   if (ret())
+   {
+      // Lay the chosen samples out in their original order; if the first one doesn't fit, we keep only its tail
+      uint8 * out = ret()->GetBuffer()+dictSize;
+      for (int32 i=chosen.GetNumItems()-1; i>=0; i--)
+      {
+         const ByteBuffer & b = *samples[chosen[i]]();
+         const uint32 numBytes = muscleMin(b.GetNumBytes(), (uint32)(out-ret()->GetBuffer()));
+         out -= numBytes;
+         memcpy(out, b.GetBuffer()+b.GetNumBytes()-numBytes, numBytes);
+      }
+   }
+   return ret;
+}
+
 static const uint32 ZLIB_CODEC_HEADER_DEPENDENT   = 2053925218;               // 'zlib'
 static const uint32 ZLIB_CODEC_HEADER_INDEPENDENT = 2053925219;               // 'zlic'
 static const uint32 ZLIB_CODEC_HEADER_SIZE  = sizeof(uint32)+sizeof(uint32);  // 4 bytes of magic, 4 bytes of raw-size
@@ -73,11 +162,8 @@ ByteBufferRef ZLibCodec :: Deflate(const uint8 * rawBytes, uint32 numRaw, bool i
    ByteBufferRef ret; 
    if ((rawBytes)&&(_deflateOkay))
    {
-      if ((independent)&&(deflateReset(&_deflater) != Z_OK))
-      {
-         _deflateOkay = false;
-         return ByteBufferRef();
-      }
+      if (_nextDeflateMustBeIndependent) independent = true;
+      if ((independent)&&(ResetDeflater() != B_NO_ERROR)) return ByteBufferRef();
 
       const uint32 compAvailSize = ZLIB_CODEC_HEADER_SIZE+deflateBound(&_deflater, numRaw)+13;
       ret = GetByteBufferFromPool(addHeaderBytes+compAvailSize+addFooterBytes);
@@ -106,11 +192,8 @@ status_t ZLibCodec :: Deflate(const uint8 * rawBytes, uint32 numRaw, bool indepe
 {
    if ((rawBytes)&&(_deflateOkay))
    {
-      if ((independent)&&(deflateReset(&_deflater) != Z_OK))
-      {
-         _deflateOkay = false;
-         return B_ERROR;
-      }
+      if (_nextDeflateMustBeIndependent) independent = true;
+      if ((independent)&&(ResetDeflater() != B_NO_ERROR)) return B_ERROR;
 
       const uint32 compAvailSize = ZLIB_CODEC_HEADER_SIZE+deflateBound(&_deflater, numRaw)+13;
       if (outBuf.SetNumBytes(addHeaderBytes+compAvailSize+addFooterBytes, false) == B_NO_ERROR)
@@ -133,6 +216,28 @@ status_t ZLibCodec :: Deflate(const uint8 * rawBytes, uint32 numRaw, bool indepe
    return B_ERROR;
 }
 
+ByteBufferRef ZLibCodec :: DeflateParallel(const uint8 * rawBytes, uint32 numRaw, IParallelJobRunner & runner, uint32 chunkSize, uint32 addHeaderBytes, uint32 addFooterBytes)
+{
+   if ((rawBytes == NULL)||(_deflateOkay == false)) return ByteBufferRef();
+   if (numRaw <= chunkSize) return Deflate(rawBytes, numRaw, true, addHeaderBytes, addFooterBytes);
+
+   uint8 zHeader[6];
+   const uint32 zHeaderSize = WriteZLibStreamHeader(zHeader, _compressionLevel, _presetDictionaryID);
+   const uint32 prefixSize  = addHeaderBytes+ZLIB_CODEC_HEADER_SIZE+zHeaderSize;
+   ByteBufferRef ret = GetByteBufferFromPool(prefixSize+GetZLibParallelDeflateBound(numRaw, chunkSize)+addFooterBytes);
+   if (ret() == NULL) return ByteBufferRef();
+   memcpy(ret()->GetBuffer()+addHeaderBytes+ZLIB_CODEC_HEADER_SIZE, zHeader, zHeaderSize);
+
+   const ByteBuffer * dict = _presetDictionary();
+   const int32 numDeflated = ZLibParallelDeflateRawChunks(rawBytes, numRaw, dict?dict->GetBuffer():NULL, dict?dict->GetNumBytes():0, _compressionLevel, false, ret()->GetBuffer()+prefixSize, &runner, chunkSize);
+   if ((numDeflated < 0)||(ret()->SetNumBytes(prefixSize+numDeflated+addFooterBytes, true) != B_NO_ERROR)) return ByteBufferRef();
+   (void) ret()->FreeExtraBytes();  // no sense keeping all that extra space around, is there?
+
+   WriteZLibCodecHeader(ret()->GetBuffer()+addHeaderBytes, true, numRaw);
+   _nextDeflateMustBeIndependent = true;  // since the peer's inflater has now seen data that our deflater hasn't
+   return ret;
+}
+
 int32 ZLibCodec :: GetInflatedSize(const uint8 * compBytes, uint32 numComp, bool * optRetIsIndependent) const
 {
    if ((compBytes)&&(numComp >= ZLIB_CODEC_HEADER_SIZE))
@@ -172,7 +277,7 @@ ByteBufferRef ZLibCodec :: Inflate(const uint8 * compBytes, uint32 numComp)
          _inflater.total_out = 0;
          _inflater.avail_out = ret()->GetNumBytes();
 
-         const int zRet = inflate(&_inflater, Z_SYNC_FLUSH);
+         const int zRet = InflateAux();
          if (((zRet != Z_OK)&&(zRet != Z_STREAM_END))||((int32)_inflater.total_out != rawLen)) ret.Reset();  // oopsie!
       }
    }
@@ -201,7 +306,7 @@ status_t ZLibCodec :: Inflate(const uint8 * compBytes, uint32 numComp, ByteBuffe
          _inflater.total_out = 0;
          _inflater.avail_out = outBuf.GetNumBytes();
 
-         const int zRet = inflate(&_inflater, Z_SYNC_FLUSH);
+         const int zRet = InflateAux();
          return (((zRet != Z_OK)&&(zRet != Z_STREAM_END))||((int32)_inflater.total_out != rawLen)) ? B_ERROR : B_NO_ERROR;
       }
    }
@@ -218,11 +323,8 @@ status_t ZLibCodec :: ReadAndDeflateAndWrite(DataIO & sourceRawIO, DataIO & dest
    ByteBuffer scratchOutBuf(scratchInBuf.GetNumBytes()*2);  // yes, bigger than scratchInBuf!  Because I'm paranoid
    if (scratchOutBuf.GetNumBytes() == 0) return B_ERROR;
 
-   if ((independent)&&(deflateReset(&_deflater) != Z_OK))
-   {
-      _deflateOkay = false;
-      return B_ERROR;
-   }
+   if (_nextDeflateMustBeIndependent) independent = true;
+   if ((independent)&&(ResetDeflater() != B_NO_ERROR)) return B_ERROR;
 
    uint8 headerBuf[ZLIB_CODEC_HEADER_SIZE];
    WriteZLibCodecHeader(headerBuf, independent, totalBytesToRead);
@@ -311,7 +413,7 @@ status_t ZLibCodec :: ReadAndInflateAndWrite(DataIO & sourceDeflatedIO, DataIO &
          _inflater.avail_in = numBytesRead;
       }
 
-      const int zRet = inflate(&_inflater, Z_SYNC_FLUSH);
+      const int zRet = InflateAux();
       if ((zRet != Z_OK)&&(zRet != Z_STREAM_END)) return B_ERROR;
 
       // If inflate() generated some inflated bytes, write them out to the destInflatedIO
@@ -6,11 +6,17 @@
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
 
 # include "util/ByteBuffer.h"
+# include "util/Queue.h"
 # include "zlib/zlib/zlib.h"
 
+# ifndef MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE
+#  define MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE (128*1024)  /**< Default number of raw bytes per chunk, when deflating in parallel */
+# endif
+
 namespace muscle {
  
 class DataIO;
+class IParallelJobRunner;
 
 /** This class is a handy wrapper around the zlib C functions.
   * It quickly and easily inflates and deflates data to/from independently compressed chunks.
@@ -34,6 +40,44 @@ public:
      */
    int GetCompressionLevel() const {return _compressionLevel;}
 
+   /** Sets a preset dictionary for this codec to use.  A preset dictionary primes the compressor with byte sequences
+     * that are likely to appear in the data, so that even a small buffer compressed with (independent) set to true
+     * can refer back to them, instead of having to start cold.  Both the compressing codec and the inflating codec
+     * must use the same dictionary; the dictionary's ID is embedded in each compressed stream, so data compressed with
+     * a different dictionary (or with none) will fail to inflate rather than inflating to garbage.
+     * Note that this call restarts the compression and decompression streams, so it should be called at the same point
+     * in the data on both sides (typically before any data is compressed at all).
+     * @param dict The dictionary bytes (e.g. as returned by BuildPresetDictionary()), or a NULL reference to use no dictionary.
+     *             Only the last 32 kilobytes of the dictionary will be used.
+     * @returns B_NO_ERROR on success, or B_ERROR on failure.
+     */
+   status_t SetPresetDictionary(const ConstByteBufferRef & dict);
+
+   /** Returns the preset dictionary that was passed to SetPresetDictionary(), or a NULL reference if there isn't one. */
+   const ConstByteBufferRef & GetPresetDictionary() const {return _presetDictionary;}
+
+   /** Returns the ID of our preset dictionary (the Adler-32 checksum of its bytes, as zlib embeds in the compressed stream),
+     * or zero if we have no preset dictionary.  Peers can exchange this value to check that they are using the same dictionary.
+     */
+   uint32 GetPresetDictionaryID() const {return _presetDictionaryID;}
+
+   /** Returns the ID of the preset dictionary that the data passed to the most recent Inflate() call was compressed with,
+     * if that call failed because we don't have that dictionary (i.e. our preset dictionary is a different one, or we
+     * have none).  Returns zero if the most recent Inflate() call didn't fail for that reason.
+     */
+   uint32 GetMismatchedPresetDictionaryID() const {return _mismatchedPresetDictionaryID;}
+
+   /** Convenience method:  Builds a preset dictionary out of some sample data, e.g. flattened Messages captured
+     * from typical traffic, or the most recently sent Messages on a connection.  The later samples are taken to be
+     * the more important ones, and are placed nearer to the end of the dictionary, where zlib can encode references
+     * to them most cheaply.  Samples that are exact duplicates of a later sample are skipped.
+     * @param samples The sample data buffers.  NULL references are ignored.
+     * @param maxDictionarySize The maximum number of bytes the dictionary should contain.  Values above 32 kilobytes
+     *                          are treated as 32 kilobytes, since zlib can't refer any further back than that.
+     * @returns a reference to the dictionary bytes on success, or a NULL reference on failure (out of memory).
+     */
+   static ByteBufferRef BuildPresetDictionary(const Queue<ConstByteBufferRef> & samples, uint32 maxDictionarySize = 32*1024);
+
    /** Given a buffer of raw data, returns a reference to a Buffer containing the corresponding compressed data.
      * @param rawData The raw data to compress
      * @param numBytes The number of bytes (rawData) points to
@@ -128,6 +172,23 @@ public:
      */
    status_t Deflate(const ByteBuffer & rawData, bool independent, ByteBuffer & targetBuf, uint32 addHeaderBytes=0, uint32 addFooterBytes=0) {return Deflate(rawData.GetBuffer(), rawData.GetNumBytes(), independent, targetBuf, addHeaderBytes, addFooterBytes);}
 
+   /** Like Deflate(), except that large inputs are split into chunks that are compressed concurrently via (runner),
+     * pigz-style.  The returned buffer is always independent, and is in the same format as the buffers returned by
+     * Deflate(), so a single call to Inflate() will decompress it.  Compression will be slightly less efficient than
+     * with Deflate(), since each chunk can only refer back to the 32KB of raw data that precede it.
+     * Note that since our ongoing compression stream doesn't include this data, the next Deflate() call made after this
+     * one will generate an independent buffer, even if (independent) was passed in to it as false.
+     * @param rawData The raw data to compress
+     * @param numBytes The number of bytes (rawData) points to.  If this is no greater than (chunkSize), this call
+     *                 is equivalent to calling Deflate(rawData, numBytes, true, addHeaderBytes, addFooterBytes).
+     * @param runner The object to compress the chunks with, e.g. a ThreadPoolJobRunner.
+     * @param chunkSize The number of raw bytes to place in each chunk.  Defaults to MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE.
+     * @param addHeaderBytes Number of undefined bytes to place before the compressed data (see Deflate() for details)
+     * @param addFooterBytes Number of undefined bytes to place after the compressed data (see Deflate() for details)
+     * @returns Reference to a buffer of compressed data on success, or a NULL reference on failure.
+     */
+   ByteBufferRef DeflateParallel(const uint8 * rawData, uint32 numBytes, IParallelJobRunner & runner, uint32 chunkSize = MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE, uint32 addHeaderBytes=0, uint32 addFooterBytes=0);
+
    /** Given a buffer of compressed data, returns a reference to a Buffer containing the corresponding raw data, or NULL on failure.
      * @param compressedData The compressed data to expand.  This should be data that was previously produced by the Deflate() method.
      * @param numBytes The number of bytes (compressedData) points to
@@ -205,13 +266,20 @@ public:
 
 private:
    void InitStream(z_stream & stream);
+   status_t ResetDeflater();
+   int InflateAux();
 
    int _compressionLevel;
 
+   ConstByteBufferRef _presetDictionary;
+   uint32 _presetDictionaryID;
+   uint32 _mismatchedPresetDictionaryID;  // set by InflateAux() when the stream needs a dictionary we don't have
+
    bool _inflateOkay;
    z_stream _inflater;
 
    bool _deflateOkay;
+   bool _nextDeflateMustBeIndependent;  // set by DeflateParallel(), since the receiver's inflater will no longer match our deflater
    z_stream _deflater;
 };
 
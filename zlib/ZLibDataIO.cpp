@@ -3,6 +3,7 @@
 #ifdef MUSCLE_ENABLE_ZLIB_ENCODING
 
 #include "zlib/ZLibDataIO.h"
+#include "zlib/ZLibParallelDeflate.h"
 #include "system/GlobalMemoryAllocator.h"
 
 namespace muscle {
@@ -19,6 +20,8 @@ static void muscleZLibFree(void *, void * address) {muscleFree(address);}
 
 ZLibDataIO :: ZLibDataIO(int compressionLevel)
    : _compressionLevel(compressionLevel)
+   , _parallelRunner(NULL)
+   , _parallelBatchSize(0)
 {
    Init();
    SetChildDataIO(DataIORef());  // necessary to get the ZLib stuff initialized
@@ -26,6 +29,8 @@ ZLibDataIO :: ZLibDataIO(int compressionLevel)
 
 ZLibDataIO :: ZLibDataIO(const DataIORef & childIO, int compressionLevel)
    : _compressionLevel(compressionLevel)  // deliberately NOT calling ProxyDataIO(childIO) ctor here!
+   , _parallelRunner(NULL)
+   , _parallelBatchSize(0)
 {
    Init();
    SetChildDataIO(childIO);  // necessary to get the ZLib stuff initialized
@@ -75,6 +80,12 @@ void ZLibDataIO :: Init()
    InitStream(_writeDeflater, _toDeflateBuf, _deflatedBuf, sizeof(_deflatedBuf));
    _deflateAllocated = false;
    _sendToChild = _deflatedBuf;
+
+   _parallelHeaderWritten = false;
+   _parallelRawBuf.Clear();
+   _parallelHistory.Clear();
+   _parallelDeflatedBuf.Clear();
+   _parallelDeflatedSent = 0;
 }
 
 void ZLibDataIO :: SetChildDataIO(const DataIORef & dio)
@@ -124,8 +135,16 @@ int32 ZLibDataIO :: Read(void * buffer, uint32 size)
       // Lastly, try to read and inflate some more bytes from our stream
       if (_inputStreamOkay)
       {
-         if (_readInflater.avail_in == 0) _readInflater.next_in = _toInflateBuf;
-         int32 bytesRead = ProxyDataIO::Read(_readInflater.next_in, (int32)((_toInflateBuf+sizeof(_toInflateBuf))-_readInflater.next_in));
+              if (_readInflater.avail_in == 0) _readInflater.next_in = _toInflateBuf;
+         else if (_readInflater.next_in > _toInflateBuf)
+         {
+            // Move the bytes that inflate() hasn't consumed yet to the front of the buffer, to make room for more
+            memmove(_toInflateBuf, _readInflater.next_in, _readInflater.avail_in);
+            _readInflater.next_in = _toInflateBuf;
+         }
+
+         uint8 * appendTo = _readInflater.next_in+_readInflater.avail_in;  // don't overwrite any bytes that inflate() hasn't consumed yet!
+         int32 bytesRead = ProxyDataIO::Read(appendTo, (int32)((_toInflateBuf+sizeof(_toInflateBuf))-appendTo));
          if (bytesRead >= 0)
          {
             _readInflater.avail_in += bytesRead;
@@ -139,7 +158,89 @@ int32 ZLibDataIO :: Read(void * buffer, uint32 size)
 
 int32 ZLibDataIO :: Write(const void * buffer, uint32 size)
 {
-   return WriteAux(buffer, size, false);
+   return _parallelRunner ? WriteParallelAux(buffer, size, false) : WriteAux(buffer, size, false);
+}
+
+status_t ZLibDataIO :: SetParallelDeflate(IParallelJobRunner * runner, uint32 batchSize)
+{
+   if ((_writeDeflater.total_in > 0)||(_writeDeflater.avail_in > 0)||(_parallelHeaderWritten)||(_parallelRawBuf.GetNumBytes() > 0)) return B_ERROR;  // too late to switch streams now
+
+   _parallelRunner    = runner;
+   _parallelBatchSize = muscleMax(batchSize, (uint32)1);
+   return B_NO_ERROR;
+}
+
+// Passes as many of our compressed bytes as possible to the child DataIO
+status_t ZLibDataIO :: SendParallelOutput()
+{
+   while(_parallelDeflatedSent < _parallelDeflatedBuf.GetNumBytes())
+   {
+      const int32 bytesWritten = ProxyDataIO::Write(_parallelDeflatedBuf.GetBuffer()+_parallelDeflatedSent, _parallelDeflatedBuf.GetNumBytes()-_parallelDeflatedSent);
+      if (bytesWritten < 0) return B_ERROR;
+      if (bytesWritten == 0) break;  // child can't accept any more right now
+      _parallelDeflatedSent += bytesWritten;
+   }
+   return B_NO_ERROR;
+}
+
+// Compresses all of the data in (_parallelRawBuf) into (_parallelDeflatedBuf), which must be empty/all-sent
+status_t ZLibDataIO :: DeflateParallelBatch()
+{
+   _parallelDeflatedSent = 0;
+
+   uint8 zHeader[6];
+   const uint32 zHeaderSize = _parallelHeaderWritten ? 0 : WriteZLibStreamHeader(zHeader, _compressionLevel, 0);
+   const uint8 * raw = _parallelRawBuf.GetBuffer();
+   const uint32 numRaw = _parallelRawBuf.GetNumBytes();
+   if (_parallelDeflatedBuf.SetNumBytes(zHeaderSize+GetZLibParallelDeflateBound(numRaw), false) != B_NO_ERROR) return B_ERROR;
+   memcpy(_parallelDeflatedBuf.GetBuffer(), zHeader, zHeaderSize);
+
+   const int32 numDeflated = ZLibParallelDeflateRawChunks(raw, numRaw, _parallelHistory.GetBuffer(), _parallelHistory.GetNumBytes(), _compressionLevel, false, _parallelDeflatedBuf.GetBuffer()+zHeaderSize, _parallelRunner);
+   if ((numDeflated < 0)||(_parallelDeflatedBuf.SetNumBytes(zHeaderSize+numDeflated, true) != B_NO_ERROR))
+   {
+      _parallelDeflatedBuf.Clear();
+      return B_ERROR;
+   }
+   _parallelHeaderWritten = true;
+
+   // Remember the tail end of what we've compressed, so the next batch can refer back to it
+   const uint32 windowSize = 32*1024;
+   if (numRaw >= windowSize)
+   {
+      if (_parallelHistory.SetBuffer(windowSize, raw+numRaw-windowSize) != B_NO_ERROR) return B_ERROR;
+   }
+   else
+   {
+      if (_parallelHistory.AppendBytes(raw, numRaw, false) != B_NO_ERROR) return B_ERROR;
+      const uint32 histSize = _parallelHistory.GetNumBytes();
+      if (histSize > windowSize)
+      {
+         memmove(_parallelHistory.GetBuffer(), _parallelHistory.GetBuffer()+histSize-windowSize, windowSize);
+         (void) _parallelHistory.SetNumBytes(windowSize, true);
+      }
+   }
+
+   _parallelRawBuf.Clear();
+   return B_NO_ERROR;
+}
+
+int32 ZLibDataIO :: WriteParallelAux(const void * buffer, uint32 size, bool flushAtEnd)
+{
+   if ((GetChildDataIO()() == NULL)||(SendParallelOutput() != B_NO_ERROR)) return -1;
+
+   uint32 bytesAccepted = 0;
+   if ((buffer)&&(_parallelRawBuf.GetNumBytes() < _parallelBatchSize))
+   {
+      bytesAccepted = muscleMin(size, _parallelBatchSize-_parallelRawBuf.GetNumBytes());
+      if (_parallelRawBuf.AppendBytes((const uint8 *)buffer, bytesAccepted) != B_NO_ERROR) return -1;
+   }
+
+   const bool batchReady = (_parallelRawBuf.GetNumBytes() >= _parallelBatchSize)||((flushAtEnd)&&(_parallelRawBuf.GetNumBytes() > 0));
+   if ((batchReady)&&(_parallelDeflatedSent == _parallelDeflatedBuf.GetNumBytes()))
+   {
+      if ((DeflateParallelBatch() != B_NO_ERROR)||(SendParallelOutput() != B_NO_ERROR)) return -1;
+   }
+   return bytesAccepted;
 }
 
 #define ZLIB_WRITE_SEND_TO_SLAVE                                                                           \
@@ -167,11 +268,19 @@ int32 ZLibDataIO :: WriteAux(const void * buffer, uint32 size, bool flushAtEnd)
       ZLIB_WRITE_SEND_TO_SLAVE;
       if (_sendToChild == _deflatedBuf)
       {
-         if (_writeDeflater.avail_in == 0) _writeDeflater.next_in = _toDeflateBuf;
+              if (_writeDeflater.avail_in == 0) _writeDeflater.next_in = _toDeflateBuf;
+         else if (_writeDeflater.next_in > _toDeflateBuf)
+         {
+            // Move the bytes that deflate() hasn't consumed yet to the front of the buffer, to make room for more
+            memmove(_toDeflateBuf, _writeDeflater.next_in, _writeDeflater.avail_in);
+            _writeDeflater.next_in = _toDeflateBuf;
+         }
+
          if (buffer)
          {
-            uint32 bytesToCopy = muscleMin((uint32)((_toDeflateBuf+sizeof(_toDeflateBuf))-_writeDeflater.next_in), size);
-            memcpy(_writeDeflater.next_in, buffer, bytesToCopy);
+            uint8 * appendTo = _writeDeflater.next_in+_writeDeflater.avail_in;  // don't overwrite any bytes that deflate() hasn't consumed yet!
+            uint32 bytesToCopy = muscleMin((uint32)((_toDeflateBuf+sizeof(_toDeflateBuf))-appendTo), size);
+            memcpy(appendTo, buffer, bytesToCopy);
             bytesCompressed += bytesToCopy;
 #ifdef REMOVED_TO_SUPPRESS_CLANG_STATIC_ANALYZER_WARNING_BUT_REENABLE_THIS_IF_THERES_ANOTHER_STEP_ADDED_IN_THE_FUTURE
             uint8 * buf8 = (uint8 *) buffer;
@@ -192,7 +301,19 @@ int32 ZLibDataIO :: WriteAux(const void * buffer, uint32 size, bool flushAtEnd)
 
 void ZLibDataIO :: FlushOutput()
 {
-   if (GetChildDataIO()()) for (uint32 i=0; i<3; i++) WriteAux(NULL, 0, true);  // try to flush any/all buffered data out first...
+   if (GetChildDataIO()())
+   {
+      // Try to flush any/all buffered data out first... the deflater may be holding more than one buffer's worth
+      while(1)
+      {
+         const uLong prevTotalOut = _writeDeflater.total_out;
+         const uint8 * prevSendToChild = _sendToChild;
+         const uint32 prevRawBytes = _parallelRawBuf.GetNumBytes();
+         const uint32 prevParallelSent = _parallelDeflatedSent;
+         if ((_parallelRunner ? WriteParallelAux(NULL, 0, true) : WriteAux(NULL, 0, true)) < 0) break;
+         if ((_writeDeflater.total_out == prevTotalOut)&&(_sendToChild == prevSendToChild)&&(_parallelRawBuf.GetNumBytes() == prevRawBytes)&&(_parallelDeflatedSent == prevParallelSent)) break;  // no more progress to be made
+      }
+   }
    ProxyDataIO::FlushOutput();
 }
 
@@ -206,12 +327,12 @@ void ZLibDataIO :: Shutdown()
 
 bool ZLibDataIO :: HasBufferedOutput() const
 {
-   return ((_sendToChild < _writeDeflater.next_out)||(_writeDeflater.avail_in > 0));
+   return ((_sendToChild < _writeDeflater.next_out)||(_writeDeflater.avail_in > 0)||(_parallelRawBuf.GetNumBytes() > 0)||(_parallelDeflatedSent < _parallelDeflatedBuf.GetNumBytes()));
 }
 
 void ZLibDataIO :: WriteBufferedOutput()
 {
-   (void) WriteAux(NULL, 0, false);
+   (void) (_parallelRunner ? WriteParallelAux(NULL, 0, true) : WriteAux(NULL, 0, false));
 }
 
 } // end namespace muscle
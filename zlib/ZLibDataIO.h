@@ -7,9 +7,13 @@
 
 # include "zlib/zlib/zlib.h"
 # include "dataio/ProxyDataIO.h"
+# include "util/ByteBuffer.h"
+# include "zlib/ZLibCodec.h"  // for MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE
 
 namespace muscle {
  
+class IParallelJobRunner;
+
 /** This class wraps around another DataIO and transparently compresses all 
   * data going to that DataIO, and decompresses all data coming from that
   * dataIO.
@@ -43,10 +47,29 @@ public:
 
    virtual void SetChildDataIO(const DataIORef & childDataIO);
 
+   /** Enables pigz-style parallel compression of the data written to this DataIO.  Outgoing data is collected
+     * into batches of (batchSize) bytes, and each batch is split into chunks that are compressed concurrently via
+     * (runner).  The output is still an ordinary zlib stream, so the receiving ZLibDataIO needn't be configured
+     * any differently.  Note that in this mode, written data is only compressed and passed on to the child DataIO
+     * when a full batch has accumulated, or when FlushOutput() or WriteBufferedOutput() is called.
+     * @param runner The object to compress the chunks with (e.g. a ThreadPoolJobRunner), or NULL to go back
+     *               to compressing in the calling thread, as a stream (which is the default).
+     * @param batchSize The number of bytes of written data to compress at once.  Defaults to 8 times MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE.
+     * @returns B_NO_ERROR on success, or B_ERROR if data has already been written to this DataIO (in which
+     *          case the compression mode can only be changed after the next call to SetChildDataIO()).
+     */
+   status_t SetParallelDeflate(IParallelJobRunner * runner, uint32 batchSize = 8*MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE);
+
+   /** Returns the IParallelJobRunner that was passed to SetParallelDeflate(), or NULL if parallel compression isn't enabled. */
+   IParallelJobRunner * GetParallelDeflateRunner() const {return _parallelRunner;}
+
 private:
    void Init();
    void InitStream(z_stream & stream, uint8 * toStreamBuf, uint8 * fromStreamBuf, uint32 outBufSize);
    int32 WriteAux(const void * buffer, uint32 size, bool flushAtEnd);
+   int32 WriteParallelAux(const void * buffer, uint32 size, bool flushAtEnd);
+   status_t DeflateParallelBatch();
+   status_t SendParallelOutput();
    void CleanupZLib();
 
    int _compressionLevel;
@@ -64,6 +87,14 @@ private:
    const uint8 * _sendToChild;
    bool _deflateAllocated;
    z_stream _writeDeflater;
+
+   IParallelJobRunner * _parallelRunner;
+   uint32 _parallelBatchSize;
+   bool _parallelHeaderWritten;
+   ByteBuffer _parallelRawBuf;      // written data that hasn't been compressed yet
+   ByteBuffer _parallelHistory;     // the last 32KB of data that we compressed, for priming the next batch
+   ByteBuffer _parallelDeflatedBuf; // compressed data that hasn't all been passed to the child DataIO yet
+   uint32 _parallelDeflatedSent;    // how many bytes of (_parallelDeflatedBuf) have been passed to the child DataIO
 };
 DECLARE_REFTYPES(ZLibDataIO);
 
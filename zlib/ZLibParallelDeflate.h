@@ -0,0 +1,166 @@
+/* This file is Copyright 2000-2013 Meyer Sound Laboratories Inc.  See the included LICENSE.txt file for details. */
+
+#ifndef ZLibParallelDeflate_h
+#define ZLibParallelDeflate_h
+
+#ifdef MUSCLE_ENABLE_ZLIB_ENCODING
+
+# include "system/IParallelJobRunner.h"
+# include "zlib/ZLibCodec.h"  // for MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE
+
+namespace muscle {
+
+#ifndef DOXYGEN_SHOULD_IGNORE_THIS
+// One chunk's worth of work for ZLibParallelDeflateRawChunks().  (Deliberately not using ByteBuffer here, since SysLog uses this too)
+class ZLibParallelDeflateChunk
+{
+public:
+   ZLibParallelDeflateChunk() : _rawData(NULL), _numRawBytes(0), _primingData(NULL), _numPrimingBytes(0), _compressionLevel(6), _flush(Z_SYNC_FLUSH), _out(NULL), _outSize(0), _numOutBytes(-1) {/* empty */}
+
+   const uint8 * _rawData;
+   uint32 _numRawBytes;
+   const uint8 * _primingData;  // the (up to) 32KB of data preceding (_rawData) in the stream, for back-references
+   uint32 _numPrimingBytes;
+   int _compressionLevel;
+   int _flush;
+   uint8 * _out;
+   uint32 _outSize;
+   int32 _numOutBytes;          // set to the number of bytes written to (_out), or left at -1 on failure
+};
+
+static inline void ZLibParallelDeflateChunkFunc(uint32 jobIndex, void * userData)
+{
+   ZLibParallelDeflateChunk & chunk = static_cast<ZLibParallelDeflateChunk *>(userData)[jobIndex];
+
+   z_stream stream;
+   memset(&stream, 0, sizeof(stream));  // Z_NULL zalloc/zfree/opaque, since this may be running in any thread
+   if (deflateInit2(&stream, chunk._compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;  // negative windowBits == raw deflate, no zlib header/trailer
+
+   if ((chunk._numPrimingBytes == 0)||(deflateSetDictionary(&stream, chunk._primingData, chunk._numPrimingBytes) == Z_OK))
+   {
+      stream.next_in   = (Bytef *) chunk._rawData;
+      stream.avail_in  = chunk._numRawBytes;
+      stream.next_out  = chunk._out;
+      stream.avail_out = chunk._outSize;
+
+      const int zRet = deflate(&stream, chunk._flush);
+      if (((zRet == Z_OK)||(zRet == Z_STREAM_END))&&(stream.avail_in == 0)&&(stream.avail_out > 0)) chunk._numOutBytes = (int32) stream.total_out;
+   }
+   (void) deflateEnd(&stream);
+}
+
+static inline uint32 GetZLibParallelDeflateChunkSize(uint32 chunkSize) {return muscleMax(chunkSize, (uint32)(32*1024));}  // chunks smaller than the deflate window don't make sense
+static inline uint32 GetZLibParallelDeflateChunkBound(uint32 chunkSize) {return chunkSize+(chunkSize>>12)+(chunkSize>>14)+(chunkSize>>25)+13+16;}  // zlib's compressBound(), plus room for the flush marker
+#endif
+
+/** Returns the number of bytes of output space that ZLibParallelDeflateRawChunks() needs, to compress (numBytes) bytes.
+  * @param numBytes The number of bytes of raw data to compress.
+  * @param chunkSize The chunk size that will be passed to ZLibParallelDeflateRawChunks().
+  */
+static inline uint32 GetZLibParallelDeflateBound(uint32 numBytes, uint32 chunkSize = MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE)
+{
+   chunkSize = GetZLibParallelDeflateChunkSize(chunkSize);
+   const uint32 numChunks = muscleMax((numBytes+chunkSize-1)/chunkSize, (uint32)1);
+   return (numChunks*GetZLibParallelDeflateChunkBound(chunkSize));
+}
+
+/** Writes a zlib stream header (as described in RFC 1950) into (buf), so that the raw deflate data
+  * generated by ZLibParallelDeflateRawChunks() can be decoded by an ordinary inflate() call.
+  * @param buf Pointer to at least 6 bytes of writable memory.
+  * @param compressionLevel The zlib compression level that the stream was compressed with (this is informational only)
+  * @param dictID The Adler-32 checksum of the preset dictionary the stream was primed with, or 0 if there isn't one.
+  * @returns The number of bytes written to (buf):  2, or 6 if (dictID) was non-zero.
+  */
+static inline uint32 WriteZLibStreamHeader(uint8 * buf, int compressionLevel, uint32 dictID)
+{
+   const uint8 levelBits = (compressionLevel < 2) ? 0 : ((compressionLevel < 6) ? 1 : ((compressionLevel == 6) ? 2 : 3));
+   uint16 header = (uint16) ((0x78<<8)|(levelBits<<6)|((dictID != 0) ? 0x20 : 0));  // 0x78 == deflate method with a 32KB window
+   header += (31-(header%31))%31;  // the FCHECK bits make the header a multiple of 31
+
+   buf[0] = (uint8) (header>>8);
+   buf[1] = (uint8) (header>>0);
+   if (dictID == 0) return 2;
+
+   muscleCopyOut(&buf[2], B_HOST_TO_BENDIAN_INT32(dictID));
+   return 6;
+}
+
+/** Compresses a buffer of raw data into a raw deflate bit-stream (i.e. one without any zlib or gzip header or
+  * trailer), pigz-style:  the data is split into chunks that are compressed concurrently via (optRunner), and the
+  * compressed chunks are concatenated into a single deflate stream that any inflater can decode.  Each chunk is
+  * primed with the 32KB of data that precede it, so the compression ratio stays close to that of a single-threaded
+  * deflate.  Each chunk except possibly the last one ends with a Z_SYNC_FLUSH marker.
+  * @param rawData The data to compress.
+  * @param numBytes The number of bytes that (rawData) points to.
+  * @param primingData If non-NULL, the data that precedes (rawData) in the stream (or a preset dictionary).  Only
+  *                    the last 32KB of it will be used.  Pass NULL if (rawData) is at the start of the stream.
+  * @param numPrimingBytes The number of bytes that (primingData) points to.
+  * @param compressionLevel The zlib compression level to use (0-9).
+  * @param endStream If true, the last chunk will be terminated with a final deflate block (as with Z_FINISH), so that
+  *                  no more data can be added to the stream.  If false, it will end with a Z_SYNC_FLUSH marker instead.
+  * @param outBuf The compressed data will be written here.  It must point to at least
+  *               GetZLibParallelDeflateBound(numBytes, chunkSize) bytes of writable memory.
+  * @param optRunner If non-NULL, the chunks will be compressed via this object (e.g. a ThreadPoolJobRunner).
+  *                  If NULL, or if the runner fails, the chunks will be compressed in the calling thread instead.
+  * @param chunkSize The number of raw bytes to place in each chunk.  Defaults to MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE.
+  * @returns The number of bytes written to (outBuf) on success, or -1 on failure.
+  */
+static inline int32 ZLibParallelDeflateRawChunks(const uint8 * rawData, uint32 numBytes, const uint8 * primingData, uint32 numPrimingBytes, int compressionLevel, bool endStream, uint8 * outBuf, IParallelJobRunner * optRunner, uint32 chunkSize = MUSCLE_ZLIB_PARALLEL_CHUNK_SIZE)
+{
+   const uint32 windowSize = 32*1024;  // how far back a deflate back-reference can reach
+   chunkSize = GetZLibParallelDeflateChunkSize(chunkSize);
+
+   const uint32 chunkBound = GetZLibParallelDeflateChunkBound(chunkSize);
+   const uint32 numChunks  = muscleMax((numBytes+chunkSize-1)/chunkSize, (uint32)1);  // even with no data, we need to emit the flush marker
+   ZLibParallelDeflateChunk * chunks = newnothrow_array(ZLibParallelDeflateChunk, numChunks);
+   if (chunks == NULL) {WARN_OUT_OF_MEMORY; return -1;}
+
+   for (uint32 i=0; i<numChunks; i++)
+   {
+      ZLibParallelDeflateChunk & c = chunks[i];
+      const uint32 offset = i*chunkSize;
+      c._rawData          = rawData+offset;
+      c._numRawBytes      = muscleMin(chunkSize, numBytes-offset);
+      c._compressionLevel = muscleClamp(compressionLevel, 0, 9);
+      c._flush            = ((endStream)&&(i == numChunks-1)) ? Z_FINISH : Z_SYNC_FLUSH;
+      c._out              = outBuf+(i*chunkBound);  // each chunk gets its own region of (outBuf), so they can all be written at once
+      c._outSize          = chunkBound;
+      if (i > 0)
+      {
+         c._numPrimingBytes = windowSize;
+         c._primingData     = c._rawData-windowSize;
+      }
+      else if (primingData)
+      {
+         c._numPrimingBytes = muscleMin(numPrimingBytes, windowSize);
+         c._primingData     = primingData+numPrimingBytes-c._numPrimingBytes;
+      }
+   }
+
+   if ((numChunks == 1)||(optRunner == NULL)||(optRunner->RunJobs(numChunks, ZLibParallelDeflateChunkFunc, chunks) != B_NO_ERROR))
+   {
+      for (uint32 i=0; i<numChunks; i++) ZLibParallelDeflateChunkFunc(i, chunks);
+   }
+
+   // Squeeze out the unused space between the compressed chunks
+   int32 ret = 0;
+   for (uint32 i=0; i<numChunks; i++)
+   {
+      const ZLibParallelDeflateChunk & c = chunks[i];
+      if (c._numOutBytes < 0)
+      {
+         ret = -1;
+         break;
+      }
+      memmove(outBuf+ret, c._out, c._numOutBytes);
+      ret += c._numOutBytes;
+   }
+   delete [] chunks;
+   return ret;
+}
+
+} // end namespace muscle
+
+#endif
+
+#endif